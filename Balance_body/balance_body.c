@@ -8,16 +8,18 @@
 #include <rc_usefulincludes.h>
 #include <roboticscape.h>
 #include "body_config.h"
+#include "controller.h"
+#include "comp_filter.h"
+#include "status_display.h"
+#include "supervisor.h"
+#include "rt_setup.h"
+#include "calibration.h"
 
 // function declarations
-controller_d_t initialize_controller(float gain,int n, int m,float* num, \
-                                     float* den,float sat);
 float complementary_filter();
-float control_step(controller_d_t* d,float loop_error);
-void clear_controls(controller_d_t* d);
-void on_pause_pressed();
-void on_pause_released();
 void inner_loop();
+void start_calibration();
+void save_calibration();
 
 // variable declarations
 rc_imu_data_t imu_reader;
@@ -26,15 +28,30 @@ float current_theta;
 float theta_error;
 float control_duty;
 
+// console status line
+const char* status_labels[]={"theta","duty"};
+
+// loop timing statistics
+rt_loop_stats_t inner_stats;
+
+// per-robot calibration, written only by the inner loop while measuring
+calibration_t cal={THETA_OFFSET,0,0,0};
+calibration_run_t cal_run;
+int cal_state=CAL_IDLE;
+const char* cal_path=CAL_PATH;
+
 /*******************************************************************************
 * int main()
 *
 * This template main function contains these critical components
-* - call to rc_initialize() at the beginning
+* - call to rc_initialize() at the beginning
+* - memory locked for real-time operation
 * - configuration and initialization of IMU
 * - initialization of controller D1
+* - saved calibration loaded, or measured first when missing or stale
+* - console status display started
 * - IMU interrupt function set to inner loop
-* - main while loop that checks for EXITING condition
+* - supervisor loop that sleeps until EXITING
 * - rc_cleanup() at the end
 *******************************************************************************/
 int main(){
@@ -44,10 +61,19 @@ int main(){
 		return -1;
 	}
 
+	// lock memory before any control thread exists
+	if(rt_setup_process()){
+		fprintf(stderr,"ERROR: failed to lock memory\n");
+		return -1;
+	}
+
 	// do your own initialization here
 	printf("\nBalance Body\n");
-	rc_set_pause_pressed_func(&on_pause_pressed);
-	rc_set_pause_released_func(&on_pause_released);
+	if(supervisor_init()){
+		return -1;
+	}
+	rc_set_pause_pressed_func(&supervisor_pause_pressed);
+	rc_set_pause_released_func(&supervisor_pause_released);
 
 	// set default IMU configuration
 	rc_imu_config_t config = rc_default_imu_config();
@@ -62,70 +88,52 @@ int main(){
 	float D1_num[]=D1_NUM;
 	float D1_den[]=D1_DEN;
 	D1=initialize_controller(D1_GAIN,D1_N,D1_M,D1_num, \
-                          D1_den,D1_SATURATION);
+                          D1_den,D1_SATURATION,0);
+
+	// use the saved calibration while fresh, otherwise measure it first;
+	// MIP_CALIBRATION=<file> moves it and MIP_CALIBRATE=1 always measures
+	if(getenv("MIP_CALIBRATION")!=NULL) cal_path=getenv("MIP_CALIBRATION");
+	if(calibration_load(cal_path,&cal,CAL_MAX_AGE)==0 && \
+	   getenv("MIP_CALIBRATE")==NULL){
+		printf("calibration from %s: theta_offset %.4f, gyro_bias %.3f\n", \
+		       cal_path,cal.theta_offset,cal.gyro_bias);
+	}
+	else{
+		printf("calibrating: hold the MiP upright and still for %d s\n", \
+		       CAL_SECONDS);
+		start_calibration();
+	}
+
+	// print status from a separate display thread
+	if(status_display_start(status_labels,2,STATUS_HZ)){
+		return -1;
+	}
+
+	// a measured calibration is saved from the supervisor loop
+	if(supervisor_set_periodic(&save_calibration,STATUS_HZ)){
+		return -1;
+	}
 
 	// set inner loop as IMU interrupt function
+	rt_stats_init(&inner_stats,"inner loop",D1_HZ);
 	rc_set_imu_interrupt_func(&inner_loop);
 
 	// done initializing so set state to RUNNING
-	rc_set_state(RUNNING);
+	supervisor_set_state(RUNNING);
 
-	// Keep looping until state changes to EXITING
-	while(rc_get_state()!=EXITING){
-		// handle other states
-		if(rc_get_state()==RUNNING){
-			// do things
-			rc_set_led(GREEN, ON);
-			rc_set_led(RED, OFF);
-		}
-		else if(rc_get_state()==PAUSED){
-			// do other things
-			rc_set_led(GREEN, OFF);
-			rc_set_led(RED, ON);
-		}
-		// always sleep at some point
-		usleep(100000);
-	}
+	// sleep until events arrive, returns once state is EXITING
+	supervisor_run();
 
 	// exit cleanly
 	rc_power_off_imu();
+	status_display_stop();
+	rt_stats_print(&inner_stats);
+	save_calibration();
+	supervisor_cleanup();
 	rc_cleanup();
 	return 0;
 }
 
-/*******************************************************************************
-* void on_pause_released()
-*
-* Make the Pause button toggle between paused and running states.
-*******************************************************************************/
-void on_pause_released(){
-	// toggle between paused and running modes
-	if(rc_get_state()==RUNNING)		rc_set_state(PAUSED);
-	else if(rc_get_state()==PAUSED)	rc_set_state(RUNNING);
-	return;
-}
-
-/*******************************************************************************
-* void on_pause_pressed()
-*
-* If the user holds the pause button for 2 seconds, set state to exiting which
-* triggers the rest of the program to exit cleanly.
-*******************************************************************************/
-void on_pause_pressed(){
-	int i=0;
-	const int samples = 100;	// check for release 100 times in this period
-	const int us_wait = 2000000; // 2 seconds
-
-	// now keep checking to see if the button is still held down
-	for(i=0;i<samples;i++){
-		rc_usleep(us_wait/samples);
-		if(rc_get_pause_button() == RELEASED) return;
-	}
-	printf("long press detected, shutting down\n");
-	rc_set_state(EXITING);
-	return;
-}
-
 /*******************************************************************************
 * void inner_loop()
 *
@@ -134,16 +142,40 @@ void on_pause_pressed(){
 * is then used as an input for controller D1, which will then produce
 * an appropriate duty to balance the MiP.
 *******************************************************************************/
-void inner_loop(){
+void inner_loop(){
+    static int rt_ready=0;
+    uint64_t start;
+    // first call runs in the IMU thread, so set it up for real-time here
+    if(!rt_ready){
+        rt_setup_thread(IMU_PRIORITY,RT_CPU);
+        rt_ready=1;
+    }
+    start=rt_stats_begin(&inner_stats);
+    RT_ENTER();
     // find current angle of MiP
-    current_theta=complementary_filter();
-    // check for tipping
+    current_theta=complementary_filter();
+    if(__atomic_load_n(&cal_state,__ATOMIC_RELAXED)==CAL_MEASURING){
+        // held upright by hand, no duty until a still window is accepted
+        rc_disable_motors();
+        status_message("calibrating, hold upright");
+        if(calibration_add(&cal_run,imu_reader.accel,imu_reader.gyro,&cal)>0){
+            __atomic_store_n(&cal_state,CAL_MEASURED,__ATOMIC_RELEASE);
+        }
+        control_duty=0;
+        float values[2]={current_theta,control_duty};
+        status_publish(values);
+        RT_EXIT();
+        rt_stats_end(&inner_stats,start);
+        return;
+    }
+    // check for tipping
     if(fabs(current_theta)>TIP_ANGLE){
         rc_disable_motors();
-        printf("Oops,unexpected trustfall!\n");
-    }
-    else{
-        rc_enable_motors();
+        status_message("Oops,unexpected trustfall!");
+    }
+    else{
+        rc_enable_motors();
+        status_message(NULL);
         clear_controls(&D1);
     }
     // calculate input error and motor duty
@@ -152,140 +184,50 @@ void inner_loop(){
     // send duty to motors to balance body angle
     rc_set_motor(MOTOR_CHANNEL_L,MOTOR_POLARITY_L*control_duty);
     rc_set_motor(MOTOR_CHANNEL_R,MOTOR_POLARITY_R*control_duty);
-    // set 100 Hz timing
-    rc_usleep(MICRO/D1_HZ);
+    // publish values for the display thread
+    float values[2]={current_theta,control_duty};
+    status_publish(values);
+    // 100 Hz timing comes from the IMU interrupt
+    RT_EXIT();
+    rt_stats_end(&inner_stats,start);
     return;
 }
 
 /*******************************************************************************
-* float complementary_filter()
+* void start_calibration()
+* void save_calibration()
 *
-* Converts accelerometer and gyroscope data into angle values (in radians) of
-* the BeagleBone relative to the x-axis. These values are then passed through
-* low-pass (accelerometer data) and high-pass (gyroscope data) filters before
-* being summed to a theta angle estimate of the MIP body relative to the
-* x-axis.
+* The inner loop averages a window of samples and applies the result itself;
+* the file is written later from the supervisor loop, since the inner loop
+* must not do file I/O.
 *******************************************************************************/
-float complementary_filter(){
-    // initialize theta values
-    static float theta_a[2],theta_a_raw[2]={0,0};
-    static float theta_g[2],theta_g_raw[2]={0,0};
-    float theta_f;
-
-    // compute accelerometer angle of BeagleBone relative to x-axis
-    theta_a_raw[0]=atan2(-imu_reader.accel[2],imu_reader.accel[1]);
-    // use Euler's integration on gyroscope x-axis data
-    theta_g_raw[0]=theta_g_raw[1]+(imu_reader.gyro[0]*DEG_TO_RAD*DT);
-
-    // apply a low-pass filter to theta_a_raw
-    theta_a[0]=(1-OMEGA_C*DT)*theta_a[1]+(OMEGA_C*DT)*theta_a_raw[1];
-    // apply a high-pass filter to theta_g_raw
-    theta_g[0]=(1-OMEGA_C*DT)*theta_g[1]+theta_g_raw[0]-theta_g_raw[1];
-    // calculate theta angle of MIP
-    theta_f=theta_a[0]+theta_g[0]+THETA_OFFSET;
-
-    // update theta values for next iteration
-    theta_a_raw[1]=theta_a_raw[0];
-    theta_g_raw[1]=theta_g_raw[0];
-    theta_a[1]=theta_a[0];
-    theta_g[1]=theta_g[0];
-
-    return theta_f;
+void start_calibration(){
+    calibration_start(&cal_run,CAL_SECONDS*D1_HZ,CAL_MAX_GYRO_STD, \
+                      THETA_OFFSET,CAL_MAX_CHANGE);
+    __atomic_store_n(&cal_state,CAL_MEASURING,__ATOMIC_RELEASE);
+    return;
 }
 
-/*******************************************************************************
-* initialize_controller()
-*
-* Allocates controller values to be used for difference equation
-* computations. Default inputs and outputs are set to zero.
-*******************************************************************************/
-controller_d_t initialize_controller(float gain,int n, int m,float* num, \
-                                     float* den,float sat){
-    // create controller object
-    controller_d_t d;
-    // initialize for loop counts
-    int i=0;
-    int j=0;
-    // allocate controller numerator values and zero inputs
-    for(i=0;i<(n+1);i++){
-        d.numerator[i]=num[i];
-        d.inputs[i]=0;
-    }
-    // allocate controller denominator values and zero outputs
-    for(j=0;j<(m+1);j++){
-        d.denominator[j]=den[j];
-        d.outputs[j]=0;
-    }
-    // allocate gain and saturation values
-    d.gain=gain;
-    d.saturation=sat;
-    // save # of poles and zeros of controller
-    d.n=n;
-    d.m=m;
-    return d;
+void save_calibration(){
+    if(__atomic_load_n(&cal_state,__ATOMIC_ACQUIRE)!=CAL_MEASURED) return;
+    calibration_save(cal_path,&cal);
+    __atomic_store_n(&cal_state,CAL_IDLE,__ATOMIC_RELAXED);
+    return;
 }
 
 /*******************************************************************************
-* float control_step()
+* float complementary_filter()
 *
-* Performs difference equation calculation using controller values from
-* controller d and an input error.
+* Body angle of the MiP in radians from the IMU through the complementary
+* filter in ../Common/comp_filter.c, with the gyro bias and theta offset of
+* the calibration.
 *******************************************************************************/
-float control_step(controller_d_t* d,float loop_error){
-    // retrieve # of poles and zeros for calculations
-    int n=d->n;
-    int m=d->m;
-    // initialize for loop counts
-    int i=0; int j=0; int k=0; int l=0;
-    // set input error as initial input
-    d->inputs[0]=loop_error;
-    // initialize output
-    float update_error=0;
-    // perform difference equation calculation
-    for(i=0;i<(n+1);i++){
-        d->outputs[0]+=d->gain*d->numerator[i]*d->inputs[i];
-    }
-    for(j=1;j<(m+1);j++){
-        d->outputs[0]-=d->denominator[j]*d->outputs[j];
-    }
-    d->outputs[0]/=d->denominator[0];
-
-    update_error=d->outputs[0];
-    // check for saturation
-    if(update_error>d->saturation){
-        update_error=d->saturation;
-    }
-    else if(update_error<-d->saturation){
-        update_error=-d->saturation;
-    }
-    // zero out output of difference equation
-    d->outputs[0]=0;
-    // update inputs and outputs for next iteration
-    for(k=n;k>0;k--){
-        d->inputs[k]=d->inputs[k-1];
-    }
-    for(l=m;l>0;l--){
-        d->outputs[l]=d->outputs[l-1];
-    }
-
-    return update_error;
+float complementary_filter(){
+    static comp_filter_t filter;
+    // accelerometer angle of BeagleBone relative to x-axis
+    float theta_a_raw=atan2(-imu_reader.accel[2],imu_reader.accel[1]);
+    // calculate theta angle of MIP, gyro bias and offset calibrated
+    return comp_filter_step(&filter,theta_a_raw, \
+                            imu_reader.gyro[0]-cal.gyro_bias,OMEGA_C,DT)+ \
+           cal.theta_offset;
 }
-
-/*******************************************************************************
-* void clear_controls()
-*
-* Clears input and output values of controllers to prevent lock-up.
-*******************************************************************************/
-void clear_controls(controller_d_t* d){
-    int n=d->n;
-    int m=d->m;
-    int i=0; int j=0;
-    // set input and output values to zero
-    for(i=n;i>=0;i--){
-        d->inputs[i]=0;
-    }
-    for(j=m;j>=0;j--){
-        d->outputs[j]=0;
-    }
-    return;
-}
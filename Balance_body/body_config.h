@@ -11,7 +11,12 @@
 
 // timing constants
 #define MICRO                   1000000 // 10^6 microseconds
-#define D1_HZ                   100
+#define D1_HZ                   100
+#define STATUS_HZ               10 // console status line refresh
+
+// real-time setup
+#define IMU_PRIORITY            80 // SCHED_FIFO priority of inner loop
+#define RT_CPU                  -1 // CPU to pin control threads, -1 for none
 
 // structural properties of eduMiP
 #define GEARBOX 				35.577
@@ -24,7 +29,14 @@
 // complementary filter constants
 #define OMEGA_C                 2 // 1/time constant
 #define DT                      0.01 // step in seconds
-#define THETA_OFFSET            0.15
+#define THETA_OFFSET            0.15 // default until calibrated
+
+// calibration, measured held upright and reused while the file is fresh
+#define CAL_PATH                "/var/lib/edumip/calibration.txt" // MIP_CALIBRATION overrides
+#define CAL_SECONDS             5 // averaging window, MIP_CALIBRATE=1 forces it
+#define CAL_MAX_AGE             86400 // s, older files are measured again
+#define CAL_MAX_GYRO_STD        2 // deg/s, window restarts if held less still
+#define CAL_MAX_CHANGE          0.2 // rad, largest offset from THETA_OFFSET
 
 // inner loop controller
 #define D1_GAIN					-4.24
@@ -44,16 +56,4 @@
 #define ENCODER_POLARITY_L		1
 #define ENCODER_POLARITY_R		-1
 
-// controller structure
-typedef struct controller_d_t{
-    float gain;
-    int n;
-    int m;
-    float numerator[3];
-    float denominator[3];
-    float inputs[3];
-    float outputs[3];
-    float saturation;
-} controller_d_t;
-
 #endif	//BODY_CONFIG
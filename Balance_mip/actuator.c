@@ -0,0 +1,245 @@
+/*******************************************************************************
+* actuator.c
+*
+* Deadband, friction and gain shaping of the motor duty, and the run that
+* measures them.
+*******************************************************************************/
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "mip_config.h"
+#include "actuator.h"
+
+#define ACT_LINE                128
+
+// stages of a segment
+enum{
+    STAGE_UP,           // ramping up until the wheel moves
+    STAGE_DOWN,         // ramping down until it stops
+    STAGE_TEST,         // held at ACT_TEST_DUTY
+    STAGE_REST          // no duty, the wheel coasts to a stop
+};
+#define SEGMENTS                6 // four ramps, two speed runs
+
+actuator_t actuator_default(){
+    actuator_t a={ACT_DEADBAND,ACT_FRICTION,ACT_SCALE};
+    return a;
+}
+
+/*******************************************************************************
+* int actuator_load()
+*
+* Reads "key=value" lines like the calibration file, ignoring comments and
+* unknown keys. All six values must be present and sensible.
+*******************************************************************************/
+int actuator_load(const char* path,actuator_t* a){
+    FILE* f=fopen(path,"r");
+    char line[ACT_LINE];
+    actuator_t read;
+    int found=0,i;
+
+    if(f==NULL) return -1;
+    memset(&read,0,sizeof(read));
+    while(fgets(line,sizeof(line),f)!=NULL){
+        if(line[0]=='#') continue;
+        if(sscanf(line,"deadband_l=%f",&read.deadband[0])==1) found|=1;
+        else if(sscanf(line,"deadband_r=%f",&read.deadband[1])==1) found|=2;
+        else if(sscanf(line,"friction_l=%f",&read.friction[0])==1) found|=4;
+        else if(sscanf(line,"friction_r=%f",&read.friction[1])==1) found|=8;
+        else if(sscanf(line,"scale_l=%f",&read.scale[0])==1) found|=16;
+        else if(sscanf(line,"scale_r=%f",&read.scale[1])==1) found|=32;
+    }
+    fclose(f);
+    for(i=0;i<2 && found==63;i++){
+        if(!(read.deadband[i]>=0 && read.deadband[i]<ACT_MAX_DUTY) || \
+           !(read.friction[i]>=0 && read.friction[i]<ACT_MAX_DUTY) || \
+           !(read.scale[i]>0.5f && read.scale[i]<2)) found=0;
+    }
+    if(found!=63){
+        fprintf(stderr,"ERROR: %s is not an actuator file\n",path);
+        return -1;
+    }
+    *a=read;
+    return 0;
+}
+
+/*******************************************************************************
+* int actuator_save()
+*
+* Creates the parent directory if needed and renames the file into place,
+* as calibration_save() does.
+*******************************************************************************/
+int actuator_save(const char* path,const actuator_t* a){
+    char tmp[ACT_LINE*2];
+    char* slash;
+    FILE* f;
+
+    snprintf(tmp,sizeof(tmp),"%s",path);
+    slash=strrchr(tmp,'/');
+    if(slash!=NULL && slash!=tmp){
+        *slash='\0';
+        if(mkdir(tmp,0755) && errno!=EEXIST){
+            perror(tmp);
+            return -1;
+        }
+    }
+    snprintf(tmp,sizeof(tmp),"%s.tmp",path);
+    f=fopen(tmp,"w");
+    if(f==NULL){
+        perror(tmp);
+        return -1;
+    }
+    fprintf(f,"# eduMiP actuator, measured with the wheels off the ground\n");
+    fprintf(f,"deadband_l=%.4f\n",a->deadband[0]);
+    fprintf(f,"deadband_r=%.4f\n",a->deadband[1]);
+    fprintf(f,"friction_l=%.4f\n",a->friction[0]);
+    fprintf(f,"friction_r=%.4f\n",a->friction[1]);
+    fprintf(f,"scale_l=%.4f\n",a->scale[0]);
+    fprintf(f,"scale_r=%.4f\n",a->scale[1]);
+    if(fflush(f) || fsync(fileno(f)) || fclose(f)){
+        perror(tmp);
+        return -1;
+    }
+    if(rename(tmp,path)){
+        perror(path);
+        return -1;
+    }
+    return 0;
+}
+
+static float unit(float x){
+    if(x>1) return 1;
+    if(x<-1) return -1;
+    return x;
+}
+
+/*******************************************************************************
+* float actuator_shape()
+*
+* The breakaway step is spread over ACT_DUTY_ZONE of duty so a controller
+* output dithering around zero does not chatter the motor at full breakaway,
+* and it hands over to the friction feed-forward as the wheel speeds up, so
+* the two never add. The gain applies to the controller duty only, the
+* deadband and friction are measured in motor duty.
+*******************************************************************************/
+float actuator_shape(const actuator_t* a,int motor,float duty,float rate){
+    float moving=unit(rate/ACT_RATE_ZONE);
+
+    return a->scale[motor]*duty+ \
+           (1-fabsf(moving))*a->deadband[motor]*unit(duty/ACT_DUTY_ZONE)+ \
+           a->friction[motor]*moving;
+}
+
+void actuator_start(actuator_run_t* r,float hz){
+    memset(r,0,sizeof(*r));
+    r->ramp=ACT_RAMP/hz;
+    r->still_ticks=(uint32_t)(ACT_STILL_TIME*hz);
+    r->rest_ticks=(uint32_t)(ACT_REST_TIME*hz);
+    r->test_ticks=(uint32_t)(ACT_TEST_TIME*hz);
+    r->stage=STAGE_REST;
+    r->segment=-1;
+    return;
+}
+
+/*******************************************************************************
+* static int finish()
+*
+* Deadband and friction are the means of both directions. A wheel's gain is
+* its speed per duty above friction, and each is scaled to the mean gain.
+*******************************************************************************/
+static int finish(actuator_run_t* r,actuator_t* a){
+    actuator_t m;
+    float gain[2];
+    int i;
+
+    for(i=0;i<2;i++){
+        m.deadband[i]=0.5f*(r->breakaway[2*i]+r->breakaway[2*i+1]);
+        m.friction[i]=0.5f*(r->stop[2*i]+r->stop[2*i+1]);
+        gain[i]=r->travel[i]/(ACT_TEST_DUTY-m.friction[i]);
+        if(!(gain[i]>0)) return r->result=-1;
+    }
+    for(i=0;i<2;i++) m.scale[i]=0.5f*(gain[0]+gain[1])/gain[i];
+    *a=m;
+    return r->result=1;
+}
+
+/*******************************************************************************
+* int actuator_measure()
+*
+* Segments 0 to 3 drive one wheel at a time, L+, L-, R+ and R-: the duty
+* ramps up by ACT_RAMP per second until the wheel has turned ACT_MOVE_COUNTS
+* counts, and the duty of the first count is the breakaway, then down until
+* no count has come for ACT_STILL_TIME, taken as the duty where the counts
+* stopped. Segments 4 and 5 hold one wheel at ACT_TEST_DUTY and count its
+* travel over the second half. Every segment ends with ACT_REST_TIME at no
+* duty.
+*******************************************************************************/
+int actuator_measure(actuator_run_t* r,const int count[2],float duty[2], \
+                     actuator_t* a){
+    int wheel,sign;
+    int32_t c;
+
+    duty[0]=0;
+    duty[1]=0;
+    wheel=(r->segment<4)?r->segment/2:r->segment-4;
+    if(wheel<0) wheel=0;
+    sign=(r->segment<4 && (r->segment&1))?-1:1;
+    c=count[wheel];
+    r->ticks++;
+    if(c!=r->last) r->still=0;
+    else r->still++;
+    r->last=c;
+
+    switch(r->stage){
+    case STAGE_UP:
+        if(c!=r->start && r->first==0) r->first=r->duty;
+        if(abs(c-r->start)>=ACT_MOVE_COUNTS){
+            r->breakaway[r->segment]=r->first;
+            r->stage=STAGE_DOWN;
+            r->ticks=0;
+            break;
+        }
+        r->duty+=r->ramp;
+        if(r->duty>ACT_MAX_DUTY) return r->result=-1;
+        break;
+    case STAGE_DOWN:
+        if(r->still>=r->still_ticks || r->duty<=0){
+            r->stop[r->segment]=fmaxf(r->duty+r->still*r->ramp,0);
+            r->stage=STAGE_REST;
+            r->ticks=0;
+            r->duty=0;
+            break;
+        }
+        r->duty-=r->ramp;
+        break;
+    case STAGE_TEST:
+        if(r->ticks==r->test_ticks/2) r->start=c;
+        if(r->ticks>=r->test_ticks){
+            r->travel[wheel]=abs(c-r->start);
+            r->stage=STAGE_REST;
+            r->ticks=0;
+            r->duty=0;
+        }
+        break;
+    case STAGE_REST:
+        if(r->ticks<r->rest_ticks) break;
+        r->segment++;
+        if(r->segment>=SEGMENTS) return finish(r,a);
+        wheel=(r->segment<4)?r->segment/2:r->segment-4;
+        sign=(r->segment<4 && (r->segment&1))?-1:1;
+        r->start=count[wheel];
+        r->last=r->start;
+        r->still=0;
+        r->first=0;
+        r->ticks=0;
+        r->stage=(r->segment<4)?STAGE_UP:STAGE_TEST;
+        r->duty=(r->segment<4)?0:ACT_TEST_DUTY;
+        break;
+    }
+    duty[wheel]=sign*r->duty;
+    return 0;
+}
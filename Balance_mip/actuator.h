@@ -0,0 +1,71 @@
+/*******************************************************************************
+* actuator.h
+*
+* Actuator shaping for balance_mip, between the controller duty and the
+* motor calls. The gearbox holds a wheel at rest until the duty passes its
+* breakaway, and a moving wheel loses a roughly constant duty to Coulomb
+* friction, so small corrections near upright do nothing and the MiP
+* limit-cycles. Per motor, the shaping adds the breakaway duty in the
+* commanded direction while the wheel is at rest (deadband inversion), the
+* friction duty in the direction the wheel turns once it moves, blending
+* over ACT_RATE_ZONE, and scales the duty so both wheels give the same
+* speed. No hardware dependencies.
+*
+* The values are measured by a characterization run with the MiP held and
+* the wheels off the ground: each wheel is ramped up in each direction until
+* it breaks away, then down until it stops, which gives the friction duty,
+* and finally driven at ACT_TEST_DUTY, which gives its speed. The result is
+* kept in a small text file loaded at startup. Measuring is allocation and
+* system call free, so it can run in the IMU interrupt.
+*******************************************************************************/
+
+#ifndef ACTUATOR
+#define ACTUATOR
+
+#include <stdint.h>
+
+typedef struct actuator_t{
+    float deadband[2];          // duty to break away from rest, left and right
+    float friction[2];          // duty lost to friction while moving
+    float scale[2];             // duty gain equalizing the wheels
+} actuator_t;
+
+// measuring state of one characterization run
+typedef struct actuator_run_t{
+    int segment;                // ramps L+,L-,R+,R-, then speed L,R
+    int stage;                  // within the segment
+    float duty;                 // magnitude driven now
+    float ramp;                 // duty per tick
+    uint32_t ticks;             // in the stage
+    uint32_t still_ticks;       // ticks without a count when stopped
+    uint32_t rest_ticks;
+    uint32_t test_ticks;
+    int32_t start;              // count where the stage started
+    int32_t last;
+    uint32_t still;             // ticks since the count last changed
+    float first;                // duty at the first count of a ramp up
+    float breakaway[4];         // per ramp segment
+    float stop[4];
+    int32_t travel[2];          // counts over the second half of the speed run
+    int result;                 // 0 measuring, 1 measured, -1 failed
+} actuator_run_t;
+
+// shaping from the ACT_* values of mip_config.h
+actuator_t actuator_default();
+// 0 if path was read, -1 if missing or unreadable, a is then unchanged
+int actuator_load(const char* path,actuator_t* a);
+// write a to path through a temporary file
+int actuator_save(const char* path,const actuator_t* a);
+// duty for motor 0 (left) or 1 (right), from the controller duty and the
+// wheel rate relative to the body in rad/s, positive as a positive duty turns
+float actuator_shape(const actuator_t* a,int motor,float duty,float rate);
+
+// begin a characterization run stepped at hz
+void actuator_start(actuator_run_t* r,float hz);
+// one tick with the encoder counts of both wheels, sets the duty of each;
+// returns 1 and fills a when done, -1 if a wheel never broke away below
+// ACT_MAX_DUTY, 0 otherwise
+int actuator_measure(actuator_run_t* r,const int count[2],float duty[2], \
+                     actuator_t* a);
+
+#endif	//ACTUATOR
@@ -1,44 +1,215 @@
 /*******************************************************************************
 * balance_mip.c
 *
-* Balances the body angle of the MiP and the position of the wheels.
+* Balances the body angle of the MiP and the position of the wheels, and
+* holds its heading by steering the wheels apart.
 *******************************************************************************/
 #include <rc_usefulincludes.h>
 #include <roboticscape.h>
 #include "mip_config.h"
+#include "supervisor.h"
+#include "rt_setup.h"
+#include "controller.h"
+#include "comp_filter.h"
+#include "watchdog.h"
+#include "recorder.h"
+#include "calibration.h"
+#include "bias_tracker.h"
+#include "wheel_velocity.h"
+#include "mpc.h"
+#include "trajectory.h"
+#include "dob.h"
+#include "battery.h"
+#include "actuator.h"
+#include "recovery.h"
+#include "telemetry.h"
+
+// what the inner loop and the filter carry from one tick to the next
+typedef struct loop_hist_t{
+    float last_duty;
+    int balancing;
+    int heading_tick;
+    float diff_duty;
+    int ref_tick;
+    int driving;
+    comp_filter_t filter;
+} loop_hist_t;
+
+// all loop state in a flight recorder keyframe, fixed-size members only so
+// a recording from the board loads on the host; the constant parts of the
+// MPC problem are rebuilt from mip_config.h instead
+typedef struct mip_state_t{
+    loop_hist_t hist;
+    controller_d_t D1;
+    controller_d_t D2;
+    controller_d_t D3;
+    float theta_f;
+    float theta_r;
+    float current_theta;
+    float phi_reference;
+    float heading_f;
+    float heading_rate;
+    float current_heading;
+    float heading_reference;
+    float wheel_rate[2];
+    wheel_vel_t wheel_vel[2];
+    watchdog_t wd;
+    calibration_t cal;
+    calibration_run_t cal_run;
+    int32_t cal_state;
+    actuator_t act;
+    actuator_run_t act_run;
+    int32_t act_state;
+    bias_tracker_t track;
+    float mpc_u[MPC_HORIZON];
+    uint32_t mpc_saturated;
+    uint32_t mpc_tilt_limited;
+    dob_t dob;
+    recovery_t recover;
+    traj_t traj;
+    uint32_t restart_req;
+    uint32_t restart_done;
+} mip_state_t;
+_Static_assert(sizeof(mip_state_t)<=REC_KEY_BYTES,"REC_KEY_BYTES too small");
 
 // function declarations
-controller_d_t initialize_controller(float gain,int n, int m,float* num, \
-                                     float* den,float sat);
 float complementary_filter();
-float control_step(controller_d_t* d,float loop_error);
-void clear_controls(controller_d_t* d);
+float heading_filter(int l_count,int r_count);
+void balance_state(float theta,int l_count,int r_count,float phi_ref, \
+                   float x[4]);
+float lqr_step(const float x[4]);
+int control_mode_from_name(const char* name);
+const char* control_mode_name(int mode);
 void clear_encoders();
-void on_pause_pressed();
-void on_pause_released();
-void initialize_ops();
+float wheel_angle(int count,int polarity);
+void initialize_ops(float theta_error);
 void suspend_ops();
 void inner_loop();
 void* outer_loop();
+void* battery_loop();
+void outer_step();
+void reference_step();
+void reference_seen(float* phi_ref,float* heading_ref);
+float motor_duty(float duty,float scale);
+void watchdog_check();
+void command_poll();
+void watchdog_report();
+void on_pause_pressed();
+void on_pause_released();
+void record_button(int pressed);
+void start_calibration();
+void save_calibration();
+void start_characterization();
+void save_actuator();
+void save_state(mip_state_t* s);
+int restore_state(const void* state,uint32_t size);
 
 // variable declarations
 rc_imu_data_t imu_reader;
 controller_d_t D1;
 controller_d_t D2;
+controller_d_t D3;
 float theta_f;
 float theta_r;
 float current_theta;
+float phi_reference=PHI_REFERENCE;
+float heading_f;
+float heading_rate;
+float current_heading;
+float heading_reference=HEADING_REFERENCE;
+int control_mode=CONTROL_CASCADE; // fixed before the loops start
+
+// status line and log samples for the mip_telemetry and mip_logger
+// processes, published by the inner loop
+telemetry_t telem;
+const char* telem_name=TELEM_NAME;
+
+// loop timing statistics
+rt_loop_stats_t inner_stats;
+rt_loop_stats_t outer_stats;
+
+// deadline watchdog
+watchdog_t wd;
+
+// flight recorder, dumped on exit and after each fall
+recorder_t rec;
+rec_event_t rec_buffer[REC_EVENTS];
+rec_event_t outer_event; // filled by outer_step(), owned by the outer loop
+const char* rec_path=REC_PATH;
+rec_keyframe_t rec_keys[REC_KEYFRAMES];
+mip_state_t key_state; // filled by the inner loop for each keyframe
+int outer_busy=0; // set while the outer loop steps, no keyframe then
+
+// trajectory and D2 restarts, asked for by initialize_ops() and taken by
+// the outer loop in cascade mode, pending while they differ
+uint32_t restart_req=0;
+uint32_t restart_done=0;
+
+// tick to tick history of the inner loop and the filter
+loop_hist_t hist;
+
+// per-robot calibration, written only by the inner loop while measuring
+calibration_t cal={THETA_OFFSET,0,0,0};
+calibration_run_t cal_run;
+int cal_state=CAL_IDLE;
+const char* cal_path=CAL_PATH;
+
+// actuator shaping, written only by the inner loop while characterizing
+actuator_t act;
+actuator_run_t act_run;
+int act_state=CAL_IDLE;
+const char* act_path=ACT_PATH;
+
+// online corrections to the calibration, owned by the inner loop
+bias_tracker_t track;
+
+// wheel rates relative to the body, updated every inner loop tick
+wheel_vel_t wheel_vel[2];
+float wheel_rate[2]; // rad/s, left and right
+
+// model predictive controller of the mpc mode, owned by the inner loop
+mpc_t mpc;
+
+// disturbance observer, owned by the inner loop, and its feed-forward switch
+// set by the supervisor loop
+dob_t dob;
+int dob_enabled=0;
+
+// battery voltage, sampled by the battery thread and read by the inner loop
+battery_t batt;
+
+// fall recovery, owned by the inner loop
+recovery_t recover;
+
+// motion commands, read by the supervisor loop and taken by the loop that
+// steps the trajectory: the outer loop, or the inner loop in lqr and mpc mode
+traj_t traj;
+traj_mailbox_t cmd_box;
+const char* cmd_path=CMD_PATH;
+int cmd_fd=-1;
 
 /*******************************************************************************
 * int main()
 *
 * This template main function contains these critical components
-* - call to rc_initialize() at the beginning
+* - call to rc_initialize() at the beginning
+* - memory locked for real-time operation
 * - configuration and initialization of IMU
-* - initialization of controllers D1 and D2
+* - initialization of controllers D1, D2 and D3
+* - controller mode from MIP_CONTROLLER, the D1/D2 cascade by default,
+*   and the condensed MPC problem built
+* - shared memory for the logger and telemetry processes created
 * - IMU interrupt function set to inner loop at 100 Hz
-* - outer loop pthread set to 20 Hz
-* - main while loop that checks for EXITING condition
+* - outer loop pthread set to 20 Hz, not started in lqr mode
+* - battery pthread sampling the voltage for the duty compensation
+* - saved calibration loaded, or measured first when missing or stale
+* - saved actuator shaping loaded, measured on request
+* - fall recovery, self-righting with MIP_RECOVER=1
+* - deadline watchdog checked from the supervisor loop
+* - motion commands and the disturbance feed-forward switch read from a
+*   FIFO by the supervisor loop
+* - flight recorder capturing all loop inputs
+* - supervisor loop that sleeps until EXITING
 * - rc_cleanup() at the end
 *******************************************************************************/
 int main(){
@@ -48,8 +219,17 @@ int main(){
 		return -1;
 	}
 
+	// lock memory before any control thread exists
+	if(rt_setup_process()){
+		fprintf(stderr,"ERROR: failed to lock memory\n");
+		return -1;
+	}
+
 	// do your own initialization here
 	printf("\nBalance Body\n");
+	if(supervisor_init()){
+		return -1;
+	}
 	rc_set_pause_pressed_func(&on_pause_pressed);
 	rc_set_pause_released_func(&on_pause_released);
 
@@ -66,301 +246,1057 @@ int main(){
 	float D1_num[]=D1_NUM;
 	float D1_den[]=D1_DEN;
 	D1=initialize_controller(D1_GAIN,D1_N,D1_M,D1_num, \
-                             D1_den,D1_SATURATION);
+                             D1_den,D1_SATURATION,D1_ANTIWINDUP);
 
     float D2_num[]=D2_NUM;
     float D2_den[]=D2_DEN;
     D2=initialize_controller(D2_GAIN,D2_N,D2_M,D2_num, \
-                             D2_den,D2_SATURATION);
+                             D2_den,D2_SATURATION,D2_ANTIWINDUP);
+
+    float D3_num[]=D3_NUM;
+    float D3_den[]=D3_DEN;
+    D3=initialize_controller(D3_GAIN,D3_N,D3_M,D3_num, \
+                             D3_den,D3_SATURATION,D3_ANTIWINDUP);
+
+	// MIP_CONTROLLER=lqr or mpc balances in the inner loop alone
+	if(getenv("MIP_CONTROLLER")!=NULL){
+		control_mode=control_mode_from_name(getenv("MIP_CONTROLLER"));
+		if(control_mode<0){
+			fprintf(stderr,"ERROR: unknown MIP_CONTROLLER '%s', use " \
+			        "cascade, lqr or mpc\n",getenv("MIP_CONTROLLER"));
+			return -1;
+		}
+	}
+	if(mpc_init(&mpc)){
+		fprintf(stderr,"ERROR: no Riccati solution for the MPC weights\n");
+		return -1;
+	}
+	printf("controller: %s\n",control_mode_name(control_mode));
+
+	// motion commands are lines written to the CMD_PATH FIFO, e.g.
+	// echo "vel 0.2 0" > /tmp/mip_command, MIP_COMMAND=<fifo> moves it
+	traj_init(&traj,D2_HZ);
+	if(getenv("MIP_COMMAND")!=NULL) cmd_path=getenv("MIP_COMMAND");
+	if(mkfifo(cmd_path,0600) && errno!=EEXIST){
+		perror(cmd_path);
+	}
+	else{
+		cmd_fd=open(cmd_path,O_RDONLY|O_NONBLOCK);
+		if(cmd_fd<0) perror(cmd_path);
+	}
+	if(cmd_fd<0) printf("no motion commands, holding position\n");
+
+	// disturbance feed-forward off unless MIP_DOB=1, switched by "dob on|off"
+	dob_init(&dob,D1_HZ);
+	if(getenv("MIP_DOB")!=NULL) dob_enabled=atoi(getenv("MIP_DOB"))!=0;
+	printf("disturbance feed-forward: %s\n",dob_enabled?"on":"off");
+
+	// duty scaled for the battery voltage unless MIP_BATTERY=0
+	battery_init(&batt,BATT_HZ);
+	int batt_comp=getenv("MIP_BATTERY")==NULL || \
+	              atoi(getenv("MIP_BATTERY"))!=0;
+	printf("battery compensation: %s\n",batt_comp?"on":"off");
+
+	// use the saved calibration while fresh, otherwise measure it first;
+	// MIP_CALIBRATION=<file> moves it and MIP_CALIBRATE=1 always measures
+	if(getenv("MIP_CALIBRATION")!=NULL) cal_path=getenv("MIP_CALIBRATION");
+	if(calibration_load(cal_path,&cal,CAL_MAX_AGE)==0 && \
+	   getenv("MIP_CALIBRATE")==NULL){
+		printf("calibration from %s: theta_offset %.4f, gyro_bias %.3f\n", \
+		       cal_path,cal.theta_offset,cal.gyro_bias);
+	}
+	else{
+		printf("calibrating: hold the MiP upright and still for %d s\n", \
+		       CAL_SECONDS);
+		start_calibration();
+	}
+
+	// shape the duty with the saved actuator values, the compiled ones
+	// without; MIP_ACTUATOR=<file> moves them, MIP_CHARACTERIZE=1 measures
+	act=actuator_default();
+	if(getenv("MIP_ACTUATOR")!=NULL) act_path=getenv("MIP_ACTUATOR");
+	if(actuator_load(act_path,&act)==0){
+		printf("actuator from %s: deadband %.3f %.3f, friction %.3f %.3f, " \
+		       "scale %.3f %.3f\n",act_path,act.deadband[0],act.deadband[1], \
+		       act.friction[0],act.friction[1],act.scale[0],act.scale[1]);
+	}
+	if(getenv("MIP_CHARACTERIZE")!=NULL && atoi(getenv("MIP_CHARACTERIZE"))){
+		printf("characterizing: hold the MiP with the wheels off the ground\n");
+		start_characterization();
+	}
+
+	// after a fall wait to be picked up, or self-right with MIP_RECOVER=1
+	recovery_init(&recover,D1_HZ,getenv("MIP_RECOVER")!=NULL && \
+	              atoi(getenv("MIP_RECOVER"))!=0);
+	printf("self-righting: %s\n",recover.kick?"on":"off");
+
+	// console and file output are left to the mip_telemetry and mip_logger
+	// processes, reading shared memory; MIP_SHM=<name> moves it
+	if(getenv("MIP_SHM")!=NULL) telem_name=getenv("MIP_SHM");
+	if(telemetry_create(&telem,telem_name,TELEM_SLOTS)){
+		return -1;
+	}
+	printf("telemetry: %s, read by mip_telemetry and mip_logger\n",telem_name);
+
+	// watch loop deadlines, optionally with injected overruns given as
+	// MIP_FAULT_INJECT=<inner|outer>:<extra_us>:<every_n>
+	watchdog_init(&wd,D1_HZ,D2_HZ);
+	char* inject=getenv("MIP_FAULT_INJECT");
+	if(inject!=NULL){
+		char loop[8];
+		unsigned long extra_us,every;
+		if(sscanf(inject,"%7[a-z]:%lu:%lu",loop,&extra_us,&every)!=3){
+			fprintf(stderr,"ERROR: bad MIP_FAULT_INJECT '%s'\n",inject);
+			return -1;
+		}
+		watchdog_inject_fault(&wd,strcmp(loop,"outer")?WD_LOOP_INNER: \
+		                      WD_LOOP_OUTER,extra_us*1000,every);
+	}
+
+	// record every loop input and a keyframe every REC_KEY_TICKS,
+	// MIP_RECORD=<file> moves the dump
+	recorder_init(&rec,rec_buffer,REC_EVENTS,rec_keys,REC_KEYFRAMES);
+	if(getenv("MIP_RECORD")!=NULL) rec_path=getenv("MIP_RECORD");
+	if(inject!=NULL){
+		rec.info.inject_loop=wd.outer.inject_every?WD_LOOP_OUTER:WD_LOOP_INNER;
+		rec.info.inject_every=wd.outer.inject_every?wd.outer.inject_every: \
+		                      wd.inner.inject_every;
+		rec.info.inject_ns=wd.outer.inject_every?wd.outer.inject_ns: \
+		                   wd.inner.inject_ns;
+	}
+	bias_tracker_init(&track,D1_HZ);
+	wheel_vel_init(&wheel_vel[0],wheel_angle(1,ENCODER_POLARITY_L),D1_HZ);
+	wheel_vel_init(&wheel_vel[1],wheel_angle(1,ENCODER_POLARITY_R),D1_HZ);
+	rec.info.theta_offset=cal.theta_offset;
+	rec.info.gyro_bias=cal.gyro_bias;
+	rec.info.controller=control_mode;
+	memcpy(rec.info.act_deadband,act.deadband,sizeof(act.deadband));
+	memcpy(rec.info.act_friction,act.friction,sizeof(act.friction));
+	memcpy(rec.info.act_scale,act.scale,sizeof(act.scale));
+	rec.info.recover_kick=recover.kick;
+	if(supervisor_set_periodic(&watchdog_check,WD_HZ)){
+		return -1;
+	}
 
 	// set inner loop as IMU interrupt function
+	rt_stats_init(&inner_stats,"inner loop",D1_HZ);
+	rt_stats_init(&outer_stats,"outer loop",D2_HZ);
 	rc_set_imu_interrupt_func(&inner_loop);
 
-	// create thread for outer loop
+	// create thread for outer loop, the single-rate modes have none
 	pthread_t outer_loop_thread;
-	pthread_create(&outer_loop_thread,NULL,outer_loop,(void*) NULL);
+	if(control_mode==CONTROL_CASCADE){
+		pthread_create(&outer_loop_thread,NULL,outer_loop,(void*) NULL);
+	}
 
-	// done initializing so set state to RUNNING
-	rc_set_state(RUNNING);
-
-	// Keep looping until state changes to EXITING
-	while(rc_get_state()!=EXITING){
-		// handle other states
-		if(rc_get_state()==RUNNING){
-			// do things
-			rc_set_led(GREEN, ON);
-			rc_set_led(RED, OFF);
-		}
-		else if(rc_get_state()==PAUSED){
-			// do other things
-			rc_set_led(GREEN, OFF);
-			rc_set_led(RED, ON);
-		}
-		// always sleep at some point
-		usleep(100000);
+	// create thread sampling the battery, without it the scale stays 1
+	pthread_t battery_thread;
+	if(batt_comp){
+		pthread_create(&battery_thread,NULL,battery_loop,(void*) NULL);
 	}
 
+	// done initializing so set state to RUNNING
+	supervisor_set_state(RUNNING);
+
+	// sleep until events arrive, returns once state is EXITING
+	supervisor_run();
+
 	// exit cleanly
+	if(control_mode==CONTROL_CASCADE) pthread_join(outer_loop_thread,NULL);
+	if(batt_comp) pthread_join(battery_thread,NULL);
 	rc_power_off_imu();
+	telemetry_close(&telem,telem_name);
+	rt_stats_print(&inner_stats);
+	if(control_mode==CONTROL_CASCADE) rt_stats_print(&outer_stats);
+	watchdog_report();
+	printf("bias tracker: adapted %.1f of %.1f s, gyro bias %+.3f deg/s, " \
+	       "theta offset %+.4f rad\n",(double)track.adapt_ticks/D1_HZ, \
+	       (double)track.ticks/D1_HZ,track.gyro_bias,track.theta_offset);
+	if(control_mode==CONTROL_MPC){
+		printf("mpc: duty at the limit %.1f s, tilt limit predicted %.1f s\n", \
+		       (double)mpc.saturated/D1_HZ,(double)mpc.tilt_limited/D1_HZ);
+	}
+	printf("recovery: %u falls, %u of %u kicks balanced, %.1f s down\n", \
+	       recover.falls,recover.captured,recover.kicked, \
+	       (double)recover.down_ticks/D1_HZ);
+	save_calibration();
+	save_actuator();
+	if(cmd_fd>=0) close(cmd_fd);
+	int recorded=recorder_dump(&rec,rec_path);
+	if(recorded>=0){
+		printf("recorded the last %d events to %s\n",recorded,rec_path);
+	}
+	supervisor_cleanup();
 	rc_cleanup();
 	return 0;
 }
 
-/*******************************************************************************
-* void on_pause_released()
-*
-* Make the Pause button toggle between paused and running states.
-*******************************************************************************/
-void on_pause_released(){
-	// toggle between paused and running modes
-	if(rc_get_state()==RUNNING)		rc_set_state(PAUSED);
-	else if(rc_get_state()==PAUSED)	rc_set_state(RUNNING);
-	return;
-}
-
-/*******************************************************************************
-* void on_pause_pressed()
-*
-* If the user holds the pause button for 2 seconds, set state to exiting which
-* triggers the rest of the program to exit cleanly.
-*******************************************************************************/
-void on_pause_pressed(){
-	int i=0;
-	const int samples = 100;	// check for release 100 times in this period
-	const int us_wait = 2000000; // 2 seconds
-
-	// now keep checking to see if the button is still held down
-	for(i=0;i<samples;i++){
-		rc_usleep(us_wait/samples);
-		if(rc_get_pause_button() == RELEASED) return;
-	}
-	printf("long press detected, shutting down\n");
-	rc_set_state(EXITING);
-	return;
-}
-
 /*******************************************************************************
 * void inner_loop()
 *
 * Retrieves angle of the body of the MiP from the complementary filter.
 * The difference between the reference theta and the angle of the body
-* is then used as an input for controller D1, which will then produce
-* an appropriate duty to balance the MiP.
+* is then used as an input for controller D1, which will then produce
+* an appropriate duty to balance the MiP. In lqr and mpc mode the duty
+* comes from lqr_step() or mpc_step() instead and no outer loop runs.
+* Values shared with other threads are read once, so the recorded event
+* holds exactly what the tick used.
+*
+* The heading loop runs here too, on every D1_HZ/D3_HZ-th tick rather than
+* in a thread of its own: controller D3 turns the error of heading_filter()
+* into a differential duty, less D3_RATE_GAIN times the yaw rate, held until
+* its next run, that is added to the right motor and taken from the left.
+* The rate damps the turn without the kick a derivative of the error would
+* give on a reference step. Balancing keeps priority, steering only gets
+* the duty left below the limit.
+*
+* Without an outer loop the trajectory is stepped here as well, every
+* D1_HZ/D2_HZ-th tick, and the state is taken relative to its speed and
+* lean as well as its position.
+*
+* The disturbance observer runs on every balancing tick in every mode, so
+* its estimate is current when the feed-forward is switched on; the
+* feed-forward is added to the controller duty before the watchdog ramp.
+*
+* The duties sent to the motors are scaled for the battery voltage last, by
+* motor_duty(), so the controllers, the observer and the recording all work
+* in duty at BATT_NOMINAL. Before that each motor's duty goes through
+* actuator_shape(), with the wheel rate for the friction feed-forward.
+*
+* While characterizing, after any calibration, the balance controllers are
+* idle and actuator_measure() drives the motors unshaped.
+*
+* Falls go through recovery_step(): from past TIP_ANGLE until the body is
+* back inside the capture window the controllers are idle and the motors
+* off, except for the self-righting kick, also unshaped. Balancing restarts
+* through initialize_ops() on the first tick inside the window, with the
+* body rate and wheel rates the estimators kept tracking meanwhile.
 *******************************************************************************/
-void inner_loop(){
-    // initialize local variables
-    float control_duty,theta_error;
+void inner_loop(){
+    // initialize local variables
+    static int rt_ready=0;
+    static int key_tick=0;
+    float control_duty,theta_error,theta_ref,theta_r_seen,phi_ref_seen,x[4];
+    float heading_ref_seen,steer=0,theta_dot,batt_scale;
+    int calibrating,characterizing,still,cleared,l_count,r_count,dob_on;
+    int recovering=0;
+    int counts[2];
+    float duty[2];
+    uint64_t start,exec;
+    uint32_t seq;
+    rc_state_t state;
+    wd_mode_t mode;
+    telem_sample_t sample;
+    rec_event_t ev;
+    // first call runs in the IMU thread, so set it up for real-time here
+    if(!rt_ready){
+        rt_setup_thread(IMU_PRIORITY,RT_CPU);
+        rt_ready=1;
+    }
+    start=rt_stats_begin(&inner_stats);
+    RT_ENTER();
+    mode=watchdog_inner_begin(&wd,start);
+    state=rc_get_state();
+    theta_r_seen=theta_r;
+    dob_on=__atomic_load_n(&dob_enabled,__ATOMIC_RELAXED);
+    batt_scale=battery_scale(&batt);
+    if(control_mode!=CONTROL_CASCADE){
+        if(hist.ref_tick==0) reference_step();
+        hist.ref_tick=(hist.ref_tick+1)%(D1_HZ/D2_HZ);
+    }
+    reference_seen(&phi_ref_seen,&heading_ref_seen);
+    // wheel rates from the encoders, before initialize_ops() clears them
+    l_count=rc_get_encoder_pos(ENCODER_CHANNEL_L);
+    r_count=rc_get_encoder_pos(ENCODER_CHANNEL_R);
+    wheel_rate[0]=wheel_vel_update(&wheel_vel[0],l_count,start);
+    wheel_rate[1]=wheel_vel_update(&wheel_vel[1],r_count,start);
+    still=fabsf(0.5f*(wheel_rate[0]+wheel_rate[1]))<TRACK_MAX_WHEEL_RATE;
+    calibrating=__atomic_load_n(&cal_state,__ATOMIC_RELAXED)==CAL_MEASURING;
+    characterizing=__atomic_load_n(&act_state,__ATOMIC_RELAXED)==CAL_MEASURING;
     // find current angle of MiP
-    current_theta=complementary_filter();
-    // check for tipping
-    if(fabs(current_theta)>TIP_ANGLE){
-        suspend_ops();
-    }
-    else{
-        initialize_ops();
+    current_theta=complementary_filter();
+    theta_dot=(imu_reader.gyro[0]-cal.gyro_bias-track.gyro_bias)*DEG_TO_RAD;
+    if(calibrating){
+        // held upright by hand, no duty until a still window is accepted
+        rc_disable_motors();
+        telemetry_message("calibrating, hold upright");
+        control_duty=0;
+        hist.balancing=0;
+        recovery_reset(&recover);
+        if(calibration_add(&cal_run,imu_reader.accel,imu_reader.gyro,&cal)>0){
+            bias_tracker_reset(&track);
+            __atomic_store_n(&cal_state,CAL_MEASURED,__ATOMIC_RELEASE);
+        }
+    }
+    else if(mode==WD_SAFE_STOP){
+        // sustained overruns, stay stopped until paused and resumed
+        rc_disable_motors();
+        telemetry_message(watchdog_mode_name(mode));
+        control_duty=0;
+        hist.balancing=0;
+        hist.driving=0;
+        recovery_reset(&recover);
+        if(state==PAUSED) watchdog_reset(&wd);
+    }
+    else if(characterizing){
+        // held with the wheels off the ground, one wheel driven at a time
+        telemetry_message("characterizing, wheels off the ground");
+        hist.balancing=0;
+        recovery_reset(&recover);
+        if(!hist.driving) rc_enable_motors();
+        hist.driving=1;
+        counts[0]=l_count;
+        counts[1]=r_count;
+        if(actuator_measure(&act_run,counts,duty,&act)){
+            rc_disable_motors();
+            hist.driving=0;
+            __atomic_store_n(&act_state,CAL_MEASURED,__ATOMIC_RELEASE);
+        }
+        control_duty=0.5f*(duty[0]+duty[1]);
+        steer=0.5f*(duty[1]-duty[0]);
+        rc_set_motor(MOTOR_CHANNEL_L,MOTOR_POLARITY_L* \
+                     motor_duty(control_duty-steer,batt_scale));
+        rc_set_motor(MOTOR_CHANNEL_R,MOTOR_POLARITY_R* \
+                     motor_duty(control_duty+steer,batt_scale));
+    }
+    else if(recovery_step(&recover,current_theta,theta_dot)!= \
+            RECOVER_UPRIGHT){
+        // fallen, motors off and the recording dumped once per fall
+        recovering=1;
+        if(hist.balancing){
+            recorder_mark(&rec);
+            suspend_ops();
+        }
+        hist.balancing=0;
+        telemetry_message(recovery_state_name(recover.state));
+        control_duty=recovery_duty(&recover);
+        if(recover.state==RECOVER_KICK){
+            if(!hist.driving) rc_enable_motors();
+            hist.driving=1;
+            rc_set_motor(MOTOR_CHANNEL_L,MOTOR_POLARITY_L* \
+                         motor_duty(control_duty,batt_scale));
+            rc_set_motor(MOTOR_CHANNEL_R,MOTOR_POLARITY_R* \
+                         motor_duty(control_duty,batt_scale));
+        }
+        else if(hist.driving){
+            rc_disable_motors();
+            hist.driving=0;
+        }
+    }
+    else{
+        // theta_r is not trusted when the outer loop is late
+        theta_ref=(mode==WD_INNER_ONLY)?THETA_REFERENCE:theta_r_seen;
+        theta_error=theta_ref-current_theta;
+        // controllers restart only when balancing starts, the motors are
+        // theirs from here even if the kick had them
+        cleared=!hist.balancing;
+        if(cleared){
+            initialize_ops(theta_error);
+            hist.balancing=1;
+            hist.driving=0;
+            // the trajectory restarted where the MiP stands
+            reference_seen(&phi_ref_seen,&heading_ref_seen);
+        }
+        if(control_mode!=CONTROL_CASCADE){
+            // one pass on the full state, phi restarts at the cleared counts
+            balance_state(current_theta,cleared?0:l_count,cleared?0:r_count, \
+                          phi_ref_seen,x);
+            if(control_mode==CONTROL_MPC) control_duty=mpc_step(&mpc,x);
+            else control_duty=lqr_step(x);
+        }
+        else{
+            // calculate motor duty
+            control_duty=control_step(&D1,theta_error);
+        }
+        // body torque from what the model did not predict of the last duty,
+        // on the raw wheel rates that DOB_E was designed for, as x[3] is
+        dob_update(&dob,current_theta,theta_dot, \
+                   0.5f*(wheel_vel[0].raw+wheel_vel[1].raw)+theta_dot);
+        if(dob_on){
+            control_duty=fminf(fmaxf(control_duty+dob_duty(&dob),-1),1);
+        }
+        // limit the duty step after an overrun
+        if(mode==WD_RAMP){
+            if(control_duty>hist.last_duty+WD_DUTY_RAMP){
+                control_duty=hist.last_duty+WD_DUTY_RAMP;
+            }
+            else if(control_duty<hist.last_duty-WD_DUTY_RAMP){
+                control_duty=hist.last_duty-WD_DUTY_RAMP;
+            }
+        }
+        dob_applied(&dob,control_duty);
+        if(mode!=WD_NORMAL) telemetry_message(watchdog_mode_name(mode));
+        else telemetry_message(NULL);
+        // heading at D3_HZ from the counts phi sees, restarting with it
+        current_heading=heading_filter(cleared?0:l_count,cleared?0:r_count);
+        if(cleared) hist.heading_tick=0;
+        if(hist.heading_tick==0){
+            hist.diff_duty=control_step(&D3,heading_ref_seen- \
+                                        current_heading)- \
+                           D3_RATE_GAIN*heading_rate;
+        }
+        hist.heading_tick=(hist.heading_tick+1)%(D1_HZ/D3_HZ);
+        steer=fminf(fmaxf(hist.diff_duty,fabsf(control_duty)-1), \
+                    1-fabsf(control_duty));
+        // send duty to motors to balance body angle and steer
+        rc_set_motor(MOTOR_CHANNEL_L,MOTOR_POLARITY_L*motor_duty( \
+                     actuator_shape(&act,0,control_duty-steer,wheel_rate[0]), \
+                     batt_scale));
+        rc_set_motor(MOTOR_CHANNEL_R,MOTOR_POLARITY_R*motor_duty( \
+                     actuator_shape(&act,1,control_duty+steer,wheel_rate[1]), \
+                     batt_scale));
+    }
+    hist.last_duty=control_duty;
+    // follow bias drift only while balancing quietly under full control
+    bias_tracker_step(&track,imu_reader.gyro[0]-cal.gyro_bias,current_theta, \
+                      !calibrating && !characterizing && !recovering && \
+                      still && mode==WD_NORMAL && state==RUNNING);
+    // publish the tick to the logger and the status line to the console
+    float values[TELEM_VALUES]={current_theta,theta_r_seen,control_duty, \
+                                wd.inner.misses,cal.gyro_bias+track.gyro_bias, \
+                                battery_volts(&batt)};
+    sample.start_ns=start;
+    sample.state=state;
+    sample.mode=mode;
+    sample.arg=calibrating|(dob_on<<1)|(characterizing<<2)|(recovering<<3);
+    sample.recover=recover.state;
+    sample.theta=current_theta;
+    sample.reference=(control_mode==CONTROL_CASCADE)?theta_r_seen:phi_ref_seen;
+    sample.duty=control_duty;
+    sample.steer=steer;
+    sample.wheel_rate=0.5f*(wheel_rate[0]+wheel_rate[1]);
+    sample.heading=current_heading;
+    sample.heading_reference=heading_ref_seen;
+    sample.volts=values[5];
+    telemetry_publish(&telem,&sample,values);
+    // 100 Hz timing comes from the IMU interrupt
+    RT_EXIT();
+    rt_stats_end(&inner_stats,start);
+    exec=rt_now_ns()-start;
+    watchdog_loop_done(&wd,WD_LOOP_INNER,exec);
+    // record the inputs and outputs of this tick
+    memset(&ev,0,sizeof(ev));
+    ev.type=REC_INNER;
+    ev.state=state;
+    ev.mode=mode;
+    ev.arg=sample.arg;
+    ev.start_ns=start;
+    ev.exec_ns=exec;
+    ev.in[0]=imu_reader.accel[1];
+    ev.in[1]=imu_reader.accel[2];
+    ev.in[2]=imu_reader.gyro[0];
+    ev.in[3]=(control_mode==CONTROL_CASCADE)?theta_r_seen:phi_ref_seen;
+    ev.in[4]=imu_reader.gyro[1];
+    ev.in[5]=imu_reader.gyro[2];
+    ev.in[6]=heading_ref_seen;
+    ev.in[7]=batt_scale;
+    ev.count[0]=l_count;
+    ev.count[1]=r_count;
+    ev.out[0]=current_theta;
+    ev.out[1]=control_duty;
+    ev.out[2]=steer;
+    seq=recorder_add(&rec,&ev);
+    // a keyframe every REC_KEY_TICKS, once the outer loop is between steps;
+    // both loops share the one core, so it cannot start a step meanwhile
+    key_tick++;
+    if(seq && key_tick>=REC_KEY_TICKS && \
+       !__atomic_load_n(&outer_busy,__ATOMIC_ACQUIRE)){
+        save_state(&key_state);
+        recorder_keyframe(&rec,seq,start,&key_state,sizeof(key_state));
+        key_tick=0;
     }
-    // calculate input error and motor duty
-    theta_error=theta_r-current_theta;
-    control_duty=control_step(&D1,theta_error);
-    // send duty to motors to balance body angle
-    rc_set_motor(MOTOR_CHANNEL_L,MOTOR_POLARITY_L*control_duty);
-    rc_set_motor(MOTOR_CHANNEL_R,MOTOR_POLARITY_R*control_duty);
-    // set 100 Hz timing
-    rc_usleep(NANO/D1_HZ);
     return;
 }
 
 /*******************************************************************************
 * void* outer_loop()
 *
-* Calculates wheel angle from encoders. The difference between the reference
-* phi and the average angle of the wheels is then used as an input for
-* controller D2, which will then produce a reference theta for the inner loop.
-*******************************************************************************/
-void* outer_loop(){
-    // initialize local variables
-    float l_wheel,r_wheel,current_phi,phi_error;
-    // calculate wheel positions in radians
-    l_wheel=(rc_get_encoder_pos(ENCODER_CHANNEL_L) \
-             *ENCODER_POLARITY_L*TWO_PI/(GEARBOX*ENCODER_RES));
-    r_wheel=(rc_get_encoder_pos(ENCODER_CHANNEL_R) \
-             *ENCODER_POLARITY_R*TWO_PI/(GEARBOX*ENCODER_RES));
-    // calculate average wheel position and subtract out current
-    // MiP body angle
-    current_phi=(0.5*(l_wheel+r_wheel))-current_theta;
-    // calculate input error and theta reference
-    phi_error=PHI_REFERENCE-current_phi;
-    theta_r=control_step(&D2,phi_error);
-    // set 20 Hz timing
-    rc_usleep(NANO/D2_HZ);
-
+* Runs outer_step() at D2_HZ on absolute deadlines until the state is EXITING.
+*******************************************************************************/
+void* outer_loop(){
+    // initialize local variables
+    struct timespec next;
+    uint64_t start,exec;
+    rt_setup_thread(OUTER_PRIORITY,RT_CPU);
+    clock_gettime(CLOCK_MONOTONIC,&next);
+
+    while(rc_get_state()!=EXITING){
+        // the flag must be set before outer_step() writes any state the
+        // keyframe saves, a relaxed store alone does not order it so
+        __atomic_store_n(&outer_busy,1,__ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        start=rt_stats_begin(&outer_stats);
+        watchdog_outer_begin(&wd,start);
+        RT_ENTER();
+        outer_step();
+        RT_EXIT();
+        rt_stats_end(&outer_stats,start);
+        exec=rt_now_ns()-start;
+        watchdog_loop_done(&wd,WD_LOOP_OUTER,exec);
+        outer_event.type=REC_OUTER;
+        outer_event.state=rc_get_state();
+        outer_event.start_ns=start;
+        outer_event.exec_ns=exec;
+        recorder_add(&rec,&outer_event);
+        __atomic_store_n(&outer_busy,0,__ATOMIC_RELEASE);
+
+        // set 20 Hz timing on absolute deadlines so the period does not drift
+        next.tv_nsec+=NANO*1000/D2_HZ;
+        while(next.tv_nsec>=1000000000){
+            next.tv_nsec-=1000000000;
+            next.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC,TIMER_ABSTIME,&next,NULL);
+    }
     return NULL;
 }
 
 /*******************************************************************************
-* float complementary_filter()
+* void* battery_loop()
 *
-* Converts accelerometer and gyroscope data into angle values (in radians) of
-* the BeagleBone relative to the x-axis. These values are then passed through
-* low-pass (accelerometer data) and high-pass (gyroscope data) filters before
-* being summed to a theta angle estimate of the MIP body relative to the
-* x-axis.
+* Samples the battery at BATT_HZ until the state is EXITING and publishes
+* the duty scale for the inner loop. Not real-time, a late sample only
+* delays a slowly changing value.
 *******************************************************************************/
-float complementary_filter(){
-    // initialize theta values
-    static float theta_a[2],theta_a_raw[2]={0,0};
-    static float theta_g[2],theta_g_raw[2]={0,0};
-
-    // compute accelerometer angle of BeagleBone relative to x-axis
-    theta_a_raw[0]=atan2(-imu_reader.accel[2],imu_reader.accel[1]);
-    // use Euler's integration on gyroscope x-axis data
-    theta_g_raw[0]=theta_g_raw[1]+(imu_reader.gyro[0]*DEG_TO_RAD*DT);
-
-    // apply a low-pass filter to theta_a_raw
-    theta_a[0]=(1-OMEGA_C*DT)*theta_a[1]+(OMEGA_C*DT)*theta_a_raw[1];
-    // apply a high-pass filter to theta_g_raw
-    theta_g[0]=(1-OMEGA_C*DT)*theta_g[1]+theta_g_raw[0]-theta_g_raw[1];
-    // calculate theta angle of MIP
-    theta_f=theta_a[0]+theta_g[0]+THETA_OFFSET;
+void* battery_loop(){
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC,&next);
 
-    // update theta values for next iteration
-    theta_a_raw[1]=theta_a_raw[0];
-    theta_g_raw[1]=theta_g_raw[0];
-    theta_a[1]=theta_a[0];
-    theta_g[1]=theta_g[0];
+    while(rc_get_state()!=EXITING){
+        battery_sample(&batt,rc_battery_voltage());
+        next.tv_nsec+=NANO*1000/BATT_HZ;
+        while(next.tv_nsec>=1000000000){
+            next.tv_nsec-=1000000000;
+            next.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC,TIMER_ABSTIME,&next,NULL);
+    }
+    return NULL;
+}
 
-    return theta_f;
+/*******************************************************************************
+* float motor_duty()
+*
+* Duty of one motor for the battery: the same torque as duty gives at
+* BATT_NOMINAL, within the +/-1 the motor driver takes.
+*******************************************************************************/
+float motor_duty(float duty,float scale){
+    return fminf(fmaxf(duty*scale,-1),1);
+}
+
+/*******************************************************************************
+* void outer_step()
+*
+* Calculates wheel angle from encoders. The difference between the reference
+* phi and the average angle of the wheels is then used as an input for
+* controller D2, which will then produce a reference theta for the inner loop.
+* The reference phi comes from the trajectory, stepped first, and the lean
+* its acceleration needs is added to theta_r so D2 only corrects the error.
+* A restart asked for by initialize_ops() since the last step resets the
+* trajectory before it is stepped and starts D2 bumpless at the error it
+* sees now; the inner loop takes the references as restarted until the new
+* ones are published. The encoder counts and body angle used are kept in
+* outer_event.
+*******************************************************************************/
+void outer_step(){
+    // initialize local variables
+    float l_wheel,r_wheel,current_phi,phi_error,theta;
+    int l_count,r_count;
+    uint32_t req;
+    req=__atomic_load_n(&restart_req,__ATOMIC_ACQUIRE);
+    if(req!=restart_done) traj_reset(&traj);
+    reference_step();
+    // read the encoders and the body angle of the inner loop once
+    l_count=rc_get_encoder_pos(ENCODER_CHANNEL_L);
+    r_count=rc_get_encoder_pos(ENCODER_CHANNEL_R);
+    theta=current_theta;
+    // calculate wheel positions in radians
+    l_wheel=wheel_angle(l_count,ENCODER_POLARITY_L);
+    r_wheel=wheel_angle(r_count,ENCODER_POLARITY_R);
+    // calculate average wheel position, the encoders turn with the wheels
+    // relative to the body so add the MiP body angle
+    current_phi=(0.5*(l_wheel+r_wheel))+theta;
+    // calculate input error and theta reference
+    phi_error=phi_reference-current_phi;
+    if(req!=restart_done){
+        preset_controls(&D2,phi_error,0);
+        __atomic_store_n(&restart_done,req,__ATOMIC_RELEASE);
+    }
+    theta_r=control_step(&D2,phi_error)+traj_lean(&traj);
+    outer_event.count[0]=l_count;
+    outer_event.count[1]=r_count;
+    outer_event.in[0]=theta;
+    outer_event.out[0]=theta_r;
+    return;
 }
 
 /*******************************************************************************
-* initialize_controller()
+* void reference_step()
 *
-* Allocates controller values to be used for difference equation
-* computations. Default inputs and outputs are set to zero.
+* Starts the latest motion command if one was posted, advances the
+* trajectory by one D2_HZ period and publishes it as phi_reference and
+* heading_reference. Runs in the loop that owns the trajectory. A command
+* taken is recorded, playback posts it again at the same point.
 *******************************************************************************/
-controller_d_t initialize_controller(float gain,int n, int m,float* num, \
-                                     float* den,float sat){
-    // create controller object
-    controller_d_t d;
-    // initialize for loop counts
-    int i=0;
-    int j=0;
-    // allocate controller numerator values and zero inputs
-    for(i=0;i<(n+1);i++){
-        d.numerator[i]=num[i];
-        d.inputs[i]=0;
-    }
-    // allocate controller denominator values and zero outputs
-    for(j=0;j<(m+1);j++){
-        d.denominator[j]=den[j];
-        d.outputs[j]=0;
+void reference_step(){
+    traj_cmd_t cmd;
+    rec_event_t ev;
+    if(traj_take(&cmd_box,&cmd)){
+        memset(&ev,0,sizeof(ev));
+        ev.type=REC_COMMAND;
+        ev.state=rc_get_state();
+        ev.arg=cmd.type;
+        ev.start_ns=rt_now_ns();
+        ev.in[0]=cmd.forward;
+        ev.in[1]=cmd.heading;
+        recorder_add(&rec,&ev);
+        traj_command(&traj,&cmd);
     }
-    // allocate gain and saturation values
-    d.gain=gain;
-    d.saturation=sat;
-    // save # of poles and zeros of controller
-    d.n=n;
-    d.m=m;
-    return d;
+    traj_step(&traj);
+    phi_reference=traj.phi.pos;
+    heading_reference=traj.heading.pos;
+    return;
 }
 
 /*******************************************************************************
-* float control_step()
+* void reference_seen()
 *
-* Performs difference equation calculation using controller values from
-* controller d and an input error.
+* The phi and heading references for the inner loop, as the trajectory last
+* published them or, while a restart is pending, as it restarts: at rest at
+* zero, where the cleared encoders put the MiP.
 *******************************************************************************/
-float control_step(controller_d_t* d,float loop_error){
-    // retrieve # of poles and zeros for calculations
-    int n=d->n;
-    int m=d->m;
-    // initialize for loop counts
-    int i=0; int j=0; int k=0; int l=0;
-    // set input error as initial input
-    d->inputs[0]=loop_error;
-    // initialize output
-    float update_error=0;
-    // perform difference equation calculation
-    for(i=0;i<(n+1);i++){
-        d->outputs[0]+=d->gain*d->numerator[i]*d->inputs[i];
+void reference_seen(float* phi_ref,float* heading_ref){
+    if(restart_req!=__atomic_load_n(&restart_done,__ATOMIC_ACQUIRE)){
+        *phi_ref=0;
+        *heading_ref=0;
     }
-    for(j=1;j<(m+1);j++){
-        d->outputs[0]-=d->denominator[j]*d->outputs[j];
+    else{
+        *phi_ref=phi_reference;
+        *heading_ref=heading_reference;
     }
-    d->outputs[0]/=d->denominator[0];
+    return;
+}
 
-    update_error=d->outputs[0];
-    // check for saturation
-    if(update_error>d->saturation){
-        update_error=d->saturation;
+/*******************************************************************************
+* void save_state()
+* int restore_state()
+*
+* Copy everything the loops carry between ticks into a keyframe and back.
+* The inner loop saves at the end of a tick, after its event is recorded
+* and with the outer loop between steps, so the state matches the event
+* sequence exactly. Playback restores, which fails with -1 for a keyframe
+* of another build.
+*******************************************************************************/
+void save_state(mip_state_t* s){
+    int i;
+    s->hist=hist;
+    s->D1=D1;
+    s->D2=D2;
+    s->D3=D3;
+    s->theta_f=theta_f;
+    s->theta_r=theta_r;
+    s->current_theta=current_theta;
+    s->phi_reference=phi_reference;
+    s->heading_f=heading_f;
+    s->heading_rate=heading_rate;
+    s->current_heading=current_heading;
+    s->heading_reference=heading_reference;
+    for(i=0;i<2;i++){
+        s->wheel_rate[i]=wheel_rate[i];
+        s->wheel_vel[i]=wheel_vel[i];
     }
-    else if(update_error<-d->saturation){
-        update_error=-d->saturation;
-    }
-    // zero out output of difference equation
-    d->outputs[0]=0;
-    // update inputs and outputs for next iteration
-    for(k=n;k>0;k--){
-        d->inputs[k]=d->inputs[k-1];
+    s->wd=wd;
+    s->cal=cal;
+    s->cal_run=cal_run;
+    s->cal_state=__atomic_load_n(&cal_state,__ATOMIC_RELAXED);
+    s->act=act;
+    s->act_run=act_run;
+    s->act_state=__atomic_load_n(&act_state,__ATOMIC_RELAXED);
+    s->track=track;
+    memcpy(s->mpc_u,mpc.u,sizeof(s->mpc_u));
+    s->mpc_saturated=mpc.saturated;
+    s->mpc_tilt_limited=mpc.tilt_limited;
+    s->dob=dob;
+    s->recover=recover;
+    s->traj=traj;
+    s->restart_req=restart_req;
+    s->restart_done=__atomic_load_n(&restart_done,__ATOMIC_RELAXED);
+    return;
+}
+
+int restore_state(const void* state,uint32_t size){
+    const mip_state_t* s=state;
+    int i;
+    if(size!=sizeof(mip_state_t)) return -1;
+    hist=s->hist;
+    D1=s->D1;
+    D2=s->D2;
+    D3=s->D3;
+    theta_f=s->theta_f;
+    theta_r=s->theta_r;
+    current_theta=s->current_theta;
+    phi_reference=s->phi_reference;
+    heading_f=s->heading_f;
+    heading_rate=s->heading_rate;
+    current_heading=s->current_heading;
+    heading_reference=s->heading_reference;
+    for(i=0;i<2;i++){
+        wheel_rate[i]=s->wheel_rate[i];
+        wheel_vel[i]=s->wheel_vel[i];
     }
-    for(l=m;l>0;l--){
-        d->outputs[l]=d->outputs[l-1];
+    wd=s->wd;
+    cal=s->cal;
+    cal_run=s->cal_run;
+    cal_state=s->cal_state;
+    act=s->act;
+    act_run=s->act_run;
+    act_state=s->act_state;
+    track=s->track;
+    memcpy(mpc.u,s->mpc_u,sizeof(mpc.u));
+    mpc.saturated=s->mpc_saturated;
+    mpc.tilt_limited=s->mpc_tilt_limited;
+    dob=s->dob;
+    recover=s->recover;
+    traj=s->traj;
+    restart_req=s->restart_req;
+    restart_done=s->restart_done;
+    return 0;
+}
+
+/*******************************************************************************
+* void watchdog_check()
+*
+* Runs on the supervisor loop. Disables the motors if the inner loop, which
+* would normally do it, has stopped running, writes the recording after
+* a fall, saves a newly measured calibration or actuator shaping and reads
+* motion commands. supervisor_run() calls it only while RUNNING, so none of
+* this happens while paused, and a silent inner loop is caught on the first
+* poll after resuming.
+*******************************************************************************/
+void watchdog_check(){
+    uint64_t now=rt_now_ns();
+    rec_event_t ev;
+    if(watchdog_poll(&wd,now)==WD_SAFE_STOP){
+        rc_disable_motors();
+        telemetry_message(watchdog_mode_name(WD_SAFE_STOP));
+        memset(&ev,0,sizeof(ev));
+        ev.type=REC_POLL;
+        ev.state=rc_get_state();
+        ev.start_ns=now;
+        recorder_add(&rec,&ev);
     }
+    // the inner loop saw a fall, dump what led up to it
+    if(recorder_take_mark(&rec)) recorder_dump(&rec,rec_path);
+    save_calibration();
+    save_actuator();
+    command_poll();
+    return;
+}
 
-    return update_error;
+/*******************************************************************************
+* void command_poll()
+*
+* Reads what the command FIFO holds without blocking and posts each complete
+* line that parses; the loop takes only the latest one posted since its last
+* step. "dob on" and "dob off" switch the disturbance feed-forward instead.
+* Lines that do not parse are reported and dropped, longer than CMD_LINE
+* they are cut.
+*******************************************************************************/
+void command_poll(){
+    static char line[CMD_LINE];
+    static int len=0;
+    char buf[CMD_LINE];
+    traj_cmd_t cmd;
+    ssize_t n;
+    int i;
+    if(cmd_fd<0) return;
+    while((n=read(cmd_fd,buf,sizeof(buf)))>0){
+        for(i=0;i<n;i++){
+            if(buf[i]!='\n'){
+                if(len<CMD_LINE-1) line[len++]=buf[i];
+                continue;
+            }
+            line[len]='\0';
+            len=0;
+            if(line[0]=='\0') continue;
+            if(strcmp(line,"dob on")==0){
+                __atomic_store_n(&dob_enabled,1,__ATOMIC_RELAXED);
+            }
+            else if(strcmp(line,"dob off")==0){
+                __atomic_store_n(&dob_enabled,0,__ATOMIC_RELAXED);
+            }
+            else if(traj_parse(line,&cmd)==0) traj_post(&cmd_box,&cmd);
+            else fprintf(stderr,"ignored command '%s'\n",line);
+        }
+    }
+    return;
 }
-
+
 /*******************************************************************************
-* void clear_controls()
+* void start_calibration()
+* void save_calibration()
 *
-* Clears input and output values of controllers to prevent lock-up.
-*******************************************************************************/
-void clear_controls(controller_d_t* d){
-    int n=d->n;
-    int m=d->m;
-    int i=0; int j=0;
-    // set input and output values to zero
-    for(i=n;i>=0;i--){
-        d->inputs[i]=0;
-    }
-    for(j=m;j>=0;j--){
-        d->outputs[j]=0;
-    }
-    return;
-}
-
+* The inner loop averages a window of samples and applies the result itself;
+* the file is written later from the supervisor loop, since the inner loop
+* must not do file I/O.
+*******************************************************************************/
+void start_calibration(){
+    calibration_start(&cal_run,CAL_SECONDS*D1_HZ,CAL_MAX_GYRO_STD, \
+                      THETA_OFFSET,CAL_MAX_CHANGE);
+    __atomic_store_n(&cal_state,CAL_MEASURING,__ATOMIC_RELEASE);
+    return;
+}
+
+void save_calibration(){
+    if(__atomic_load_n(&cal_state,__ATOMIC_ACQUIRE)!=CAL_MEASURED) return;
+    calibration_save(cal_path,&cal);
+    __atomic_store_n(&cal_state,CAL_IDLE,__ATOMIC_RELAXED);
+    return;
+}
+
+/*******************************************************************************
+* void start_characterization()
+* void save_actuator()
+*
+* As the calibration: the inner loop measures and applies the result, the
+* supervisor loop saves it, or reports a run that failed.
+*******************************************************************************/
+void start_characterization(){
+    actuator_start(&act_run,D1_HZ);
+    __atomic_store_n(&act_state,CAL_MEASURING,__ATOMIC_RELEASE);
+    return;
+}
+
+void save_actuator(){
+    if(__atomic_load_n(&act_state,__ATOMIC_ACQUIRE)!=CAL_MEASURED) return;
+    if(act_run.result>0){
+        printf("actuator measured: deadband %.3f %.3f, friction %.3f %.3f, " \
+               "scale %.3f %.3f\n",act.deadband[0],act.deadband[1], \
+               act.friction[0],act.friction[1],act.scale[0],act.scale[1]);
+        actuator_save(act_path,&act);
+    }
+    else{
+        fprintf(stderr,"ERROR: characterization failed, a wheel did not " \
+                "turn, keeping the previous shaping\n");
+    }
+    __atomic_store_n(&act_state,CAL_IDLE,__ATOMIC_RELAXED);
+    return;
+}
+
+/*******************************************************************************
+* void watchdog_report()
+*
+* Prints the watchdog counters on exit.
+*******************************************************************************/
+void watchdog_report(){
+    printf("watchdog: %llu inner misses, %llu outer misses, %llu ramps, " \
+           "%llu inner-only, %llu safe stops\n", \
+           (unsigned long long)wd.inner.misses, \
+           (unsigned long long)wd.outer.misses, \
+           (unsigned long long)wd.ramp_events, \
+           (unsigned long long)wd.inner_only_events, \
+           (unsigned long long)wd.safe_stops);
+    return;
+}
+
+/*******************************************************************************
+* void on_pause_pressed()
+* void on_pause_released()
+*
+* Record button events before handing them to the supervisor.
+*******************************************************************************/
+void on_pause_pressed(){
+    record_button(1);
+    supervisor_pause_pressed();
+    return;
+}
+
+void on_pause_released(){
+    record_button(0);
+    supervisor_pause_released();
+    return;
+}
+
+void record_button(int pressed){
+    rec_event_t ev;
+    memset(&ev,0,sizeof(ev));
+    ev.type=REC_BUTTON;
+    ev.state=rc_get_state();
+    ev.arg=pressed;
+    ev.start_ns=rt_now_ns();
+    recorder_add(&rec,&ev);
+    return;
+}
+
+/*******************************************************************************
+* float complementary_filter()
+*
+* Body angle of the MiP in radians from the IMU through the complementary
+* filter in ../Common/comp_filter.c, with the gyro bias and theta offset of
+* the calibration and the bias tracker. The filter values are kept in hist
+* for the keyframes.
+*******************************************************************************/
+float complementary_filter(){
+    // accelerometer angle of BeagleBone relative to x-axis, or while
+    // kicking, when the wheels swamp it, the last angle estimate
+    float theta_a_raw=atan2(-imu_reader.accel[2],imu_reader.accel[1]);
+    if(recover.state==RECOVER_KICK){
+        theta_a_raw=theta_f-cal.theta_offset-track.theta_offset;
+    }
+    // calculate theta angle of MIP
+    theta_f=comp_filter_step(&hist.filter,theta_a_raw,imu_reader.gyro[0]- \
+                             cal.gyro_bias-track.gyro_bias,OMEGA_C,DT)+ \
+            cal.theta_offset+track.theta_offset;
+    return theta_f;
+}
+
+/*******************************************************************************
+* float heading_filter()
+*
+* Heading of the MiP in radians, positive turning left. The encoder
+* difference gives it without drift, since the wheels turn apart by
+* TRACK_WIDTH_M/WHEEL_RADIUS_M radians per radian of heading, and the gyro
+* rate about the vertical follows turns and wheel slip without quantization.
+* The board is upright in its y-axis, so the vertical rate is gyro y and z
+* rotated by the board angle. The integrated rate is high-passed and the
+* encoder heading low-passed at HEADING_OMEGA_C, as in the complementary
+* filter, in one recursion on heading_f. The rate is kept in heading_rate.
+*******************************************************************************/
+float heading_filter(int l_count,int r_count){
+    // encoder heading, the body turns both wheels alike so it cancels
+    float psi_e=WHEEL_RADIUS_M/TRACK_WIDTH_M* \
+                (wheel_angle(r_count,ENCODER_POLARITY_R)- \
+                 wheel_angle(l_count,ENCODER_POLARITY_L));
+    // yaw rate in the board frame, tilted by the board angle
+    float b=current_theta-cal.theta_offset-track.theta_offset;
+    heading_rate=(imu_reader.gyro[1]*cosf(b)-imu_reader.gyro[2]*sinf(b))* \
+                 DEG_TO_RAD;
+    heading_f=(1-HEADING_OMEGA_C*DT)*(heading_f+heading_rate*DT)+ \
+              HEADING_OMEGA_C*DT*psi_e;
+    return heading_f;
+}
+
+/*******************************************************************************
+* void balance_state()
+*
+* State x = [theta, theta_dot, phi, phi_dot] less its reference for the
+* single-rate modes, all measured in the same tick: theta from the filter,
+* theta_dot from the bias corrected gyro, and phi, the absolute wheel angle,
+* from the encoders relative to the body plus theta. phi_dot uses the raw
+* wheel rates rather than the observer's, whose lag host/lqr_design does
+* not model.
+* theta and phi_dot are taken relative to the lean and speed the trajectory
+* plans, so it is followed without a standing error.
+*******************************************************************************/
+void balance_state(float theta,int l_count,int r_count,float phi_ref, \
+                   float x[4]){
+    float theta_dot=(imu_reader.gyro[0]-cal.gyro_bias-track.gyro_bias)* \
+                    DEG_TO_RAD;
+    x[0]=theta-traj_lean(&traj);
+    x[1]=theta_dot;
+    x[2]=0.5f*(wheel_angle(l_count,ENCODER_POLARITY_L)+ \
+               wheel_angle(r_count,ENCODER_POLARITY_R))+theta-phi_ref;
+    x[3]=0.5f*(wheel_vel[0].raw+wheel_vel[1].raw)+theta_dot-traj.phi.vel;
+    return;
+}
+
+/*******************************************************************************
+* float lqr_step()
+*
+* State feedback u = -K x.
+*******************************************************************************/
+float lqr_step(const float x[4]){
+    static const float k[4]=LQR_K;
+    float duty;
+
+    duty=-(k[0]*x[0]+k[1]*x[1]+k[2]*x[2]+k[3]*x[3]);
+    if(duty>LQR_SATURATION) duty=LQR_SATURATION;
+    else if(duty<-LQR_SATURATION) duty=-LQR_SATURATION;
+    return duty;
+}
+
+/*******************************************************************************
+* int control_mode_from_name()
+* const char* control_mode_name()
+*
+* "cascade", "lqr" or "mpc", -1 for anything else.
+*******************************************************************************/
+int control_mode_from_name(const char* name){
+    if(strcmp(name,"cascade")==0) return CONTROL_CASCADE;
+    if(strcmp(name,"lqr")==0) return CONTROL_LQR;
+    if(strcmp(name,"mpc")==0) return CONTROL_MPC;
+    return -1;
+}
+
+const char* control_mode_name(int mode){
+    if(mode==CONTROL_LQR) return "lqr";
+    if(mode==CONTROL_MPC) return "mpc";
+    return "cascade";
+}
+
 /*******************************************************************************
 * void clear_encoders()
 *
-* Set encoder positions to zero for wheel tracking.
+* Set encoder positions to zero for wheel tracking. Called from the inner
+* loop, which also owns the wheel rate estimators.
 *******************************************************************************/
 void clear_encoders(){
-    rc_set_encoder_pos(ENCODER_CHANNEL_L,0);
-    rc_set_encoder_pos(ENCODER_CHANNEL_R,0);
+    rc_set_encoder_pos(ENCODER_CHANNEL_L,0);
+    rc_set_encoder_pos(ENCODER_CHANNEL_R,0);
+    wheel_vel_rebase(&wheel_vel[0],0);
+    wheel_vel_rebase(&wheel_vel[1],0);
     return;
 }
 
+/*******************************************************************************
+* float wheel_angle()
+*
+* Converts the encoder count of one wheel into radians.
+*******************************************************************************/
+float wheel_angle(int count,int polarity){
+    return count*polarity*TWO_PI/(GEARBOX*ENCODER_RES);
+}
+
 /*******************************************************************************
 * void initialize_ops()
 *
-* Enable motors and zero out controllers and encoders.
+* Enable motors, zero out the encoders and start the controllers bumpless:
+* the motors were off, so D1, D2 and D3 continue from zero output at the
+* errors they see now rather than kicking on their first step. With the
+* encoders cleared, the outer loop sees the body angle as the wheel angle
+* and the heading starts at zero, so the trajectory restarts at rest there.
+* In cascade mode the trajectory and D2 belong to the outer loop, which is
+* asked to restart them on its next step, after the encoders are cleared.
+* The single-rate modes step the trajectory here and reset it directly. The
+* disturbance observer starts without an estimate.
 *******************************************************************************/
-void initialize_ops(){
-    clear_controls(&D1);
-    clear_controls(&D2);
-    clear_encoders();
-    rc_enable_motors();
+void initialize_ops(float theta_error){
+    preset_controls(&D1,theta_error,0);
+    heading_f=0;
+    preset_controls(&D3,0,0);
+    mpc_reset(&mpc);
+    dob_reset(&dob);
+    clear_encoders();
+    if(control_mode==CONTROL_CASCADE){
+        __atomic_store_n(&restart_req,restart_req+1,__ATOMIC_RELEASE);
+    }
+    else{
+        traj_reset(&traj);
+        phi_reference=traj.phi.pos;
+        heading_reference=traj.heading.pos;
+    }
+    rc_enable_motors();
+    telemetry_message(NULL);
     return;
 }
 
 /*******************************************************************************
 * void suspend_ops()
 *
-* Disable motors to stop balancing.
+* Disable motors to stop balancing, once per fall.
 *******************************************************************************/
 void suspend_ops(){
-    rc_disable_motors();
-    printf("\r");
-    printf("Oops,unexpected trustfall!");
+    rc_disable_motors();
+    telemetry_message("Oops,unexpected trustfall!");
     return;
 }
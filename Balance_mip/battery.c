@@ -0,0 +1,59 @@
+/*******************************************************************************
+* battery.c
+*
+* Filtered battery voltage and the duty scale published from it.
+*******************************************************************************/
+#include <math.h>
+#include <string.h>
+#include "mip_config.h"
+#include "battery.h"
+
+void battery_init(battery_t* b,float hz){
+    memset(b,0,sizeof(*b));
+    b->alpha=1-expf(-1/(BATT_TAU*hz));
+    b->scale=1;
+    return;
+}
+
+/*******************************************************************************
+* float battery_sample()
+*
+* The filter starts at the first valid reading and restarts after an
+* invalid one. The scale is kept within BATT_MIN_SCALE and BATT_MAX_SCALE,
+* so a bad reading cannot multiply the duty by much. Each published value
+* is a single aligned store, a reader sees the old or the new one.
+*******************************************************************************/
+float battery_sample(battery_t* b,float volts){
+    float scale=1;
+
+    if(!(volts>=BATT_MIN_VOLTS)){
+        b->primed=0;
+        b->filtered=0;
+    }
+    else if(!b->primed){
+        b->filtered=volts;
+        b->primed=1;
+    }
+    else{
+        b->filtered+=b->alpha*(volts-b->filtered);
+    }
+    if(b->primed){
+        scale=fminf(fmaxf(BATT_NOMINAL/b->filtered,BATT_MIN_SCALE), \
+                    BATT_MAX_SCALE);
+    }
+    __atomic_store(&b->volts,&b->filtered,__ATOMIC_RELAXED);
+    __atomic_store(&b->scale,&scale,__ATOMIC_RELAXED);
+    return b->filtered;
+}
+
+float battery_scale(battery_t* b){
+    float scale;
+    __atomic_load(&b->scale,&scale,__ATOMIC_RELAXED);
+    return scale;
+}
+
+float battery_volts(battery_t* b){
+    float volts;
+    __atomic_load(&b->volts,&volts,__ATOMIC_RELAXED);
+    return volts;
+}
@@ -0,0 +1,32 @@
+/*******************************************************************************
+* battery.h
+*
+* Battery voltage compensation of the motor duty for balance_mip. The same
+* duty gives less torque as the 2S pack discharges, so the loop gain drops
+* over a run. A low-rate task samples the battery, low-passes the reading
+* with BATT_TAU and publishes BATT_NOMINAL over it as a duty scale, which
+* the inner loop reads once per tick without locking. Readings below
+* BATT_MIN_VOLTS, no battery or none fitted, publish 1. No hardware
+* dependencies.
+*******************************************************************************/
+
+#ifndef BATTERY
+#define BATTERY
+
+typedef struct battery_t{
+    float alpha;                // low-pass gain per sample
+    int primed;
+    float filtered;             // V, owned by the sampling task
+    float volts;                // V, published, 0 without a battery
+    float scale;                // published duty scale
+} battery_t;
+
+void battery_init(battery_t* b,float hz);
+// from the sampling task: one reading in V, returns the filtered voltage
+float battery_sample(battery_t* b,float volts);
+// from any thread: the latest duty scale, 1 until a valid reading
+float battery_scale(battery_t* b);
+// from any thread: the latest filtered voltage, 0 without a battery
+float battery_volts(battery_t* b);
+
+#endif	//BATTERY
@@ -0,0 +1,58 @@
+/*******************************************************************************
+* bias_tracker.c
+*
+* Quasi-static detection and slow tracking of the gyro bias and theta offset.
+*******************************************************************************/
+#include <math.h>
+#include <string.h>
+#include "mip_config.h"
+#include "bias_tracker.h"
+
+void bias_tracker_init(bias_tracker_t* t,float hz){
+    memset(t,0,sizeof(*t));
+    t->detect_alpha=1/(TRACK_DETECT_TAU*hz);
+    t->bias_alpha=1/(TRACK_BIAS_TAU*hz);
+    t->offset_alpha=1/(TRACK_OFFSET_TAU*hz);
+    t->settle=TRACK_SETTLE*hz;
+    return;
+}
+
+void bias_tracker_reset(bias_tracker_t* t){
+    t->gyro_bias=0;
+    t->theta_offset=0;
+    t->still=0;
+    return;
+}
+
+/*******************************************************************************
+* int bias_tracker_step()
+*
+* The gyro mean and variance are exponentially weighted over about
+* TRACK_DETECT_TAU. After TRACK_SETTLE of quasi-static ticks, the bias moves
+* toward the corrected gyro mean and the offset toward the value that zeroes
+* the filter angle. theta already includes the current offset correction.
+*******************************************************************************/
+int bias_tracker_step(bias_tracker_t* t,float gyro_x,float theta, \
+                      int balancing){
+    float d=gyro_x-t->gyro_mean;
+
+    t->ticks++;
+    t->gyro_mean+=t->detect_alpha*d;
+    t->gyro_var=(1-t->detect_alpha)*(t->gyro_var+t->detect_alpha*d*d);
+    if(!balancing || t->bias_alpha==0 || fabsf(theta)>TRACK_MAX_THETA || \
+       t->gyro_var>TRACK_MAX_GYRO_STD*TRACK_MAX_GYRO_STD){
+        t->still=0;
+        return 0;
+    }
+    if(t->still<t->settle){
+        t->still++;
+        return 0;
+    }
+    t->gyro_bias+=t->bias_alpha*(t->gyro_mean-t->gyro_bias);
+    t->theta_offset-=t->offset_alpha*theta;
+    t->gyro_bias=fmaxf(fminf(t->gyro_bias,TRACK_MAX_BIAS),-TRACK_MAX_BIAS);
+    t->theta_offset=fmaxf(fminf(t->theta_offset,TRACK_MAX_OFFSET), \
+                          -TRACK_MAX_OFFSET);
+    t->adapt_ticks++;
+    return 1;
+}
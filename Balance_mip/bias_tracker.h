@@ -0,0 +1,45 @@
+/*******************************************************************************
+* bias_tracker.h
+*
+* Online correction of the gyro bias and theta offset of balance_mip, on top
+* of the startup calibration. While the robot balances quietly (low gyro
+* variance, wheels nearly stopped, body near upright) the true body rate and
+* tilt average zero, so the mean gyro rate is the bias and the mean filter
+* angle is the offset error; both are followed with slow time constants and
+* kept within TRACK_MAX_* of the calibration. Constant work per tick, no
+* hardware dependencies.
+*******************************************************************************/
+
+#ifndef BIAS_TRACKER
+#define BIAS_TRACKER
+
+#include <stdint.h>
+
+typedef struct bias_tracker_t{
+    // corrections added to the calibration, read by the filter
+    float gyro_bias;            // deg/s
+    float theta_offset;         // rad
+    // quasi-static detection
+    float gyro_mean;            // deg/s, exponentially weighted
+    float gyro_var;             // (deg/s)^2, exponentially weighted
+    uint32_t still;             // consecutive quasi-static ticks
+    // rates, 0 until bias_tracker_init() so an unset tracker never adapts
+    float detect_alpha;
+    float bias_alpha;
+    float offset_alpha;
+    uint32_t settle;            // quasi-static ticks before adapting
+    // telemetry
+    uint64_t ticks;
+    uint64_t adapt_ticks;
+} bias_tracker_t;
+
+void bias_tracker_init(bias_tracker_t* t,float hz);
+// forget the corrections, e.g. after a new calibration
+void bias_tracker_reset(bias_tracker_t* t);
+// one inner loop tick: gyro x less the calibrated bias in deg/s, filter
+// angle theta in rad, and whether the robot is balancing with its wheels
+// still; returns 1 if the corrections were updated
+int bias_tracker_step(bias_tracker_t* t,float gyro_x,float theta, \
+                      int balancing);
+
+#endif	//BIAS_TRACKER
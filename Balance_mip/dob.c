@@ -0,0 +1,65 @@
+/*******************************************************************************
+* dob.c
+*
+* Body torque estimate from the model residual of the body rate.
+*******************************************************************************/
+#include <math.h>
+#include <string.h>
+#include "mip_config.h"
+#include "dob.h"
+
+void dob_init(dob_t* d,float hz){
+    static const float A[4][4]=MPC_A;
+    static const float B[4]=MPC_B;
+    static const float E[4]=DOB_E;
+
+    memset(d,0,sizeof(*d));
+    d->a[0]=A[1][0];
+    d->a[1]=A[1][1];
+    d->a[2]=A[1][3];
+    d->b=B[1];
+    d->e=E[1];
+    d->alpha=1-expf(-1/(DOB_TAU*hz));
+    return;
+}
+
+void dob_reset(dob_t* d){
+    d->primed=0;
+    d->duty=0;
+    d->torque=0;
+    return;
+}
+
+/*******************************************************************************
+* float dob_update()
+*
+* The torque that makes the predicted body rate match the measured one,
+* through a first order low-pass. The first tick after a reset only primes.
+*******************************************************************************/
+float dob_update(dob_t* d,float theta,float theta_dot,float phi_dot){
+    float predicted,raw;
+
+    if(d->primed){
+        predicted=d->a[0]*d->x[0]+d->a[1]*d->x[1]+d->a[2]*d->x[2]+ \
+                  d->b*d->duty;
+        raw=(theta_dot-predicted)/d->e;
+        d->torque+=d->alpha*(raw-d->torque);
+    }
+    d->x[0]=theta;
+    d->x[1]=theta_dot;
+    d->x[2]=phi_dot;
+    d->primed=1;
+    return d->torque;
+}
+
+float dob_duty(const dob_t* d){
+    float duty=-DOB_GAIN*d->e/d->b*d->torque;
+    if(duty>DOB_MAX_DUTY) return DOB_MAX_DUTY;
+    if(duty<-DOB_MAX_DUTY) return -DOB_MAX_DUTY;
+    return duty;
+}
+
+void dob_applied(dob_t* d,float duty){
+    d->duty=duty;
+    return;
+}
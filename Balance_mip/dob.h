@@ -0,0 +1,41 @@
+/*******************************************************************************
+* dob.h
+*
+* Disturbance observer for the inner loop of balance_mip. The linear model
+* MPC_A, MPC_B predicts the body rate of each tick from the state and duty of
+* the tick before; what the gyro measures beyond that is put down to a
+* torque on the body, per DOB_E, and low-passed with DOB_TAU. Pushes, slopes
+* and payload shifts show up here a tick after they act instead of only once
+* they have tilted the body. The duty that cancels the estimate's effect on
+* the body rate is the feed-forward. The wheel angle does not enter the body
+* dynamics, so the state is theta, theta_dot and phi_dot. Constant work per
+* tick, no hardware dependencies.
+*******************************************************************************/
+
+#ifndef DOB
+#define DOB
+
+typedef struct dob_t{
+    // model, body rate row
+    float a[3];                 // per theta, theta_dot, phi_dot
+    float b;                    // per duty
+    float e;                    // per Nm
+    float alpha;                // estimate low-pass gain per tick
+    // previous tick
+    int primed;
+    float x[3];
+    float duty;                 // as applied
+    float torque;               // estimate, Nm
+} dob_t;
+
+void dob_init(dob_t* d,float hz);
+// forget the previous tick and the estimate, e.g. when balancing starts
+void dob_reset(dob_t* d);
+// one tick measured, returns the torque estimate in Nm
+float dob_update(dob_t* d,float theta,float theta_dot,float phi_dot);
+// feed-forward duty for the current estimate, within +-DOB_MAX_DUTY
+float dob_duty(const dob_t* d);
+// the duty the motors got this tick, feed-forward included
+void dob_applied(dob_t* d,float duty);
+
+#endif	//DOB
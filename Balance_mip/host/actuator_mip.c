@@ -0,0 +1,294 @@
+/*******************************************************************************
+* actuator_mip.c
+*
+* Actuator characterization and shaping of balance_mip on a plant with
+* gearbox friction. Runs the unmodified inner_loop() and outer_step() on the
+* eduMiP plant model from mip_plant.c with each case's friction and motor
+* mismatch. First the MiP is held with the wheels off the ground while the
+* characterization measures the actuator, which is compared with what the
+* plant has: a breakaway and friction duty of friction/(1 +/- mismatch) and
+* a scale of 1/(1 +/- mismatch), left and right. Then it is released at
+* START_TILT and balances undisturbed for RUN_TIME, once with no shaping and
+* once with the measured one, and the limit cycle is measured after
+* SETTLE_TIME as the RMS tilt and wheel rate.
+*
+* Exits non-zero if the characterization fails, is off by more than
+* MEASURE_DUTY in a duty or MEASURE_SCALE in a scale, if the MiP falls with
+* the shaping, or if the shaping makes the limit cycle larger.
+*
+* usage: actuator_mip [-c cascade|lqr|mpc] [-o trace.csv]
+*******************************************************************************/
+#include <rc_usefulincludes.h>
+#include <roboticscape.h>
+#include <sys/wait.h>
+#include "mip_host.h"
+#include "mip_plant.h"
+#include "rt_setup.h"
+
+#define MEASURE_DUTY            0.005
+#define MEASURE_SCALE           0.02 // relative
+#define MEASURE_TIME            60.0 // s, longest characterization
+#define HOLD_TIME               3.0 // s, held before release
+#define SETTLE_TIME             5.0 // s after release
+#define RUN_TIME                30.0 // s after release
+#define START_TILT              0.05 // rad at release
+
+typedef struct shaping_t{
+    int result;                 // of the characterization
+    double time;                // s it took
+    actuator_t act;             // measured
+    int fell;
+    double rms_theta;           // rad, after settling
+    double rms_rate;            // rad/s of the mean wheel, after settling
+    double travel;              // m, wheel travel from the start
+} shaping_t;
+
+typedef struct case_t{
+    double friction;            // plant friction, duty
+    double mismatch;            // plant motor_mismatch
+} case_t;
+
+static const case_t cases[]={
+    {0.02, 0},
+    {0.05, 0},
+    {0.05, 0.10},
+    {0.10, 0.10},
+};
+#define CASES                   (int)(sizeof(cases)/sizeof(cases[0]))
+
+// trace of the running case, NULL when not writing one
+static FILE* trace=NULL;
+
+static void plant_setup(mip_plant_t* p,const case_t* c){
+    plant_init(p);
+    p->friction=c->friction;
+    p->motor_mismatch=c->mismatch;
+    return;
+}
+
+/*******************************************************************************
+* static shaping_t characterize()
+*
+* The characterization as balance_mip runs it with MIP_CHARACTERIZE=1, held
+* with the wheels free.
+*******************************************************************************/
+static shaping_t characterize(const case_t* c){
+    const double dt=1.0/D1_HZ;
+    int ticks=(int)(MEASURE_TIME*D1_HZ);
+    shaping_t r;
+    mip_plant_t p;
+    int count[2],last_count[2],k;
+
+    memset(&r,0,sizeof(r));
+    plant_setup(&p,c);
+    p.held=1;
+    mip_host_init();
+    start_characterization();
+    plant_encoders(&p,&last_count[0],&last_count[1]);
+    for(k=0;k<ticks && act_state==CAL_MEASURING;k++){
+        rt_sim_time_ns=(uint64_t)k*1000000000ULL/D1_HZ;
+        plant_imu(&p,THETA_OFFSET,imu_reader.accel,imu_reader.gyro);
+        plant_encoders(&p,&count[0],&count[1]);
+        rc_host_encoder[ENCODER_CHANNEL_L]+=ENCODER_POLARITY_L* \
+                                            (count[0]-last_count[0]);
+        rc_host_encoder[ENCODER_CHANNEL_R]+=ENCODER_POLARITY_R* \
+                                            (count[1]-last_count[1]);
+        last_count[0]=count[0];
+        last_count[1]=count[1];
+        inner_loop();
+        p.duty=0.5*(rc_host_motor[MOTOR_CHANNEL_L]*MOTOR_POLARITY_L+ \
+                    rc_host_motor[MOTOR_CHANNEL_R]*MOTOR_POLARITY_R);
+        p.duty_diff=0.5*(rc_host_motor[MOTOR_CHANNEL_R]*MOTOR_POLARITY_R- \
+                         rc_host_motor[MOTOR_CHANNEL_L]*MOTOR_POLARITY_L);
+        plant_step(&p,dt);
+    }
+    r.result=(act_state==CAL_MEASURED)?act_run.result:0;
+    r.time=k*dt;
+    r.act=act;
+    return r;
+}
+
+/*******************************************************************************
+* static shaping_t balance()
+*
+* Released upright with the given shaping and left alone.
+*******************************************************************************/
+static shaping_t balance(const case_t* c,const actuator_t* a){
+    const double dt=1.0/D1_HZ;
+    const int outer_every=D1_HZ/D2_HZ;
+    int hold=(int)(HOLD_TIME*D1_HZ);
+    int ticks=(int)(RUN_TIME*D1_HZ);
+    shaping_t r;
+    mip_plant_t p;
+    int count[2],last_count[2],k,n=0;
+    double t;
+
+    memset(&r,0,sizeof(r));
+    plant_setup(&p,c);
+    p.theta=START_TILT;
+    mip_host_init();
+    act=*a;
+    r.act=*a;
+    plant_encoders(&p,&last_count[0],&last_count[1]);
+    for(k=-hold;k<ticks;k++){
+        t=k*dt;
+        rt_sim_time_ns=(uint64_t)(k+hold)*1000000000ULL/D1_HZ;
+        plant_imu(&p,THETA_OFFSET,imu_reader.accel,imu_reader.gyro);
+        plant_encoders(&p,&count[0],&count[1]);
+        rc_host_encoder[ENCODER_CHANNEL_L]+=ENCODER_POLARITY_L* \
+                                            (count[0]-last_count[0]);
+        rc_host_encoder[ENCODER_CHANNEL_R]+=ENCODER_POLARITY_R* \
+                                            (count[1]-last_count[1]);
+        last_count[0]=count[0];
+        last_count[1]=count[1];
+        if(control_mode==CONTROL_CASCADE && (k+hold)%outer_every==0){
+            outer_step();
+        }
+        inner_loop();
+        p.duty=0.5*(rc_host_motor[MOTOR_CHANNEL_L]*MOTOR_POLARITY_L+ \
+                    rc_host_motor[MOTOR_CHANNEL_R]*MOTOR_POLARITY_R);
+        p.duty_diff=0.5*(rc_host_motor[MOTOR_CHANNEL_R]*MOTOR_POLARITY_R- \
+                         rc_host_motor[MOTOR_CHANNEL_L]*MOTOR_POLARITY_L);
+        if(k<0) continue;
+        plant_step(&p,dt);
+        if(trace!=NULL){
+            fprintf(trace,"%.2f,%.2f,%d,%.3f,%.5f,%.5f,%.4f\n",c->friction, \
+                    c->mismatch,a->scale[0]!=1 || a->deadband[0]!=0,t, \
+                    p.theta,p.phi,p.duty);
+        }
+        if(fabs(p.phi*WHEEL_RADIUS_M)>r.travel){
+            r.travel=fabs(p.phi*WHEEL_RADIUS_M);
+        }
+        if(fabs(p.theta)>TIP_ANGLE){
+            r.fell=1;
+            break;
+        }
+        if(t<SETTLE_TIME) continue;
+        r.rms_theta+=p.theta*p.theta;
+        r.rms_rate+=p.phi_dot*p.phi_dot;
+        n++;
+    }
+    if(n>0){
+        r.rms_theta=sqrt(r.rms_theta/n);
+        r.rms_rate=sqrt(r.rms_rate/n);
+    }
+    return r;
+}
+
+/*******************************************************************************
+* static int run_isolated()
+*
+* One characterization, a NULL shaping, or one balance run in a fresh
+* process so the filter, controller and wheel state start the same every
+* time.
+*******************************************************************************/
+static int run_isolated(const case_t* c,const actuator_t* a,shaping_t* r){
+    int fd[2],status;
+    pid_t pid;
+
+    if(trace!=NULL) fflush(trace);
+    if(pipe(fd)) return -1;
+    pid=fork();
+    if(pid<0) return -1;
+    if(pid==0){
+        shaping_t res=(a==NULL)?characterize(c):balance(c,a);
+        if(trace!=NULL) fclose(trace);
+        close(fd[0]);
+        if(write(fd[1],&res,sizeof(res))!=sizeof(res)) _exit(1);
+        _exit(0);
+    }
+    close(fd[1]);
+    if(read(fd[0],r,sizeof(*r))!=sizeof(*r)){
+        close(fd[0]);
+        waitpid(pid,&status,0);
+        return -1;
+    }
+    close(fd[0]);
+    waitpid(pid,&status,0);
+    return 0;
+}
+
+// 1 if the measured actuator is close to the plant's
+static int measured_well(const case_t* c,const actuator_t* a){
+    double m[2]={1+c->mismatch,1-c->mismatch};
+    int i;
+
+    for(i=0;i<2;i++){
+        if(fabs(a->deadband[i]-c->friction/m[i])>MEASURE_DUTY || \
+           fabs(a->friction[i]-c->friction/m[i])>MEASURE_DUTY || \
+           fabs(a->scale[i]*m[i]-1)>MEASURE_SCALE) return 0;
+    }
+    return 1;
+}
+
+int main(int argc,char* argv[]){
+    actuator_t none=actuator_default();
+    shaping_t m,r[2];
+    int c,i,j,fail=0;
+
+    while((c=getopt(argc,argv,"c:o:"))!=-1){
+        switch(c){
+        case 'c':
+            control_mode=control_mode_from_name(optarg);
+            if(control_mode<0){
+                fprintf(stderr,"ERROR: unknown controller '%s'\n",optarg);
+                return 1;
+            }
+            break;
+        case 'o':
+            trace=fopen(optarg,"w");
+            if(trace==NULL){
+                perror(optarg);
+                return 1;
+            }
+            fprintf(trace,"friction,mismatch,shaped,t,theta,phi,duty\n");
+            break;
+        default:
+            fprintf(stderr,"usage: actuator_mip [-c cascade|lqr|mpc] " \
+                    "[-o trace.csv]\n");
+            return 1;
+        }
+    }
+
+    printf("%s\n",control_mode_name(control_mode));
+    printf("friction  mismatch  measure_s  deadband_l  deadband_r  " \
+           "friction_l  friction_r  scale_l  scale_r\n");
+    for(i=0;i<CASES;i++){
+        if(run_isolated(&cases[i],NULL,&m)){
+            fprintf(stderr,"ERROR: case %d failed to run\n",i);
+            return 1;
+        }
+        printf("%8.2f  %8.2f  %9.1f  %10.4f  %10.4f  %10.4f  %10.4f  " \
+               "%7.3f  %7.3f\n",cases[i].friction,cases[i].mismatch,m.time, \
+               m.act.deadband[0],m.act.deadband[1],m.act.friction[0], \
+               m.act.friction[1],m.act.scale[0],m.act.scale[1]);
+        if(m.result<=0){
+            printf("FAIL: characterization did not finish\n");
+            fail=1;
+            continue;
+        }
+        if(!measured_well(&cases[i],&m.act)){
+            printf("FAIL: measured actuator is off\n");
+            fail=1;
+        }
+        for(j=0;j<2;j++){
+            if(run_isolated(&cases[i],j?&m.act:&none,&r[j])){
+                fprintf(stderr,"ERROR: case %d failed to run\n",i);
+                return 1;
+            }
+            printf("  shaped %d  fell %d  rms_theta %.5f  rms_rate %.4f  " \
+                   "travel_m %.3f\n",j,r[j].fell,r[j].rms_theta, \
+                   r[j].rms_rate,r[j].travel);
+        }
+        if(r[1].fell){
+            printf("FAIL: falls with the shaping\n");
+            fail=1;
+        }
+        else if(!r[0].fell && r[1].rms_theta>r[0].rms_theta){
+            printf("FAIL: shaping makes the limit cycle larger\n");
+            fail=1;
+        }
+    }
+    if(trace!=NULL) fclose(trace);
+    return fail;
+}
@@ -0,0 +1,251 @@
+/*******************************************************************************
+* battery_mip.c
+*
+* Balancing of balance_mip through a battery discharge with and without the
+* voltage compensation. Runs the unmodified inner_loop() and outer_step() on
+* the eduMiP plant model from mip_plant.c while the 2S pack runs down its
+* open-circuit voltage curve, compressed into DISCHARGE_TIME, from full to
+* empty, and stays empty for one more push. The plant's drive scales with
+* the voltage over BATT_NOMINAL. With the compensation the battery is
+* sampled at BATT_HZ, as battery_loop() does; without it there are no
+* samples and the duty scale stays 1.
+*
+* The same push, a torque on the body for PUSH_LENGTH, comes every
+* PUSH_EVERY. Recovery is the time from the end of a push until |theta|
+* stays within SETTLE_THETA. Exits non-zero if the compensation makes the
+* MiP fall, or if it makes the peak tilt vary more over the discharge.
+*
+* usage: battery_mip [-c cascade|lqr|mpc] [-o trace.csv]
+*******************************************************************************/
+#include <rc_usefulincludes.h>
+#include <roboticscape.h>
+#include <sys/wait.h>
+#include "mip_host.h"
+#include "mip_plant.h"
+#include "rt_setup.h"
+
+#define SETTLE_THETA            0.02 // rad
+#define HOLD_TIME               3.0 // s, held before release
+#define DISCHARGE_TIME          60.0 // s after release, full to empty
+#define PUSH_EVERY              6.0 // s, first push one period in
+#define PUSH_LENGTH             0.1 // s
+#define PUSH_TORQUE             0.15 // Nm
+#define PUSHES                  10 // DISCHARGE_TIME/PUSH_EVERY, the last empty
+#define CELLS                   2
+
+// open-circuit voltage of a LiPo cell from full to empty in steps of 10%
+static const double cell_ocv[]={4.20,4.13,4.06,3.99,3.92,3.85,3.79,3.75, \
+                                3.70,3.61,3.27};
+#define OCV_POINTS              (int)(sizeof(cell_ocv)/sizeof(cell_ocv[0]))
+
+typedef struct push_t{
+    double volts;               // V at the push
+    double scale;               // duty scale in use
+    double peak_theta;          // rad
+    double recovery;            // s from the end of the push
+} push_t;
+
+typedef struct discharge_t{
+    int fell;
+    double fell_volts;          // V when it fell
+    push_t push[PUSHES];
+} discharge_t;
+
+// trace of the running case, NULL when not writing one
+static FILE* trace=NULL;
+
+/*******************************************************************************
+* static double pack_volts()
+*
+* Pack voltage at a fraction of the discharge, 0 full and 1 empty,
+* interpolated on the cell curve.
+*******************************************************************************/
+static double pack_volts(double used){
+    double x;
+    int i;
+
+    if(used<=0) return CELLS*cell_ocv[0];
+    if(used>=1) return CELLS*cell_ocv[OCV_POINTS-1];
+    x=used*(OCV_POINTS-1);
+    i=(int)x;
+    return CELLS*(cell_ocv[i]+(x-i)*(cell_ocv[i+1]-cell_ocv[i]));
+}
+
+/*******************************************************************************
+* static discharge_t run_case()
+*
+* One discharge with or without the compensation, in a fresh process so
+* the filter, controller and battery state start the same every time.
+*******************************************************************************/
+static discharge_t run_case(int comp){
+    const double dt=1.0/D1_HZ;
+    const int outer_every=D1_HZ/D2_HZ;
+    const int batt_every=D1_HZ/BATT_HZ;
+    const int push_every=(int)(PUSH_EVERY*D1_HZ);
+    int hold=(int)(HOLD_TIME*D1_HZ);
+    int ticks=(int)((DISCHARGE_TIME+PUSH_EVERY)*D1_HZ);
+    discharge_t r;
+    mip_plant_t p;
+    push_t* u;
+    int count[2],last_count[2],k,i;
+    double t,volts,since;
+
+    memset(&r,0,sizeof(r));
+    plant_init(&p);
+    mip_host_init();
+    plant_encoders(&p,&last_count[0],&last_count[1]);
+    for(k=-hold;k<ticks;k++){
+        t=k*dt;
+        rt_sim_time_ns=(uint64_t)(k+hold)*1000000000ULL/D1_HZ;
+        volts=pack_volts(t/DISCHARGE_TIME);
+        rc_host_battery_voltage=volts;
+        p.supply=volts/BATT_NOMINAL;
+        if(comp && (k+hold)%batt_every==0){
+            battery_sample(&batt,rc_battery_voltage());
+        }
+        // push i from tick 0 of its period
+        i=(k<0)?-1:k/push_every-1;
+        since=(k<0)?0:(k%push_every)*dt;
+        p.body_torque=(i>=0 && i<PUSHES && since<PUSH_LENGTH)?PUSH_TORQUE:0;
+        plant_imu(&p,THETA_OFFSET,imu_reader.accel,imu_reader.gyro);
+        plant_encoders(&p,&count[0],&count[1]);
+        rc_host_encoder[ENCODER_CHANNEL_L]+=ENCODER_POLARITY_L* \
+                                            (count[0]-last_count[0]);
+        rc_host_encoder[ENCODER_CHANNEL_R]+=ENCODER_POLARITY_R* \
+                                            (count[1]-last_count[1]);
+        last_count[0]=count[0];
+        last_count[1]=count[1];
+        if(control_mode==CONTROL_CASCADE && (k+hold)%outer_every==0){
+            outer_step();
+        }
+        inner_loop();
+        p.duty=0.5*(rc_host_motor[MOTOR_CHANNEL_L]*MOTOR_POLARITY_L+ \
+                    rc_host_motor[MOTOR_CHANNEL_R]*MOTOR_POLARITY_R);
+        if(k<0) continue;
+        plant_step(&p,dt);
+        if(trace!=NULL){
+            fprintf(trace,"%d,%.3f,%.3f,%.4f,%.5f,%.5f,%.4f\n",comp,t,volts, \
+                    battery_scale(&batt),p.theta,p.phi,p.duty);
+        }
+        if(fabs(p.theta)>TIP_ANGLE){
+            r.fell=1;
+            r.fell_volts=volts;
+            return r;
+        }
+        if(i<0 || i>=PUSHES) continue;
+        u=&r.push[i];
+        if(k%push_every==0){
+            u->volts=volts;
+            u->scale=battery_scale(&batt);
+        }
+        if(fabs(p.theta)>u->peak_theta) u->peak_theta=fabs(p.theta);
+        if(fabs(p.theta)>SETTLE_THETA) u->recovery=since+dt-PUSH_LENGTH;
+    }
+    for(i=0;i<PUSHES;i++){
+        if(r.push[i].recovery<0) r.push[i].recovery=0;
+    }
+    return r;
+}
+
+static int run_isolated(int comp,discharge_t* r){
+    int fd[2],status;
+    pid_t pid;
+
+    if(trace!=NULL) fflush(trace);
+    if(pipe(fd)) return -1;
+    pid=fork();
+    if(pid<0) return -1;
+    if(pid==0){
+        discharge_t res=run_case(comp);
+        if(trace!=NULL) fclose(trace);
+        close(fd[0]);
+        if(write(fd[1],&res,sizeof(res))!=sizeof(res)) _exit(1);
+        _exit(0);
+    }
+    close(fd[1]);
+    if(read(fd[0],r,sizeof(*r))!=sizeof(*r)){
+        close(fd[0]);
+        waitpid(pid,&status,0);
+        return -1;
+    }
+    close(fd[0]);
+    waitpid(pid,&status,0);
+    return 0;
+}
+
+// largest less smallest peak tilt over the pushes
+static double peak_spread(const discharge_t* r){
+    double lo=r->push[0].peak_theta,hi=lo;
+    int i;
+
+    for(i=1;i<PUSHES;i++){
+        lo=fmin(lo,r->push[i].peak_theta);
+        hi=fmax(hi,r->push[i].peak_theta);
+    }
+    return hi-lo;
+}
+
+int main(int argc,char* argv[]){
+    discharge_t r[2];
+    int c,i,j,fail=0;
+
+    while((c=getopt(argc,argv,"c:o:"))!=-1){
+        switch(c){
+        case 'c':
+            control_mode=control_mode_from_name(optarg);
+            if(control_mode<0){
+                fprintf(stderr,"ERROR: unknown controller '%s'\n",optarg);
+                return 1;
+            }
+            break;
+        case 'o':
+            trace=fopen(optarg,"w");
+            if(trace==NULL){
+                perror(optarg);
+                return 1;
+            }
+            fprintf(trace,"comp,t,volts,scale,theta,phi,duty\n");
+            break;
+        default:
+            fprintf(stderr,"usage: battery_mip [-c cascade|lqr|mpc] " \
+                    "[-o trace.csv]\n");
+            return 1;
+        }
+    }
+
+    for(j=0;j<2;j++){
+        if(run_isolated(j,&r[j])){
+            fprintf(stderr,"ERROR: discharge %d failed to run\n",j);
+            return 1;
+        }
+    }
+    printf("%s\n",control_mode_name(control_mode));
+    printf("push  volts  scale  peak_off  peak_on  recovery_off  " \
+           "recovery_on\n");
+    for(i=0;i<PUSHES;i++){
+        printf("%4d  %5.2f  %5.3f  %8.4f  %7.4f  %12.2f  %11.2f\n",i+1, \
+               r[1].push[i].volts,r[1].push[i].scale, \
+               r[0].push[i].peak_theta,r[1].push[i].peak_theta, \
+               r[0].push[i].recovery,r[1].push[i].recovery);
+    }
+    for(j=0;j<2;j++){
+        if(r[j].fell){
+            printf("compensation %s: fell at %.2f V\n",j?"on":"off", \
+                   r[j].fell_volts);
+        }
+        else{
+            printf("compensation %s: peak tilt spread %.4f rad\n", \
+                   j?"on":"off",peak_spread(&r[j]));
+        }
+    }
+    if(r[1].fell){
+        printf("FAIL: falls with the compensation\n");
+        fail=1;
+    }
+    else if(!r[0].fell && peak_spread(&r[1])>peak_spread(&r[0])){
+        printf("FAIL: compensation makes the response vary more\n");
+        fail=1;
+    }
+    if(trace!=NULL) fclose(trace);
+    return fail;
+}
@@ -0,0 +1,260 @@
+/*******************************************************************************
+* bench_mip.c
+*
+* Microbenchmarks for the balance_mip hot path on the rc_host.c stand-in:
+* complementary_filter(), control_step() for D1 and D2, the encoder to radian
+* conversion of the outer loop, the wheel rate estimators of both wheels,
+* heading_filter() and control_step() for D3, lqr_step(), mpc_step(), the
+* disturbance observer and the whole inner_loop() body in each controller
+* mode.
+* Prints one CSV row per benchmark with ns/call statistics over several
+* batches, CPU cycles from perf_event_open where available, and the share
+* of the 10 ms inner loop period used.
+*
+* usage: bench_mip [-n calls_per_batch] [-b batches] [-o file]
+*******************************************************************************/
+#include <rc_usefulincludes.h>
+#include <roboticscape.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include "mip_host.h"
+
+#ifndef BENCH_REVISION
+#define BENCH_REVISION          "unknown"
+#endif
+
+#define INPUT_LEN               1024 // power of 2
+#define MAX_BATCHES             1000
+
+typedef struct bench_t{
+    const char* name;
+    void (*func)(int i);
+} bench_t;
+
+// varying inputs so nothing is constant folded
+static float input_accel[INPUT_LEN][3];
+static float input_gyro[INPUT_LEN];
+static float input_error[INPUT_LEN];
+static int input_counts[INPUT_LEN];
+static volatile float sink;
+
+static void bench_empty(int i){ sink=input_error[i]; }
+
+static void bench_filter(int i){
+    imu_reader.accel[1]=input_accel[i][1];
+    imu_reader.accel[2]=input_accel[i][2];
+    imu_reader.gyro[0]=input_gyro[i];
+    sink=complementary_filter();
+}
+
+static void bench_d1(int i){ sink=control_step(&D1,input_error[i]); }
+
+static void bench_d2(int i){ sink=control_step(&D2,input_error[i]*0.1f); }
+
+static void bench_encoder(int i){
+    rc_host_encoder[ENCODER_CHANNEL_L]=input_counts[i];
+    rc_host_encoder[ENCODER_CHANNEL_R]=-input_counts[i];
+    sink=0.5f*(wheel_angle(rc_get_encoder_pos(ENCODER_CHANNEL_L), \
+                           ENCODER_POLARITY_L)+ \
+               wheel_angle(rc_get_encoder_pos(ENCODER_CHANNEL_R), \
+                           ENCODER_POLARITY_R));
+}
+
+static void bench_velocity(int i){
+    static uint64_t t=0;
+    t+=1000000000ULL/D1_HZ;
+    sink=wheel_vel_update(&wheel_vel[0],input_counts[i],t)+ \
+         wheel_vel_update(&wheel_vel[1],-input_counts[i],t);
+}
+
+static void bench_heading(int i){
+    imu_reader.gyro[1]=input_gyro[i];
+    imu_reader.gyro[2]=-input_gyro[i]*0.1f;
+    sink=heading_filter(input_counts[i],-input_counts[i]);
+}
+
+static void bench_d3(int i){ sink=control_step(&D3,input_error[i]); }
+
+static void bench_lqr(int i){
+    float x[4]={input_error[i],input_gyro[i]*0.01f,input_counts[i]*0.001f,0};
+    sink=lqr_step(x);
+}
+
+static void bench_mpc(int i){
+    float x[4]={input_error[i],input_gyro[i]*0.01f,input_counts[i]*0.001f,0};
+    sink=mpc_step(&mpc,x);
+}
+
+static void bench_dob(int i){
+    dob_update(&dob,input_error[i],input_gyro[i]*0.01f,input_counts[i]*0.01f);
+    sink=dob_duty(&dob);
+    dob_applied(&dob,sink);
+}
+
+static void bench_actuator(int i){
+    sink=actuator_shape(&act,i&1,input_error[i],input_gyro[i]*0.01f);
+}
+
+static void bench_inner(int i){
+    imu_reader.accel[1]=input_accel[i][1];
+    imu_reader.accel[2]=input_accel[i][2];
+    imu_reader.gyro[0]=input_gyro[i];
+    inner_loop();
+}
+
+static void bench_inner_lqr(int i){
+    control_mode=CONTROL_LQR;
+    bench_inner(i);
+    control_mode=CONTROL_CASCADE;
+}
+
+static void bench_inner_mpc(int i){
+    control_mode=CONTROL_MPC;
+    bench_inner(i);
+    control_mode=CONTROL_CASCADE;
+}
+
+static const bench_t benches[]={
+    {"call_overhead",bench_empty},
+    {"complementary_filter",bench_filter},
+    {"control_step_D1",bench_d1},
+    {"control_step_D2",bench_d2},
+    {"encoder_to_rad",bench_encoder},
+    {"wheel_velocity",bench_velocity},
+    {"heading_filter",bench_heading},
+    {"control_step_D3",bench_d3},
+    {"lqr_step",bench_lqr},
+    {"mpc_step",bench_mpc},
+    {"dob_update",bench_dob},
+    {"actuator_shape",bench_actuator},
+    {"inner_loop",bench_inner},
+    {"inner_loop_lqr",bench_inner_lqr},
+    {"inner_loop_mpc",bench_inner_mpc},
+};
+
+/*******************************************************************************
+* cycle counter
+*
+* Counts user-space CPU cycles of this thread, returns -1 if the kernel or
+* CPU does not allow it (common in VMs and on boards without PMU access).
+*******************************************************************************/
+static int cycles_open(){
+    struct perf_event_attr attr;
+    memset(&attr,0,sizeof(attr));
+    attr.size=sizeof(attr);
+    attr.type=PERF_TYPE_HARDWARE;
+    attr.config=PERF_COUNT_HW_CPU_CYCLES;
+    attr.disabled=1;
+    attr.exclude_kernel=1;
+    attr.exclude_hv=1;
+    return syscall(SYS_perf_event_open,&attr,0,-1,-1,0);
+}
+
+static uint64_t now_ns(){
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC,&t);
+    return (uint64_t)t.tv_sec*1000000000ULL+t.tv_nsec;
+}
+
+static void make_inputs(){
+    int i=0;
+    for(i=0;i<INPUT_LEN;i++){
+        float theta=0.3f*sinf(i*0.05f);
+        input_accel[i][1]=9.81f*cosf(theta);
+        input_accel[i][2]=-9.81f*sinf(theta);
+        input_gyro[i]=20.0f*cosf(i*0.05f);
+        input_error[i]=0.2f*sinf(i*0.11f);
+        input_counts[i]=(int)(500*sinf(i*0.01f));
+    }
+    return;
+}
+
+/*******************************************************************************
+* void run_bench()
+*
+* Runs one warm-up batch and then the measured batches, printing mean,
+* standard deviation and minimum ns/call and mean cycles/call.
+*******************************************************************************/
+static void run_bench(FILE* out,const bench_t* b,int calls,int batches, \
+                      int cycles_fd){
+    static double ns[MAX_BATCHES];
+    double sum=0,sq=0,min=0,cyc_sum=0,mean,sd;
+    uint64_t t0,cycles;
+    int i,k;
+
+    for(i=0;i<calls;i++) b->func(i&(INPUT_LEN-1));
+    for(k=0;k<batches;k++){
+        if(cycles_fd>=0){
+            ioctl(cycles_fd,PERF_EVENT_IOC_RESET,0);
+            ioctl(cycles_fd,PERF_EVENT_IOC_ENABLE,0);
+        }
+        t0=now_ns();
+        for(i=0;i<calls;i++) b->func(i&(INPUT_LEN-1));
+        ns[k]=(double)(now_ns()-t0)/calls;
+        if(cycles_fd>=0){
+            ioctl(cycles_fd,PERF_EVENT_IOC_DISABLE,0);
+            if(read(cycles_fd,&cycles,sizeof(cycles))==sizeof(cycles)){
+                cyc_sum+=(double)cycles/calls;
+            }
+        }
+        sum+=ns[k];
+        if(k==0 || ns[k]<min) min=ns[k];
+    }
+    mean=sum/batches;
+    for(k=0;k<batches;k++) sq+=(ns[k]-mean)*(ns[k]-mean);
+    sd=(batches>1)?sqrt(sq/(batches-1)):0;
+
+    fprintf(out,"%s,%s,%d,%d,%.2f,%.2f,%.2f,",BENCH_REVISION,b->name, \
+            calls,batches,mean,sd,min);
+    if(cycles_fd>=0) fprintf(out,"%.1f,",cyc_sum/batches);
+    else fprintf(out,"nan,");
+    fprintf(out,"%.4f\n",100.0*mean/(1e9/D1_HZ));
+    return;
+}
+
+int main(int argc,char* argv[]){
+    int calls=10000;
+    int batches=30;
+    FILE* out=stdout;
+    int c,i,cycles_fd;
+
+    while((c=getopt(argc,argv,"n:b:o:"))!=-1){
+        switch(c){
+        case 'n':
+            calls=atoi(optarg);
+            break;
+        case 'b':
+            batches=atoi(optarg);
+            break;
+        case 'o':
+            out=fopen(optarg,"w");
+            if(out==NULL){
+                perror(optarg);
+                return -1;
+            }
+            break;
+        default:
+            fprintf(stderr,"usage: bench_mip [-n calls] [-b batches] [-o file]\n");
+            return -1;
+        }
+    }
+    if(calls<1 || batches<1 || batches>MAX_BATCHES){
+        fprintf(stderr,"ERROR: need calls>0 and 0<batches<=%d\n",MAX_BATCHES);
+        return -1;
+    }
+
+    make_inputs();
+    mip_host_init();
+    cycles_fd=cycles_open();
+    if(cycles_fd<0) fprintf(stderr,"cycle counter unavailable, reporting nan\n");
+
+    fprintf(out,"revision,name,calls,batches,ns_mean,ns_stddev,ns_min," \
+            "cycles_mean,budget_pct\n");
+    for(i=0;i<(int)(sizeof(benches)/sizeof(benches[0]));i++){
+        run_bench(out,&benches[i],calls,batches,cycles_fd);
+    }
+    if(cycles_fd>=0) close(cycles_fd);
+    if(out!=stdout) fclose(out);
+    return 0;
+}
@@ -0,0 +1,210 @@
+/*******************************************************************************
+* disturbance_mip.c
+*
+* Disturbance rejection of balance_mip with and without the feed-forward of
+* the disturbance observer. Runs the unmodified inner_loop() and
+* outer_step() on the eduMiP plant model from mip_plant.c, once with the
+* plain controller and once with dob_enabled set. Two kinds of case, both a
+* torque on the body once settled:
+*
+*   push   a pulse of PUSH_LENGTH, from small to strong enough to fall
+*   shift  a step that stays, as a payload shift or a slope
+*
+* Recovery is the time from the end of the push, or the start of the shift,
+* until |theta| stays within SETTLE_THETA of where it ends. Exits non-zero if
+* the feed-forward makes a case fall that did not fall without it, or if it
+* makes one that does not fall recover more slowly.
+*
+* usage: disturbance_mip [-c cascade|lqr|mpc] [-o trace.csv]
+*******************************************************************************/
+#include <rc_usefulincludes.h>
+#include <roboticscape.h>
+#include <sys/wait.h>
+#include "mip_host.h"
+#include "mip_plant.h"
+#include "rt_setup.h"
+
+#define SETTLE_THETA            0.02 // rad
+#define HOLD_TIME               3.0 // s, held before release
+#define EVENT_TIME              5.0 // s after release, settled by then
+#define PUSH_LENGTH             0.1 // s
+#define RUN_TIME                12.0 // s after release
+#define RUN_TICKS               (12*D1_HZ) // RUN_TIME
+
+typedef struct rejection_t{
+    int fell;
+    double recovery;            // s from the end of the push
+    double peak_theta;          // rad
+    double travel;              // m, largest wheel travel from the start
+    double peak_torque;         // Nm, largest estimate
+} rejection_t;
+
+typedef struct case_t{
+    const char* name;
+    double torque;              // Nm
+    double length;              // s, 0 to stay on
+} case_t;
+
+static const case_t cases[]={
+    {"push",  0.10, PUSH_LENGTH},
+    {"push",  0.20, PUSH_LENGTH},
+    {"push",  0.25, PUSH_LENGTH},
+    {"push",  0.30, PUSH_LENGTH},
+    {"push",  0.35, PUSH_LENGTH},
+    {"shift", 0.02, 0},
+    {"shift", 0.05, 0},
+};
+#define CASES                   (int)(sizeof(cases)/sizeof(cases[0]))
+
+// trace of the running case, NULL when not writing one
+static FILE* trace=NULL;
+
+/*******************************************************************************
+* static rejection_t run_case()
+*
+* One case with or without the feed-forward, in a fresh process so the
+* filter, controller and observer state start the same every time.
+*******************************************************************************/
+static rejection_t run_case(const case_t* c,int ff){
+    const double dt=1.0/D1_HZ;
+    const double end=EVENT_TIME+c->length;
+    const int outer_every=D1_HZ/D2_HZ;
+    int hold=(int)(HOLD_TIME*D1_HZ);
+    static double theta[RUN_TICKS];
+    rejection_t r;
+    mip_plant_t p;
+    int count[2],last_count[2],k,n=0;
+    double t,phi0=0;
+
+    memset(&r,0,sizeof(r));
+    plant_init(&p);
+    mip_host_init();
+    dob_enabled=ff;
+    plant_encoders(&p,&last_count[0],&last_count[1]);
+    for(k=-hold;k<RUN_TICKS;k++){
+        t=k*dt;
+        rt_sim_time_ns=(uint64_t)(k+hold)*1000000000ULL/D1_HZ;
+        p.body_torque=(t>=EVENT_TIME && (c->length==0 || t<end))? \
+                      c->torque:0;
+        plant_imu(&p,THETA_OFFSET,imu_reader.accel,imu_reader.gyro);
+        plant_encoders(&p,&count[0],&count[1]);
+        rc_host_encoder[ENCODER_CHANNEL_L]+=ENCODER_POLARITY_L* \
+                                            (count[0]-last_count[0]);
+        rc_host_encoder[ENCODER_CHANNEL_R]+=ENCODER_POLARITY_R* \
+                                            (count[1]-last_count[1]);
+        last_count[0]=count[0];
+        last_count[1]=count[1];
+        if(control_mode==CONTROL_CASCADE && (k+hold)%outer_every==0){
+            outer_step();
+        }
+        inner_loop();
+        p.duty=0.5*(rc_host_motor[MOTOR_CHANNEL_L]*MOTOR_POLARITY_L+ \
+                    rc_host_motor[MOTOR_CHANNEL_R]*MOTOR_POLARITY_R);
+        if(k<0) continue;
+        plant_step(&p,dt);
+        if(trace!=NULL){
+            fprintf(trace,"%s,%.2f,%d,%.3f,%.5f,%.5f,%.4f,%.5f\n",c->name, \
+                    c->torque,ff,t,p.theta,p.phi,p.duty,dob.torque);
+        }
+        theta[n++]=p.theta;
+        if(t<EVENT_TIME){
+            phi0=p.phi;
+            continue;
+        }
+        if(fabs(p.theta)>r.peak_theta) r.peak_theta=fabs(p.theta);
+        if(fabs(p.phi-phi0)*WHEEL_RADIUS_M>r.travel){
+            r.travel=fabs(p.phi-phi0)*WHEEL_RADIUS_M;
+        }
+        if(fabs(dob.torque)>r.peak_torque) r.peak_torque=fabs(dob.torque);
+        if(fabs(p.theta)>TIP_ANGLE){
+            r.fell=1;
+            r.recovery=RUN_TIME-end;
+            return r;
+        }
+    }
+    // a shift ends tilted against it, a push upright
+    for(k=n-1;k>=0 && fabs(theta[k]-theta[n-1])<=SETTLE_THETA;k--);
+    r.recovery=(k+1)*dt-end;
+    if(r.recovery<0) r.recovery=0;
+    return r;
+}
+
+static int run_isolated(const case_t* c,int ff,rejection_t* r){
+    int fd[2],status;
+    pid_t pid;
+
+    if(trace!=NULL) fflush(trace);
+    if(pipe(fd)) return -1;
+    pid=fork();
+    if(pid<0) return -1;
+    if(pid==0){
+        rejection_t res=run_case(c,ff);
+        if(trace!=NULL) fclose(trace);
+        close(fd[0]);
+        if(write(fd[1],&res,sizeof(res))!=sizeof(res)) _exit(1);
+        _exit(0);
+    }
+    close(fd[1]);
+    if(read(fd[0],r,sizeof(*r))!=sizeof(*r)){
+        close(fd[0]);
+        waitpid(pid,&status,0);
+        return -1;
+    }
+    close(fd[0]);
+    waitpid(pid,&status,0);
+    return 0;
+}
+
+int main(int argc,char* argv[]){
+    rejection_t r[2];
+    int c,i,j,fail=0;
+
+    while((c=getopt(argc,argv,"c:o:"))!=-1){
+        switch(c){
+        case 'c':
+            control_mode=control_mode_from_name(optarg);
+            if(control_mode<0){
+                fprintf(stderr,"ERROR: unknown controller '%s'\n",optarg);
+                return 1;
+            }
+            break;
+        case 'o':
+            trace=fopen(optarg,"w");
+            if(trace==NULL){
+                perror(optarg);
+                return 1;
+            }
+            fprintf(trace,"case,torque_Nm,dob,t,theta,phi,duty,estimate_Nm\n");
+            break;
+        default:
+            fprintf(stderr,"usage: disturbance_mip [-c cascade|lqr|mpc] " \
+                    "[-o trace.csv]\n");
+            return 1;
+        }
+    }
+
+    printf("%s\n",control_mode_name(control_mode));
+    printf("case   torque_Nm  dob  fell  recovery_s  peak_theta  travel_m  " \
+           "estimate_Nm\n");
+    for(i=0;i<CASES;i++){
+        for(j=0;j<2;j++){
+            if(run_isolated(&cases[i],j,&r[j])){
+                fprintf(stderr,"ERROR: case %d failed to run\n",i);
+                return 1;
+            }
+            printf("%-5s  %9.2f  %3d  %4d  %10.2f  %10.3f  %8.3f  %11.3f\n", \
+                   cases[i].name,cases[i].torque,j,r[j].fell,r[j].recovery, \
+                   r[j].peak_theta,r[j].travel,r[j].peak_torque);
+        }
+        if(r[1].fell && !r[0].fell){
+            printf("FAIL: falls only with the feed-forward\n");
+            fail=1;
+        }
+        else if(!r[1].fell && r[1].recovery>r[0].recovery){
+            printf("FAIL: recovers more slowly with the feed-forward\n");
+            fail=1;
+        }
+    }
+    if(trace!=NULL) fclose(trace);
+    return fail;
+}
@@ -0,0 +1,228 @@
+/*******************************************************************************
+* fall_mip.c
+*
+* Fall recovery of balance_mip. Runs the unmodified inner_loop() and
+* outer_step() on the eduMiP plant model from mip_plant.c with a floor the
+* body lands on at PLANT_LYING_ANGLE. Each case knocks the MiP over, or
+* starts it on the ground, and then either lets the self-righting kick
+* bring it back or leaves it until a hand stands it up at HAND_SPEED from
+* HAND_TIME on and lets go as it starts balancing:
+*
+*   push    balancing, then pushed over with a body torque pulse
+*   ground  switched on lying on the ground
+*
+* Downtime is from the first tick past TIP_ANGLE until balancing last
+* restarted.
+* Exits non-zero if a case does not end balanced, within SETTLE_THETA over
+* the last SETTLE_TIME, if a self-righting case needed a hand, or if a case
+* without the kick moved the wheels while down.
+*
+* usage: fall_mip [-c cascade|lqr|mpc] [-o trace.csv]
+*******************************************************************************/
+#include <rc_usefulincludes.h>
+#include <roboticscape.h>
+#include <sys/wait.h>
+#include "mip_host.h"
+#include "mip_plant.h"
+#include "rt_setup.h"
+
+#define SETTLE_THETA            0.05 // rad
+#define SETTLE_TIME             2.0 // s at the end of the run
+#define HOLD_TIME               3.0 // s, held before release
+#define PUSH_AT                 2.0 // s after release
+#define PUSH_LENGTH             0.1 // s
+#define PUSH_TORQUE             0.5 // Nm, past what the controllers can hold
+#define HAND_TIME               8.0 // s after release, picked up without kick
+#define HAND_SPEED              1.0 // rad/s, tilt rate of the hand
+#define RUN_TIME                15.0 // s after release
+
+typedef struct case_t{
+    const char* name;
+    int kick;                   // self-righting on
+    double push;                // Nm, 0 to start on the ground
+} case_t;
+
+static const case_t cases[]={
+    {"push+", 1, PUSH_TORQUE},
+    {"push-", 1, -PUSH_TORQUE},
+    {"ground", 1, 0},
+    {"push+", 0, PUSH_TORQUE},
+    {"ground", 0, 0},
+};
+#define CASES                   (int)(sizeof(cases)/sizeof(cases[0]))
+
+typedef struct fall_t{
+    int fell;                   // went past TIP_ANGLE
+    int handled;                // stood up by the hand
+    double down;                // s from the fall until balancing last restarted
+    uint32_t kicks;
+    uint32_t captured;
+    double down_duty;           // largest while not balancing
+    double end_theta;           // rad, largest |theta| over the last SETTLE_TIME
+    int balancing;              // upright at the end
+} fall_t;
+
+// trace of the running case, NULL when not writing one
+static FILE* trace=NULL;
+
+/*******************************************************************************
+* static fall_t run_case()
+*
+* The hand sets the tilt and the body rate while the wheels keep their
+* dynamics.
+*******************************************************************************/
+static fall_t run_case(const case_t* c){
+    const double dt=1.0/D1_HZ;
+    const int outer_every=D1_HZ/D2_HZ;
+    int hold=(c->push!=0)?(int)(HOLD_TIME*D1_HZ):0;
+    int ticks=(int)(RUN_TIME*D1_HZ);
+    int push_at=(int)(PUSH_AT*D1_HZ);
+    int push_len=(int)(PUSH_LENGTH*D1_HZ);
+    int fall_tick=-1,hand;
+    fall_t r;
+    mip_plant_t p;
+    int count[2],last_count[2],k;
+    double t,theta;
+
+    memset(&r,0,sizeof(r));
+    plant_init(&p);
+    p.floor=1;
+    if(c->push==0) p.theta=PLANT_LYING_ANGLE;
+    mip_host_init();
+    recovery_init(&recover,D1_HZ,c->kick);
+    plant_encoders(&p,&last_count[0],&last_count[1]);
+    for(k=-hold;k<ticks;k++){
+        t=k*dt;
+        rt_sim_time_ns=(uint64_t)(k+hold)*1000000000ULL/D1_HZ;
+        p.body_torque=(c->push!=0 && k>=push_at && k<push_at+push_len)? \
+                      c->push:0;
+        plant_imu(&p,THETA_OFFSET,imu_reader.accel,imu_reader.gyro);
+        plant_encoders(&p,&count[0],&count[1]);
+        rc_host_encoder[ENCODER_CHANNEL_L]+=ENCODER_POLARITY_L* \
+                                            (count[0]-last_count[0]);
+        rc_host_encoder[ENCODER_CHANNEL_R]+=ENCODER_POLARITY_R* \
+                                            (count[1]-last_count[1]);
+        last_count[0]=count[0];
+        last_count[1]=count[1];
+        if(control_mode==CONTROL_CASCADE && (k+hold)%outer_every==0){
+            outer_step();
+        }
+        inner_loop();
+        p.duty=0.5*(rc_host_motor[MOTOR_CHANNEL_L]*MOTOR_POLARITY_L+ \
+                    rc_host_motor[MOTOR_CHANNEL_R]*MOTOR_POLARITY_R);
+        p.duty_diff=0.5*(rc_host_motor[MOTOR_CHANNEL_R]*MOTOR_POLARITY_R- \
+                         rc_host_motor[MOTOR_CHANNEL_L]*MOTOR_POLARITY_L);
+        if(k<0) continue;
+        // a hand stands up a MiP still down at HAND_TIME and lets go once
+        // it balances
+        hand=t>=HAND_TIME && recover.state!=RECOVER_UPRIGHT;
+        if(hand) r.handled=1;
+        theta=p.theta;
+        plant_step(&p,dt);
+        if(hand){
+            p.theta=theta-copysign(HAND_SPEED*dt,theta);
+            p.theta_dot=-copysign(HAND_SPEED,theta);
+        }
+        if(trace!=NULL){
+            fprintf(trace,"%s,%d,%.2f,%d,%.5f,%.5f,%.5f,%.4f\n",c->name, \
+                    c->kick,t,recover.state,p.theta,current_theta,p.phi,p.duty);
+        }
+        if(fabs(p.theta)>TIP_ANGLE && fall_tick<0){
+            fall_tick=k;
+            r.fell=1;
+        }
+        if(fall_tick>=0 && recover.state!=RECOVER_UPRIGHT){
+            r.down=(k+1-fall_tick)*dt;
+            if(fabs(p.duty)>r.down_duty) r.down_duty=fabs(p.duty);
+        }
+        if(t>=RUN_TIME-SETTLE_TIME && fabs(p.theta)>r.end_theta){
+            r.end_theta=fabs(p.theta);
+        }
+    }
+    r.kicks=recover.kicked;
+    r.captured=recover.captured;
+    r.balancing=recover.state==RECOVER_UPRIGHT && r.end_theta<SETTLE_THETA;
+    return r;
+}
+
+static int run_isolated(const case_t* c,fall_t* r){
+    int fd[2],status;
+    pid_t pid;
+
+    if(trace!=NULL) fflush(trace);
+    if(pipe(fd)) return -1;
+    pid=fork();
+    if(pid<0) return -1;
+    if(pid==0){
+        fall_t res=run_case(c);
+        if(trace!=NULL) fclose(trace);
+        close(fd[0]);
+        if(write(fd[1],&res,sizeof(res))!=sizeof(res)) _exit(1);
+        _exit(0);
+    }
+    close(fd[1]);
+    if(read(fd[0],r,sizeof(*r))!=sizeof(*r)){
+        close(fd[0]);
+        waitpid(pid,&status,0);
+        return -1;
+    }
+    close(fd[0]);
+    waitpid(pid,&status,0);
+    return 0;
+}
+
+int main(int argc,char* argv[]){
+    fall_t r;
+    int c,i,fail=0;
+
+    while((c=getopt(argc,argv,"c:o:"))!=-1){
+        switch(c){
+        case 'c':
+            control_mode=control_mode_from_name(optarg);
+            if(control_mode<0){
+                fprintf(stderr,"ERROR: unknown controller '%s'\n",optarg);
+                return 1;
+            }
+            break;
+        case 'o':
+            trace=fopen(optarg,"w");
+            if(trace==NULL){
+                perror(optarg);
+                return 1;
+            }
+            fprintf(trace,"case,kick,t,state,theta,estimate,phi,duty\n");
+            break;
+        default:
+            fprintf(stderr,"usage: fall_mip [-c cascade|lqr|mpc] " \
+                    "[-o trace.csv]\n");
+            return 1;
+        }
+    }
+
+    printf("%s\n",control_mode_name(control_mode));
+    printf("case    kick  fell  kicks  captured  hand  down_s  " \
+           "end_theta  balancing\n");
+    for(i=0;i<CASES;i++){
+        if(run_isolated(&cases[i],&r)){
+            fprintf(stderr,"ERROR: case %d failed to run\n",i);
+            return 1;
+        }
+        printf("%-6s  %4d  %4d  %5u  %8u  %4d  %6.2f  %9.4f  %9d\n", \
+               cases[i].name,cases[i].kick,r.fell,r.kicks,r.captured, \
+               r.handled,r.down,r.end_theta,r.balancing);
+        if(!r.balancing){
+            printf("FAIL: %s does not end balancing\n",cases[i].name);
+            fail=1;
+        }
+        if(cases[i].kick && r.handled){
+            printf("FAIL: %s did not right itself\n",cases[i].name);
+            fail=1;
+        }
+        if(!cases[i].kick && r.down_duty>0){
+            printf("FAIL: %s drove the wheels while down\n",cases[i].name);
+            fail=1;
+        }
+    }
+    if(trace!=NULL) fclose(trace);
+    return fail;
+}
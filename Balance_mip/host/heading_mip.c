@@ -0,0 +1,221 @@
+/*******************************************************************************
+* heading_mip.c
+*
+* Heading hold of balance_mip with and without the D3 heading loop. Runs the
+* unmodified inner_loop() and outer_step() on the eduMiP plant model from
+* mip_plant.c with a motor per wheel, once with D3 at a gain of 0 and once
+* as configured. Two kinds of case:
+*
+*   drive  drives forward at DRIVE_RATE for DRIVE_TIME with one motor
+*          faster than the other for the same duty, which turns an
+*          uncontrolled MiP off its heading
+*   turn   turns in place to a heading reference step, matched motors
+*
+* The heading error is the true heading less the reference. Exits non-zero
+* if a case falls with the heading loop, if it ends a drive further off its
+* heading than without it, or if a turn does not settle.
+*
+* usage: heading_mip [-c cascade|lqr|mpc] [-o trace.csv]
+*******************************************************************************/
+#include <rc_usefulincludes.h>
+#include <roboticscape.h>
+#include <sys/wait.h>
+#include "mip_host.h"
+#include "mip_plant.h"
+#include "rt_setup.h"
+
+#define SETTLE_HEADING          0.05 // rad
+#define HOLD_TIME               3.0 // s, held before release
+#define EVENT_TIME              2.0 // s after release, drive or turn
+#define DRIVE_RATE              5.0 // rad/s of wheel rotation, phi ramp
+#define DRIVE_TIME              6.0 // s
+#define RUN_TIME                12.0 // s after release
+
+typedef struct heading_t{
+    int fell;
+    double settle;              // s from the turn until the heading holds
+    double peak_error;          // rad
+    double final_error;         // rad
+    double ise_theta;           // balance, as sim_mip
+} heading_t;
+
+typedef struct case_t{
+    const char* name;
+    double mismatch;            // plant motor_mismatch
+    double heading;             // rad, heading reference step
+} case_t;
+
+static const case_t cases[]={
+    {"drive", 0.05, 0},
+    {"drive", 0.10, 0},
+    {"drive", 0.20, 0},
+    {"turn",  0,    0.5},
+    {"turn",  0,    1.5},
+    {"turn",  0.10, 1.5},
+};
+#define CASES                   (int)(sizeof(cases)/sizeof(cases[0]))
+
+// trace of the running case, NULL when not writing one
+static FILE* trace=NULL;
+
+/*******************************************************************************
+* static heading_t run_case()
+*
+* One case, with the heading loop when steer is set, in a fresh process so
+* the filter and controller state start the same every time.
+*******************************************************************************/
+static heading_t run_case(const case_t* c,int steer){
+    const double dt=1.0/D1_HZ;
+    const int outer_every=D1_HZ/D2_HZ;
+    int hold=(int)(HOLD_TIME*D1_HZ);
+    int ticks=(int)(RUN_TIME*D1_HZ);
+    heading_t r;
+    mip_plant_t p;
+    int count[2],last_count[2],k;
+    double t,ref,err;
+    float num[]=D3_NUM;
+    float den[]=D3_DEN;
+
+    memset(&r,0,sizeof(r));
+    plant_init(&p);
+    p.motor_mismatch=c->mismatch;
+    mip_host_init();
+    D3=initialize_controller(steer?D3_GAIN:0,D3_N,D3_M,num,den, \
+                             D3_SATURATION,D3_ANTIWINDUP);
+    plant_encoders(&p,&last_count[0],&last_count[1]);
+    for(k=-hold;k<ticks;k++){
+        t=k*dt;
+        rt_sim_time_ns=(uint64_t)(k+hold)*1000000000ULL/D1_HZ;
+        ref=(t>=EVENT_TIME)?c->heading:0;
+        // references set directly, not by a trajectory
+        traj.heading.pos=ref;
+        heading_reference=ref;
+        if(c->heading==0 && t>=EVENT_TIME){
+            traj.phi.pos=DRIVE_RATE*fmin(t-EVENT_TIME,DRIVE_TIME);
+            phi_reference=traj.phi.pos;
+        }
+        plant_imu(&p,THETA_OFFSET,imu_reader.accel,imu_reader.gyro);
+        plant_encoders(&p,&count[0],&count[1]);
+        rc_host_encoder[ENCODER_CHANNEL_L]+=ENCODER_POLARITY_L* \
+                                            (count[0]-last_count[0]);
+        rc_host_encoder[ENCODER_CHANNEL_R]+=ENCODER_POLARITY_R* \
+                                            (count[1]-last_count[1]);
+        last_count[0]=count[0];
+        last_count[1]=count[1];
+        if(control_mode==CONTROL_CASCADE && (k+hold)%outer_every==0){
+            outer_step();
+        }
+        inner_loop();
+        p.duty=0.5*(rc_host_motor[MOTOR_CHANNEL_L]*MOTOR_POLARITY_L+ \
+                    rc_host_motor[MOTOR_CHANNEL_R]*MOTOR_POLARITY_R);
+        p.duty_diff=0.5*(rc_host_motor[MOTOR_CHANNEL_R]*MOTOR_POLARITY_R- \
+                         rc_host_motor[MOTOR_CHANNEL_L]*MOTOR_POLARITY_L);
+        if(k<0) continue;
+        plant_step(&p,dt);
+        err=p.psi-ref;
+        if(trace!=NULL){
+            fprintf(trace,"%s,%.2f,%.2f,%d,%.3f,%.5f,%.5f,%.5f,%.4f\n", \
+                    c->name,c->mismatch,c->heading,steer,t,p.theta,p.phi, \
+                    p.psi,p.duty_diff);
+        }
+        r.ise_theta+=p.theta*p.theta*dt;
+        if(fabs(err)>r.peak_error) r.peak_error=fabs(err);
+        if(fabs(err)>SETTLE_HEADING) r.settle=t+dt-EVENT_TIME;
+        r.final_error=err;
+        if(fabs(p.theta)>TIP_ANGLE){
+            r.fell=1;
+            r.settle=RUN_TIME-EVENT_TIME;
+            break;
+        }
+    }
+    if(r.settle<0) r.settle=0;
+    return r;
+}
+
+static int run_isolated(const case_t* c,int steer,heading_t* r){
+    int fd[2],status;
+    pid_t pid;
+
+    if(trace!=NULL) fflush(trace);
+    if(pipe(fd)) return -1;
+    pid=fork();
+    if(pid<0) return -1;
+    if(pid==0){
+        heading_t res=run_case(c,steer);
+        if(trace!=NULL) fclose(trace);
+        close(fd[0]);
+        if(write(fd[1],&res,sizeof(res))!=sizeof(res)) _exit(1);
+        _exit(0);
+    }
+    close(fd[1]);
+    if(read(fd[0],r,sizeof(*r))!=sizeof(*r)){
+        close(fd[0]);
+        waitpid(pid,&status,0);
+        return -1;
+    }
+    close(fd[0]);
+    waitpid(pid,&status,0);
+    return 0;
+}
+
+int main(int argc,char* argv[]){
+    heading_t r[2];
+    int c,i,j,fail=0;
+
+    while((c=getopt(argc,argv,"c:o:"))!=-1){
+        switch(c){
+        case 'c':
+            control_mode=control_mode_from_name(optarg);
+            if(control_mode<0){
+                fprintf(stderr,"ERROR: unknown controller '%s'\n",optarg);
+                return 1;
+            }
+            break;
+        case 'o':
+            trace=fopen(optarg,"w");
+            if(trace==NULL){
+                perror(optarg);
+                return 1;
+            }
+            fprintf(trace,"case,mismatch,heading,steer,t,theta,phi,psi," \
+                    "duty_diff\n");
+            break;
+        default:
+            fprintf(stderr,"usage: heading_mip [-c cascade|lqr|mpc] " \
+                    "[-o trace.csv]\n");
+            return 1;
+        }
+    }
+
+    printf("%s\n",control_mode_name(control_mode));
+    printf("case   mismatch  heading  steer  fell  settle_s  peak_err  " \
+           "final_err  ise_theta\n");
+    for(i=0;i<CASES;i++){
+        for(j=0;j<2;j++){
+            if(run_isolated(&cases[i],j,&r[j])){
+                fprintf(stderr,"ERROR: case %d failed to run\n",i);
+                return 1;
+            }
+            printf("%-5s  %8.2f  %7.2f  %5d  %4d  %8.2f  %8.3f  %9.3f  " \
+                   "%9.5f\n",cases[i].name,cases[i].mismatch, \
+                   cases[i].heading,j,r[j].fell,r[j].settle,r[j].peak_error, \
+                   r[j].final_error,r[j].ise_theta);
+        }
+        if(r[1].fell){
+            printf("FAIL: falls with the heading loop\n");
+            fail=1;
+        }
+        else if(cases[i].heading==0 && \
+                fabs(r[1].final_error)>=fabs(r[0].final_error)){
+            printf("FAIL: heading loop does not reduce the drift\n");
+            fail=1;
+        }
+        else if(cases[i].heading!=0 && \
+                fabs(r[1].final_error)>SETTLE_HEADING){
+            printf("FAIL: turn does not settle\n");
+            fail=1;
+        }
+    }
+    if(trace!=NULL) fclose(trace);
+    return fail;
+}
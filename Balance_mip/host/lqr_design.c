@@ -0,0 +1,208 @@
+/*******************************************************************************
+* lqr_design.c
+*
+* Offline gain design for the single-rate state feedback mode of
+* balance_mip. The eduMiP model in mip_plant.c is linearized about upright
+* by central differences of one D1_HZ step with the duty held, so A and B
+* are the exact zero-order-hold discretization the inner loop sees. The
+* discrete Riccati equation is iterated to convergence for diagonal weights
+* on x = [theta, theta_dot, phi, phi_dot] and the duty, and the gain
+* u = -K (x - x_ref) is printed as a LQR_K line for mip_config.h, followed
+* by the model as MPC_A and MPC_B lines for the mpc mode, which uses the
+* same weights, and the response to a body torque as a DOB_E line for the
+* disturbance observer.
+*
+* lqr_step() does not see phi_dot exactly but the wheel rate differenced
+* over the last tick, which lags half a tick; high bandwidth designs that
+* are stable on paper oscillate at the Nyquist rate through that lag. The
+* closed loop is therefore also checked with the measured rate and the gain
+* rejected if it is unstable.
+*
+* The default weights follow Bryson's rule: each state is weighted by one
+* over the square of the deviation that should cost as much as -r duty.
+*
+* usage: lqr_design [-q theta,theta_dot,phi,phi_dot] [-r duty]
+*******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include "mip_config.h"
+#include "mip_plant.h"
+#include "mpc.h"
+
+#define NX                      MPC_NX
+#define NZ                      5 // with the previous relative wheel angle
+#define RHO_STEPS               1024 // steps for the spectral radius estimate
+
+/*******************************************************************************
+* static void linearize()
+*
+* Column j of A is the change of the state after one tick per unit of state
+* j, column B the change per unit of duty and E per Nm of torque on the
+* body, all about the upright rest point.
+*******************************************************************************/
+static void linearize(double dt,double A[NX][NX],double B[NX],double E[NX]){
+    const double eps=1e-6;
+    mip_plant_t p,m;
+    double xp[NX],xm[NX];
+    int i,j;
+
+    for(j=0;j<=NX+1;j++){
+        plant_init(&p);
+        plant_init(&m);
+        switch(j){
+        case 0: p.theta=eps; m.theta=-eps; break;
+        case 1: p.theta_dot=eps; m.theta_dot=-eps; break;
+        case 2: p.phi=eps; m.phi=-eps; break;
+        case 3: p.phi_dot=eps; m.phi_dot=-eps; break;
+        case NX: p.duty=eps; m.duty=-eps; break;
+        default: p.body_torque=eps; m.body_torque=-eps; break;
+        }
+        plant_step(&p,dt);
+        plant_step(&m,dt);
+        xp[0]=p.theta; xp[1]=p.theta_dot; xp[2]=p.phi; xp[3]=p.phi_dot;
+        xm[0]=m.theta; xm[1]=m.theta_dot; xm[2]=m.phi; xm[3]=m.phi_dot;
+        for(i=0;i<NX;i++){
+            if(j<NX) A[i][j]=(xp[i]-xm[i])/(2*eps);
+            else if(j==NX) B[i]=(xp[i]-xm[i])/(2*eps);
+            else E[i]=(xp[i]-xm[i])/(2*eps);
+        }
+    }
+    return;
+}
+
+/*******************************************************************************
+* static double spectral_radius()
+*
+* Growth rate of ||M^n|| over RHO_STEPS steps for the NZ x NZ matrix M,
+* renormalized as it goes.
+*******************************************************************************/
+static double spectral_radius(double M[NZ][NZ]){
+    double X[NZ][NZ],Y[NZ][NZ],norm,log_growth=0;
+    int i,j,k,n;
+
+    for(i=0;i<NZ;i++) for(j=0;j<NZ;j++) X[i][j]=(i==j);
+    for(n=0;n<RHO_STEPS;n++){
+        norm=0;
+        for(i=0;i<NZ;i++){
+            for(j=0;j<NZ;j++){
+                Y[i][j]=0;
+                for(k=0;k<NZ;k++) Y[i][j]+=M[i][k]*X[k][j];
+                norm+=Y[i][j]*Y[i][j];
+            }
+        }
+        norm=sqrt(norm);
+        log_growth+=log(norm);
+        for(i=0;i<NZ;i++) for(j=0;j<NZ;j++) X[i][j]=Y[i][j]/norm;
+    }
+    return exp(log_growth/RHO_STEPS);
+}
+
+/*******************************************************************************
+* static void closed_loop()
+*
+* Closed loop of the linear model under u = -K x, either with the exact
+* state (the design assumption) or as lqr_step() measures it, with phi_dot
+* the wheel rate differenced over the last tick plus theta_dot. The extra
+* state z[4] is the wheel angle relative to the body one tick ago, unused
+* for the exact state.
+*******************************************************************************/
+static void closed_loop(double A[NX][NX],double B[NX],double K[NX], \
+                        double dt,int measured,double M[NZ][NZ]){
+    // u = -g z, with g the gain on z=[theta,theta_dot,phi,phi_dot,psi_prev]
+    double g[NZ]={K[0],K[1],K[2],K[3],0};
+    int i,j;
+
+    if(measured){
+        // phi_dot ~ (phi-theta-psi_prev)/dt + theta_dot
+        g[0]-=K[3]/dt;
+        g[1]+=K[3];
+        g[2]+=K[3]/dt;
+        g[3]=0;
+        g[4]=-K[3]/dt;
+    }
+    memset(M,0,sizeof(double)*NZ*NZ);
+    for(i=0;i<NX;i++){
+        for(j=0;j<NZ;j++) M[i][j]=((j<NX)?A[i][j]:0)-B[i]*g[j];
+    }
+    // psi_prev <- phi-theta
+    M[4][2]=1;
+    M[4][0]=-1;
+    return;
+}
+
+int main(int argc,char* argv[]){
+    // largest acceptable deviation of each state, and of the duty
+    double dev[NX]={0.05,1.0,0.2,2.0};
+    double duty=0.03;
+    double A[NX][NX],B[NX],E[NX],K[NX],P[NX][NX],q[NX],M[NZ][NZ];
+    double rho_exact,rho_measured;
+    int c,i,it;
+
+    while((c=getopt(argc,argv,"q:r:"))!=-1){
+        switch(c){
+        case 'q':
+            if(sscanf(optarg,"%lf,%lf,%lf,%lf",&dev[0],&dev[1],&dev[2], \
+                      &dev[3])!=NX){
+                fprintf(stderr,"ERROR: -q needs four deviations\n");
+                return 1;
+            }
+            break;
+        case 'r':
+            duty=atof(optarg);
+            break;
+        default:
+            fprintf(stderr,"usage: lqr_design [-q theta,theta_dot,phi," \
+                    "phi_dot] [-r duty]\n");
+            return 1;
+        }
+    }
+    for(i=0;i<NX;i++){
+        if(dev[i]<=0 || duty<=0){
+            fprintf(stderr,"ERROR: deviations must be positive\n");
+            return 1;
+        }
+        q[i]=1/(dev[i]*dev[i]);
+    }
+
+    linearize(1.0/D1_HZ,A,B,E);
+    it=mpc_dare(A,B,q,1/(duty*duty),P,K);
+    if(it<0){
+        fprintf(stderr,"ERROR: Riccati iteration did not converge\n");
+        return 1;
+    }
+    fprintf(stderr,"A = [% .6f % .6f % .6f % .6f]   B = [% .6f]\n", \
+            A[0][0],A[0][1],A[0][2],A[0][3],B[0]);
+    for(i=1;i<NX;i++){
+        fprintf(stderr,"    [% .6f % .6f % .6f % .6f]       [% .6f]\n", \
+                A[i][0],A[i][1],A[i][2],A[i][3],B[i]);
+    }
+    closed_loop(A,B,K,1.0/D1_HZ,0,M);
+    rho_exact=spectral_radius(M);
+    closed_loop(A,B,K,1.0/D1_HZ,1,M);
+    rho_measured=spectral_radius(M);
+    fprintf(stderr,"converged in %d iterations, closed loop spectral " \
+            "radius %.4f with the exact state, %.4f as measured at %d Hz\n", \
+            it,rho_exact,rho_measured,D1_HZ);
+    if(rho_measured>=1){
+        fprintf(stderr,"ERROR: unstable with the differenced wheel rate, " \
+                "weight the duty more (smaller -r)\n");
+        return 1;
+    }
+    printf("// lqr_design -q %g,%g,%g,%g -r %g\n",dev[0],dev[1],dev[2], \
+           dev[3],duty);
+    printf("#define LQR_K                   {%.5g, %.5g, %.5g, %.5g}\n", \
+           K[0],K[1],K[2],K[3]);
+    printf("#define MPC_A                   {");
+    for(i=0;i<NX;i++){
+        printf("{%.8g, %.8g, %.8g, %.8g}%s",A[i][0],A[i][1],A[i][2],A[i][3], \
+               (i<NX-1)?", \\\n                                 ":"}\n");
+    }
+    printf("#define MPC_B                   {%.8g, %.8g, %.8g, %.8g}\n", \
+           B[0],B[1],B[2],B[3]);
+    printf("#define DOB_E                   {%.8g, %.8g, %.8g, %.8g}\n", \
+           E[0],E[1],E[2],E[3]);
+    return 0;
+}
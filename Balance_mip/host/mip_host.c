@@ -0,0 +1,44 @@
+/*******************************************************************************
+* mip_host.c
+*
+* Host side replacement for the setup done in balance_mip's main().
+*******************************************************************************/
+#include <rc_usefulincludes.h>
+#include <roboticscape.h>
+#include "mip_host.h"
+
+/*******************************************************************************
+* void mip_host_init()
+*
+* Creates D1, D2 and D3 from mip_config.h, builds the MPC problem, the
+* trajectory, the disturbance observer and fall recovery without the kick,
+* starts the watchdog, bias tracker and wheel rate estimators and sets the
+* state to RUNNING, without touching the IMU, the command FIFO or starting
+* any thread.
+*******************************************************************************/
+void mip_host_init(){
+    float D1_num[]=D1_NUM;
+    float D1_den[]=D1_DEN;
+    float D2_num[]=D2_NUM;
+    float D2_den[]=D2_DEN;
+    float D3_num[]=D3_NUM;
+    float D3_den[]=D3_DEN;
+    D1=initialize_controller(D1_GAIN,D1_N,D1_M,D1_num,D1_den,D1_SATURATION, \
+                             D1_ANTIWINDUP);
+    D2=initialize_controller(D2_GAIN,D2_N,D2_M,D2_num,D2_den,D2_SATURATION, \
+                             D2_ANTIWINDUP);
+    D3=initialize_controller(D3_GAIN,D3_N,D3_M,D3_num,D3_den,D3_SATURATION, \
+                             D3_ANTIWINDUP);
+    mpc_init(&mpc);
+    traj_init(&traj,D2_HZ);
+    dob_init(&dob,D1_HZ);
+    battery_init(&batt,BATT_HZ);
+    act=actuator_default();
+    recovery_init(&recover,D1_HZ,0);
+    watchdog_init(&wd,D1_HZ,D2_HZ);
+    bias_tracker_init(&track,D1_HZ);
+    wheel_vel_init(&wheel_vel[0],wheel_angle(1,ENCODER_POLARITY_L),D1_HZ);
+    wheel_vel_init(&wheel_vel[1],wheel_angle(1,ENCODER_POLARITY_R),D1_HZ);
+    rc_set_state(RUNNING);
+    return;
+}
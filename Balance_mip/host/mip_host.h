@@ -0,0 +1,80 @@
+/*******************************************************************************
+* mip_host.h
+*
+* Declarations of the balance_mip.c globals and functions used by the host
+* tools. balance_mip.c is built for the host with its main() renamed to
+* balance_mip_main() and linked against the rc_host.c stand-in.
+*******************************************************************************/
+
+#ifndef MIP_HOST
+#define MIP_HOST
+
+#include <roboticscape.h>
+#include "mip_config.h"
+#include "controller.h"
+#include "watchdog.h"
+#include "calibration.h"
+#include "bias_tracker.h"
+#include "wheel_velocity.h"
+#include "mpc.h"
+#include "trajectory.h"
+#include "dob.h"
+#include "battery.h"
+#include "actuator.h"
+#include "recovery.h"
+#include "telemetry.h"
+#include "recorder.h"
+
+extern rc_imu_data_t imu_reader;
+extern controller_d_t D1;
+extern controller_d_t D2;
+extern controller_d_t D3;
+extern float theta_r;
+extern float current_theta;
+extern float phi_reference;
+extern float heading_rate;
+extern float current_heading;
+extern float heading_reference;
+extern int control_mode;
+extern watchdog_t wd;
+extern calibration_t cal;
+extern int cal_state;
+extern bias_tracker_t track;
+extern wheel_vel_t wheel_vel[2];
+extern float wheel_rate[2];
+extern mpc_t mpc;
+extern traj_t traj;
+extern traj_mailbox_t cmd_box;
+extern dob_t dob;
+extern int dob_enabled;
+extern battery_t batt;
+extern actuator_t act;
+extern actuator_run_t act_run;
+extern int act_state;
+extern recovery_t recover;
+extern telemetry_t telem;
+extern recorder_t rec;
+extern rec_event_t rec_buffer[REC_EVENTS];
+extern rec_event_t outer_event;
+extern rec_keyframe_t rec_keys[REC_KEYFRAMES];
+
+float complementary_filter();
+float heading_filter(int l_count,int r_count);
+void balance_state(float theta,int l_count,int r_count,float phi_ref, \
+                   float x[4]);
+float lqr_step(const float x[4]);
+int control_mode_from_name(const char* name);
+const char* control_mode_name(int mode);
+float wheel_angle(int count,int polarity);
+void inner_loop();
+void outer_step();
+void reference_step();
+float motor_duty(float duty,float scale);
+void start_calibration();
+void start_characterization();
+int restore_state(const void* state,uint32_t size);
+
+// host side setup: controllers, watchdog and RUNNING state as in main()
+void mip_host_init();
+
+#endif	//MIP_HOST
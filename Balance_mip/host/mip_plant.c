@@ -0,0 +1,195 @@
+/*******************************************************************************
+* mip_plant.c
+*
+* Equations of motion of the eduMiP, integrated with fixed-step RK4:
+*
+*   [Iw+(mw+mb)r^2]   phi'' + mb r l cos(theta) theta'' = tau + mb r l theta'^2 sin(theta)
+*   mb r l cos(theta) phi'' + (Ib+mb l^2) theta''       = mb g l sin(theta) - tau + tau_d
+*
+* with tau = 2 G ts (u - G (phi'-theta')/wf) the torque of both motors, and
+* the heading, with k = w/2r the wheel angle per heading angle,
+*
+*   [Iz + 2 k^2 (Iw/2 + mw r^2)] psi''                  = k (tau_r - tau_l)
+*
+* where each motor gives half of tau at its own duty, scaled by 1 -/+ the
+* mismatch, and wheel speed phi' -/+ k psi'. With a mismatch the motors run
+* at different speeds for the same duty, so a MiP driving straight turns.
+* Gearbox friction takes a constant duty from a turning motor, and holds
+* one at rest until its duty exceeds that.
+*
+* Held with the wheels off the ground the body stays put and each wheel
+* turns on its own under its motor, [Iw/2] phi_i'' = tau_i.
+*
+* With a floor the body lands on the ground at PLANT_LYING_ANGLE and stops
+* there. It lies as long as the free theta'' would push it further into the
+* ground, and the wheels roll it along with theta' = 0, [Iw+(mw+mb)r^2]
+* phi'' = tau. Once the motors pitch it back up it lifts off again.
+*******************************************************************************/
+#include <math.h>
+#include "mip_plant.h"
+
+static void derivatives(const mip_plant_t* p,const double x[6],double dx[6]);
+
+void plant_init(mip_plant_t* p){
+    p->theta=0;
+    p->theta_dot=0;
+    p->phi=0;
+    p->phi_dot=0;
+    p->phi_ddot=0;
+    p->psi=0;
+    p->psi_dot=0;
+    p->duty=0;
+    p->duty_diff=0;
+    p->motor_mismatch=0;
+    p->deadband=0;
+    p->supply=1;
+    p->friction=0;
+    p->held=0;
+    p->floor=0;
+    p->body_torque=0;
+    p->gyro_bias=0;
+    p->accel_tilt=0;
+    p->encoder_counts=PLANT_GEARBOX*60;
+    return;
+}
+
+/*******************************************************************************
+* void plant_step()
+*
+* Holds the inputs constant over dt, as the motor duty is between ticks. A
+* body that reaches the floor stops dead, the landing takes no energy from
+* the wheels.
+*******************************************************************************/
+void plant_step(mip_plant_t* p,double dt){
+    double x[6],k1[6],k2[6],k3[6],k4[6],t[6];
+    double h;
+    int i;
+
+    while(dt>1e-12){
+        h=(dt<PLANT_DT)?dt:PLANT_DT;
+        x[0]=p->theta; x[1]=p->theta_dot; x[2]=p->phi; x[3]=p->phi_dot;
+        x[4]=p->psi; x[5]=p->psi_dot;
+        derivatives(p,x,k1);
+        for(i=0;i<6;i++) t[i]=x[i]+0.5*h*k1[i];
+        derivatives(p,t,k2);
+        for(i=0;i<6;i++) t[i]=x[i]+0.5*h*k2[i];
+        derivatives(p,t,k3);
+        for(i=0;i<6;i++) t[i]=x[i]+h*k3[i];
+        derivatives(p,t,k4);
+        for(i=0;i<6;i++) x[i]+=h/6*(k1[i]+2*k2[i]+2*k3[i]+k4[i]);
+        if(p->floor && fabs(x[0])>=PLANT_LYING_ANGLE){
+            x[0]=copysign(PLANT_LYING_ANGLE,x[0]);
+            if(x[1]*x[0]>0) x[1]=0;
+        }
+        p->theta=x[0]; p->theta_dot=x[1]; p->phi=x[2]; p->phi_dot=x[3];
+        p->psi=x[4]; p->psi_dot=x[5];
+        p->phi_ddot=k4[3];
+        dt-=h;
+    }
+    return;
+}
+
+/*******************************************************************************
+* void plant_imu()
+*
+* Specific force (acceleration minus gravity) of the axle, rotated into the
+* board frame, whose angle is theta-board_offset. The filter adds the offset
+* back, so a correct offset gives an unbiased estimate. The yaw rate is
+* about the vertical, which is (0, cos b, -sin b) in the board frame.
+*******************************************************************************/
+void plant_imu(const mip_plant_t* p,double board_offset,float accel[3], \
+               float gyro[3]){
+    double b=p->theta-board_offset+p->accel_tilt;
+    double ax=PLANT_WHEEL_RADIUS*p->phi_ddot;
+    accel[0]=0;
+    accel[1]=ax*sin(b)+PLANT_GRAVITY*cos(b);
+    accel[2]=ax*cos(b)-PLANT_GRAVITY*sin(b);
+    gyro[0]=p->theta_dot*180.0/M_PI+p->gyro_bias;
+    gyro[1]=p->psi_dot*cos(b)*180.0/M_PI;
+    gyro[2]=-p->psi_dot*sin(b)*180.0/M_PI;
+    return;
+}
+
+/*******************************************************************************
+* int plant_encoder()
+*
+* The encoder turns with the wheel relative to the body.
+*******************************************************************************/
+int plant_encoder(const mip_plant_t* p){
+    return (int)floor((p->phi-p->theta)*p->encoder_counts/(2*M_PI));
+}
+
+void plant_encoders(const mip_plant_t* p,int* left,int* right){
+    double k=PLANT_TRACK_WIDTH/(2*PLANT_WHEEL_RADIUS);
+    *left=(int)floor((p->phi-k*p->psi-p->theta)*p->encoder_counts/(2*M_PI));
+    *right=(int)floor((p->phi+k*p->psi-p->theta)*p->encoder_counts/(2*M_PI));
+    return;
+}
+
+/*******************************************************************************
+* static void derivatives()
+*
+* x = [theta, theta', phi, phi', psi, psi'], solves the 2x2 mass matrix
+* directly. Each motor saturates and has the deadband on its own duty, and
+* its drive scales with the supply voltage.
+*******************************************************************************/
+static void derivatives(const mip_plant_t* p,const double x[6],double dx[6]){
+    const double mb=PLANT_BODY_MASS;
+    const double l=PLANT_BODY_COM;
+    const double r=PLANT_WHEEL_RADIUS;
+    const double G=PLANT_GEARBOX;
+    const double ts=PLANT_STALL_TORQUE;
+    const double Iw=2*0.5*PLANT_WHEEL_MASS*r*r;
+    const double a=Iw+(2*PLANT_WHEEL_MASS+mb)*r*r;
+    const double c=PLANT_BODY_INERTIA+mb*l*l;
+    const double k=PLANT_TRACK_WIDTH/(2*r);
+    const double Iz=PLANT_YAW_INERTIA+2*k*k*(0.5*Iw+PLANT_WHEEL_MASS*r*r);
+    double u[2]={p->duty-p->duty_diff,p->duty+p->duty_diff};
+    double w[2]={x[3]-k*x[5],x[3]+k*x[5]};
+    double m[2]={1+p->motor_mismatch,1-p->motor_mismatch};
+    double s=sin(x[0]);
+    double b=mb*r*l*cos(x[0]);
+    double tau,tw[2],f1,f2,det,d,wr;
+    int i;
+
+    for(i=0;i<2;i++){
+        // saturate and apply deadband to the duty
+        if(u[i]>1) u[i]=1;
+        else if(u[i]<-1) u[i]=-1;
+        if(fabs(u[i])<=p->deadband) u[i]=0;
+        d=m[i]*p->supply*u[i];
+        wr=w[i]-x[1];
+        if(fabs(wr)>=PLANT_STICK_SPEED) d-=copysign(p->friction,wr);
+        else if(fabs(d)<=p->friction) d=0;
+        else d-=copysign(p->friction,d);
+        tw[i]=G*ts*(d-G*wr/PLANT_FREE_SPEED);
+    }
+    tau=tw[0]+tw[1];
+    if(p->held){
+        dx[0]=0;
+        dx[1]=0;
+        dx[2]=x[3];
+        dx[3]=tau/Iw;
+        dx[4]=x[5];
+        dx[5]=(tw[1]-tw[0])/(k*Iw);
+        return;
+    }
+
+    f1=tau+mb*r*l*x[1]*x[1]*s;
+    f2=mb*PLANT_GRAVITY*l*s-tau+p->body_torque;
+    det=a*c-b*b;
+    dx[0]=x[1];
+    dx[1]=(a*f2-b*f1)/det;
+    dx[2]=x[3];
+    dx[3]=(c*f1-b*f2)/det;
+    // on the ground and pressed into it, the ground takes the body torque
+    if(p->floor && fabs(x[0])>=PLANT_LYING_ANGLE && x[1]*x[0]>=0 && \
+       dx[1]*x[0]>=0){
+        dx[0]=0;
+        dx[1]=0;
+        dx[3]=f1/a;
+    }
+    dx[4]=x[5];
+    dx[5]=k*(tw[1]-tw[0])/Iz;
+    return;
+}
@@ -0,0 +1,68 @@
+/*******************************************************************************
+* mip_plant.h
+*
+* Nonlinear model of the eduMiP for host simulations: body pendulum on two
+* wheels driven by geared DC motors, following the MAE 144 eduMiP model.
+* Angles use the controller's frame: theta is body tilt, phi is absolute
+* wheel rotation, and positive duty drives the wheels toward positive phi.
+* Heading psi is positive turning left, toward the right wheel leading; the
+* yaw is taken as decoupled from the tilt, which holds near upright.
+*******************************************************************************/
+
+#ifndef MIP_PLANT
+#define MIP_PLANT
+
+// physical parameters of the eduMiP
+#define PLANT_BODY_MASS         0.263 // kg
+#define PLANT_BODY_COM          0.0477 // m, axle to center of mass
+#define PLANT_BODY_INERTIA      0.0004 // kg m^2 about center of mass
+#define PLANT_WHEEL_MASS        0.027 // kg per wheel
+#define PLANT_WHEEL_RADIUS      0.034 // m
+#define PLANT_TRACK_WIDTH       0.035 // m, between the wheels
+#define PLANT_YAW_INERTIA       0.0003 // kg m^2, body about the vertical
+#define PLANT_STALL_TORQUE      0.003 // Nm per motor at full duty
+#define PLANT_FREE_SPEED        1760 // rad/s motor free run speed
+#define PLANT_GEARBOX           35.577
+#define PLANT_GRAVITY           9.81
+#define PLANT_STICK_SPEED       0.05 // rad/s, wheel at rest for the friction
+#define PLANT_LYING_ANGLE       1.25 // rad, body on the ground either way
+#define PLANT_DT                0.001 // s, integration step
+
+typedef struct mip_plant_t{
+    // state
+    double theta;
+    double theta_dot;
+    double phi;
+    double phi_dot;
+    double phi_ddot;            // last wheel acceleration, for the accelerometer
+    double psi;                 // heading, rad
+    double psi_dot;
+    // actuator and disturbance inputs
+    double duty;                // commanded duty, -1 to 1
+    double duty_diff;           // right motor duty+this, left duty-this
+    double motor_mismatch;      // left motor duty gain 1+this, right 1-this
+    double deadband;            // duty below which the motors do not move
+    double supply;              // battery over the voltage of the model
+    double friction;            // duty each motor loses to gearbox friction
+    int held;                   // body held still, wheels off the ground
+    int floor;                  // body stops on the ground at PLANT_LYING_ANGLE
+    double body_torque;         // external torque on the body, Nm
+    // sensor model
+    double gyro_bias;           // deg/s
+    double accel_tilt;          // rad, accelerometer mounting error
+    double encoder_counts;      // counts per wheel revolution
+} mip_plant_t;
+
+// zero state with nominal actuator and ideal sensors
+void plant_init(mip_plant_t* p);
+// advance the model by dt seconds in PLANT_DT steps
+void plant_step(mip_plant_t* p,double dt);
+// IMU readings in board frame: accel in m/s^2, gyro in deg/s
+void plant_imu(const mip_plant_t* p,double board_offset,float accel[3], \
+               float gyro[3]);
+// encoder count of the mean wheel relative to the body
+int plant_encoder(const mip_plant_t* p);
+// encoder counts of each wheel relative to the body
+void plant_encoders(const mip_plant_t* p,int* left,int* right);
+
+#endif	//MIP_PLANT
@@ -0,0 +1,302 @@
+/*******************************************************************************
+* playback_mip.c
+*
+* Re-executes a balance_mip flight recording (mip_record.bin) against the
+* unmodified inner_loop() and outer_step() on a simulated clock. Events run
+* in the order the loops committed them; each loop gets the IMU sample,
+* encoder counts, state and start time it saw on the robot, and the
+* watchdog gets the recorded execution times, so degraded modes replay too.
+* The filter starts from the calibration and the controller mode recorded
+* in the header, the actuator shaping and self-righting too, and a
+* calibration window or actuator characterization measured during the run
+* is measured again.
+*
+* Motion commands are posted again just before the loop that took them runs.
+*
+* A recording that still starts with the first event of the run plays from
+* there. Once the ring has wrapped, playback starts at the oldest keyframe
+* instead, or with -m at the last keyframe before the fall that triggered
+* the dump, with the loop state restored from it.
+*
+* Outputs are compared with the recording bit for bit. A mismatch in a value
+* read across threads (theta_r and heading_reference in the inner loop,
+* current_theta in the outer loop) means the loops overlapped on the
+* robot; the recorded value is used and playback continues. Built for the
+* board, playback is bit-exact; on another host libm may differ in the
+* last bit, see -t.
+*
+* Set a breakpoint on playback_break() and pass -s <seq> to stop just before
+* an event under a debugger.
+*
+* usage: playback_mip [-m] [-s seq] [-t tol] [-o trace.csv] mip_record.bin
+*******************************************************************************/
+#include <rc_usefulincludes.h>
+#include <roboticscape.h>
+#include "mip_host.h"
+#include "recorder.h"
+#include "rt_setup.h"
+
+typedef struct playback_t{
+    uint32_t events;
+    uint32_t mismatches;        // outputs that differ from the recording
+    uint32_t first_mismatch;    // seq, 0 if none
+    uint32_t races;             // cross-thread values that differ
+    double worst;               // largest output difference
+} playback_t;
+
+static const char* type_names[]={"inner","outer","button","poll","command"};
+static double tolerance=0;
+
+// noinline so a breakpoint here always hits
+void __attribute__((noinline)) playback_break(const rec_event_t* ev){
+    __asm__ volatile("" ::: "memory");
+    return;
+}
+
+static void check(playback_t* p,const rec_event_t* ev,float got,float want){
+    double err=fabs((double)got-want);
+    if(err>p->worst) p->worst=err;
+    if(got==want || err<=tolerance) return;
+    p->mismatches++;
+    if(p->first_mismatch==0) p->first_mismatch=ev->seq;
+    return;
+}
+
+/*******************************************************************************
+* float wheel_duty()
+*
+* Motor duty the inner loop sent for the recorded duty and steering of a
+* tick, motor 0 left and 1 right, in the wheel's direction.
+*******************************************************************************/
+static float wheel_duty(const rec_event_t* ev,int motor){
+    float duty=motor?ev->out[1]+ev->out[2]:ev->out[1]-ev->out[2];
+    if(!(ev->arg&12)) duty=actuator_shape(&act,motor,duty,wheel_rate[motor]);
+    return motor_duty(duty,ev->in[7]);
+}
+
+/*******************************************************************************
+* void play_event()
+*
+* Feeds one recorded event to the control code the way the loop thread,
+* IMU driver or supervisor delivered it on the robot.
+*******************************************************************************/
+static void play_event(playback_t* p,const rec_event_t* ev,FILE* trace){
+    wd_mode_t mode;
+    traj_cmd_t cmd;
+    float duty;
+
+    rt_sim_time_ns=ev->start_ns;
+    switch(ev->type){
+    case REC_INNER:
+        rc_set_state(ev->state);
+        // the calibration window started before the first tick measuring it
+        if((ev->arg&1) && cal_state==CAL_IDLE) start_calibration();
+        if((ev->arg&4) && act_state==CAL_IDLE) start_characterization();
+        dob_enabled=(ev->arg>>1)&1;
+        batt.scale=ev->in[7];
+        imu_reader.accel[1]=ev->in[0];
+        imu_reader.accel[2]=ev->in[1];
+        imu_reader.gyro[0]=ev->in[2];
+        imu_reader.gyro[1]=ev->in[4];
+        imu_reader.gyro[2]=ev->in[5];
+        // in lqr and mpc mode the inner loop steps the references itself
+        if(control_mode==CONTROL_CASCADE){
+            if(theta_r!=ev->in[3] || heading_reference!=ev->in[6]) p->races++;
+            theta_r=ev->in[3];
+            heading_reference=ev->in[6];
+        }
+        rc_host_encoder[ENCODER_CHANNEL_L]=ev->count[0];
+        rc_host_encoder[ENCODER_CHANNEL_R]=ev->count[1];
+        // a safe stop commands no duty at all
+        rc_host_motor_cmd[MOTOR_CHANNEL_L]=0;
+        rc_host_motor_cmd[MOTOR_CHANNEL_R]=0;
+        inner_loop();
+        watchdog_loop_done(&wd,WD_LOOP_INNER,ev->exec_ns);
+        // each motor gets the balance duty less or plus the steering,
+        // shaped and scaled for the battery
+        duty=rc_host_motor_cmd[MOTOR_CHANNEL_L]*MOTOR_POLARITY_L;
+        check(p,ev,current_theta,ev->out[0]);
+        check(p,ev,duty,wheel_duty(ev,0));
+        check(p,ev,rc_host_motor_cmd[MOTOR_CHANNEL_R]*MOTOR_POLARITY_R, \
+              wheel_duty(ev,1));
+        // a paused safe stop resets the watchdog at the end of the tick
+        mode=(ev->mode==WD_SAFE_STOP && ev->state==PAUSED)?WD_NORMAL:ev->mode;
+        if(wd.mode!=mode && p->first_mismatch==0){
+            p->first_mismatch=ev->seq;
+            p->mismatches++;
+        }
+        if(trace!=NULL){
+            fprintf(trace,"%u,inner,%.6f,%d,%d,%.9g,%.9g,%.9g,%.9g\n",ev->seq, \
+                    ev->start_ns/1e9,ev->state,wd.mode,current_theta, \
+                    ev->out[0],duty,wheel_duty(ev,0));
+        }
+        break;
+    case REC_OUTER:
+        rc_set_state(ev->state);
+        rc_host_encoder[ENCODER_CHANNEL_L]=ev->count[0];
+        rc_host_encoder[ENCODER_CHANNEL_R]=ev->count[1];
+        if(current_theta!=ev->in[0]) p->races++;
+        current_theta=ev->in[0];
+        watchdog_outer_begin(&wd,ev->start_ns);
+        outer_step();
+        watchdog_loop_done(&wd,WD_LOOP_OUTER,ev->exec_ns);
+        check(p,ev,theta_r,ev->out[0]);
+        if(trace!=NULL){
+            fprintf(trace,"%u,outer,%.6f,%d,%d,%.9g,%.9g,,\n",ev->seq, \
+                    ev->start_ns/1e9,ev->state,wd.mode,theta_r,ev->out[0]);
+        }
+        break;
+    case REC_POLL:
+        watchdog_poll(&wd,ev->start_ns);
+        break;
+    case REC_COMMAND:
+        cmd.type=ev->arg;
+        cmd.forward=ev->in[0];
+        cmd.heading=ev->in[1];
+        traj_post(&cmd_box,&cmd);
+        if(trace!=NULL){
+            fprintf(trace,"%u,command,%.6f,%d,%d,%.9g,%.9g,,\n",ev->seq, \
+                    ev->start_ns/1e9,ev->state,wd.mode,cmd.forward, \
+                    cmd.heading);
+        }
+        break;
+    case REC_BUTTON:
+        if(trace!=NULL){
+            fprintf(trace,"%u,button,%.6f,%d,%d,%s,,,\n",ev->seq, \
+                    ev->start_ns/1e9,ev->state,wd.mode, \
+                    ev->arg?"pressed":"released");
+        }
+        break;
+    }
+    return;
+}
+
+/*******************************************************************************
+* const rec_keyframe_t* start_key()
+*
+* Keyframe to start from: NULL to play from the first event of the run, the
+* last one before the mark with at_mark, otherwise the oldest.
+*******************************************************************************/
+static const rec_keyframe_t* start_key(const rec_header_t* info, \
+                                       const rec_keyframe_t* keys,int at_mark){
+    const rec_keyframe_t* k=NULL;
+    uint32_t i;
+
+    if(!at_mark){
+        if(info->first==1) return NULL;
+        return info->keyframes?&keys[0]:NULL;
+    }
+    for(i=0;i<info->keyframes;i++){
+        if(keys[i].seq<=info->mark) k=&keys[i];
+    }
+    return k;
+}
+
+int main(int argc,char* argv[]){
+    rec_header_t info;
+    rec_event_t* events;
+    rec_keyframe_t* keys;
+    const rec_keyframe_t* key;
+    playback_t p;
+    FILE* trace=NULL;
+    uint32_t stop_seq=0;
+    int at_mark=0;
+    int c,i,n;
+
+    while((c=getopt(argc,argv,"ms:t:o:"))!=-1){
+        switch(c){
+        case 'm':
+            at_mark=1;
+            break;
+        case 's':
+            stop_seq=strtoul(optarg,NULL,0);
+            break;
+        case 't':
+            tolerance=atof(optarg);
+            break;
+        case 'o':
+            trace=fopen(optarg,"w");
+            if(trace==NULL){
+                perror(optarg);
+                return -1;
+            }
+            fprintf(trace,"seq,type,time_s,state,mode,value,recorded," \
+                    "duty,recorded_duty\n");
+            break;
+        default:
+            fprintf(stderr,"usage: playback_mip [-m] [-s seq] [-t tol] " \
+                    "[-o trace.csv] mip_record.bin\n");
+            return -1;
+        }
+    }
+    if(optind!=argc-1){
+        fprintf(stderr,"usage: playback_mip [-m] [-s seq] [-t tol] " \
+                "[-o trace.csv] mip_record.bin\n");
+        return -1;
+    }
+
+    n=recorder_load(argv[optind],&info,&events,&keys);
+    if(n<0) return -1;
+    if(at_mark && info.mark==0){
+        fprintf(stderr,"ERROR: no fall marked in %s\n",argv[optind]);
+        return -1;
+    }
+    key=start_key(&info,keys,at_mark);
+    if(key==NULL && (at_mark || info.first!=1)){
+        fprintf(stderr,"ERROR: no keyframe %s is left in %s\n", \
+                at_mark?"before the fall":"to start from",argv[optind]);
+        return -1;
+    }
+    mip_host_init();
+    cal.theta_offset=info.theta_offset;
+    cal.gyro_bias=info.gyro_bias;
+    control_mode=info.controller;
+    memcpy(act.deadband,info.act_deadband,sizeof(act.deadband));
+    memcpy(act.friction,info.act_friction,sizeof(act.friction));
+    memcpy(act.scale,info.act_scale,sizeof(act.scale));
+    recover.kick=info.recover_kick;
+    if(info.inject_every){
+        watchdog_inject_fault(&wd,info.inject_loop,info.inject_ns, \
+                              info.inject_every);
+    }
+    // the keyframe holds the calibration and shaping in use at that point
+    if(key!=NULL && restore_state(key->state,key->size)){
+        fprintf(stderr,"ERROR: %s was recorded by another build\n", \
+                argv[optind]);
+        return -1;
+    }
+
+    memset(&p,0,sizeof(p));
+    i=key?key->seq+1-info.first:0;
+    for(;i<n;i++){
+        if(events[i].seq==stop_seq) playback_break(&events[i]);
+        play_event(&p,&events[i],trace);
+        p.events++;
+    }
+
+    printf("%s: %u events, %s",argv[optind],p.events, \
+           control_mode_name(control_mode));
+    if(p.events>0){
+        printf(", %.2f s",(events[n-1].start_ns- \
+                           events[n-p.events].start_ns)/1e9);
+    }
+    if(key!=NULL){
+        printf(", from the keyframe after seq %u (%.2f s into the recording)", \
+               key->seq,(key->start_ns-events[0].start_ns)/1e9);
+    }
+    if(info.first>1) printf(", %u older events overwritten",info.first-1);
+    printf("\n%u cross-thread values differ (loops overlapped)\n",p.races);
+    if(p.mismatches){
+        printf("DIVERGED: %u outputs differ, first at seq %u (%s), " \
+               "largest difference %.3g\n",p.mismatches,p.first_mismatch, \
+               type_names[events[p.first_mismatch-info.first].type],p.worst);
+    }
+    else{
+        printf("all outputs match the recording (largest difference %.3g)\n", \
+               p.worst);
+    }
+    if(trace!=NULL) fclose(trace);
+    free(events);
+    free(keys);
+    return p.mismatches?1:0;
+}
@@ -0,0 +1,82 @@
+/*******************************************************************************
+* rc_host.c
+*
+* Hardware-free implementation of the Robotics Cape calls used by
+* balance_mip. Nothing here blocks except rc_usleep(), so the control code
+* runs as fast as the host allows.
+*******************************************************************************/
+#include <rc_usefulincludes.h>
+#include <roboticscape.h>
+
+float rc_host_motor[RC_HOST_CHANNELS];
+float rc_host_motor_cmd[RC_HOST_CHANNELS];
+int rc_host_encoder[RC_HOST_CHANNELS];
+int rc_host_motors_enabled=0;
+float rc_host_battery_voltage=0;
+rc_button_state_t rc_host_pause_button=RELEASED;
+
+static rc_state_t host_state=UNINITIALIZED;
+
+int rc_initialize(){ return 0; }
+int rc_cleanup(){ return 0; }
+rc_state_t rc_get_state(){ return __atomic_load_n(&host_state,__ATOMIC_ACQUIRE); }
+int rc_set_led(rc_led_t led,int state){ return 0; }
+int rc_set_pause_pressed_func(void (*func)()){ return 0; }
+int rc_set_pause_released_func(void (*func)()){ return 0; }
+rc_button_state_t rc_get_pause_button(){ return rc_host_pause_button; }
+int rc_initialize_imu_dmp(rc_imu_data_t* data,rc_imu_config_t conf){ return 0; }
+int rc_set_imu_interrupt_func(void (*func)()){ return 0; }
+int rc_power_off_imu(){ return 0; }
+
+int rc_set_state(rc_state_t state){
+    __atomic_store_n(&host_state,state,__ATOMIC_RELEASE);
+    return 0;
+}
+
+rc_imu_config_t rc_default_imu_config(){
+    rc_imu_config_t conf;
+    conf.dmp_sample_rate=100;
+    conf.dmp_interrupt_priority=0;
+    return conf;
+}
+
+int rc_enable_motors(){
+    rc_host_motors_enabled=1;
+    return 0;
+}
+
+// the driver in standby stops the motors at once
+int rc_disable_motors(){
+    int i;
+    rc_host_motors_enabled=0;
+    for(i=0;i<RC_HOST_CHANNELS;i++) rc_host_motor[i]=0;
+    return 0;
+}
+
+// a disabled driver outputs nothing, as on the board
+int rc_set_motor(int motor,float duty){
+    if(motor<1 || motor>=RC_HOST_CHANNELS) return -1;
+    rc_host_motor_cmd[motor]=duty;
+    rc_host_motor[motor]=rc_host_motors_enabled?duty:0;
+    return 0;
+}
+
+int rc_get_encoder_pos(int ch){
+    if(ch<1 || ch>=RC_HOST_CHANNELS) return 0;
+    return rc_host_encoder[ch];
+}
+
+int rc_set_encoder_pos(int ch,int value){
+    if(ch<1 || ch>=RC_HOST_CHANNELS) return -1;
+    rc_host_encoder[ch]=value;
+    return 0;
+}
+
+float rc_battery_voltage(){
+    return rc_host_battery_voltage;
+}
+
+void rc_usleep(unsigned int us){
+    usleep(us);
+    return;
+}
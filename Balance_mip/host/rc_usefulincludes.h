@@ -0,0 +1,24 @@
+/*******************************************************************************
+* rc_usefulincludes.h (host stand-in)
+*
+* Standard headers the Robotics Cape library pulls in, so balance_mip.c can
+* be built on a plain Linux box for benchmarks and simulation.
+*******************************************************************************/
+
+#ifndef RC_USEFULINCLUDES_HOST
+#define RC_USEFULINCLUDES_HOST
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <math.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#endif	//RC_USEFULINCLUDES_HOST
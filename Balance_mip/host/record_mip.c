@@ -0,0 +1,178 @@
+/*******************************************************************************
+* record_mip.c
+*
+* Records a simulated run the way balance_mip records one on the robot, for
+* the playback regression. The unmodified inner_loop() and outer_step() run
+* on the eduMiP plant model from mip_plant.c, the outer loop wrapped as
+* outer_loop() wraps it, and the ring, keyframes and header are filled as
+* in main(). Over RUN_TIME, in simulated seconds, the run takes motion
+* commands, switches the disturbance feed-forward on and off, is pushed,
+* runs down the battery, has an inner overrun injected every INJECT_EVERY
+* ticks and at FALL_AT is pushed over, rights itself and balances again.
+* The ring is then dumped for playback_mip.
+*
+* With -n the ring holds only that many events, so it wraps and playback
+* has to start from a keyframe; it is an error if it does not wrap.
+*
+* usage: record_mip [-c cascade|lqr|mpc] [-n events] mip_record.bin
+*******************************************************************************/
+#include <rc_usefulincludes.h>
+#include <roboticscape.h>
+#include "mip_host.h"
+#include "mip_plant.h"
+#include "rt_setup.h"
+
+#define RUN_TIME                40.0 // s
+#define GYRO_BIAS               1.0 // deg/s, left to the bias tracker
+#define MOTOR_MISMATCH          0.05
+#define PUSH_AT                 11.0 // s, recovered without a fall
+#define PUSH_TORQUE             0.15 // Nm
+#define FALL_AT                 32.0 // s
+#define FALL_TORQUE             0.5 // Nm
+#define PUSH_LENGTH             0.1 // s
+#define DOB_ON                  6.0 // s
+#define DOB_OFF                 14.0 // s
+#define BATT_START              8.4 // V
+#define BATT_END                7.0 // V
+#define INJECT_EVERY            97 // inner ticks
+#define INJECT_NS               8000000 // over the inner budget
+#define OUTER_EXEC_NS           100000 // recorded outer execution time
+
+typedef struct command_t{
+    double time;                // s
+    const char* line;
+} command_t;
+
+static const command_t commands[]={
+    {4,  "vel 0.2 0"},
+    {9,  "pos 0.3 1.0"},
+    {16, "vel 0.1 -0.5"},
+    {20, "stop"},
+};
+#define COMMANDS                (int)(sizeof(commands)/sizeof(commands[0]))
+
+int main(int argc,char* argv[]){
+    const double dt=1.0/D1_HZ;
+    const int outer_every=D1_HZ/D2_HZ;
+    const int batt_every=D1_HZ/BATT_HZ;
+    uint32_t len=REC_EVENTS;
+    mip_plant_t p;
+    traj_cmd_t cmd;
+    int count[2],last_count[2];
+    int c,i,k,n;
+    double t,torque;
+
+    control_mode=CONTROL_CASCADE;
+    while((c=getopt(argc,argv,"c:n:"))!=-1){
+        switch(c){
+        case 'c':
+            control_mode=control_mode_from_name(optarg);
+            if(control_mode<0){
+                fprintf(stderr,"ERROR: unknown controller '%s'\n",optarg);
+                return 1;
+            }
+            break;
+        case 'n':
+            len=strtoul(optarg,NULL,0);
+            if(len<2 || len>REC_EVENTS){
+                fprintf(stderr,"ERROR: -n takes 2 to %d events\n",REC_EVENTS);
+                return 1;
+            }
+            break;
+        default:
+            fprintf(stderr,"usage: record_mip [-c cascade|lqr|mpc] " \
+                    "[-n events] mip_record.bin\n");
+            return 1;
+        }
+    }
+    if(optind!=argc-1){
+        fprintf(stderr,"usage: record_mip [-c cascade|lqr|mpc] " \
+                "[-n events] mip_record.bin\n");
+        return 1;
+    }
+
+    plant_init(&p);
+    p.floor=1;
+    p.gyro_bias=GYRO_BIAS;
+    p.motor_mismatch=MOTOR_MISMATCH;
+    mip_host_init();
+    recovery_init(&recover,D1_HZ,1);
+    watchdog_inject_fault(&wd,WD_LOOP_INNER,INJECT_NS,INJECT_EVERY);
+    // the header as main() fills it
+    recorder_init(&rec,rec_buffer,len,rec_keys,REC_KEYFRAMES);
+    rec.info.inject_loop=WD_LOOP_INNER;
+    rec.info.inject_every=INJECT_EVERY;
+    rec.info.inject_ns=INJECT_NS;
+    rec.info.theta_offset=cal.theta_offset;
+    rec.info.gyro_bias=cal.gyro_bias;
+    rec.info.controller=control_mode;
+    memcpy(rec.info.act_deadband,act.deadband,sizeof(act.deadband));
+    memcpy(rec.info.act_friction,act.friction,sizeof(act.friction));
+    memcpy(rec.info.act_scale,act.scale,sizeof(act.scale));
+    rec.info.recover_kick=recover.kick;
+
+    plant_encoders(&p,&last_count[0],&last_count[1]);
+    for(k=0;k<RUN_TIME*D1_HZ;k++){
+        t=k*dt;
+        rt_sim_time_ns=(uint64_t)k*1000000000ULL/D1_HZ;
+        torque=0;
+        if(t>=PUSH_AT && t<PUSH_AT+PUSH_LENGTH) torque=PUSH_TORQUE;
+        if(t>=FALL_AT && t<FALL_AT+PUSH_LENGTH) torque=FALL_TORQUE;
+        p.body_torque=torque;
+        plant_imu(&p,THETA_OFFSET,imu_reader.accel,imu_reader.gyro);
+        plant_encoders(&p,&count[0],&count[1]);
+        rc_host_encoder[ENCODER_CHANNEL_L]+=ENCODER_POLARITY_L* \
+                                            (count[0]-last_count[0]);
+        rc_host_encoder[ENCODER_CHANNEL_R]+=ENCODER_POLARITY_R* \
+                                            (count[1]-last_count[1]);
+        last_count[0]=count[0];
+        last_count[1]=count[1];
+        // commands reach the mailbox from the supervisor, as command_poll()
+        for(i=0;i<COMMANDS;i++){
+            if(k!=(int)(commands[i].time*D1_HZ)) continue;
+            if(traj_parse(commands[i].line,&cmd)==0){
+                traj_post(&cmd_box,&cmd);
+            }
+        }
+        if(k==(int)(DOB_ON*D1_HZ)) dob_enabled=1;
+        if(k==(int)(DOB_OFF*D1_HZ)) dob_enabled=0;
+        if(k%batt_every==0){
+            double volts=BATT_START+(BATT_END-BATT_START)*t/RUN_TIME;
+            p.supply=volts/BATT_NOMINAL;
+            battery_sample(&batt,volts);
+        }
+        if(control_mode==CONTROL_CASCADE && k%outer_every==0){
+            watchdog_outer_begin(&wd,rt_sim_time_ns);
+            outer_step();
+            watchdog_loop_done(&wd,WD_LOOP_OUTER,OUTER_EXEC_NS);
+            outer_event.type=REC_OUTER;
+            outer_event.state=rc_get_state();
+            outer_event.start_ns=rt_sim_time_ns;
+            outer_event.exec_ns=OUTER_EXEC_NS;
+            recorder_add(&rec,&outer_event);
+        }
+        inner_loop();
+        p.duty=0.5*(rc_host_motor[MOTOR_CHANNEL_L]*MOTOR_POLARITY_L+ \
+                    rc_host_motor[MOTOR_CHANNEL_R]*MOTOR_POLARITY_R);
+        p.duty_diff=0.5*(rc_host_motor[MOTOR_CHANNEL_R]*MOTOR_POLARITY_R- \
+                         rc_host_motor[MOTOR_CHANNEL_L]*MOTOR_POLARITY_L);
+        plant_step(&p,dt);
+    }
+
+    n=recorder_dump(&rec,argv[optind]);
+    if(n<0) return 1;
+    printf("%s: %d events, %s, %u falls, %u kicks, %u captured, %llu " \
+           "ramps, %s\n",argv[optind],n,control_mode_name(control_mode), \
+           recover.falls,recover.kicked,recover.captured, \
+           (unsigned long long)wd.ramp_events, \
+           rec.head>rec.len?"wrapped":"not wrapped");
+    if(recover.falls==0 || rec.info.mark==0){
+        printf("FAIL: no fall recorded\n");
+        return 1;
+    }
+    if(len<REC_EVENTS && rec.head<=rec.len){
+        printf("FAIL: a ring of %u events did not wrap\n",len);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,203 @@
+/*******************************************************************************
+* recovery_mip.c
+*
+* Recovery of the cascade with and without anti-windup. Runs the
+* unmodified balance_mip inner_loop() and outer_step() on the eduMiP plant
+* model from mip_plant.c, once with the D1 anti-windup gain at 0 and once
+* at D1_ANTIWINDUP. D1 is the controller with the integrator, so that is
+* where windup shows. Two kinds of case:
+*
+*   held   held by hand at a tilt for HOLD_TIME while the loops run, as at
+*          startup, so the duty sits at its limit, then released
+*   push   held upright, released, and pushed with a body torque pulse
+*          once settled, from small to strong enough to reach the limit
+*
+* Recovery is the time from the release or the end of the push until
+* |theta| stays within SETTLE_THETA. Exits non-zero if anti-windup makes a
+* case fall that did not fall without it, or recover more than
+* RECOVERY_SLACK slower.
+*
+* Stopping the integration completely while clipped (D1_ANTIWINDUP 1) is
+* what the held cases need, but after a strong push the duty is clipped
+* for only a few ticks, and cutting the integral there leaves D1 short of
+* the duty that would have caught the body: the 0.20 Nm push then leans
+* further (0.536 against 0.501 rad) and recovers in 3.56 s against 3.06 s
+* without anti-windup. A slow leak of the integral while clipped, 0.1 per
+* tick, still keeps the held cases from winding up and costs the pushes
+* at most 0.06 s.
+*
+* usage: recovery_mip [-o trace.csv]
+*******************************************************************************/
+#include <rc_usefulincludes.h>
+#include <roboticscape.h>
+#include <sys/wait.h>
+#include "mip_host.h"
+#include "mip_plant.h"
+#include "rt_setup.h"
+
+#define SETTLE_THETA            0.02 // rad
+#define HOLD_TIME               3.0 // s, held before release
+#define PUSH_TIME               5.0 // s after release, settled by then
+#define PUSH_LENGTH             0.1 // s
+#define RUN_TIME                12.0 // s after release
+#define RECOVERY_SLACK          0.05 // relative, allowed for anti-windup
+
+typedef struct settle_t{
+    int fell;
+    double recovery;            // s from the end of the push
+    double peak_theta;
+    double saturated;           // s with the duty at its limit
+} settle_t;
+
+typedef struct case_t{
+    const char* name;
+    double tilt;                // rad, while held
+    double torque;              // Nm, 0 for none
+} case_t;
+
+static const case_t cases[]={
+    {"held",  0.05, 0},
+    {"held",  0.10, 0},
+    {"held",  0.20, 0},
+    {"push",  0,    0.05},
+    {"push",  0,    0.10},
+    {"push",  0,    0.15},
+    {"push",  0,    0.20},
+    {"push",  0,    0.25},
+};
+#define CASES                   (int)(sizeof(cases)/sizeof(cases[0]))
+
+// trace of the running case, NULL when not writing one
+static FILE* trace=NULL;
+
+/*******************************************************************************
+* static settle_t run_case()
+*
+* One case with the given anti-windup gain, in a fresh process so the
+* filter and controller state start the same every time.
+*******************************************************************************/
+static settle_t run_case(const case_t* c,float aw){
+    const double dt=1.0/D1_HZ;
+    const double end=(c->torque!=0)?PUSH_TIME+PUSH_LENGTH:0;
+    const int outer_every=D1_HZ/D2_HZ;
+    int hold=(int)(HOLD_TIME*D1_HZ);
+    int ticks=(int)(RUN_TIME*D1_HZ);
+    settle_t r;
+    mip_plant_t p;
+    int count,last_count,k;
+    double t,duty;
+    float num[]=D1_NUM;
+    float den[]=D1_DEN;
+
+    memset(&r,0,sizeof(r));
+    plant_init(&p);
+    p.theta=c->tilt;
+    mip_host_init();
+    D1=initialize_controller(D1_GAIN,D1_N,D1_M,num,den,D1_SATURATION,aw);
+    last_count=plant_encoder(&p);
+    for(k=-hold;k<ticks;k++){
+        t=k*dt;
+        rt_sim_time_ns=(uint64_t)(k+hold)*1000000000ULL/D1_HZ;
+        p.body_torque=(t>=PUSH_TIME && t<end)?c->torque:0;
+        plant_imu(&p,THETA_OFFSET,imu_reader.accel,imu_reader.gyro);
+        count=plant_encoder(&p);
+        rc_host_encoder[ENCODER_CHANNEL_L]+=ENCODER_POLARITY_L*(count-last_count);
+        rc_host_encoder[ENCODER_CHANNEL_R]+=ENCODER_POLARITY_R*(count-last_count);
+        last_count=count;
+        if((k+hold)%outer_every==0) outer_step();
+        inner_loop();
+        duty=0.5*(rc_host_motor[MOTOR_CHANNEL_L]*MOTOR_POLARITY_L+ \
+                  rc_host_motor[MOTOR_CHANNEL_R]*MOTOR_POLARITY_R);
+        p.duty=duty;
+        if(k<0) continue;
+        plant_step(&p,dt);
+        if(trace!=NULL){
+            fprintf(trace,"%s,%.2f,%.2f,%.2f,%.3f,%.5f,%.4f\n",c->name, \
+                    c->tilt,c->torque,aw,t,p.theta,duty);
+        }
+        if(c->torque!=0 && t<PUSH_TIME) continue;
+        if(fabs(p.theta)>r.peak_theta) r.peak_theta=fabs(p.theta);
+        if(fabs(duty)>=0.999*D1_SATURATION) r.saturated+=dt;
+        if(fabs(p.theta)>SETTLE_THETA) r.recovery=t+dt-end;
+        if(fabs(p.theta)>TIP_ANGLE){
+            r.fell=1;
+            r.recovery=RUN_TIME-end;
+            break;
+        }
+    }
+    if(r.recovery<0) r.recovery=0;
+    return r;
+}
+
+static int run_isolated(const case_t* c,float aw,settle_t* r){
+    int fd[2],status;
+    pid_t pid;
+
+    if(trace!=NULL) fflush(trace);
+    if(pipe(fd)) return -1;
+    pid=fork();
+    if(pid<0) return -1;
+    if(pid==0){
+        settle_t res=run_case(c,aw);
+        if(trace!=NULL) fclose(trace);
+        close(fd[0]);
+        if(write(fd[1],&res,sizeof(res))!=sizeof(res)) _exit(1);
+        _exit(0);
+    }
+    close(fd[1]);
+    if(read(fd[0],r,sizeof(*r))!=sizeof(*r)){
+        close(fd[0]);
+        waitpid(pid,&status,0);
+        return -1;
+    }
+    close(fd[0]);
+    waitpid(pid,&status,0);
+    return 0;
+}
+
+int main(int argc,char* argv[]){
+    const float gains[2]={0,D1_ANTIWINDUP};
+    settle_t r[2];
+    int c,i,j,fail=0;
+
+    while((c=getopt(argc,argv,"o:"))!=-1){
+        switch(c){
+        case 'o':
+            trace=fopen(optarg,"w");
+            if(trace==NULL){
+                perror(optarg);
+                return 1;
+            }
+            fprintf(trace,"case,tilt,push_Nm,antiwindup,t,theta,duty\n");
+            break;
+        default:
+            fprintf(stderr,"usage: recovery_mip [-o trace.csv]\n");
+            return 1;
+        }
+    }
+
+    printf("case  tilt  push_Nm  antiwindup  fell  recovery_s  peak_theta  " \
+           "saturated_s\n");
+    for(i=0;i<CASES;i++){
+        for(j=0;j<2;j++){
+            if(run_isolated(&cases[i],gains[j],&r[j])){
+                fprintf(stderr,"ERROR: case %d failed to run\n",i);
+                return 1;
+            }
+            printf("%-4s  %4.2f  %7.2f  %10.2f  %4d  %10.2f  %10.3f  %11.2f\n", \
+                   cases[i].name,cases[i].tilt,cases[i].torque,gains[j], \
+                   r[j].fell,r[j].recovery,r[j].peak_theta,r[j].saturated);
+        }
+        if(r[1].fell && !r[0].fell){
+            printf("FAIL: falls only with anti-windup\n");
+            fail=1;
+        }
+        else if(!r[0].fell && \
+                r[1].recovery>(1+RECOVERY_SLACK)*r[0].recovery){
+            printf("FAIL: slower recovery with anti-windup\n");
+            fail=1;
+        }
+    }
+    if(trace!=NULL) fclose(trace);
+    return fail;
+}
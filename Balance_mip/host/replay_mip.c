@@ -0,0 +1,250 @@
+/*******************************************************************************
+* replay_mip.c
+*
+* Golden-log regression check. Feeds a raw capture (imu_data_export -w, or
+* sim_mip -w) sample by sample through the unmodified complementary_filter(),
+* outer_step() and control_step() of balance_mip as fast as the host allows,
+* and compares theta, theta_r and duty against a stored golden file with a
+* tolerance per channel. Nothing depends on wall time, so a replay gives the
+* same result on every run.
+*
+* The outer loop runs before the inner loop on every D1_HZ/D2_HZ-th sample,
+* as in sim_mip. The tip check and the watchdog are not part of the replay.
+*
+* usage: replay_mip [-g golden] [-w golden_out] [-t channel=tol] raw_log
+*******************************************************************************/
+#include <rc_usefulincludes.h>
+#include <roboticscape.h>
+#include "mip_host.h"
+
+#define REPLAY_CHANNELS         3
+#define MAX_LINE                256
+
+typedef struct raw_sample_t{
+    uint64_t sample;
+    float accel_y;
+    float accel_z;
+    float gyro_x;
+    int encoder_l;
+    int encoder_r;
+} raw_sample_t;
+
+typedef struct replay_out_t{
+    uint64_t sample;
+    float value[REPLAY_CHANNELS];
+} replay_out_t;
+
+static const char* channel_names[REPLAY_CHANNELS]={"theta","theta_r","duty"};
+// float rounding differences between compilers stay well below these
+static double tolerance[REPLAY_CHANNELS]={1e-5,1e-5,1e-4};
+
+/*******************************************************************************
+* int load_raw()
+*
+* Reads a raw capture into a newly allocated array, returns the sample count
+* or -1. The first time column is ignored, replay is paced by sample index.
+*******************************************************************************/
+static int load_raw(const char* path,raw_sample_t** out,double* seconds){
+    FILE* f=fopen(path,"r");
+    char line[MAX_LINE];
+    raw_sample_t* s=NULL;
+    int n=0,cap=0;
+    double t=0;
+    unsigned long long sample;
+
+    if(f==NULL){
+        perror(path);
+        return -1;
+    }
+    if(fgets(line,sizeof(line),f)==NULL){
+        fprintf(stderr,"ERROR: %s is empty\n",path);
+        fclose(f);
+        return -1;
+    }
+    while(fgets(line,sizeof(line),f)!=NULL){
+        if(n==cap){
+            cap=cap?2*cap:1024;
+            s=realloc(s,cap*sizeof(*s));
+            if(s==NULL){
+                fclose(f);
+                return -1;
+            }
+        }
+        if(sscanf(line,"%lf,%llu,%f,%f,%f,%d,%d",&t,&sample,&s[n].accel_y, \
+                  &s[n].accel_z,&s[n].gyro_x,&s[n].encoder_l, \
+                  &s[n].encoder_r)!=7){
+            fprintf(stderr,"ERROR: %s:%d: bad record\n",path,n+2);
+            free(s);
+            fclose(f);
+            return -1;
+        }
+        s[n].sample=sample;
+        n++;
+    }
+    fclose(f);
+    *out=s;
+    *seconds=t;
+    return n;
+}
+
+/*******************************************************************************
+* void replay()
+*
+* Runs the control math over every raw sample, as inner_loop() and
+* outer_step() would on the board.
+*******************************************************************************/
+static void replay(const raw_sample_t* s,int n,replay_out_t* out){
+    const int outer_every=D1_HZ/D2_HZ;
+    int k;
+
+    for(k=0;k<n;k++){
+        imu_reader.accel[1]=s[k].accel_y;
+        imu_reader.accel[2]=s[k].accel_z;
+        imu_reader.gyro[0]=s[k].gyro_x;
+        rc_host_encoder[ENCODER_CHANNEL_L]=s[k].encoder_l;
+        rc_host_encoder[ENCODER_CHANNEL_R]=s[k].encoder_r;
+        if(k%outer_every==0) outer_step();
+        current_theta=complementary_filter();
+        out[k].sample=s[k].sample;
+        out[k].value[0]=current_theta;
+        out[k].value[1]=theta_r;
+        out[k].value[2]=control_step(&D1,theta_r-current_theta);
+    }
+    return;
+}
+
+static int write_golden(const char* path,const replay_out_t* out,int n){
+    FILE* f=fopen(path,"w");
+    int k;
+
+    if(f==NULL){
+        perror(path);
+        return -1;
+    }
+    fprintf(f,"sample,theta,theta_r,duty\n");
+    for(k=0;k<n;k++){
+        fprintf(f,"%llu,%.9g,%.9g,%.9g\n",(unsigned long long)out[k].sample, \
+                out[k].value[0],out[k].value[1],out[k].value[2]);
+    }
+    fclose(f);
+    return 0;
+}
+
+/*******************************************************************************
+* int compare_golden()
+*
+* Prints the worst error of each channel and returns the number of channels
+* outside tolerance, or -1 if the golden file does not match the capture.
+*******************************************************************************/
+static int compare_golden(const char* path,const replay_out_t* out,int n){
+    FILE* f=fopen(path,"r");
+    char line[MAX_LINE];
+    double worst[REPLAY_CHANNELS]={0,0,0};
+    int first_bad[REPLAY_CHANNELS]={-1,-1,-1};
+    unsigned long long sample;
+    float g[REPLAY_CHANNELS];
+    int k=0,i,failed=0;
+
+    if(f==NULL){
+        perror(path);
+        return -1;
+    }
+    if(fgets(line,sizeof(line),f)==NULL) k=-1;
+    while(k>=0 && fgets(line,sizeof(line),f)!=NULL){
+        if(k>=n || sscanf(line,"%llu,%f,%f,%f",&sample,&g[0],&g[1],&g[2])!=4 \
+           || sample!=out[k].sample){
+            k=-1;
+            break;
+        }
+        for(i=0;i<REPLAY_CHANNELS;i++){
+            double err=fabs((double)g[i]-out[k].value[i]);
+            if(err>worst[i]) worst[i]=err;
+            if(err>tolerance[i] && first_bad[i]<0) first_bad[i]=k;
+        }
+        k++;
+    }
+    fclose(f);
+    if(k!=n){
+        fprintf(stderr,"ERROR: %s does not match the samples of the capture\n",path);
+        return -1;
+    }
+    for(i=0;i<REPLAY_CHANNELS;i++){
+        printf("%-8s max error %.3g (tolerance %.3g)",channel_names[i], \
+               worst[i],tolerance[i]);
+        if(first_bad[i]>=0){
+            printf(" FAIL from sample %llu", \
+                   (unsigned long long)out[first_bad[i]].sample);
+            failed++;
+        }
+        printf("\n");
+    }
+    return failed;
+}
+
+static int parse_tolerance(const char* arg){
+    char name[16];
+    double tol;
+    int i;
+
+    if(sscanf(arg,"%15[a-z_]=%lf",name,&tol)!=2 || tol<0) return -1;
+    for(i=0;i<REPLAY_CHANNELS;i++){
+        if(strcmp(name,channel_names[i])==0){
+            tolerance[i]=tol;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+int main(int argc,char* argv[]){
+    const char* golden=NULL;
+    const char* golden_out=NULL;
+    raw_sample_t* raw;
+    replay_out_t* out;
+    struct timespec t0,t1;
+    double seconds,elapsed;
+    int c,n,failed=0;
+
+    while((c=getopt(argc,argv,"g:w:t:"))!=-1){
+        switch(c){
+        case 'g':
+            golden=optarg;
+            break;
+        case 'w':
+            golden_out=optarg;
+            break;
+        case 't':
+            if(parse_tolerance(optarg)==0) break;
+            fprintf(stderr,"ERROR: bad tolerance '%s'\n",optarg);
+            return -1;
+        default:
+            fprintf(stderr,"usage: replay_mip [-g golden] [-w golden_out] " \
+                    "[-t channel=tol] raw_log\n");
+            return -1;
+        }
+    }
+    if(optind!=argc-1){
+        fprintf(stderr,"usage: replay_mip [-g golden] [-w golden_out] " \
+                "[-t channel=tol] raw_log\n");
+        return -1;
+    }
+
+    n=load_raw(argv[optind],&raw,&seconds);
+    if(n<=0) return -1;
+    out=malloc(n*sizeof(*out));
+    if(out==NULL) return -1;
+    mip_host_init();
+
+    clock_gettime(CLOCK_MONOTONIC,&t0);
+    replay(raw,n,out);
+    clock_gettime(CLOCK_MONOTONIC,&t1);
+    elapsed=(t1.tv_sec-t0.tv_sec)+(t1.tv_nsec-t0.tv_nsec)/1e9;
+    printf("%s: %d samples, %.2f s of data replayed in %.3f ms (%.0fx real time)\n", \
+           argv[optind],n,seconds,elapsed*1e3,seconds/elapsed);
+
+    if(golden_out!=NULL && write_golden(golden_out,out,n)) failed=-1;
+    if(golden!=NULL && !failed) failed=compare_golden(golden,out,n);
+    free(raw);
+    free(out);
+    return failed?1:0;
+}
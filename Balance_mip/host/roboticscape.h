@@ -0,0 +1,78 @@
+/*******************************************************************************
+* roboticscape.h (host stand-in)
+*
+* The subset of the Robotics Cape API used by balance_mip, implemented in
+* rc_host.c without hardware. Motor duties and encoder counts live in plain
+* arrays that benchmarks and simulations read and write directly.
+*******************************************************************************/
+
+#ifndef ROBOTICSCAPE_HOST
+#define ROBOTICSCAPE_HOST
+
+#include <stdint.h>
+
+#define DEG_TO_RAD              0.0174532925199
+#define RAD_TO_DEG              57.295779513
+#define TWO_PI                  6.28318530718
+#define ON                      1
+#define OFF                     0
+#define RC_HOST_CHANNELS        5 // channels are 1-4, index 0 unused
+
+typedef enum rc_state_t{
+    UNINITIALIZED,
+    RUNNING,
+    PAUSED,
+    EXITING
+} rc_state_t;
+
+typedef enum rc_led_t{
+    GREEN,
+    RED
+} rc_led_t;
+
+typedef enum rc_button_state_t{
+    RELEASED,
+    PRESSED
+} rc_button_state_t;
+
+typedef struct rc_imu_data_t{
+    float accel[3];
+    float gyro[3];
+    float mag[3];
+    float dmp_TaitBryan[3];
+} rc_imu_data_t;
+
+typedef struct rc_imu_config_t{
+    int dmp_sample_rate;
+    int dmp_interrupt_priority;
+} rc_imu_config_t;
+
+// simulated hardware state
+extern float rc_host_motor[RC_HOST_CHANNELS];
+extern float rc_host_motor_cmd[RC_HOST_CHANNELS]; // as commanded, even if disabled
+extern int rc_host_encoder[RC_HOST_CHANNELS];
+extern int rc_host_motors_enabled;
+extern float rc_host_battery_voltage; // V, 0 reads as no battery
+extern rc_button_state_t rc_host_pause_button;
+
+int rc_initialize();
+int rc_cleanup();
+rc_state_t rc_get_state();
+int rc_set_state(rc_state_t state);
+int rc_set_led(rc_led_t led,int state);
+int rc_set_pause_pressed_func(void (*func)());
+int rc_set_pause_released_func(void (*func)());
+rc_button_state_t rc_get_pause_button();
+rc_imu_config_t rc_default_imu_config();
+int rc_initialize_imu_dmp(rc_imu_data_t* data,rc_imu_config_t conf);
+int rc_set_imu_interrupt_func(void (*func)());
+int rc_power_off_imu();
+int rc_enable_motors();
+int rc_disable_motors();
+int rc_set_motor(int motor,float duty);
+int rc_get_encoder_pos(int ch);
+float rc_battery_voltage();
+int rc_set_encoder_pos(int ch,int value);
+void rc_usleep(unsigned int us);
+
+#endif	//ROBOTICSCAPE_HOST
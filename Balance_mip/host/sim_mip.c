@@ -0,0 +1,268 @@
+/*******************************************************************************
+* sim_mip.c
+*
+* Closed-loop control benchmark. Runs fixed scenarios through the eduMiP
+* plant model in mip_plant.c with the unmodified balance_mip inner_loop()
+* and outer_step(), i.e. complementary_filter() and the D1/D2 cascade, on a
+* simulated clock. -c lqr or -c mpc runs a single-rate mode instead, with
+* no outer step, so the controllers can be scored on the same scenarios.
+* Each scenario runs in its own child process so every run starts from the
+* same controller and filter state. The robot is held still for HOLD_TIME
+* before each scenario, as it is by hand at startup, so the filter has
+* converged when it is released.
+*
+* A scenario has settled once the tilt stays within SETTLE_THETA and, after
+* a phi step, the wheel angle within SETTLE_PHI_STEP of the step from the
+* reference. Without a step the wheels may come to rest anywhere, so phi is
+* left to ise_phi. A run still outside the band in its last SETTLE_HOLD did
+* not settle, which is reported as settled=0 with settle_s the rest of the
+* run.
+*
+* Prints one CSV row per scenario and a final score, lower is better:
+*   score = sum(settle_s + 10*ise_theta + ise_phi) + 100 per fall
+*
+* With -w dir, the raw sensor stream of every scenario is also written to
+* dir/<scenario>.raw.txt in the imu_data_export -w format, for replay_mip,
+* with the true body tilt appended as theta_true for tune_filter.
+*
+* usage: sim_mip [-c cascade|lqr|mpc] [-o file] [-w dir]
+*******************************************************************************/
+#include <rc_usefulincludes.h>
+#include <roboticscape.h>
+#include <limits.h>
+#include <sys/wait.h>
+#include "mip_host.h"
+#include "mip_plant.h"
+#include "rt_setup.h"
+
+#ifndef BENCH_REVISION
+#define BENCH_REVISION          "unknown"
+#endif
+
+#define SETTLE_THETA            0.02 // rad
+#define SETTLE_PHI_STEP         0.1 // fraction of the phi step
+#define SETTLE_HOLD             0.5 // s in the band at the end of the run
+#define FALL_PENALTY            100
+#define HOLD_TIME               3.0 // s, held at theta0 before release
+
+typedef struct scenario_t{
+    const char* name;
+    double duration;            // s
+    double theta0;              // initial tilt, rad
+    double push_time;           // s, start of body torque pulse
+    double push_torque;         // Nm
+    double push_length;         // s
+    double step_time;           // s, time of phi reference step
+    double phi_step;            // rad
+    double gyro_bias;           // deg/s
+    double accel_tilt;          // rad
+    double deadband;            // duty
+} scenario_t;
+
+typedef struct sim_result_t{
+    int fell;
+    int settled;
+    double settle;
+    double ise_theta;
+    double ise_phi;
+    double peak_duty;
+    double saturated;
+} sim_result_t;
+
+// raw capture of the running scenario, NULL when not recording
+static FILE* raw_out=NULL;
+
+static const scenario_t scenarios[]={
+    // name            dur   th0   push t,Nm,len      step t,rad  bias  tilt  db
+    {"initial_tilt",   5.0,  0.1,  0,  0,    0,       0,  0,      0,    0,    0},
+    {"push",           5.0,  0,    1.0,0.03, 0.1,     0,  0,      0,    0,    0},
+    {"phi_step",       8.0,  0,    0,  0,    0,       1.0,3.0,    0,    0,    0},
+    {"sensor_bias",    8.0,  0,    0,  0,    0,       0,  0,      2.0,  0.02, 0},
+    {"motor_deadband", 8.0,  0.05, 0,  0,    0,       0,  0,      0,    0,    0.08},
+};
+
+/*******************************************************************************
+* sim_result_t run_scenario()
+*
+* Steps the plant at the IMU rate. The outer step runs before the inner loop
+* on every D1_HZ/D2_HZ-th tick, encoders advance by whole counts the way the
+* eQEP counters do, so clear_encoders() behaves as on the board. Each wheel
+* has its own encoder and motor, so the heading loop runs as on the robot.
+*******************************************************************************/
+static sim_result_t run_scenario(const scenario_t* s){
+    const double dt=1.0/D1_HZ;
+    const int outer_every=D1_HZ/D2_HZ;
+    sim_result_t r;
+    mip_plant_t p;
+    int hold=(int)(HOLD_TIME*D1_HZ);
+    int ticks=(int)(s->duration*D1_HZ);
+    int count[2],last_count[2],k,outside;
+    double t,event,duty,phi_ref;
+
+    memset(&r,0,sizeof(r));
+    plant_init(&p);
+    p.theta=s->theta0;
+    p.gyro_bias=s->gyro_bias;
+    p.accel_tilt=s->accel_tilt;
+    p.deadband=s->deadband;
+    mip_host_init();
+    plant_encoders(&p,&last_count[0],&last_count[1]);
+    event=(s->push_torque!=0)?s->push_time:s->step_time;
+
+    for(k=-hold;k<ticks;k++){
+        t=k*dt;
+        rt_sim_time_ns=(uint64_t)(k+hold)*1000000000ULL/D1_HZ;
+        // disturbances
+        p.body_torque=(t>=s->push_time && t<s->push_time+s->push_length)? \
+                      s->push_torque:0;
+        // a step, not a trajectory: moved where the loops read it
+        phi_ref=(s->phi_step!=0 && t>=s->step_time)?s->phi_step:0;
+        traj.phi.pos=phi_ref;
+        phi_reference=phi_ref;
+        // sensors
+        plant_imu(&p,THETA_OFFSET,imu_reader.accel,imu_reader.gyro);
+        plant_encoders(&p,&count[0],&count[1]);
+        rc_host_encoder[ENCODER_CHANNEL_L]+=ENCODER_POLARITY_L* \
+                                            (count[0]-last_count[0]);
+        rc_host_encoder[ENCODER_CHANNEL_R]+=ENCODER_POLARITY_R* \
+                                            (count[1]-last_count[1]);
+        last_count[0]=count[0];
+        last_count[1]=count[1];
+        if(raw_out!=NULL){
+            fprintf(raw_out,"%.6f,%d,%.9g,%.9g,%.9g,%d,%d,%.9g\n", \
+                    (k+hold)*dt,k+hold,imu_reader.accel[1], \
+                    imu_reader.accel[2],imu_reader.gyro[0], \
+                    rc_host_encoder[ENCODER_CHANNEL_L], \
+                    rc_host_encoder[ENCODER_CHANNEL_R],p.theta);
+        }
+        // controller
+        if(control_mode==CONTROL_CASCADE && (k+hold)%outer_every==0){
+            outer_step();
+        }
+        inner_loop();
+        duty=0.5*(rc_host_motor[MOTOR_CHANNEL_L]*MOTOR_POLARITY_L+ \
+                  rc_host_motor[MOTOR_CHANNEL_R]*MOTOR_POLARITY_R);
+        p.duty=duty;
+        p.duty_diff=0.5*(rc_host_motor[MOTOR_CHANNEL_R]*MOTOR_POLARITY_R- \
+                         rc_host_motor[MOTOR_CHANNEL_L]*MOTOR_POLARITY_L);
+        // held by hand: the controller runs but the robot does not move
+        if(k<0) continue;
+        plant_step(&p,dt);
+
+        // metrics
+        r.ise_theta+=p.theta*p.theta*dt;
+        r.ise_phi+=(p.phi-phi_ref)*(p.phi-phi_ref)*dt;
+        if(fabs(duty)>r.peak_duty) r.peak_duty=fabs(duty);
+        if(fabs(duty)>=0.999*D1_SATURATION) r.saturated+=dt;
+        outside=fabs(p.theta)>SETTLE_THETA;
+        if(s->phi_step!=0){
+            outside|=fabs(p.phi-phi_ref)>SETTLE_PHI_STEP*fabs(s->phi_step);
+        }
+        if(outside) r.settle=t+dt-event;
+        if(fabs(p.theta)>TIP_ANGLE){
+            r.fell=1;
+            r.settle=s->duration-event;
+            break;
+        }
+    }
+    if(r.settle<0) r.settle=0;
+    // still outside the band at the end
+    r.settled=!r.fell && r.settle<s->duration-event-SETTLE_HOLD;
+    if(!r.settled) r.settle=s->duration-event;
+    return r;
+}
+
+/*******************************************************************************
+* int run_isolated()
+*
+* Forks so the static filter and controller state start fresh for every
+* scenario, and reads the result back through a pipe. The child writes the
+* raw capture when raw_dir is set.
+*******************************************************************************/
+static int run_isolated(const scenario_t* s,sim_result_t* r,const char* raw_dir){
+    int fd[2],status;
+    pid_t pid;
+
+    if(pipe(fd)) return -1;
+    pid=fork();
+    if(pid<0) return -1;
+    if(pid==0){
+        sim_result_t res;
+        if(raw_dir!=NULL){
+            char path[PATH_MAX];
+            snprintf(path,sizeof(path),"%s/%s.raw.txt",raw_dir,s->name);
+            raw_out=fopen(path,"w");
+            if(raw_out==NULL){
+                perror(path);
+                _exit(1);
+            }
+            fprintf(raw_out,"time(s),sample,accel_y,accel_z,gyro_x," \
+                    "encoder_l,encoder_r,theta_true\n");
+        }
+        res=run_scenario(s);
+        if(raw_out!=NULL) fclose(raw_out);
+        close(fd[0]);
+        if(write(fd[1],&res,sizeof(res))!=sizeof(res)) _exit(1);
+        _exit(0);
+    }
+    close(fd[1]);
+    if(read(fd[0],r,sizeof(*r))!=sizeof(*r)){
+        close(fd[0]);
+        waitpid(pid,&status,0);
+        return -1;
+    }
+    close(fd[0]);
+    waitpid(pid,&status,0);
+    return 0;
+}
+
+int main(int argc,char* argv[]){
+    FILE* out=stdout;
+    const char* raw_dir=NULL;
+    sim_result_t r;
+    double score=0;
+    int c,i;
+
+    while((c=getopt(argc,argv,"c:o:w:"))!=-1){
+        switch(c){
+        case 'c':
+            // set before the scenarios fork, so every child runs it
+            control_mode=control_mode_from_name(optarg);
+            if(control_mode<0){
+                fprintf(stderr,"ERROR: unknown controller '%s'\n",optarg);
+                return -1;
+            }
+            break;
+        case 'o':
+            out=fopen(optarg,"w");
+            if(out==NULL){
+                perror(optarg);
+                return -1;
+            }
+            break;
+        case 'w':
+            raw_dir=optarg;
+            break;
+        default:
+            fprintf(stderr,"usage: sim_mip [-c cascade|lqr|mpc] [-o file] " \
+                    "[-w dir]\n");
+            return -1;
+        }
+    }
+
+    fprintf(out,"revision,scenario,fell,settled,settle_s,ise_theta,ise_phi," \
+            "peak_duty,saturated_s\n");
+    for(i=0;i<(int)(sizeof(scenarios)/sizeof(scenarios[0]));i++){
+        if(run_isolated(&scenarios[i],&r,raw_dir)){
+            fprintf(stderr,"ERROR: scenario %s failed to run\n",scenarios[i].name);
+            return -1;
+        }
+        fprintf(out,"%s,%s,%d,%d,%.2f,%.5f,%.4f,%.3f,%.2f\n",BENCH_REVISION, \
+                scenarios[i].name,r.fell,r.settled,r.settle,r.ise_theta, \
+                r.ise_phi,r.peak_duty,r.saturated);
+        score+=r.settle+10*r.ise_theta+r.ise_phi+FALL_PENALTY*r.fell;
+    }
+    fprintf(out,"%s,score,,,%.3f,,,,\n",BENCH_REVISION,score);
+    if(out!=stdout) fclose(out);
+    return 0;
+}
@@ -0,0 +1,319 @@
+/*******************************************************************************
+* split_mip.c
+*
+* The process split of balance_mip. Runs the unmodified inner_loop() and
+* outer_step() on the eduMiP plant model from mip_plant.c at SPEEDUP times
+* real time, publishing into a shared memory segment with a RING_SLOTS
+* sample ring, while the mip_logger and mip_telemetry programs built next
+* to balance_mip read it as separate processes. Meanwhile, in simulated
+* seconds:
+*
+*   SHORT_KILL   the logger is killed, restarted SHORT_OUTAGE later,
+*                which the ring covers
+*   STOP_AT      the telemetry process is stopped, continued STOP_TIME later
+*   LONG_KILL    the logger is killed, restarted LONG_OUTAGE later,
+*                which overflows the ring
+*
+* Then both are terminated and the log is checked tick by tick: every tick
+* published must be in it once, in order, or counted in a "# lost" line,
+* nothing may be lost before LONG_KILL and the lost ticks must be what the
+* ring dropped. The telemetry process must have printed again after being
+* continued. Finally telemetry_publish() is timed in batches as the inner
+* loop calls it, and must cost less than PUBLISH_BUDGET per tick.
+*
+* Exits non-zero on any failure.
+*
+* usage: split_mip [-c cascade|lqr|mpc]
+*******************************************************************************/
+#include <rc_usefulincludes.h>
+#include <roboticscape.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "mip_host.h"
+#include "mip_plant.h"
+#include "rt_setup.h"
+
+#define SPEEDUP                 10
+#define RING_SLOTS              256 // 2.56 s of ticks
+#define START_TILT              0.05 // rad at release
+#define RUN_TIME                20.0 // s
+#define SHORT_KILL              3.0 // s
+#define SHORT_OUTAGE            1.0 // s
+#define STOP_AT                 6.0 // s
+#define STOP_TIME               2.0 // s
+#define LONG_KILL               10.0 // s
+#define LONG_OUTAGE             6.0 // s
+#define CATCH_UP                2.0 // s of real time the logger gets at the end
+#define BATCHES                 50
+#define BATCH                   200 // publishes, less than RING_SLOTS
+#define PUBLISH_BUDGET          2000 // ns per tick
+
+// inner loop and plant of the run
+static mip_plant_t p;
+static int last_count[2];
+static int k=0;
+
+static uint64_t now_ns(){
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC,&t);
+    return (uint64_t)t.tv_sec*1000000000ULL+t.tv_nsec;
+}
+
+/*******************************************************************************
+* static void tick()
+*
+* One simulated inner loop tick.
+*******************************************************************************/
+static void tick(){
+    int count[2];
+
+    rt_sim_time_ns=(uint64_t)k*1000000000ULL/D1_HZ;
+    plant_imu(&p,THETA_OFFSET,imu_reader.accel,imu_reader.gyro);
+    plant_encoders(&p,&count[0],&count[1]);
+    rc_host_encoder[ENCODER_CHANNEL_L]+=ENCODER_POLARITY_L* \
+                                        (count[0]-last_count[0]);
+    rc_host_encoder[ENCODER_CHANNEL_R]+=ENCODER_POLARITY_R* \
+                                        (count[1]-last_count[1]);
+    last_count[0]=count[0];
+    last_count[1]=count[1];
+    if(control_mode==CONTROL_CASCADE && k%(D1_HZ/D2_HZ)==0) outer_step();
+    inner_loop();
+    p.duty=0.5*(rc_host_motor[MOTOR_CHANNEL_L]*MOTOR_POLARITY_L+ \
+                rc_host_motor[MOTOR_CHANNEL_R]*MOTOR_POLARITY_R);
+    p.duty_diff=0.5*(rc_host_motor[MOTOR_CHANNEL_R]*MOTOR_POLARITY_R- \
+                     rc_host_motor[MOTOR_CHANNEL_L]*MOTOR_POLARITY_L);
+    plant_step(&p,1.0/D1_HZ);
+    k++;
+    return;
+}
+
+static pid_t spawn(const char* prog,const char* out,const char* log){
+    pid_t pid=fork();
+    int fd;
+
+    if(pid!=0) return pid;
+    fd=open(out,O_WRONLY|O_CREAT|O_APPEND,0644);
+    if(fd>=0){
+        dup2(fd,STDOUT_FILENO);
+        close(fd);
+    }
+    if(log!=NULL) execl(prog,prog,"-o",log,(char*)NULL);
+    else execl(prog,prog,(char*)NULL);
+    perror(prog);
+    _exit(127);
+}
+
+static int stop_child(pid_t pid){
+    int status;
+
+    kill(pid,SIGTERM);
+    if(waitpid(pid,&status,0)!=pid) return -1;
+    return (WIFEXITED(status) && WEXITSTATUS(status)==0)?0:-1;
+}
+
+static off_t file_size(const char* path){
+    struct stat st;
+    return stat(path,&st)?0:st.st_size;
+}
+
+/*******************************************************************************
+* static int check_log()
+*
+* Walks the log and counts written and lost ticks. Returns the number of
+* problems found.
+*******************************************************************************/
+static int check_log(const char* path,uint32_t ticks,uint32_t dropped, \
+                     uint32_t long_tick){
+    FILE* f=fopen(path,"r");
+    char line[256];
+    uint32_t last=0,tk,lost=0,written=0,n;
+    int fail=0;
+
+    if(f==NULL){
+        perror(path);
+        return 1;
+    }
+    while(fgets(line,sizeof(line),f)!=NULL){
+        if(sscanf(line,"# lost %u",&n)==1){
+            if(last<long_tick){
+                printf("FAIL: %u ticks lost after tick %u, before the long " \
+                       "outage\n",n,last);
+                fail++;
+            }
+            last+=n;
+            lost+=n;
+            continue;
+        }
+        if(line[0]=='#' || line[0]=='t') continue;
+        if(sscanf(line,"%*f,%u,",&tk)!=1 || tk!=last+1){
+            printf("FAIL: tick %u follows %u in the log\n",tk,last);
+            fail++;
+            break;
+        }
+        last=tk;
+        written++;
+    }
+    fclose(f);
+    printf("ticks %u  written %u  lost %u  dropped %u\n",ticks,written,lost, \
+           dropped);
+    if(last!=ticks){
+        printf("FAIL: the log ends at tick %u\n",last);
+        fail++;
+    }
+    if(lost!=dropped){
+        printf("FAIL: lost ticks are not what the ring dropped\n");
+        fail++;
+    }
+    if(lost==0){
+        printf("FAIL: the long outage lost nothing\n");
+        fail++;
+    }
+    return fail;
+}
+
+/*******************************************************************************
+* static double publish_cost()
+*
+* Mean ns per telemetry_publish() of the fastest batch, to leave out host
+* noise. The ring is emptied between batches, so every push takes a slot,
+* and the message changes every call, so it is copied every time.
+*******************************************************************************/
+static double publish_cost(){
+    const char* msgs[2]={"publish cost","publish cost, other message"};
+    float values[TELEM_VALUES]={0};
+    telem_sample_t s;
+    double best=1e9,mean;
+    uint64_t t0;
+    int b,i;
+
+    memset(&s,0,sizeof(s));
+    for(b=0;b<BATCHES;b++){
+        t0=now_ns();
+        for(i=0;i<BATCH;i++){
+            telemetry_message(msgs[i&1]);
+            s.theta=i;
+            values[0]=i;
+            telemetry_publish(&telem,&s,values);
+        }
+        mean=(double)(now_ns()-t0)/BATCH;
+        if(mean<best) best=mean;
+        shm_ring_release(&telem.samples,shm_ring_pending(&telem.samples));
+    }
+    return best;
+}
+
+int main(int argc,char* argv[]){
+    const double dt=1.0/D1_HZ;
+    char name[64],log_path[64],out[64],tout[64];
+    struct timespec next;
+    pid_t logger,console;
+    uint32_t long_tick=0,ticks,dropped;
+    off_t cont_size=0;
+    double t,cost;
+    int c,fail=0,stopped=0;
+
+    while((c=getopt(argc,argv,"c:"))!=-1){
+        switch(c){
+        case 'c':
+            control_mode=control_mode_from_name(optarg);
+            if(control_mode<0){
+                fprintf(stderr,"ERROR: unknown controller '%s'\n",optarg);
+                return 1;
+            }
+            break;
+        default:
+            fprintf(stderr,"usage: split_mip [-c cascade|lqr|mpc]\n");
+            return 1;
+        }
+    }
+
+    snprintf(name,sizeof(name),"/split_mip.%d",(int)getpid());
+    snprintf(log_path,sizeof(log_path),"/tmp/split_mip.%d.csv",(int)getpid());
+    snprintf(out,sizeof(out),"/tmp/split_mip.%d.out",(int)getpid());
+    snprintf(tout,sizeof(tout),"/tmp/split_mip.%d.console",(int)getpid());
+    setenv("MIP_SHM",name,1);
+    plant_init(&p);
+    p.theta=START_TILT;
+    mip_host_init();
+    if(telemetry_create(&telem,name,RING_SLOTS)) return 1;
+    plant_encoders(&p,&last_count[0],&last_count[1]);
+    logger=spawn("./mip_logger",out,log_path);
+    console=spawn("./mip_telemetry",tout,NULL);
+
+    printf("%s\n",control_mode_name(control_mode));
+    clock_gettime(CLOCK_MONOTONIC,&next);
+    while((t=k*dt)<RUN_TIME){
+        if(k==(int)(SHORT_KILL*D1_HZ) || k==(int)(LONG_KILL*D1_HZ)){
+            kill(logger,SIGKILL);
+            waitpid(logger,NULL,0);
+            if(k==(int)(LONG_KILL*D1_HZ)) long_tick=telem.tick;
+        }
+        if(k==(int)((SHORT_KILL+SHORT_OUTAGE)*D1_HZ) || \
+           k==(int)((LONG_KILL+LONG_OUTAGE)*D1_HZ)){
+            logger=spawn("./mip_logger",out,log_path);
+        }
+        if(k==(int)(STOP_AT*D1_HZ)){
+            kill(console,SIGSTOP);
+            stopped=1;
+        }
+        if(k==(int)((STOP_AT+STOP_TIME)*D1_HZ)){
+            cont_size=file_size(tout);
+            kill(console,SIGCONT);
+            stopped=0;
+        }
+        tick();
+        if(fabs(p.theta)>TIP_ANGLE){
+            printf("FAIL: fell at %.2f s\n",t);
+            fail=1;
+            break;
+        }
+        next.tv_nsec+=1000000000/D1_HZ/SPEEDUP;
+        if(next.tv_nsec>=1000000000){
+            next.tv_nsec-=1000000000;
+            next.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC,TIMER_ABSTIME,&next,NULL);
+    }
+    if(stopped) kill(console,SIGCONT);
+
+    // the logger writes out the rest before it is stopped
+    ticks=telem.tick;
+    dropped=telem.samples.head->dropped;
+    for(c=0;c<CATCH_UP*TELEM_DRAIN_HZ*2 && \
+        __atomic_load_n(&telem.readers->logged,__ATOMIC_ACQUIRE)!=ticks;c++){
+        rc_usleep(500000/TELEM_DRAIN_HZ);
+    }
+    if(stop_child(logger)){
+        printf("FAIL: mip_logger did not exit cleanly\n");
+        fail=1;
+    }
+    if(stop_child(console)){
+        printf("FAIL: mip_telemetry did not exit cleanly\n");
+        fail=1;
+    }
+    if(telem.readers->reader_pid[TELEM_LOGGER] || \
+       telem.readers->reader_pid[TELEM_CONSOLE]){
+        printf("FAIL: a reader did not detach\n");
+        fail=1;
+    }
+    fail|=check_log(log_path,ticks,dropped,long_tick)!=0;
+    if(file_size(tout)<=cont_size){
+        printf("FAIL: mip_telemetry printed nothing once continued\n");
+        fail=1;
+    }
+
+    cost=publish_cost();
+    printf("publishing %.0f ns per tick\n",cost);
+    if(cost>PUBLISH_BUDGET){
+        printf("FAIL: publishing costs more than %d ns\n",PUBLISH_BUDGET);
+        fail=1;
+    }
+    telemetry_close(&telem,name);
+    if(!fail){
+        unlink(log_path);
+        unlink(out);
+        unlink(tout);
+    }
+    else printf("log in %s, output in %s and %s\n",log_path,out,tout);
+    return fail;
+}
@@ -0,0 +1,231 @@
+/*******************************************************************************
+* trajectory_mip.c
+*
+* Command following of balance_mip with and without the feed-forward lean.
+* Runs the unmodified inner_loop() and outer_step() on the eduMiP plant
+* model from mip_plant.c and posts each case's motion commands, as lines,
+* to the same mailbox command_poll() posts to, once with theta_ff at 0 and
+* once at REF_THETA_FF. Cases:
+*
+*   move   pos to a point ahead and stop there
+*   drive  vel forward, then stop
+*   turn   pos to a heading in place
+*   arc    vel forward while turning, then stop
+*
+* The tracking error is the true wheel angle and heading less the
+* trajectory from the first command on, the final error is taken at the end
+* of the run, when the trajectory is at rest. Exits non-zero if a case falls
+* with the feed-forward, if it ends off its final position or heading, or if
+* the feed-forward makes the forward tracking worse.
+*
+* usage: trajectory_mip [-c cascade|lqr|mpc] [-o trace.csv]
+*******************************************************************************/
+#include <rc_usefulincludes.h>
+#include <roboticscape.h>
+#include <sys/wait.h>
+#include "mip_host.h"
+#include "mip_plant.h"
+#include "rt_setup.h"
+
+#define FINAL_FORWARD           0.02 // m
+#define FINAL_HEADING           0.05 // rad
+#define HOLD_TIME               3.0 // s, held before release
+#define RUN_TIME                12.0 // s after release
+#define COMMANDS                2
+
+typedef struct follow_t{
+    int fell;
+    double rms_forward;         // m, tracking error
+    double rms_heading;         // rad
+    double final_forward;       // m
+    double final_heading;       // rad
+    double peak_theta;          // rad
+} follow_t;
+
+typedef struct case_t{
+    const char* name;
+    double time[COMMANDS];      // s after release, 0 for none
+    const char* line[COMMANDS];
+} case_t;
+
+static const case_t cases[]={
+    {"move",  {2.0, 0},   {"pos 0.5 0",     NULL}},
+    {"drive", {2.0, 5.0}, {"vel 0.2 0",     "stop"}},
+    {"turn",  {2.0, 0},   {"pos 0 1.57",    NULL}},
+    {"arc",   {2.0, 6.0}, {"vel 0.15 0.5",  "stop"}},
+};
+#define CASES                   (int)(sizeof(cases)/sizeof(cases[0]))
+
+// trace of the running case, NULL when not writing one
+static FILE* trace=NULL;
+
+/*******************************************************************************
+* static follow_t run_case()
+*
+* One case with the given feed-forward lean, in a fresh process so the
+* filter, controller and trajectory state start the same every time.
+*******************************************************************************/
+static follow_t run_case(const case_t* c,float theta_ff){
+    const double dt=1.0/D1_HZ;
+    const int outer_every=D1_HZ/D2_HZ;
+    int hold=(int)(HOLD_TIME*D1_HZ);
+    int ticks=(int)(RUN_TIME*D1_HZ);
+    follow_t r;
+    mip_plant_t p;
+    traj_cmd_t cmd;
+    int count[2],last_count[2],i,k,n=0;
+    double t,e_fwd,e_head;
+
+    memset(&r,0,sizeof(r));
+    plant_init(&p);
+    mip_host_init();
+    traj.theta_ff=theta_ff;
+    plant_encoders(&p,&last_count[0],&last_count[1]);
+    for(k=-hold;k<ticks;k++){
+        t=k*dt;
+        rt_sim_time_ns=(uint64_t)(k+hold)*1000000000ULL/D1_HZ;
+        for(i=0;i<COMMANDS;i++){
+            if(c->line[i]==NULL || k!=(int)(c->time[i]*D1_HZ)) continue;
+            if(traj_parse(c->line[i],&cmd)) continue;
+            traj_post(&cmd_box,&cmd);
+        }
+        plant_imu(&p,THETA_OFFSET,imu_reader.accel,imu_reader.gyro);
+        plant_encoders(&p,&count[0],&count[1]);
+        rc_host_encoder[ENCODER_CHANNEL_L]+=ENCODER_POLARITY_L* \
+                                            (count[0]-last_count[0]);
+        rc_host_encoder[ENCODER_CHANNEL_R]+=ENCODER_POLARITY_R* \
+                                            (count[1]-last_count[1]);
+        last_count[0]=count[0];
+        last_count[1]=count[1];
+        if(control_mode==CONTROL_CASCADE && (k+hold)%outer_every==0){
+            outer_step();
+        }
+        inner_loop();
+        p.duty=0.5*(rc_host_motor[MOTOR_CHANNEL_L]*MOTOR_POLARITY_L+ \
+                    rc_host_motor[MOTOR_CHANNEL_R]*MOTOR_POLARITY_R);
+        p.duty_diff=0.5*(rc_host_motor[MOTOR_CHANNEL_R]*MOTOR_POLARITY_R- \
+                         rc_host_motor[MOTOR_CHANNEL_L]*MOTOR_POLARITY_L);
+        if(k<0) continue;
+        plant_step(&p,dt);
+        if(t<c->time[0]) continue;
+        e_fwd=(p.phi-traj.phi.pos)*WHEEL_RADIUS_M;
+        e_head=p.psi-traj.heading.pos;
+        if(trace!=NULL){
+            fprintf(trace,"%s,%.4f,%.3f,%.5f,%.5f,%.5f,%.5f,%.5f\n",c->name, \
+                    theta_ff,t,p.theta,p.phi,traj.phi.pos,p.psi, \
+                    traj.heading.pos);
+        }
+        r.rms_forward+=e_fwd*e_fwd;
+        r.rms_heading+=e_head*e_head;
+        n++;
+        r.final_forward=e_fwd;
+        r.final_heading=e_head;
+        if(fabs(p.theta)>r.peak_theta) r.peak_theta=fabs(p.theta);
+        if(fabs(p.theta)>TIP_ANGLE){
+            r.fell=1;
+            break;
+        }
+    }
+    if(n>0){
+        r.rms_forward=sqrt(r.rms_forward/n);
+        r.rms_heading=sqrt(r.rms_heading/n);
+    }
+    return r;
+}
+
+static int run_isolated(const case_t* c,float theta_ff,follow_t* r){
+    int fd[2],status;
+    pid_t pid;
+
+    if(trace!=NULL) fflush(trace);
+    if(pipe(fd)) return -1;
+    pid=fork();
+    if(pid<0) return -1;
+    if(pid==0){
+        follow_t res=run_case(c,theta_ff);
+        if(trace!=NULL) fclose(trace);
+        close(fd[0]);
+        if(write(fd[1],&res,sizeof(res))!=sizeof(res)) _exit(1);
+        _exit(0);
+    }
+    close(fd[1]);
+    if(read(fd[0],r,sizeof(*r))!=sizeof(*r)){
+        close(fd[0]);
+        waitpid(pid,&status,0);
+        return -1;
+    }
+    close(fd[0]);
+    waitpid(pid,&status,0);
+    return 0;
+}
+
+int main(int argc,char* argv[]){
+    const float ff[2]={0,REF_THETA_FF};
+    follow_t r[2];
+    int c,i,j,fail=0;
+
+    while((c=getopt(argc,argv,"c:o:"))!=-1){
+        switch(c){
+        case 'c':
+            control_mode=control_mode_from_name(optarg);
+            if(control_mode<0){
+                fprintf(stderr,"ERROR: unknown controller '%s'\n",optarg);
+                return 1;
+            }
+            break;
+        case 'o':
+            trace=fopen(optarg,"w");
+            if(trace==NULL){
+                perror(optarg);
+                return 1;
+            }
+            fprintf(trace,"case,theta_ff,t,theta,phi,phi_ref,psi," \
+                    "heading_ref\n");
+            break;
+        default:
+            fprintf(stderr,"usage: trajectory_mip [-c cascade|lqr|mpc] " \
+                    "[-o trace.csv]\n");
+            return 1;
+        }
+    }
+    for(i=0;i<CASES;i++){
+        for(j=0;j<COMMANDS;j++){
+            traj_cmd_t cmd;
+            if(cases[i].line[j]!=NULL && traj_parse(cases[i].line[j],&cmd)){
+                fprintf(stderr,"ERROR: bad command '%s'\n",cases[i].line[j]);
+                return 1;
+            }
+        }
+    }
+
+    printf("%s\n",control_mode_name(control_mode));
+    printf("case   theta_ff  fell  rms_fwd_m  rms_head  final_fwd_m  " \
+           "final_head  peak_theta\n");
+    for(i=0;i<CASES;i++){
+        for(j=0;j<2;j++){
+            if(run_isolated(&cases[i],ff[j],&r[j])){
+                fprintf(stderr,"ERROR: case %d failed to run\n",i);
+                return 1;
+            }
+            printf("%-5s  %8.4f  %4d  %9.4f  %8.4f  %11.4f  %10.4f  " \
+                   "%10.3f\n",cases[i].name,ff[j],r[j].fell,r[j].rms_forward, \
+                   r[j].rms_heading,r[j].final_forward,r[j].final_heading, \
+                   r[j].peak_theta);
+        }
+        if(r[1].fell){
+            printf("FAIL: falls with the feed-forward\n");
+            fail=1;
+        }
+        else if(fabs(r[1].final_forward)>FINAL_FORWARD || \
+                fabs(r[1].final_heading)>FINAL_HEADING){
+            printf("FAIL: does not end where commanded\n");
+            fail=1;
+        }
+        else if(r[1].rms_forward>r[0].rms_forward){
+            printf("FAIL: feed-forward makes the tracking worse\n");
+            fail=1;
+        }
+    }
+    if(trace!=NULL) fclose(trace);
+    return fail;
+}
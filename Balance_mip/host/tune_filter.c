@@ -0,0 +1,468 @@
+/*******************************************************************************
+* tune_filter.c
+*
+* Offline search for the complementary filter constants OMEGA_C and
+* THETA_OFFSET. Reads one or more raw captures (imu_data_export -w,
+* sim_mip -w, or any CSV with accel_y, accel_z and gyro_x columns) and
+* evaluates a log-spaced grid of omega_c candidates on all cores.
+*
+* Every candidate runs the same difference equations as
+* complementary_filter(). Candidates are packed FILTER_LANES at a time into
+* one pass over the log, with the accelerometer angle and gyro increment of
+* each sample computed once up front, so the per-lane update is a few
+* multiply-adds the compiler vectorizes. Thousands of candidates over an
+* hour of 100 Hz data take a few seconds.
+*
+* The estimate is scored against a reference angle: the column given with
+* -c (default theta_true, written by sim_mip -w), or when the log has none,
+* a zero-phase forward-backward complementary smoother of the same data
+* crossing over at -s rad/s. The cost is the RMS error plus -l times the
+* estimation lag, found by regressing the error on the reference rate.
+* THETA_OFFSET is the mean error for the best omega_c; without a reference
+* column it is chosen so the mean tilt is zero, which assumes the log was
+* recorded while balancing.
+*
+* The config snippet goes to stdout, the summary to stderr, and every
+* candidate to -o as CSV.
+*
+* usage: tune_filter [-c ref_column] [-w lo:hi:count] [-l lag_weight]
+*                    [-s smoother_omega] [-k settle_s] [-d dt] [-j threads]
+*                    [-o table.csv] log...
+*******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <pthread.h>
+#include "mip_config.h"
+
+#define FILTER_LANES            16 // candidates evaluated per pass
+#define MAX_THREADS             64
+#define MAX_FIELDS              32
+#define MAX_LINE                1024
+#define DEG_TO_RAD              0.0174532925199
+
+// all logs back to back, one filter restart per log
+typedef struct log_data_t{
+    long n;
+    long cap;
+    float* accel;               // accelerometer angle, atan2(-z,y)
+    float* gyro;                // gyro increment over one step, rad
+    float* ref;                 // reference angle, without THETA_OFFSET
+    float* ref_rate;            // reference rate, rad/s
+    unsigned char* used;        // 0 inside the settle time after a restart
+    int nlogs;
+    long* start;                // first sample of each log
+} log_data_t;
+
+typedef struct candidate_t{
+    double omega_c;
+    double mean;                // mean of reference minus estimate
+    double rms;
+    double lag;                 // s, positive when the estimate is late
+    double cost;
+} candidate_t;
+
+typedef struct work_t{
+    pthread_mutex_t lock;
+    int next;                   // first candidate of the next pass
+} work_t;
+
+static log_data_t data;
+static candidate_t* candidates;
+static int ncandidates=2000;
+static double dt=DT;
+static double lag_weight=1;
+static work_t work={PTHREAD_MUTEX_INITIALIZER,0};
+
+/*******************************************************************************
+* int split_csv()
+*
+* Splits a CSV line in place, returns the field count.
+*******************************************************************************/
+static int split_csv(char* line,char** fields,int max){
+    int n=0;
+    char* p=line;
+    while(n<max){
+        fields[n++]=p;
+        p=strchr(p,',');
+        if(p==NULL) break;
+        *p++='\0';
+    }
+    return n;
+}
+
+static int find_column(char** names,int n,const char* name){
+    int i;
+    for(i=0;i<n;i++) if(strcmp(names[i],name)==0) return i;
+    return -1;
+}
+
+static int grow(log_data_t* d){
+    long cap=d->cap?2*d->cap:65536;
+    float** arrays[4]={&d->accel,&d->gyro,&d->ref,&d->ref_rate};
+    unsigned char* used;
+    int i;
+    for(i=0;i<4;i++){
+        float* p=realloc(*arrays[i],cap*sizeof(float));
+        if(p==NULL) return -1;
+        *arrays[i]=p;
+    }
+    used=realloc(d->used,cap);
+    if(used==NULL) return -1;
+    d->used=used;
+    d->cap=cap;
+    return 0;
+}
+
+/*******************************************************************************
+* void smooth_reference()
+*
+* Zero-phase reference for logs without one: the accelerometer angle plus
+* the gyro angle minus the accelerometer angle, high-passed forward and then
+* backward at omega_s. The two paths stay exactly complementary and neither
+* is delayed, so this is better than any causal filter of the same data.
+*******************************************************************************/
+static void smooth_reference(float* ref,const float* accel,const float* gyro, \
+                             long n,double omega_s){
+    double c=1-omega_s*dt;
+    double g=0,x,prev,y;
+    long k;
+
+    // ref holds the difference to be high-passed
+    for(k=0;k<n;k++){
+        g+=gyro[k];
+        ref[k]=g-accel[k];
+    }
+    prev=ref[0];
+    y=0;
+    for(k=0;k<n;k++){
+        x=ref[k];
+        y=c*y+x-prev;
+        prev=x;
+        ref[k]=y;
+    }
+    prev=ref[n-1];
+    y=0;
+    for(k=n-1;k>=0;k--){
+        x=ref[k];
+        y=c*y+x-prev;
+        prev=x;
+        ref[k]=accel[k]+y;
+    }
+    return;
+}
+
+/*******************************************************************************
+* int load_log()
+*
+* Appends one capture to data, returns 1 if it had a reference column, 0 if
+* the smoother was used, or -1.
+*******************************************************************************/
+static int load_log(const char* path,const char* ref_name,double omega_s, \
+                    double settle){
+    FILE* f=fopen(path,"r");
+    char line[MAX_LINE];
+    char header[MAX_LINE];
+    char* fields[MAX_FIELDS];
+    long first=data.n,k;
+    int nfields,col_y,col_z,col_g,col_r;
+    double mean=0,used=0;
+
+    if(f==NULL){
+        perror(path);
+        return -1;
+    }
+    do{
+        if(fgets(header,sizeof(header),f)==NULL){
+            fprintf(stderr,"ERROR: %s has no header\n",path);
+            fclose(f);
+            return -1;
+        }
+    }while(header[0]=='#');
+    header[strcspn(header,"\r\n")]='\0';
+    nfields=split_csv(header,fields,MAX_FIELDS);
+    col_y=find_column(fields,nfields,"accel_y");
+    col_z=find_column(fields,nfields,"accel_z");
+    col_g=find_column(fields,nfields,"gyro_x");
+    col_r=find_column(fields,nfields,ref_name);
+    if(col_y<0 || col_z<0 || col_g<0){
+        fprintf(stderr,"ERROR: %s needs accel_y, accel_z and gyro_x\n",path);
+        fclose(f);
+        return -1;
+    }
+
+    while(fgets(line,sizeof(line),f)!=NULL){
+        if(line[0]=='#') continue;
+        line[strcspn(line,"\r\n")]='\0';
+        if(split_csv(line,fields,MAX_FIELDS)<nfields) continue;
+        if(data.n==data.cap && grow(&data)){
+            fprintf(stderr,"ERROR: out of memory\n");
+            fclose(f);
+            return -1;
+        }
+        // same expressions and precision as complementary_filter()
+        data.accel[data.n]=atan2(-(float)atof(fields[col_z]), \
+                                  (float)atof(fields[col_y]));
+        data.gyro[data.n]=(float)atof(fields[col_g])*DEG_TO_RAD*dt;
+        data.ref[data.n]=(col_r>=0)?(float)atof(fields[col_r])-THETA_OFFSET:0;
+        data.n++;
+    }
+    fclose(f);
+    if(data.n-first<2*settle/dt+3){
+        fprintf(stderr,"ERROR: %s is shorter than twice the settle time\n",path);
+        return -1;
+    }
+
+    if(col_r<0){
+        smooth_reference(data.ref+first,data.accel+first,data.gyro+first, \
+                         data.n-first,omega_s);
+    }
+    for(k=first;k<data.n;k++){
+        long a=(k>first)?k-1:k;
+        long b=(k<data.n-1)?k+1:k;
+        data.ref_rate[k]=(data.ref[b]-data.ref[a])/((b-a)*dt);
+        // a smoothed reference is also unreliable near the end of the log
+        data.used[k]=(k-first>=settle/dt) && \
+                     (col_r>=0 || data.n-k>settle/dt);
+        if(data.used[k]){
+            mean+=data.ref[k];
+            used++;
+        }
+    }
+    // a balancing robot averages zero tilt, which sets the offset
+    if(col_r<0){
+        for(k=first;k<data.n;k++) data.ref[k]-=mean/used+THETA_OFFSET;
+    }
+    data.start=realloc(data.start,(data.nlogs+1)*sizeof(long));
+    data.start[data.nlogs++]=first;
+    return col_r>=0;
+}
+
+/*******************************************************************************
+* void filter_lanes()
+*
+* Runs FILTER_LANES candidates side by side over all logs and fills in their
+* error statistics. The lane loops have no dependencies between lanes, so
+* they compile to vector instructions. Unused lanes repeat the last omega_c.
+*******************************************************************************/
+static void filter_lanes(candidate_t* c,int lanes){
+    float a[FILTER_LANES],wdt[FILTER_LANES];
+    float ta[FILTER_LANES],tg[FILTER_LANES];
+    double se[FILTER_LANES],see[FILTER_LANES],sed[FILTER_LANES];
+    double sd=0,sdd=0,cov,var,cnt=0;
+    long k,end;
+    int i,l;
+
+    for(l=0;l<FILTER_LANES;l++){
+        wdt[l]=c[(l<lanes)?l:lanes-1].omega_c*dt;
+        a[l]=1-wdt[l];
+        se[l]=see[l]=sed[l]=0;
+    }
+    for(i=0;i<data.nlogs;i++){
+        end=(i+1<data.nlogs)?data.start[i+1]:data.n;
+        k=data.start[i];
+        // start settled on the first sample instead of from zero
+        for(l=0;l<FILTER_LANES;l++){
+            ta[l]=data.accel[k];
+            tg[l]=0;
+        }
+        for(k++;k<end;k++){
+            const float accel_prev=data.accel[k-1];
+            const float gyro=data.gyro[k];
+            const float ref=data.ref[k];
+            const float rate=data.ref_rate[k];
+            const float w=data.used[k];
+            // theta_a uses the previous raw angle, as in complementary_filter()
+            for(l=0;l<FILTER_LANES;l++){
+                ta[l]=a[l]*ta[l]+wdt[l]*accel_prev;
+                tg[l]=a[l]*tg[l]+gyro;
+            }
+            // settle samples are weighted out rather than skipped
+            for(l=0;l<FILTER_LANES;l++){
+                float e=w*(ref-(ta[l]+tg[l]));
+                se[l]+=e;
+                see[l]+=e*e;
+                sed[l]+=e*rate;
+            }
+            sd+=w*rate;
+            sdd+=w*rate*rate;
+            cnt+=w;
+        }
+    }
+
+    var=sdd/cnt-(sd/cnt)*(sd/cnt);
+    for(l=0;l<lanes;l++){
+        c[l].mean=se[l]/cnt;
+        c[l].rms=sqrt(fmax(see[l]/cnt-c[l].mean*c[l].mean,0));
+        // ref-est ~ lag*ref_rate for a small delay
+        cov=sed[l]/cnt-c[l].mean*sd/cnt;
+        c[l].lag=(var>0)?cov/var:0;
+        c[l].cost=c[l].rms+lag_weight*fabs(c[l].lag);
+    }
+    return;
+}
+
+static void* worker(void* arg){
+    int first,lanes;
+    (void)arg;
+    for(;;){
+        pthread_mutex_lock(&work.lock);
+        first=work.next;
+        work.next+=FILTER_LANES;
+        pthread_mutex_unlock(&work.lock);
+        if(first>=ncandidates) break;
+        lanes=ncandidates-first;
+        if(lanes>FILTER_LANES) lanes=FILTER_LANES;
+        filter_lanes(candidates+first,lanes);
+    }
+    return NULL;
+}
+
+static double now_s(){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC,&ts);
+    return ts.tv_sec+ts.tv_nsec*1e-9;
+}
+
+static const char* usage="usage: tune_filter [-c ref_column] " \
+    "[-w lo:hi:count] [-l lag_weight] [-s smoother_omega] [-k settle_s] " \
+    "[-d dt] [-j threads] [-o table.csv] log...\n";
+
+int main(int argc,char* argv[]){
+    const char* ref_name="theta_true";
+    const char* table_name=NULL;
+    pthread_t tid[MAX_THREADS];
+    candidate_t current;
+    double lo=0.2,hi=20,omega_s=OMEGA_C,settle=2,t0,elapsed,offset;
+    int threads,c,i,best,referenced=0,smoothed=0;
+
+    threads=(int)sysconf(_SC_NPROCESSORS_ONLN);
+    while((c=getopt(argc,argv,"c:w:l:s:k:d:j:o:"))!=-1){
+        switch(c){
+        case 'c':
+            ref_name=optarg;
+            break;
+        case 'w':
+            if(sscanf(optarg,"%lf:%lf:%d",&lo,&hi,&ncandidates)!=3){
+                fprintf(stderr,"%s",usage);
+                return 1;
+            }
+            break;
+        case 'l':
+            lag_weight=atof(optarg);
+            break;
+        case 's':
+            omega_s=atof(optarg);
+            break;
+        case 'k':
+            settle=atof(optarg);
+            break;
+        case 'd':
+            dt=atof(optarg);
+            break;
+        case 'j':
+            threads=atoi(optarg);
+            break;
+        case 'o':
+            table_name=optarg;
+            break;
+        default:
+            fprintf(stderr,"%s",usage);
+            return 1;
+        }
+    }
+    if(optind>=argc || dt<=0 || lo<=0 || hi<lo || ncandidates<1 || \
+       omega_s<=0 || omega_s*dt>=1){
+        fprintf(stderr,"%s",usage);
+        return 1;
+    }
+    // the filter is only stable for omega_c*dt<1
+    if(hi*dt>=1){
+        hi=0.99/dt;
+        fprintf(stderr,"omega_c limited to %.3g rad/s at dt=%g s\n",hi,dt);
+        if(lo>hi) lo=hi;
+    }
+    if(threads<1) threads=1;
+    if(threads>MAX_THREADS) threads=MAX_THREADS;
+
+    for(i=optind;i<argc;i++){
+        int r=load_log(argv[i],ref_name,omega_s,settle);
+        if(r<0) return 1;
+        if(r) referenced++;
+        else smoothed++;
+    }
+    // candidate grid, plus the configured OMEGA_C evaluated alongside it
+    candidates=calloc(ncandidates+1,sizeof(candidate_t));
+    for(i=0;i<ncandidates;i++){
+        candidates[i].omega_c=(ncandidates>1)? \
+            lo*pow(hi/lo,(double)i/(ncandidates-1)):lo;
+    }
+    current.omega_c=OMEGA_C;
+
+    t0=now_s();
+    if(threads>ncandidates/FILTER_LANES+1) threads=ncandidates/FILTER_LANES+1;
+    for(i=0;i<threads;i++){
+        if(pthread_create(&tid[i],NULL,worker,NULL)){
+            fprintf(stderr,"ERROR: failed to start worker\n");
+            return 1;
+        }
+    }
+    for(i=0;i<threads;i++) pthread_join(tid[i],NULL);
+    filter_lanes(&current,1);
+    elapsed=now_s()-t0;
+
+    best=0;
+    for(i=1;i<ncandidates;i++){
+        if(candidates[i].cost<candidates[best].cost) best=i;
+    }
+    // references are stored relative to the configured offset
+    offset=THETA_OFFSET+candidates[best].mean;
+
+    if(table_name!=NULL){
+        FILE* t=fopen(table_name,"w");
+        if(t==NULL){
+            perror(table_name);
+            return 1;
+        }
+        fprintf(t,"omega_c,theta_offset,rms,lag,cost\n");
+        for(i=0;i<ncandidates;i++){
+            fprintf(t,"%.6g,%.6g,%.6g,%.6g,%.6g\n",candidates[i].omega_c, \
+                    THETA_OFFSET+candidates[i].mean,candidates[i].rms, \
+                    candidates[i].lag,candidates[i].cost);
+        }
+        fclose(t);
+    }
+
+    fprintf(stderr,"%d log(s), %ld samples (%.1f s), %d with %s, %d smoothed " \
+            "at %g rad/s\n",data.nlogs,data.n,data.n*dt,referenced,ref_name, \
+            smoothed,omega_s);
+    fprintf(stderr,"%d candidates %.3g to %.3g rad/s on %d thread(s) in " \
+            "%.3f s (%.3g samples/s)\n",ncandidates,lo,hi,threads,elapsed, \
+            (double)data.n*(ncandidates+1)/elapsed);
+    fprintf(stderr,"%-10s %10s %12s %10s %10s %10s\n","","omega_c", \
+            "theta_offset","rms(rad)","lag(ms)","cost");
+    fprintf(stderr,"%-10s %10.4g %12.4f %10.4g %10.3g %10.4g\n","current", \
+            current.omega_c,THETA_OFFSET+current.mean,current.rms, \
+            current.lag*1e3,current.cost);
+    fprintf(stderr,"%-10s %10.4g %12.4f %10.4g %10.3g %10.4g\n","best", \
+            candidates[best].omega_c,offset,candidates[best].rms, \
+            candidates[best].lag*1e3,candidates[best].cost);
+    if(best==0 || best==ncandidates-1){
+        fprintf(stderr,"WARNING: best omega_c is at the edge of the grid\n");
+    }
+    if(smoothed){
+        fprintf(stderr,"NOTE: no %s column in %d log(s), theta_offset " \
+                "assumes they were recorded while balancing\n",ref_name,smoothed);
+    }
+
+    printf("// complementary filter constants, tune_filter over %d log(s)\n", \
+           data.nlogs);
+    printf("#define OMEGA_C                 %.3g // 1/time constant\n", \
+           candidates[best].omega_c);
+    printf("#define DT                      %g // step in seconds\n",dt);
+    printf("#define THETA_OFFSET            %.4f\n",offset);
+    free(candidates);
+    return 0;
+}
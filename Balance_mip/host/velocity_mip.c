@@ -0,0 +1,184 @@
+/*******************************************************************************
+* velocity_mip.c
+*
+* Checks the wheel rate estimator against a simulated encoder. A wheel
+* follows a known rate profile (standstill, slow creep, cruising, slow
+* reversals, small balancing oscillations, and creep again with a noisy
+* reading), integrated at 100 kHz and quantized to GEARBOX*ENCODER_RES
+* counts per revolution. In the last segment every sample is read up to
+* NOISE_COUNTS off, so edges come early or late and chatter back and forth,
+* while the rate to report is the creep alone. The counts are
+* sampled at D1_HZ with a little timing jitter, as the IMU interrupt does,
+* and fed to wheel_vel_update() with the time they were sampled. For
+* reference the same counts are differenced at D2_HZ, as the outer loop
+* would, and at D1_HZ through a REF_CUTOFF_HZ low-pass.
+*
+* Prints the RMS error of each estimate against the true rate, per segment
+* and overall. Exits non-zero if the estimator is worse than either
+* differencing scheme in any segment or overall, so it works as a
+* regression check.
+*
+* usage: velocity_mip [-o trace.csv]
+*******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include "mip_config.h"
+#include "wheel_velocity.h"
+
+#define SIM_HZ                  100000 // wheel integration rate
+#define JITTER_NS               500000 // +- sample time jitter
+#define ESTIMATES               3
+#define REF_CUTOFF_HZ           10 // low-pass on the one tick differencing
+#define NOISE_COUNTS            0.3 // +- reading noise in the last segment
+
+typedef struct segment_t{
+    const char* name;
+    double start;               // s
+    double length;              // s
+} segment_t;
+
+// back to back, the profile is defined per segment in true_rate()
+static const segment_t segments[]={
+    {"standstill",0,1},
+    {"creep",1,4},
+    {"cruise",5,4},
+    {"reversal",9,6},
+    {"balancing",15,5},
+    {"noisy_creep",20,6},
+};
+#define SEGMENTS                (int)(sizeof(segments)/sizeof(segments[0]))
+
+static const char* estimate_names[ESTIMATES]={"estimator","diff_d2","diff_d1"};
+
+/*******************************************************************************
+* double true_rate()
+*
+* Wheel rate in rad/s at time t.
+*******************************************************************************/
+static double true_rate(double t){
+    if(t<1) return 0;
+    if(t<5) return 0.02+0.03*(t-1);                 // 0.02 to 0.14 rad/s
+    if(t<9) return 6+3*sin(2*M_PI*0.5*(t-5));       // fast, several counts/tick
+    if(t<15) return 0.4*sin(2*M_PI*0.25*(t-9));     // slow through zero
+    if(t<20) return 0.3*sin(2*M_PI*2*(t-15));       // rocking in place
+    return 0.03+0.02*sin(2*M_PI*0.2*(t-20));        // 3 to 17 counts/s
+}
+
+/*******************************************************************************
+* double noise()
+*
+* Encoder reading offset in counts for a sample at time t, not part of the
+* wheel rate. Deterministic like jitter().
+*******************************************************************************/
+static double noise(double t){
+    static uint32_t s=54321;
+    if(t<20) return 0;
+    s=s*1103515245u+12345u;
+    return NOISE_COUNTS*(((s>>8)%2001)/1000.0-1);
+}
+
+// deterministic jitter so runs are repeatable
+static int64_t jitter(){
+    static uint32_t s=12345;
+    s=s*1103515245u+12345u;
+    return (int64_t)((s>>8)%(2*JITTER_NS+1))-JITTER_NS;
+}
+
+int main(int argc,char* argv[]){
+    const double rpc=2*M_PI/(GEARBOX*ENCODER_RES);
+    const double end=segments[SEGMENTS-1].start+segments[SEGMENTS-1].length;
+    const int d2_every=D1_HZ/D2_HZ;
+    double sq[SEGMENTS+1][ESTIMATES];
+    long n[SEGMENTS+1];
+    double angle=0,t,rate,est[ESTIMATES],alpha;
+    int32_t count,d2_count=0,d1_count=0;
+    wheel_vel_t w;
+    FILE* trace=NULL;
+    long k,step=0;
+    int c,i,s,fail=0;
+    uint64_t now;
+
+    while((c=getopt(argc,argv,"o:"))!=-1){
+        switch(c){
+        case 'o':
+            trace=fopen(optarg,"w");
+            if(trace==NULL){
+                perror(optarg);
+                return 1;
+            }
+            break;
+        default:
+            fprintf(stderr,"usage: velocity_mip [-o trace.csv]\n");
+            return 1;
+        }
+    }
+    if(trace!=NULL){
+        fprintf(trace,"time(s),count,true,estimator,diff_d2,diff_d1\n");
+    }
+
+    memset(sq,0,sizeof(sq));
+    memset(n,0,sizeof(n));
+    memset(est,0,sizeof(est));
+    wheel_vel_init(&w,rpc,D1_HZ);
+    alpha=1-exp(-2*M_PI*REF_CUTOFF_HZ/D1_HZ);
+    for(k=1;k<=end*D1_HZ;k++){
+        // integrate the wheel up to the jittered sample time
+        now=(uint64_t)(k*(1000000000LL/D1_HZ)+jitter());
+        while(step*(1000000000LL/SIM_HZ)<(int64_t)now){
+            angle+=true_rate(step/(double)SIM_HZ)/SIM_HZ;
+            step++;
+        }
+        t=now*1e-9;
+        rate=true_rate(t);
+        count=(int32_t)floor(angle/rpc+noise(t));
+
+        est[0]=wheel_vel_update(&w,count,now);
+        if(k%d2_every==0){
+            est[1]=(count-d2_count)*rpc*D2_HZ;
+            d2_count=count;
+        }
+        est[2]+=alpha*((count-d1_count)*rpc*D1_HZ-est[2]);
+        d1_count=count;
+
+        for(s=0;s<SEGMENTS;s++){
+            if(t>=segments[s].start && t<segments[s].start+segments[s].length){
+                break;
+            }
+        }
+        for(i=0;i<ESTIMATES;i++){
+            double e=est[i]-rate;
+            if(s<SEGMENTS) sq[s][i]+=e*e;
+            sq[SEGMENTS][i]+=e*e;
+        }
+        if(s<SEGMENTS) n[s]++;
+        n[SEGMENTS]++;
+        if(trace!=NULL){
+            fprintf(trace,"%.3f,%d,%.6f,%.6f,%.6f,%.6f\n",t,count,rate, \
+                    est[0],est[1],est[2]);
+        }
+    }
+    if(trace!=NULL) fclose(trace);
+
+    printf("RMS error (rad/s), %.5f rad per count, %d Hz samples\n",rpc,D1_HZ);
+    printf("%-12s","segment");
+    for(i=0;i<ESTIMATES;i++) printf(" %10s",estimate_names[i]);
+    printf("\n");
+    for(s=0;s<=SEGMENTS;s++){
+        printf("%-12s",s<SEGMENTS?segments[s].name:"overall");
+        for(i=0;i<ESTIMATES;i++) printf(" %10.4f",sqrt(sq[s][i]/n[s]));
+        printf("\n");
+    }
+    for(s=0;s<=SEGMENTS;s++){
+        for(i=1;i<ESTIMATES;i++){
+            if(sq[s][0]>sq[s][i]){
+                printf("FAIL: estimator worse than %s in %s\n", \
+                       estimate_names[i],s<SEGMENTS?segments[s].name:"overall");
+                fail=1;
+            }
+        }
+    }
+    return fail;
+}
@@ -0,0 +1,353 @@
+/*******************************************************************************
+* watchdog_mip.c
+*
+* Checks the deadline watchdog. Two parts:
+*
+*   sequences  watchdog.c alone on a simulated clock. Overruns are injected
+*              with watchdog_inject_fault() every n-th inner tick, ticks are
+*              started late, or the outer loop stops publishing, and every
+*              tick's mode, miss score and the final counters are compared
+*              with a model of the documented rules: a miss adds
+*              WD_MISS_WEIGHT to a score that leaks by one per good tick,
+*              WD_STOP_SCORE stops, WD_DEGRADE_SCORE or a stale outer loop
+*              drop to inner-loop-only, any other miss ramps. Then an
+*              inner loop that goes silent must be stopped by
+*              watchdog_poll() after WD_INNER_TIMEOUT periods, not before.
+*   closed     the unmodified balance_mip inner_loop() and outer_step() on
+*              the eduMiP plant model from mip_plant.c. The outer loop
+*              stops with a bad theta_r left behind, which the inner loop
+*              must drop for THETA_REFERENCE within WD_OUTER_STALE outer
+*              periods and keep balancing, then resumes. Last, an overrun
+*              every tick must stop the motors until the pause button.
+*
+* Exits non-zero on the first tick or counter that differs.
+*
+* usage: watchdog_mip
+*******************************************************************************/
+#include <rc_usefulincludes.h>
+#include <roboticscape.h>
+#include "mip_host.h"
+#include "mip_plant.h"
+#include "rt_setup.h"
+
+#define BAD_THETA_R             0.1 // rad, left behind by the stopped loop
+#define SETTLE_THETA            0.03 // rad, after the fallback took over
+#define PHASE_TIME              3.0 // s, per closed loop phase
+
+typedef struct sequence_t{
+    const char* name;
+    uint64_t inject_every;      // inner ticks, 0 for none
+    int late_every;             // start every n-th tick a period late, 0 none
+    int outer_stop;             // tick the outer loop stops at, 0 never
+    int ticks;
+    wd_mode_t worst;            // most severe mode the sequence must reach
+} sequence_t;
+
+static const sequence_t sequences[]={
+    {"clean",     0,  0, 0,   300, WD_NORMAL},
+    {"isolated",  12, 0, 0,   300, WD_RAMP},
+    {"late",      0,  15,0,   300, WD_RAMP},
+    {"clustered", 6,  0, 0,   40,  WD_INNER_ONLY},
+    {"sustained", 6,  0, 0,   300, WD_SAFE_STOP},
+    {"every",     1,  0, 0,   20,  WD_SAFE_STOP},
+    {"stale",     0,  0, 100, 300, WD_INNER_ONLY},
+};
+#define SEQUENCES               (int)(sizeof(sequences)/sizeof(sequences[0]))
+
+// the watchdog as documented, kept beside the real one
+typedef struct model_t{
+    wd_mode_t mode;
+    int score;
+    uint64_t misses;
+    uint64_t ramp_events;
+    uint64_t inner_only_events;
+    uint64_t safe_stops;
+} model_t;
+
+static void model_enter(model_t* m,wd_mode_t mode){
+    if(mode==m->mode) return;
+    if(mode==WD_RAMP) m->ramp_events++;
+    else if(mode==WD_INNER_ONLY) m->inner_only_events++;
+    else if(mode==WD_SAFE_STOP) m->safe_stops++;
+    m->mode=mode;
+    return;
+}
+
+static void model_tick(model_t* m,int missed,int stale){
+    if(m->mode==WD_SAFE_STOP) return;
+    if(missed){
+        m->misses++;
+        m->score+=WD_MISS_WEIGHT;
+    }
+    else if(m->score>0) m->score--;
+    if(m->score>=WD_STOP_SCORE) model_enter(m,WD_SAFE_STOP);
+    else if(m->score>=WD_DEGRADE_SCORE || stale) model_enter(m,WD_INNER_ONLY);
+    else if(missed) model_enter(m,WD_RAMP);
+    else model_enter(m,WD_NORMAL);
+    return;
+}
+
+static int counters_match(const char* name,const watchdog_t* w, \
+                          const model_t* m){
+    if(w->inner.misses==m->misses && w->ramp_events==m->ramp_events && \
+       w->inner_only_events==m->inner_only_events && \
+       w->safe_stops==m->safe_stops){
+        return 1;
+    }
+    printf("FAIL: %s counters misses %llu ramps %llu inner_only %llu " \
+           "stops %llu, expected %llu %llu %llu %llu\n",name, \
+           (unsigned long long)w->inner.misses, \
+           (unsigned long long)w->ramp_events, \
+           (unsigned long long)w->inner_only_events, \
+           (unsigned long long)w->safe_stops,(unsigned long long)m->misses, \
+           (unsigned long long)m->ramp_events, \
+           (unsigned long long)m->inner_only_events, \
+           (unsigned long long)m->safe_stops);
+    return 0;
+}
+
+/*******************************************************************************
+* static int run_sequence()
+*
+* Drives watchdog.c through one sequence next to the model, then leaves
+* SAFE_STOP with watchdog_reset() if it got there. Returns 0 if they agree
+* on every tick.
+*******************************************************************************/
+static int run_sequence(const sequence_t* s){
+    const uint64_t period=1000000000ULL/D1_HZ;
+    const uint64_t outer_period=1000000000ULL/D2_HZ;
+    const int outer_every=D1_HZ/D2_HZ;
+    watchdog_t w;
+    model_t m;
+    uint64_t now=0,last=0,outer_start=0,injected=0;
+    wd_mode_t mode,worst=WD_NORMAL;
+    int k,missed,stale;
+    int first_degrade=0,first_stop=0;
+
+    watchdog_init(&w,D1_HZ,D2_HZ);
+    watchdog_inject_fault(&w,WD_LOOP_INNER,period,s->inject_every);
+    memset(&m,0,sizeof(m));
+    m.mode=WD_NORMAL;
+    for(k=1;k<=s->ticks;k++){
+        now+=period;
+        if(s->late_every && k%s->late_every==0) now+=period;
+        if((k-1)%outer_every==0 && (s->outer_stop==0 || k<s->outer_stop)){
+            watchdog_outer_begin(&w,now);
+            outer_start=now;
+        }
+        mode=watchdog_inner_begin(&w,now);
+        // the previous tick carried an injected overrun or this one is late
+        missed=(last!=0 && (injected || now-last>period+period/2));
+        stale=(outer_start!=0 && now-outer_start>WD_OUTER_STALE*outer_period);
+        model_tick(&m,missed,stale);
+        injected=(s->inject_every && k%s->inject_every==0);
+        watchdog_loop_done(&w,WD_LOOP_INNER,0);
+        last=now;
+
+        if(mode!=m.mode || w.miss_score!=m.score){
+            printf("FAIL: %s tick %d mode %s score %d, expected %s score " \
+                   "%d\n",s->name,k,watchdog_mode_name(mode),w.miss_score, \
+                   watchdog_mode_name(m.mode),m.score);
+            return -1;
+        }
+        if(mode>worst) worst=mode;
+        if(!first_degrade && m.score>=WD_DEGRADE_SCORE) first_degrade=k;
+        if(!first_stop && m.score>=WD_STOP_SCORE) first_stop=k;
+    }
+    printf("%-10s  %5d  %6llu  %5llu  %10llu  %5llu  %14d  %10d  %s\n", \
+           s->name,s->ticks,(unsigned long long)w.inner.misses, \
+           (unsigned long long)w.ramp_events, \
+           (unsigned long long)w.inner_only_events, \
+           (unsigned long long)w.safe_stops,first_degrade,first_stop, \
+           watchdog_mode_name(worst));
+    if(!counters_match(s->name,&w,&m)) return -1;
+    if(worst!=s->worst){
+        printf("FAIL: %s reached %s, expected %s\n",s->name, \
+               watchdog_mode_name(worst),watchdog_mode_name(s->worst));
+        return -1;
+    }
+    if(w.mode!=WD_SAFE_STOP) return 0;
+
+    // only watchdog_reset() leaves SAFE_STOP, keeping the totals
+    watchdog_inject_fault(&w,WD_LOOP_INNER,0,0);
+    now+=period;
+    if(watchdog_inner_begin(&w,now)!=WD_SAFE_STOP){
+        printf("FAIL: %s left SAFE_STOP without a reset\n",s->name);
+        return -1;
+    }
+    watchdog_loop_done(&w,WD_LOOP_INNER,0);
+    watchdog_reset(&w);
+    now+=period;
+    if(s->outer_stop==0) watchdog_outer_begin(&w,now);
+    mode=watchdog_inner_begin(&w,now);
+    if(mode!=WD_NORMAL || w.miss_score!=0 || !counters_match(s->name,&w,&m)){
+        printf("FAIL: %s after reset mode %s score %d\n",s->name, \
+               watchdog_mode_name(mode),w.miss_score);
+        return -1;
+    }
+    return 0;
+}
+
+/*******************************************************************************
+* static int run_silence()
+*
+* An inner loop that stops starting ticks. watchdog_poll() must not stop
+* before one has run or within WD_INNER_TIMEOUT periods of the last start,
+* must stop once after that, and inner_begin must then report SAFE_STOP.
+*******************************************************************************/
+static int run_silence(){
+    const uint64_t period=1000000000ULL/D1_HZ;
+    const uint64_t timeout=WD_INNER_TIMEOUT*period;
+    watchdog_t w;
+    uint64_t now=0;
+    int k;
+
+    watchdog_init(&w,D1_HZ,D2_HZ);
+    if(watchdog_poll(&w,10*timeout)!=WD_NORMAL){
+        printf("FAIL: silence stopped before the first tick\n");
+        return -1;
+    }
+    for(k=0;k<10;k++){
+        now+=period;
+        watchdog_inner_begin(&w,now);
+        watchdog_loop_done(&w,WD_LOOP_INNER,0);
+    }
+    if(watchdog_poll(&w,now+timeout)!=WD_NORMAL || w.safe_stops!=0){
+        printf("FAIL: silence stopped within %d periods\n",WD_INNER_TIMEOUT);
+        return -1;
+    }
+    if(watchdog_poll(&w,now+timeout+1)!=WD_SAFE_STOP || \
+       watchdog_poll(&w,now+timeout+period)!=WD_SAFE_STOP || w.safe_stops!=1){
+        printf("FAIL: silence after %d periods gave %s, %llu stops\n", \
+               WD_INNER_TIMEOUT,watchdog_mode_name(w.mode), \
+               (unsigned long long)w.safe_stops);
+        return -1;
+    }
+    now+=timeout+2*period;
+    if(watchdog_inner_begin(&w,now)!=WD_SAFE_STOP){
+        printf("FAIL: inner loop resumed past a silence stop\n");
+        return -1;
+    }
+    printf("%-10s  stopped after %d periods\n","silence",WD_INNER_TIMEOUT);
+    return 0;
+}
+
+/*******************************************************************************
+* static int run_closed()
+*
+* inner_loop() and outer_step() on the plant, the outer loop publishing its
+* start as outer_loop() does. Phases of PHASE_TIME: balancing, the outer
+* loop stopped with BAD_THETA_R in theta_r, the outer loop back, an inner
+* overrun injected every tick. Then the pause button must clear the stop.
+*******************************************************************************/
+static int run_closed(){
+    const double dt=1.0/D1_HZ;
+    const int outer_every=D1_HZ/D2_HZ;
+    const int phase=(int)(PHASE_TIME*D1_HZ);
+    const uint64_t stale_ns=WD_OUTER_STALE*(1000000000ULL/D2_HZ);
+    mip_plant_t p;
+    int count,last_count,k;
+    uint64_t stopped_ns=0,fallback_ns=0;
+    double peak=0;
+
+    plant_init(&p);
+    mip_host_init();
+    last_count=plant_encoder(&p);
+    for(k=0;k<4*phase;k++){
+        rt_sim_time_ns=(uint64_t)k*1000000000ULL/D1_HZ;
+        plant_imu(&p,THETA_OFFSET,imu_reader.accel,imu_reader.gyro);
+        count=plant_encoder(&p);
+        rc_host_encoder[ENCODER_CHANNEL_L]+=ENCODER_POLARITY_L*(count-last_count);
+        rc_host_encoder[ENCODER_CHANNEL_R]+=ENCODER_POLARITY_R*(count-last_count);
+        last_count=count;
+        if(k==phase){
+            stopped_ns=wd.outer.last_start_ns;
+            theta_r=BAD_THETA_R;
+        }
+        if(k==3*phase){
+            watchdog_inject_fault(&wd,WD_LOOP_INNER,1000000000ULL/D1_HZ,1);
+            p.held=1;
+        }
+        if(k%outer_every==0 && (k<phase || k>=2*phase)){
+            watchdog_outer_begin(&wd,rt_sim_time_ns);
+            outer_step();
+        }
+        inner_loop();
+        if(k>=phase && k<2*phase){
+            if(!fallback_ns && wd.mode==WD_INNER_ONLY){
+                fallback_ns=rt_sim_time_ns;
+            }
+            if(k>=phase+D1_HZ && fabs(p.theta)>peak) peak=fabs(p.theta);
+        }
+        if(k==2*phase-1 && wd.mode!=WD_INNER_ONLY){
+            printf("FAIL: stale theta_r left %s\n",watchdog_mode_name(wd.mode));
+            return -1;
+        }
+        if(k==3*phase-1 && wd.mode!=WD_NORMAL){
+            printf("FAIL: outer loop back but %s\n",watchdog_mode_name(wd.mode));
+            return -1;
+        }
+        p.duty=0.5*(rc_host_motor[MOTOR_CHANNEL_L]*MOTOR_POLARITY_L+ \
+                    rc_host_motor[MOTOR_CHANNEL_R]*MOTOR_POLARITY_R);
+        plant_step(&p,dt);
+        if(!p.held && fabs(p.theta)>TIP_ANGLE){
+            printf("FAIL: fell at %.2f s\n",k*dt);
+            return -1;
+        }
+    }
+    printf("%-10s  stale after %.0f ms, fallback %.0f ms after the last " \
+           "outer step, peak theta %.3f rad\n","closed",stale_ns*1e-6, \
+           fallback_ns?(fallback_ns-stopped_ns)*1e-6:-1.0,peak);
+    if(!fallback_ns || fallback_ns-stopped_ns<=stale_ns || \
+       fallback_ns-stopped_ns>stale_ns+1000000000ULL/D1_HZ){
+        printf("FAIL: inner-loop-only fallback not on the first tick past " \
+               "%.0f ms\n",stale_ns*1e-6);
+        return -1;
+    }
+    if(peak>SETTLE_THETA){
+        printf("FAIL: stale theta_r %.2f still followed, peak %.3f rad\n", \
+               BAD_THETA_R,peak);
+        return -1;
+    }
+    if(wd.mode!=WD_SAFE_STOP || rc_host_motors_enabled || \
+       rc_host_motor[MOTOR_CHANNEL_L]!=0 || rc_host_motor[MOTOR_CHANNEL_R]!=0){
+        printf("FAIL: overruns every tick left the motors running, %s\n", \
+               watchdog_mode_name(wd.mode));
+        return -1;
+    }
+    // stays stopped until paused, as the inner loop resets it then
+    watchdog_inject_fault(&wd,WD_LOOP_INNER,0,0);
+    rt_sim_time_ns+=1000000000ULL/D1_HZ;
+    inner_loop();
+    if(wd.mode!=WD_SAFE_STOP){
+        printf("FAIL: motors stop cleared without the pause button\n");
+        return -1;
+    }
+    rc_set_state(PAUSED);
+    rt_sim_time_ns+=1000000000ULL/D1_HZ;
+    inner_loop();
+    if(wd.mode!=WD_NORMAL){
+        printf("FAIL: pause left %s\n",watchdog_mode_name(wd.mode));
+        return -1;
+    }
+    printf("%-10s  motors stopped, cleared by pause, %llu stops\n","overrun", \
+           (unsigned long long)wd.safe_stops);
+    return 0;
+}
+
+int main(int argc,char* argv[]){
+    int i;
+
+    if(argc>1){
+        fprintf(stderr,"usage: watchdog_mip\n");
+        return 1;
+    }
+    printf("sequence    ticks  misses  ramps  inner_only  stops  " \
+           "degrade_tick  stop_tick  worst\n");
+    for(i=0;i<SEQUENCES;i++){
+        if(run_sequence(&sequences[i])) return 1;
+    }
+    if(run_silence()) return 1;
+    if(run_closed()) return 1;
+    return 0;
+}
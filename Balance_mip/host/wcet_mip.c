@@ -0,0 +1,232 @@
+/*******************************************************************************
+* wcet_mip.c
+*
+* Execution time and limit handling of the mpc mode. Runs the eduMiP plant
+* model at D1_HZ under mpc_step(), and under the clipped LQR_K law for
+* comparison, through body pushes from none to strong enough to drive the
+* duty into its limit. The controllers see the true state, so the table
+* shows what the limits do rather than estimation error.
+*
+* Every mpc_step() call is timed once, with the caches cold: before each
+* call EVICT_BYTES (-e kB) of unrelated memory is written, more than the
+* last level cache holds, so the solver state, its matrices and most of its
+* code come from memory as they do when the inner loop wakes after the rest
+* of the system ran. The process runs under the same SCHED_FIFO priority
+* and memory locking as the inner loop when it is allowed to.
+*
+* The table gives the mean, median, 99th and 99.9th percentile and the
+* largest call. These are measured times, not a bound: the largest call
+* includes whatever interference the run met. On a host the gate is on the
+* WCET_PERCENTILE call, since a desktop scheduler can preempt any single
+* call. With -b, meant for the board ("make wcetboard" as root), the
+* real-time setup must succeed and the gate is on the largest call.
+*
+* Exits non-zero if the gated time is over MPC_BUDGET of the inner loop
+* period, or if the MPC fell in a case the clipped LQR survived.
+*
+* usage: wcet_mip [-b] [-e kB] [-o times.csv]
+*******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <math.h>
+#include "mip_config.h"
+#include "mip_plant.h"
+#include "mpc.h"
+#include "rt_setup.h"
+
+#define RUN_TIME                3.0 // s per case
+#define PUSH_TIME               0.5 // s, start of the push
+#define PUSH_LENGTH             0.1 // s
+#define MAX_SAMPLES             1000000
+#define EVICT_BYTES             (8*1024*1024) // default, larger than the L3
+#define CACHE_LINE              64
+#define WCET_PERCENTILE         99.9 // gated call on a host
+
+typedef struct run_result_t{
+    int fell;
+    double peak_theta;
+    double peak_duty;
+    double saturated;           // s with the duty at its limit
+} run_result_t;
+
+static const double pushes[]={0,0.05,0.10,0.15,0.20,0.25}; // Nm
+#define PUSHES                  (int)(sizeof(pushes)/sizeof(pushes[0]))
+
+static double times[MAX_SAMPLES];
+static long samples=0;
+static volatile unsigned char* evict;
+static size_t evict_bytes=EVICT_BYTES;
+
+static uint64_t now_ns(){
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC,&t);
+    return (uint64_t)t.tv_sec*1000000000ULL+t.tv_nsec;
+}
+
+static int compare(const void* a,const void* b){
+    double x=*(const double*)a,y=*(const double*)b;
+    return (x>y)-(x<y);
+}
+
+// one write per cache line, pushes everything else out of the caches
+static void evict_caches(){
+    static unsigned char v=0;
+    size_t i;
+
+    v++;
+    for(i=0;i<evict_bytes;i+=CACHE_LINE) evict[i]=v;
+    return;
+}
+
+// sorted times[] at percentile pc
+static double percentile(double pc){
+    long i=(long)ceil(pc/100*samples)-1;
+
+    if(i<0) i=0;
+    if(i>=samples) i=samples-1;
+    return times[i];
+}
+
+/*******************************************************************************
+* static run_result_t run()
+*
+* One push of torque Nm from upright, with the MPC when m is not NULL and
+* the clipped LQR otherwise. MPC calls are timed cold into times[].
+*******************************************************************************/
+static run_result_t run(mpc_t* m,double torque){
+    static const float k[4]=LQR_K;
+    const double dt=1.0/D1_HZ;
+    run_result_t r;
+    mip_plant_t p;
+    float x[MPC_NX],u=0;
+    uint64_t t0,t1;
+    double t;
+    int i;
+
+    memset(&r,0,sizeof(r));
+    plant_init(&p);
+    if(m!=NULL) mpc_reset(m);
+    for(i=0;i<RUN_TIME*D1_HZ;i++){
+        t=i*dt;
+        p.body_torque=(t>=PUSH_TIME && t<PUSH_TIME+PUSH_LENGTH)?torque:0;
+        x[0]=p.theta;
+        x[1]=p.theta_dot;
+        x[2]=p.phi;
+        x[3]=p.phi_dot;
+        if(m!=NULL){
+            evict_caches();
+            t0=now_ns();
+            u=mpc_step(m,x);
+            t1=now_ns();
+            if(samples<MAX_SAMPLES) times[samples++]=(double)(t1-t0);
+        }
+        else{
+            u=-(k[0]*x[0]+k[1]*x[1]+k[2]*x[2]+k[3]*x[3]);
+            u=fmaxf(fminf(u,LQR_SATURATION),-LQR_SATURATION);
+        }
+        p.duty=u;
+        plant_step(&p,dt);
+        if(fabs(p.theta)>r.peak_theta) r.peak_theta=fabs(p.theta);
+        if(fabs(u)>r.peak_duty) r.peak_duty=fabs(u);
+        if(fabs(u)>=0.999*MPC_MAX_DUTY) r.saturated+=dt;
+        if(fabs(p.theta)>TIP_ANGLE){
+            r.fell=1;
+            break;
+        }
+    }
+    return r;
+}
+
+int main(int argc,char* argv[]){
+    const double budget=MPC_BUDGET*1e9/D1_HZ;
+    const long macs=(long)MPC_HORIZON*MPC_NX*2+(long)MPC_ITERATIONS* \
+                    (MPC_HORIZON*(MPC_HORIZON+1)+MPC_HORIZON*MPC_HORIZON);
+    static mpc_t m;
+    run_result_t lqr,mpc;
+    FILE* out=NULL;
+    double overhead,gated,sum=0;
+    uint64_t t0;
+    int c,i,board=0,realtime,fail=0;
+
+    while((c=getopt(argc,argv,"be:o:"))!=-1){
+        switch(c){
+        case 'b':
+            board=1;
+            break;
+        case 'e':
+            evict_bytes=(size_t)atol(optarg)*1024;
+            break;
+        case 'o':
+            out=fopen(optarg,"w");
+            if(out==NULL){
+                perror(optarg);
+                return 1;
+            }
+            break;
+        default:
+            fprintf(stderr,"usage: wcet_mip [-b] [-e kB] [-o times.csv]\n");
+            return 1;
+        }
+    }
+    evict=malloc(evict_bytes+1);
+    if(evict==NULL){
+        fprintf(stderr,"ERROR: no memory for the eviction buffer\n");
+        return 1;
+    }
+    // as the inner loop, the eviction buffer is locked too
+    realtime=(rt_setup_process()==0 && \
+              rt_setup_thread(IMU_PRIORITY,RT_CPU)==0);
+    if(board && !realtime){
+        fprintf(stderr,"ERROR: -b needs the real-time setup, run as root\n");
+        return 1;
+    }
+    if(mpc_init(&m)){
+        fprintf(stderr,"ERROR: no Riccati solution for the MPC weights\n");
+        return 1;
+    }
+
+    printf("push_Nm  controller  fell  peak_theta  peak_duty  saturated_s\n");
+    for(i=0;i<PUSHES;i++){
+        lqr=run(NULL,pushes[i]);
+        mpc=run(&m,pushes[i]);
+        printf("%7.2f  %-10s  %4d  %10.3f  %9.3f  %11.2f\n",pushes[i],"lqr", \
+               lqr.fell,lqr.peak_theta,lqr.peak_duty,lqr.saturated);
+        printf("%7.2f  %-10s  %4d  %10.3f  %9.3f  %11.2f\n",pushes[i],"mpc", \
+               mpc.fell,mpc.peak_theta,mpc.peak_duty,mpc.saturated);
+        if(mpc.fell && !lqr.fell){
+            printf("FAIL: mpc fell where lqr did not\n");
+            fail=1;
+        }
+    }
+    // cost of the timer itself
+    t0=now_ns();
+    for(i=0;i<1000;i++) now_ns();
+    overhead=(double)(now_ns()-t0)/1000;
+
+    if(out!=NULL){
+        fprintf(out,"call,ns\n");
+        for(i=0;i<samples;i++) fprintf(out,"%d,%.0f\n",i,times[i]);
+        fclose(out);
+    }
+    for(i=0;i<samples;i++) sum+=times[i];
+    qsort(times,samples,sizeof(times[0]),compare);
+    printf("\nmpc_step: horizon %d, %d iterations, %ld multiply-adds per call\n", \
+           MPC_HORIZON,MPC_ITERATIONS,macs);
+    printf("%ld calls, caches cold (%zu kB evicted), %s\n",samples, \
+           evict_bytes/1024,realtime?"SCHED_FIFO":"no real-time setup");
+    printf("mean %.0f ns, p50 %.0f ns, p99 %.0f ns, p99.9 %.0f ns, " \
+           "max %.0f ns\n",sum/samples,percentile(50),percentile(99), \
+           percentile(99.9),times[samples-1]);
+    printf("timer overhead %.0f ns, budget %.0f ns\n",overhead,budget);
+    if(board) gated=times[samples-1];
+    else gated=percentile(WCET_PERCENTILE);
+    if(gated>budget){
+        if(board) printf("FAIL: largest call over MPC_BUDGET\n");
+        else printf("FAIL: p%g call over MPC_BUDGET\n",WCET_PERCENTILE);
+        fail=1;
+    }
+    return fail;
+}
@@ -2,8 +2,8 @@
 * mip_config.h
 *
 * Contains defines for balance_mip.c
-* Defines properties for controller D1, controller D2, the complementary filter,
-* the eduMiP, the motors, and the encoders.
+* Defines properties for controller D1, controller D2, the heading controller
+* D3, the complementary filter, the eduMiP, the motors, and the encoders.
 *******************************************************************************/
 
 #ifndef MIP_CONFIG
@@ -13,19 +13,125 @@
 #define NANO                    1000000 // 10^6 microseconds
 #define D1_HZ                   100
 #define D2_HZ                   20
+#define D3_HZ                   50 // heading, every D1_HZ/D3_HZ inner tick
+#define STATUS_HZ               10 // console status line refresh, mip_telemetry
+
+// real-time setup
+#define IMU_PRIORITY            80 // SCHED_FIFO priority of inner loop
+#define OUTER_PRIORITY          70 // SCHED_FIFO priority of outer loop
+#define RT_CPU                  -1 // CPU to pin control threads, -1 for none
+
+// deadline watchdog
+#define WD_HZ                   50 // supervisor liveness check rate
+#define WD_INNER_BUDGET         0.5 // fraction of period inner loop may use
+#define WD_OUTER_BUDGET         0.5 // fraction of period outer loop may use
+#define WD_OUTER_STALE          3 // outer periods before theta_r is stale
+#define WD_INNER_TIMEOUT        5 // inner periods of silence before stopping
+#define WD_MISS_WEIGHT          10 // score per miss, leaks 1 per good tick
+#define WD_DEGRADE_SCORE        20 // drop to inner-loop-only balancing
+#define WD_STOP_SCORE           50 // disable motors
+#define WD_DUTY_RAMP            0.05 // max duty change per tick in ramp mode
+
+// flight recorder
+#define REC_EVENTS              65536 // the last ~8 min of events, 3.5 MB locked
+#define REC_KEY_TICKS           500 // inner loop ticks between keyframes
+#define REC_KEYFRAMES           128 // ~10 min of keyframes, 260 kB locked
+#define REC_PATH                "mip_record.bin" // MIP_RECORD overrides
+
+// shared memory to the mip_logger and mip_telemetry processes
+#define TELEM_NAME              "/balance_mip" // MIP_SHM overrides
+#define TELEM_SLOTS             4096 // power of 2, ~40 s of samples, 200 kB
+#define TELEM_LOG_PATH          "mip_log.csv" // MIP_LOG overrides
+#define TELEM_DRAIN_HZ          20 // logger writes out the ring
+#define TELEM_RETRY             1.0 // s between looks for balance_mip
+#define TELEM_STALE             0.5 // s without a tick, "not responding"
 
 // structural properties of eduMiP
 #define GEARBOX 				35.577
 #define ENCODER_RES				60
+#define WHEEL_RADIUS_M          0.034 // as in feedback_config.h
+#define TRACK_WIDTH_M           0.035
 
 // MiP balance constants
 #define TIP_ANGLE               0.8 // radians from y-axis (~45 degrees)
 #define PHI_REFERENCE           0
+#define THETA_REFERENCE         0 // used when the outer loop is bypassed
+
+// fall recovery, a MiP lying still is kicked upright with the wheels when
+// MIP_RECOVER=1, otherwise it waits to be picked up; balancing restarts
+// inside the capture window either way
+#define RECOVER_CAPTURE_ANGLE   0.3 // rad
+#define RECOVER_STILL_RATE      0.5 // rad/s, lying below this body rate
+#define RECOVER_LYING_TIME      1 // s lying still before a kick
+#define RECOVER_WIND_DUTY       1 // away from the side the MiP lies on
+#define RECOVER_WIND_TIME       0.1 // s winding up the wheels
+#define RECOVER_KICK_DUTY       0.5 // then toward it, slow enough to catch
+#define RECOVER_KICK_TIME       0.5 // s, longest kick
+#define RECOVER_MAX_KICKS       3 // without balancing, then wait for a hand
+#define RECOVER_UPRIGHT_TIME    2 // s balancing that allows new kicks
 
 // complementary filter constants
 #define OMEGA_C                 2 // 1/time constant
 #define DT                      0.01 // step in seconds
-#define THETA_OFFSET            0.23
+#define THETA_OFFSET            0.23 // default until calibrated
+
+// motion commands, read from the CMD_PATH FIFO by the supervisor loop and
+// followed with jerk-limited phi and heading references at D2_HZ
+#define CMD_PATH                "/tmp/mip_command" // MIP_COMMAND overrides
+#define CMD_LINE                64 // longest command line
+#define REF_MAX_SPEED           0.3 // m/s
+#define REF_MAX_ACCEL           0.3 // m/s^2
+#define REF_MAX_JERK            1.5 // m/s^3
+#define REF_MAX_YAW_RATE        1.5 // rad/s
+#define REF_MAX_YAW_ACCEL       3 // rad/s^2
+#define REF_MAX_YAW_JERK        15 // rad/s^3
+#define REF_THETA_FF            0.0035 // rad per rad/s^2 of wheel acceleration, ~WHEEL_RADIUS_M/g
+
+// heading filter, encoder difference below and gyro yaw rate above HEADING_OMEGA_C
+#define HEADING_OMEGA_C         1 // 1/time constant
+#define HEADING_REFERENCE       0 // rad, positive turns left
+
+// calibration, measured held upright and reused while the file is fresh
+#define CAL_PATH                "/var/lib/edumip/calibration.txt" // MIP_CALIBRATION overrides
+#define CAL_SECONDS             5 // averaging window, MIP_CALIBRATE=1 forces it
+#define CAL_MAX_AGE             86400 // s, older files are measured again
+#define CAL_MAX_GYRO_STD        2 // deg/s, window restarts if held less still
+#define CAL_MAX_CHANGE          0.2 // rad, largest offset from THETA_OFFSET
+
+// actuator shaping between the controllers and the motors, left and right;
+// measured with the wheels off the ground when MIP_CHARACTERIZE=1 and kept
+// in ACT_PATH, these until then
+#define ACT_PATH                "/var/lib/edumip/actuator.txt" // MIP_ACTUATOR overrides
+#define ACT_DEADBAND            {0, 0} // duty to break away from rest
+#define ACT_FRICTION            {0, 0} // duty lost to Coulomb friction moving
+#define ACT_SCALE               {1, 1} // duty gain equalizing the wheels
+#define ACT_DUTY_ZONE           0.02 // duty over which the breakaway step is spread
+#define ACT_RATE_ZONE           0.5 // rad/s, wheel rate of full friction feed-forward
+#define ACT_RAMP                0.1 // duty per second while characterizing
+#define ACT_MOVE_COUNTS         10 // counts turned at breakaway
+#define ACT_STILL_TIME          0.1 // s without a count when stopped
+#define ACT_REST_TIME           0.5 // s at no duty between segments
+#define ACT_TEST_DUTY           0.3 // speed run duty
+#define ACT_TEST_TIME           2 // s per wheel, speed from the second half
+#define ACT_MAX_DUTY            0.5 // no breakaway below this fails the run
+
+// wheel velocity estimation in the inner loop
+#define VEL_OBSERVER_HZ         12 // bandwidth of the wheel rate observer
+#define VEL_DAMPING             0.5
+#define VEL_SPARSE_TICKS        3 // edge interval (ticks) from which 1/T is used
+#define VEL_TIMEOUT             0.3 // s without a count before a wheel is stopped
+#define VEL_SLOW_HZ             5 // low-pass on the 1/T rate
+
+// online bias tracking while balancing quietly
+#define TRACK_DETECT_TAU        0.5 // s, gyro mean and variance window
+#define TRACK_SETTLE            1 // s quasi-static before adapting
+#define TRACK_MAX_GYRO_STD      3 // deg/s, quasi-static below this
+#define TRACK_MAX_THETA         0.1 // rad, quasi-static near upright
+#define TRACK_MAX_WHEEL_RATE    0.5 // rad/s, quasi-static wheel speed
+#define TRACK_BIAS_TAU          20 // s, gyro bias time constant
+#define TRACK_OFFSET_TAU        60 // s, theta offset time constant
+#define TRACK_MAX_BIAS          5 // deg/s, largest change from calibration
+#define TRACK_MAX_OFFSET        0.05 // rad, largest change from calibration
 
 // inner loop controller
 #define D1_GAIN					-4.24
@@ -34,6 +140,7 @@
 #define D1_NUM					{1, -1.678, 0.6931}
 #define D1_DEN					{1, -1.566, 0.566}
 #define D1_SATURATION        	1
+#define D1_ANTIWINDUP           0.1 // integrator pole at 1-this clipped, 0 for none
 
 // outer loop controller
 #define D2_GAIN					0.283
@@ -42,6 +149,58 @@
 #define D2_NUM					{1, -0.9756}
 #define D2_DEN					{1, -0.5113}
 #define D2_SATURATION        	0.3
+#define D2_ANTIWINDUP           1 // no effect, D2 has no integrator
+
+// heading controller, PI on the heading error at D3_HZ, damped by the gyro
+// yaw rate; the output is the duty added to the right motor and taken from
+// the left
+#define D3_GAIN                 0.2688
+#define D3_N                    1 // # of zeros in numerator
+#define D3_M                    1 // # of poles in denominator
+#define D3_NUM                  {1, -0.9718}
+#define D3_DEN                  {1, -1}
+#define D3_SATURATION           0.3
+#define D3_ANTIWINDUP           1
+#define D3_RATE_GAIN            0.0334 // duty per rad/s of yaw rate
+
+// single-rate state feedback on [theta, theta_dot, phi, phi_dot], used
+// instead of D1/D2 with MIP_CONTROLLER=lqr; gains from host/lqr_design
+#define LQR_K                   {-1.982, -0.17026, -0.12652, -0.077779} // -q 0.05,1,0.2,2 -r 0.03
+#define LQR_SATURATION          1
+
+// model predictive balance with duty and tilt limits, MIP_CONTROLLER=mpc;
+// MPC_A and MPC_B are the model at D1_HZ printed by host/lqr_design
+#define MPC_A                   {{1.0102299, 0.0093184305, 0, 0.00071655236}, \
+                                 {1.9452838, 0.87664322, 0, 0.13358663}, \
+                                 {-0.010206988, 0.0012023189, 1, 0.0087621133}, \
+                                 {-1.8647507, 0.22037831, 0, 0.76941471}}
+#define MPC_B                   {-0.035447962, -6.6085525, 0.061238457, 11.407092}
+#define MPC_DEVIATION           {0.05, 1, 0.2, 2} // weights as lqr_design -q
+#define MPC_DUTY_DEVIATION      0.03 // as lqr_design -r
+#define MPC_HORIZON             15 // ticks predicted
+#define MPC_ITERATIONS          30 // fixed, bounds the execution time
+#define MPC_MAX_DUTY            1
+#define MPC_MAX_THETA           0.3 // rad, soft limit on the predicted tilt
+#define MPC_TILT_WEIGHT         100 // penalty beyond it, times the theta weight
+#define MPC_BUDGET              0.1 // share of the period mpc_step() may use
+
+// battery compensation, the duty is scaled by BATT_NOMINAL over the filtered
+// voltage sampled at BATT_HZ, so the loop gain stays as designed
+#define BATT_HZ                 10 // sampling task rate
+#define BATT_TAU                1 // s, voltage low-pass
+#define BATT_NOMINAL            7.4 // V, 2S pack the gains are tuned for
+#define BATT_MIN_VOLTS          5.5 // V, below this no battery, scale 1
+#define BATT_MIN_SCALE          0.8
+#define BATT_MAX_SCALE          1.25
+
+// disturbance observer in the inner loop, the body torque that explains what
+// MPC_A and MPC_B do not predict of the body rate, cancelled by a feed-forward
+// duty; off at startup unless MIP_DOB=1, "dob on|off" on CMD_PATH switches it;
+// DOB_E is per Nm, printed by host/lqr_design
+#define DOB_E                   {0.083123991, 15.80665, -0.082938175, -15.152268}
+#define DOB_TAU                 0.03 // s, estimate low-pass
+#define DOB_GAIN                1 // share of the estimate cancelled
+#define DOB_MAX_DUTY            0.5
 
 // electrical hookups
 #define MOTOR_CHANNEL_L			3
@@ -53,16 +212,11 @@
 #define ENCODER_POLARITY_L		1
 #define ENCODER_POLARITY_R		-1
 
-// controller structure
-typedef struct controller_d_t{
-    float gain;
-    int n;
-    int m;
-    float numerator[3];
-    float denominator[3];
-    float inputs[3];
-    float outputs[3];
-    float saturation;
-} controller_d_t;
+// balance controllers, MIP_CONTROLLER selects one at startup
+typedef enum control_mode_t{
+    CONTROL_CASCADE,            // D1 at D1_HZ under D2 at D2_HZ
+    CONTROL_LQR,                // LQR_K on the full state at D1_HZ
+    CONTROL_MPC                 // mpc.c with the MPC_* limits at D1_HZ
+} control_mode_t;
 
 #endif	//MIP_CONFIG
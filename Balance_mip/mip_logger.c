@@ -0,0 +1,134 @@
+/*******************************************************************************
+* mip_logger.c
+*
+* Logger process of balance_mip. Attaches to the shared memory segment
+* balance_mip creates and, TELEM_DRAIN_HZ times a second, appends the inner
+* loop samples waiting in its ring to a CSV file, one line per tick. Samples
+* are released to the ring only once written, so a logger killed at any
+* point and started again loses nothing the ring still holds; ticks the
+* ring had to drop meanwhile are written as a "# lost" line. It waits for
+* balance_mip to start, and again after it exits, so it can be left running.
+*
+* usage: mip_logger [-o log.csv]
+*******************************************************************************/
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "mip_config.h"
+#include "telemetry.h"
+
+static volatile sig_atomic_t stop=0;
+
+static void on_signal(int sig){
+    (void)sig;
+    stop=1;
+    return;
+}
+
+/*******************************************************************************
+* static int drain()
+*
+* Writes every pending sample and releases them once flushed. Samples up to
+* the last tick written were left in the ring by a logger killed between
+* writing and releasing them, and are skipped. Returns -1 if the file
+* cannot be written, leaving the samples for the next logger.
+*******************************************************************************/
+static int drain(telemetry_t* t,FILE* f){
+    uint32_t n=shm_ring_pending(&t->samples);
+    uint32_t last=__atomic_load_n(&t->readers->logged,__ATOMIC_ACQUIRE);
+    telem_sample_t s;
+    uint32_t i;
+
+    for(i=0;i<n;i++){
+        shm_ring_peek(&t->samples,i,&s);
+        if((int32_t)(s.tick-last)<=0) continue;
+        if(s.tick!=last+1) fprintf(f,"# lost %u samples\n",s.tick-last-1);
+        fprintf(f,"%.4f,%u,%u,%u,%u,%u,%.5f,%.5f,%.4f,%.4f,%.3f,%.4f,%.4f," \
+                "%.3f\n",s.start_ns*1e-9,s.tick,s.state,s.mode,s.arg, \
+                s.recover,s.theta,s.reference,s.duty,s.steer,s.wheel_rate, \
+                s.heading,s.heading_reference,s.volts);
+        last=s.tick;
+    }
+    if(fflush(f)) return -1;
+    __atomic_store_n(&t->readers->logged,last,__ATOMIC_RELEASE);
+    shm_ring_release(&t->samples,n);
+    return 0;
+}
+
+int main(int argc,char* argv[]){
+    const char* name=TELEM_NAME;
+    const char* path=TELEM_LOG_PATH;
+    telemetry_t t;
+    FILE* f;
+    int c,alive,waiting=0,ret=0;
+
+    if(getenv("MIP_SHM")!=NULL) name=getenv("MIP_SHM");
+    if(getenv("MIP_LOG")!=NULL) path=getenv("MIP_LOG");
+    while((c=getopt(argc,argv,"o:"))!=-1){
+        switch(c){
+        case 'o':
+            path=optarg;
+            break;
+        default:
+            fprintf(stderr,"usage: mip_logger [-o log.csv]\n");
+            return 1;
+        }
+    }
+    f=fopen(path,"a");
+    if(f==NULL){
+        perror(path);
+        return 1;
+    }
+    signal(SIGINT,on_signal);
+    signal(SIGTERM,on_signal);
+    t.shm=NULL;
+
+    while(!stop){
+        if(t.shm==NULL){
+            ret=telemetry_attach(&t,name,TELEM_LOGGER);
+            if(ret<-1) break;
+            ret=0;
+            if(t.shm==NULL){
+                if(!waiting) printf("waiting for balance_mip\n");
+                fflush(stdout);
+                waiting=1;
+                usleep(TELEM_RETRY*1000000);
+                continue;
+            }
+            waiting=0;
+            printf("logging balance_mip pid %d to %s\n",t.shm->control_pid, \
+                   path);
+            fflush(stdout);
+            fseek(f,0,SEEK_END);
+            if(ftell(f)==0){
+                fprintf(f,"t,tick,state,mode,arg,recover,theta,reference," \
+                        "duty,steer,wheel_rate,heading,heading_reference," \
+                        "volts\n");
+            }
+            fprintf(f,"# balance_mip pid %d\n",t.shm->control_pid);
+        }
+        // what was published before an exit is still written out
+        alive=telemetry_alive(&t);
+        if(drain(&t,f)){
+            perror(path);
+            ret=1;
+            break;
+        }
+        if(!alive){
+            printf("balance_mip exited\n");
+            fflush(stdout);
+            telemetry_detach(&t);
+            continue;
+        }
+        usleep(1000000/TELEM_DRAIN_HZ);
+    }
+    if(ret<0) ret=1;
+    else if(t.shm!=NULL && drain(&t,f)){
+        perror(path);
+        ret=1;
+    }
+    telemetry_detach(&t);
+    fclose(f);
+    return ret;
+}
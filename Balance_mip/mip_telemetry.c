@@ -0,0 +1,83 @@
+/*******************************************************************************
+* mip_telemetry.c
+*
+* Console process of balance_mip. Prints the status line from the snapshot
+* balance_mip writes every inner loop tick, STATUS_HZ times a second, and
+* says so when the ticks have stopped for TELEM_STALE. Like mip_logger it
+* waits for balance_mip to start, and again after it exits, and can be
+* stopped, hung or restarted without balance_mip noticing.
+*
+* usage: mip_telemetry
+*******************************************************************************/
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include "mip_config.h"
+#include "telemetry.h"
+
+static volatile sig_atomic_t stop=0;
+
+static void on_signal(int sig){
+    (void)sig;
+    stop=1;
+    return;
+}
+
+int main(int argc,char* argv[]){
+    const char* labels[TELEM_VALUES]=TELEM_LABELS;
+    const char* name=TELEM_NAME;
+    const int stale_frames=(int)(TELEM_STALE*STATUS_HZ);
+    telem_status_t st;
+    telemetry_t t;
+    uint32_t last_tick=0;
+    int i,alive,stale=0,waiting=0;
+
+    if(argc>1){
+        fprintf(stderr,"usage: mip_telemetry\n");
+        return 1;
+    }
+    if(getenv("MIP_SHM")!=NULL) name=getenv("MIP_SHM");
+    signal(SIGINT,on_signal);
+    signal(SIGTERM,on_signal);
+    t.shm=NULL;
+
+    while(!stop){
+        if(t.shm==NULL){
+            if(telemetry_attach(&t,name,TELEM_CONSOLE)<-1) return 1;
+            if(t.shm==NULL){
+                if(!waiting) printf("waiting for balance_mip\n");
+                fflush(stdout);
+                waiting=1;
+                usleep(TELEM_RETRY*1000000);
+                continue;
+            }
+            waiting=0;
+            last_tick=0;
+            stale=0;
+        }
+        alive=telemetry_alive(&t);
+        // a frame the writer kept tearing is skipped, not waited for
+        if(shm_snapshot_read(&t.status,&st)==0){
+            if(st.tick!=last_tick) stale=0;
+            else if(stale<stale_frames) stale++;
+            last_tick=st.tick;
+            printf("\r");
+            for(i=0;i<TELEM_VALUES;i++){
+                printf("%s= %f,",labels[i],st.values[i]);
+            }
+            printf(" %-32s",(stale>=stale_frames)?"not responding":st.msg);
+            fflush(stdout);
+        }
+        if(!alive){
+            printf("\nbalance_mip exited\n");
+            fflush(stdout);
+            telemetry_detach(&t);
+            continue;
+        }
+        usleep(1000000/STATUS_HZ);
+    }
+    printf("\n");
+    telemetry_detach(&t);
+    return 0;
+}
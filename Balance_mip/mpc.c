@@ -0,0 +1,239 @@
+/*******************************************************************************
+* mpc.c
+*
+* Condensed linear MPC with a fixed-iteration projected gradient solver.
+*
+* With U the N future duties, the predicted states are X = Phi x + Gamma U
+* and the cost is 1/2 U'HU + (Fx)'U plus a quadratic penalty on predicted
+* tilt beyond MPC_MAX_THETA. The duty limits are a box, so each iteration
+* is a gradient step followed by a clip.
+*******************************************************************************/
+#include <math.h>
+#include <string.h>
+#include "mpc.h"
+
+#define POWER_ITERATIONS        200 // for the Lipschitz constant
+
+/*******************************************************************************
+* int mpc_dare()
+*
+* P = Q + A'PA - A'PB (R + B'PB)^-1 B'PA, single input so the inverse is a
+* division.
+*******************************************************************************/
+int mpc_dare(const double A[MPC_NX][MPC_NX],const double B[MPC_NX], \
+             const double q[MPC_NX],double r,double P[MPC_NX][MPC_NX], \
+             double K[MPC_NX]){
+    double PA[MPC_NX][MPC_NX],PB[MPC_NX],N[MPC_NX][MPC_NX],s,change,size,v;
+    int i,j,k,it;
+
+    memset(P,0,sizeof(double)*MPC_NX*MPC_NX);
+    for(i=0;i<MPC_NX;i++) P[i][i]=q[i];
+    for(it=1;it<=100000;it++){
+        for(i=0;i<MPC_NX;i++){
+            PB[i]=0;
+            for(j=0;j<MPC_NX;j++){
+                PA[i][j]=0;
+                for(k=0;k<MPC_NX;k++) PA[i][j]+=P[i][k]*A[k][j];
+                PB[i]+=P[i][j]*B[j];
+            }
+        }
+        // K = (R + B'PB)^-1 B'PA
+        s=r;
+        for(i=0;i<MPC_NX;i++) s+=B[i]*PB[i];
+        for(j=0;j<MPC_NX;j++){
+            K[j]=0;
+            for(i=0;i<MPC_NX;i++) K[j]+=B[i]*PA[i][j];
+            K[j]/=s;
+        }
+        // P' = Q + A'P(A - BK)
+        for(i=0;i<MPC_NX;i++){
+            for(j=0;j<MPC_NX;j++){
+                N[i][j]=(i==j)?q[i]:0;
+                for(k=0;k<MPC_NX;k++){
+                    N[i][j]+=A[k][i]*(PA[k][j]-PB[k]*K[j]);
+                }
+            }
+        }
+        change=0;
+        size=0;
+        for(i=0;i<MPC_NX;i++){
+            for(j=0;j<MPC_NX;j++){
+                // keep P symmetric against rounding
+                v=0.5*(N[i][j]+N[j][i]);
+                change+=fabs(v-P[i][j]);
+                size+=fabs(v);
+                N[i][j]=v;
+            }
+        }
+        memcpy(P,N,sizeof(N));
+        if(!isfinite(size)) return -1;
+        if(change<=1e-12*size) return it;
+    }
+    return -1;
+}
+
+/*******************************************************************************
+* int mpc_init()
+*
+* Prediction k=1..N of the state is A^k x + sum_j A^(k-1-j) B u_j. Stages
+* 1..N-1 are weighted by Q and the last by the Riccati P, so without active
+* limits the first duty is the LQR one. Runs once before the loops start,
+* in double precision.
+*******************************************************************************/
+int mpc_init(mpc_t* m){
+    static const double A[MPC_NX][MPC_NX]=MPC_A;
+    static const double B[MPC_NX]=MPC_B;
+    static const double dev[MPC_NX]=MPC_DEVIATION;
+    static double gamma[MPC_HORIZON][MPC_HORIZON][MPC_NX];
+    static double phi[MPC_HORIZON][MPC_NX][MPC_NX];
+    static double h[MPC_HORIZON][MPC_HORIZON],v[MPC_HORIZON],w[MPC_HORIZON];
+    double P[MPC_NX][MPC_NX],K[MPC_NX],q[MPC_NX],W[MPC_NX][MPC_NX];
+    double r,s,wg,norm,lipschitz=0,t=1,t_next;
+    int i,j,k,a,b,n;
+
+    memset(m,0,sizeof(*m));
+    for(i=0;i<MPC_NX;i++) q[i]=1/(dev[i]*dev[i]);
+    r=1/(MPC_DUTY_DEVIATION*MPC_DUTY_DEVIATION);
+    if(mpc_dare(A,B,q,r,P,K)<0) return -1;
+
+    // phi[k] = A^(k+1), gamma[k][j] = A^(k-j) B for j<=k, else 0
+    for(k=0;k<MPC_HORIZON;k++){
+        for(a=0;a<MPC_NX;a++){
+            for(b=0;b<MPC_NX;b++){
+                if(k==0) phi[k][a][b]=A[a][b];
+                else{
+                    s=0;
+                    for(i=0;i<MPC_NX;i++) s+=A[a][i]*phi[k-1][i][b];
+                    phi[k][a][b]=s;
+                }
+            }
+        }
+        for(j=0;j<MPC_HORIZON;j++){
+            for(a=0;a<MPC_NX;a++){
+                if(j>k) gamma[k][j][a]=0;
+                else if(j==k) gamma[k][j][a]=B[a];
+                else{
+                    s=0;
+                    for(i=0;i<MPC_NX;i++) s+=A[a][i]*gamma[k-1][j][i];
+                    gamma[k][j][a]=s;
+                }
+            }
+        }
+    }
+
+    // H = Gamma' Qbar Gamma + R, F = Gamma' Qbar Phi
+    memset(h,0,sizeof(h));
+    for(k=0;k<MPC_HORIZON;k++){
+        for(a=0;a<MPC_NX;a++){
+            for(b=0;b<MPC_NX;b++){
+                W[a][b]=(k==MPC_HORIZON-1)?P[a][b]:((a==b)?q[a]:0);
+            }
+        }
+        for(i=0;i<MPC_HORIZON;i++){
+            for(a=0;a<MPC_NX;a++){
+                // row a of Qbar times column i of Gamma
+                wg=0;
+                for(b=0;b<MPC_NX;b++) wg+=W[a][b]*gamma[k][i][b];
+                for(j=0;j<MPC_HORIZON;j++) h[i][j]+=gamma[k][j][a]*wg;
+                for(b=0;b<MPC_NX;b++) m->F[i][b]+=wg*phi[k][a][b];
+            }
+        }
+        for(j=0;j<MPC_HORIZON;j++) m->St[k][j]=gamma[k][j][0];
+        for(b=0;b<MPC_NX;b++) m->Pt[k][b]=phi[k][0][b];
+    }
+    m->tilt_weight=MPC_TILT_WEIGHT*q[0];
+    for(i=0;i<MPC_HORIZON;i++){
+        h[i][i]+=r;
+        for(j=0;j<MPC_HORIZON;j++) m->H[i][j]=h[i][j];
+    }
+
+    // Lipschitz constant of the gradient with the tilt penalty active,
+    // largest eigenvalue of H + w St'St by power iteration
+    for(i=0;i<MPC_HORIZON;i++) v[i]=1;
+    for(n=0;n<POWER_ITERATIONS;n++){
+        norm=0;
+        for(i=0;i<MPC_HORIZON;i++){
+            w[i]=0;
+            for(j=0;j<MPC_HORIZON;j++){
+                s=h[i][j];
+                for(k=0;k<MPC_HORIZON;k++){
+                    s+=m->tilt_weight*(double)m->St[k][i]*m->St[k][j];
+                }
+                w[i]+=s*v[j];
+            }
+            norm+=w[i]*w[i];
+        }
+        norm=sqrt(norm);
+        lipschitz=norm;
+        for(i=0;i<MPC_HORIZON;i++) v[i]=w[i]/norm;
+    }
+    m->step=1/lipschitz;
+
+    // Nesterov momentum for each of the fixed iterations
+    for(n=0;n<MPC_ITERATIONS;n++){
+        t_next=0.5*(1+sqrt(1+4*t*t));
+        m->momentum[n]=(t-1)/t_next;
+        t=t_next;
+    }
+    return 0;
+}
+
+void mpc_reset(mpc_t* m){
+    memset(m->u,0,sizeof(m->u));
+    return;
+}
+
+/*******************************************************************************
+* float mpc_step()
+*
+* MPC_ITERATIONS accelerated projected gradient steps from the shifted
+* previous solution. Every iteration does the same work whatever the state.
+*******************************************************************************/
+float mpc_step(mpc_t* m,const float x[MPC_NX]){
+    float f[MPC_HORIZON],pt[MPC_HORIZON],y[MPC_HORIZON],prev[MPC_HORIZON];
+    float g[MPC_HORIZON],d[MPC_HORIZON],s,theta,duty;
+    int i,j,n,limited=0,saturated=0;
+
+    for(i=0;i<MPC_HORIZON;i++){
+        f[i]=0;
+        pt[i]=0;
+        for(j=0;j<MPC_NX;j++){
+            f[i]+=m->F[i][j]*x[j];
+            pt[i]+=m->Pt[i][j]*x[j];
+        }
+        y[i]=m->u[i];
+        prev[i]=m->u[i];
+    }
+    for(n=0;n<MPC_ITERATIONS;n++){
+        // tilt beyond the limit, predicted from y
+        limited=0;
+        for(i=0;i<MPC_HORIZON;i++){
+            theta=pt[i];
+            for(j=0;j<=i;j++) theta+=m->St[i][j]*y[j];
+            d[i]=theta-fmaxf(fminf(theta,MPC_MAX_THETA),-MPC_MAX_THETA);
+            limited|=(d[i]!=0);
+        }
+        // gradient of the cost and the penalty
+        for(i=0;i<MPC_HORIZON;i++){
+            s=f[i];
+            for(j=0;j<MPC_HORIZON;j++) s+=m->H[i][j]*y[j];
+            for(j=i;j<MPC_HORIZON;j++) s+=m->tilt_weight*m->St[j][i]*d[j];
+            g[i]=s;
+        }
+        // projected step, then extrapolate
+        for(i=0;i<MPC_HORIZON;i++){
+            s=y[i]-m->step*g[i];
+            s=fmaxf(fminf(s,MPC_MAX_DUTY),-MPC_MAX_DUTY);
+            y[i]=s+m->momentum[n]*(s-prev[i]);
+            prev[i]=s;
+        }
+    }
+    duty=prev[0];
+    saturated=fabsf(duty)>=MPC_MAX_DUTY;
+    m->saturated+=saturated;
+    m->tilt_limited+=limited;
+    // warm start: the rest of this plan, holding the last duty
+    for(i=0;i<MPC_HORIZON-1;i++) m->u[i]=prev[i+1];
+    m->u[MPC_HORIZON-1]=prev[MPC_HORIZON-1];
+    return duty;
+}
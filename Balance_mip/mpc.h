@@ -0,0 +1,53 @@
+/*******************************************************************************
+* mpc.h
+*
+* Model predictive balance controller for balance_mip. Each tick minimizes
+* the LQR cost over MPC_HORIZON ticks of the linear model, with the LQR
+* Riccati solution as terminal cost, subject to |duty| <= MPC_MAX_DUTY and
+* a soft limit |theta| <= MPC_MAX_THETA on every predicted step. Away from
+* the limits the first duty equals the LQR duty.
+*
+* The problem is condensed to the N future duties at startup, and solved
+* each tick by accelerated projected gradient with a fixed MPC_ITERATIONS,
+* warm started from the previous solution shifted by one tick. No step
+* depends on the data, so the execution time is the same every tick and
+* host/wcet_mip measures it. No hardware dependencies.
+*******************************************************************************/
+
+#ifndef MPC
+#define MPC
+
+#include <stdint.h>
+#include "mip_config.h"
+
+#define MPC_NX                  4 // theta, theta_dot, phi, phi_dot
+
+typedef struct mpc_t{
+    // condensed problem, fixed after mpc_init()
+    float H[MPC_HORIZON][MPC_HORIZON];      // duty Hessian
+    float F[MPC_HORIZON][MPC_NX];           // gradient per initial state
+    float St[MPC_HORIZON][MPC_HORIZON];     // predicted theta per duty
+    float Pt[MPC_HORIZON][MPC_NX];          // predicted theta per state
+    float tilt_weight;                      // soft limit penalty
+    float step;                             // 1/Lipschitz constant
+    float momentum[MPC_ITERATIONS];         // accelerated gradient weights
+    // solver state
+    float u[MPC_HORIZON];                   // last solution, warm start
+    uint32_t saturated;                     // ticks with a duty at the limit
+    uint32_t tilt_limited;                  // ticks predicting the tilt limit
+} mpc_t;
+
+// Riccati solution P and gain K of the discrete LQR problem, iterated until
+// P changes less than a relative 1e-12; returns the iterations or -1
+int mpc_dare(const double A[MPC_NX][MPC_NX],const double B[MPC_NX], \
+             const double q[MPC_NX],double r,double P[MPC_NX][MPC_NX], \
+             double K[MPC_NX]);
+// builds the condensed problem from MPC_A, MPC_B and the MPC_* weights,
+// returns -1 if the Riccati iteration fails
+int mpc_init(mpc_t* m);
+// forget the warm start, e.g. when balancing starts
+void mpc_reset(mpc_t* m);
+// one tick: x is the state less its reference, returns the duty to apply
+float mpc_step(mpc_t* m,const float x[MPC_NX]);
+
+#endif	//MPC
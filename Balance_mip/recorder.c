@@ -0,0 +1,204 @@
+/*******************************************************************************
+* recorder.c
+*
+* Lock-free event ring for balance_mip. Writers claim a slot with an atomic
+* increment and publish it by storing its sequence number last, so the dump
+* can skip slots that are still being filled or were overwritten while it
+* copied them. Keyframes have a single writer and are published the same
+* way.
+*******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "recorder.h"
+
+// a dump leaves the oldest 1/DUMP_MARGIN of a full ring to the writers, so
+// they only overtake it if writing the file takes that long
+#define DUMP_MARGIN             8
+
+/*******************************************************************************
+* void recorder_init()
+*
+* Takes caller-owned buffers of len events and key_len keyframes and clears
+* them. Clearing touches every page, so with memory locked no page fault is
+* left for the loops.
+*******************************************************************************/
+void recorder_init(recorder_t* r,rec_event_t* buffer,uint32_t len, \
+                   rec_keyframe_t* keys,uint32_t key_len){
+    memset(buffer,0,len*sizeof(rec_event_t));
+    memset(keys,0,key_len*sizeof(rec_keyframe_t));
+    memset(&r->info,0,sizeof(r->info));
+    r->events=buffer;
+    r->len=len;
+    r->head=0;
+    r->keys=keys;
+    r->key_len=key_len;
+    r->key_head=0;
+    r->mark=0;
+    return;
+}
+
+/*******************************************************************************
+* uint32_t recorder_add()
+*
+* Copies ev over the oldest slot once the ring has wrapped, so a dump always
+* ends with the latest events. Returns the seq given to ev, 0 without a
+* buffer, as in the host tools that never call recorder_init().
+*******************************************************************************/
+uint32_t recorder_add(recorder_t* r,const rec_event_t* ev){
+    uint32_t i;
+    rec_event_t* slot;
+    if(r->len==0) return 0;
+    i=__atomic_fetch_add(&r->head,1,__ATOMIC_RELAXED);
+    slot=&r->events[i%r->len];
+    __atomic_store_n(&slot->seq,0,__ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    *slot=*ev;
+    slot->seq=0;
+    // publish the event only after it is fully written
+    __atomic_store_n(&slot->seq,i+1,__ATOMIC_RELEASE);
+    return i+1;
+}
+
+/*******************************************************************************
+* void recorder_keyframe()
+*
+* Copies size bytes of state into the oldest keyframe slot. seq is the event
+* the state follows, playback resumes with the next one.
+*******************************************************************************/
+void recorder_keyframe(recorder_t* r,uint32_t seq,uint64_t start_ns, \
+                       const void* state,uint32_t size){
+    rec_keyframe_t* k;
+    if(r->key_len==0 || seq==0 || size>REC_KEY_BYTES) return;
+    k=&r->keys[r->key_head%r->key_len];
+    __atomic_store_n(&k->seq,0,__ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    k->size=size;
+    k->start_ns=start_ns;
+    memcpy(k->state,state,size);
+    __atomic_store_n(&k->seq,seq,__ATOMIC_RELEASE);
+    __atomic_store_n(&r->key_head,r->key_head+1,__ATOMIC_RELEASE);
+    return;
+}
+
+/*******************************************************************************
+* void recorder_mark()
+* int recorder_take_mark()
+*
+* The mark also notes the last event before it, playback -m starts at the
+* keyframe before that.
+*******************************************************************************/
+void recorder_mark(recorder_t* r){
+    __atomic_store_n(&r->info.mark,__atomic_load_n(&r->head,__ATOMIC_ACQUIRE), \
+                     __ATOMIC_RELAXED);
+    __atomic_store_n(&r->mark,1,__ATOMIC_RELEASE);
+    return;
+}
+
+int recorder_take_mark(recorder_t* r){
+    return __atomic_exchange_n(&r->mark,0,__ATOMIC_ACQ_REL);
+}
+
+/*******************************************************************************
+* int recorder_dump()
+*
+* Writes the header, the committed events from the oldest still in the ring
+* and the keyframes playback can start from. Each event is copied and its
+* seq checked again afterwards; a slot claimed but not yet published, or
+* overwritten meanwhile, ends the dump, so it never contains a half-written
+* event or a gap in the sequence. The header is written last, once the
+* counts are known.
+*******************************************************************************/
+int recorder_dump(recorder_t* r,const char* path){
+    FILE* f;
+    uint32_t head=__atomic_load_n(&r->head,__ATOMIC_ACQUIRE);
+    uint32_t key_head=__atomic_load_n(&r->key_head,__ATOMIC_ACQUIRE);
+    uint32_t first=0,i,n=0,keys=0,last;
+    rec_header_t info=r->info;
+    rec_event_t ev;
+    rec_keyframe_t key;
+
+    if(head>r->len) first=head-r->len+r->len/DUMP_MARGIN;
+    f=fopen(path,"wb");
+    if(f==NULL){
+        perror(path);
+        return -1;
+    }
+    if(fwrite(&info,sizeof(info),1,f)!=1) goto fail;
+    for(i=first;i<head;i++){
+        rec_event_t* slot=&r->events[i%r->len];
+        if(__atomic_load_n(&slot->seq,__ATOMIC_ACQUIRE)!=i+1) break;
+        ev=*slot;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if(__atomic_load_n(&slot->seq,__ATOMIC_RELAXED)!=i+1) break;
+        ev.seq=i+1;
+        if(fwrite(&ev,sizeof(ev),1,f)!=1) goto fail;
+        n++;
+    }
+    // keyframes whose next event is dumped, oldest first
+    last=first+n;
+    for(i=key_head>r->key_len?key_head-r->key_len:0;i<key_head;i++){
+        rec_keyframe_t* slot=&r->keys[i%r->key_len];
+        uint32_t seq=__atomic_load_n(&slot->seq,__ATOMIC_ACQUIRE);
+        if(seq==0 || seq<first || seq>=last) continue;
+        key=*slot;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if(__atomic_load_n(&slot->seq,__ATOMIC_RELAXED)!=seq) continue;
+        if(fwrite(&key,sizeof(key),1,f)!=1) goto fail;
+        keys++;
+    }
+
+    info.magic=REC_MAGIC;
+    info.event_size=sizeof(rec_event_t);
+    info.count=n;
+    info.first=first+1;
+    info.key_size=sizeof(rec_keyframe_t);
+    info.keyframes=keys;
+    if(fseek(f,0,SEEK_SET) || fwrite(&info,sizeof(info),1,f)!=1) goto fail;
+    fclose(f);
+    return n;
+
+fail:
+    fprintf(stderr,"ERROR: failed to write %s\n",path);
+    fclose(f);
+    return -1;
+}
+
+/*******************************************************************************
+* int recorder_load()
+*
+* Reads a dump written by recorder_dump() on this or another machine.
+*******************************************************************************/
+int recorder_load(const char* path,rec_header_t* info,rec_event_t** events, \
+                  rec_keyframe_t** keys){
+    FILE* f=fopen(path,"rb");
+    rec_event_t* e;
+    rec_keyframe_t* k;
+
+    if(f==NULL){
+        perror(path);
+        return -1;
+    }
+    if(fread(info,sizeof(*info),1,f)!=1 || info->magic!=REC_MAGIC || \
+       info->event_size!=sizeof(rec_event_t) || \
+       info->key_size!=sizeof(rec_keyframe_t)){
+        fprintf(stderr,"ERROR: %s is not a balance_mip recording\n",path);
+        fclose(f);
+        return -1;
+    }
+    e=malloc((info->count?info->count:1)*sizeof(rec_event_t));
+    k=malloc((info->keyframes?info->keyframes:1)*sizeof(rec_keyframe_t));
+    if(e==NULL || k==NULL || \
+       fread(e,sizeof(rec_event_t),info->count,f)!=info->count || \
+       fread(k,sizeof(rec_keyframe_t),info->keyframes,f)!=info->keyframes){
+        fprintf(stderr,"ERROR: %s is truncated\n",path);
+        free(e);
+        free(k);
+        fclose(f);
+        return -1;
+    }
+    fclose(f);
+    *events=e;
+    *keys=k;
+    return info->count;
+}
@@ -0,0 +1,118 @@
+/*******************************************************************************
+* recorder.h
+*
+* Flight recorder for balance_mip. Every input that crosses the hardware or
+* thread boundary of the control code (IMU samples, encoder counts, the state
+* and theta_r/current_theta values each loop saw, loop start and execution
+* times, button presses, watchdog polls and motion commands) is appended as
+* one event to a preallocated ring, in the order the loops committed them,
+* overwriting the oldest. Every REC_KEY_TICKS the inner loop adds a keyframe,
+* a copy of all the state the control code carries between ticks, so
+* playback can start at any keyframe still covered by the ring.
+* Appending never allocates, blocks or makes a system call, so the recorder
+* stays enabled in normal runs. host/playback_mip re-executes a dump
+* against the same control code. Has no hardware dependencies.
+*******************************************************************************/
+
+#ifndef RECORDER
+#define RECORDER
+
+#include <stdint.h>
+
+#define REC_MAGIC               0x4143524d // "MRCA"
+#define REC_KEY_BYTES           2048 // room for the state in a keyframe
+
+typedef enum rec_type_t{
+    REC_INNER,          // in: accel_y,accel_z,gyro_x,theta_r,gyro_y,gyro_z,
+                        //     heading_reference,battery scale
+                        // out: theta,duty,steer before the shaping and
+                        //      the battery scale
+                        // (in[3] is phi_reference in lqr and mpc mode)
+                        // arg: bit 0 while measuring the calibration,
+                        //      bit 1 with the disturbance feed-forward on,
+                        //      bit 2 while characterizing the actuator,
+                        //      bit 3 while recovering from a fall,
+                        //      when duty and steer are not shaped
+                        // count: encoders L,R read by the tick
+    REC_OUTER,          // count: encoders L,R  in: current_theta  out: theta_r
+    REC_BUTTON,         // arg: 1 pressed, 0 released
+    REC_POLL,           // watchdog_poll() from the supervisor forced a stop
+    REC_COMMAND         // motion command taken by the loop stepping the
+                        // trajectory, arg: traj_cmd_type_t
+                        // in: forward,heading
+} rec_type_t;
+
+// one recorded event, fixed layout so dumps read the same on any host
+typedef struct rec_event_t{
+    uint32_t seq;               // 1-based commit order, 0 while being written
+    uint8_t type;
+    uint8_t state;              // rc_state_t seen by the loop
+    uint8_t mode;               // wd_mode_t of the inner tick
+    uint8_t arg;
+    uint64_t start_ns;          // rt_now_ns() at loop start
+    uint64_t exec_ns;           // execution time given to the watchdog
+    float in[8];
+    int32_t count[2];
+    float out[3];
+} rec_event_t;
+
+// control state after one event, opaque to the recorder
+typedef struct rec_keyframe_t{
+    uint32_t seq;               // of the event, 0 while being written
+    uint32_t size;              // bytes of state in use
+    uint64_t start_ns;          // of the event
+    uint8_t state[REC_KEY_BYTES];
+} rec_keyframe_t;
+
+// dump file header, followed by the events and then the keyframes
+typedef struct rec_header_t{
+    uint32_t magic;
+    uint32_t event_size;
+    uint32_t count;
+    uint32_t first;             // seq of the first event, older are overwritten
+    uint32_t inject_loop;       // fault injection active during the run
+    uint32_t inject_every;
+    uint64_t inject_ns;
+    float theta_offset;         // calibration in use when recording started
+    float gyro_bias;
+    uint32_t controller;        // control_mode_t of the run
+    float act_deadband[2];      // actuator shaping when recording started
+    float act_friction[2];
+    float act_scale[2];
+    uint32_t recover_kick;      // self-righting on
+    uint32_t key_size;
+    uint32_t keyframes;
+    uint32_t mark;              // seq of the last event before the last mark
+} rec_header_t;
+
+typedef struct recorder_t{
+    rec_event_t* events;
+    uint32_t len;
+    uint32_t head;              // events claimed, shared by all writers
+    rec_keyframe_t* keys;
+    uint32_t key_len;
+    uint32_t key_head;          // keyframes written, single writer
+    int mark;                   // set by recorder_mark(), cleared on read
+    rec_header_t info;
+} recorder_t;
+
+// buffers are owned by the caller and zeroed here, so they are faulted in now
+void recorder_init(recorder_t* r,rec_event_t* buffer,uint32_t len, \
+                   rec_keyframe_t* keys,uint32_t key_len);
+// from any thread: copy ev over the oldest slot, returns its seq
+uint32_t recorder_add(recorder_t* r,const rec_event_t* ev);
+// from one thread: size bytes of state as they are after event seq
+void recorder_keyframe(recorder_t* r,uint32_t seq,uint64_t start_ns, \
+                       const void* state,uint32_t size);
+// request a dump from a loop that must not do file I/O itself
+void recorder_mark(recorder_t* r);
+// returns 1 once per recorder_mark()
+int recorder_take_mark(recorder_t* r);
+// write the committed events and the keyframes they cover to path, safe
+// while writers are running; returns the events written or -1
+int recorder_dump(recorder_t* r,const char* path);
+// read a dump, allocates *events and *keys, returns the event count or -1
+int recorder_load(const char* path,rec_header_t* info,rec_event_t** events, \
+                  rec_keyframe_t** keys);
+
+#endif	//RECORDER
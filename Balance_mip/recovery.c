@@ -0,0 +1,107 @@
+/*******************************************************************************
+* recovery.c
+*
+* Fall detection, lying detection and the self-righting kick.
+*******************************************************************************/
+#include <math.h>
+#include "mip_config.h"
+#include "recovery.h"
+
+void recovery_init(recovery_t* r,float hz,int kick){
+    r->kick=kick;
+    r->lying_ticks=(uint32_t)(RECOVER_LYING_TIME*hz);
+    r->wind_ticks=(uint32_t)(RECOVER_WIND_TIME*hz);
+    r->kick_ticks=(uint32_t)(RECOVER_KICK_TIME*hz);
+    r->upright_ticks=(uint32_t)(RECOVER_UPRIGHT_TIME*hz);
+    r->falls=0;
+    r->kicked=0;
+    r->captured=0;
+    r->down_ticks=0;
+    recovery_reset(r);
+    return;
+}
+
+void recovery_reset(recovery_t* r){
+    r->state=RECOVER_UPRIGHT;
+    r->ticks=0;
+    r->sign=0;
+    r->duty=0;
+    r->kicks=0;
+    return;
+}
+
+static void enter(recovery_t* r,recover_state_t state){
+    r->state=state;
+    r->ticks=0;
+    return;
+}
+
+/*******************************************************************************
+* recover_state_t recovery_step()
+*
+* The capture window is checked first, so a MiP stood up by hand or by the
+* kick balances from the tick it gets there. Lying is judged on the rate
+* alone past TIP_ANGLE, the ground stops the body wherever it rests.
+*******************************************************************************/
+recover_state_t recovery_step(recovery_t* r,float theta,float theta_dot){
+    r->ticks++;
+    if(r->state!=RECOVER_UPRIGHT){
+        r->down_ticks++;
+        if(fabsf(theta)<RECOVER_CAPTURE_ANGLE){
+            if(r->state==RECOVER_KICK) r->captured++;
+            enter(r,RECOVER_UPRIGHT);
+            return r->state;
+        }
+    }
+    switch(r->state){
+    case RECOVER_UPRIGHT:
+        if(r->ticks>=r->upright_ticks) r->kicks=0;
+        if(fabsf(theta)>TIP_ANGLE){
+            r->falls++;
+            enter(r,RECOVER_FALLEN);
+        }
+        break;
+    case RECOVER_FALLEN:
+        if(fabsf(theta)<=TIP_ANGLE || fabsf(theta_dot)>=RECOVER_STILL_RATE){
+            r->ticks=0;
+        }
+        else if(r->ticks>=r->lying_ticks) enter(r,RECOVER_LYING);
+        break;
+    case RECOVER_LYING:
+        if(fabsf(theta)<=TIP_ANGLE || fabsf(theta_dot)>=RECOVER_STILL_RATE){
+            enter(r,RECOVER_FALLEN);
+        }
+        else if(r->kick && r->kicks<RECOVER_MAX_KICKS){
+            r->sign=(theta>0)?1:-1;
+            r->duty=-r->sign*RECOVER_WIND_DUTY;
+            r->kicks++;
+            r->kicked++;
+            enter(r,RECOVER_KICK);
+        }
+        break;
+    case RECOVER_KICK:
+        if(r->ticks>=r->wind_ticks) r->duty=r->sign*RECOVER_KICK_DUTY;
+        if(r->ticks>=r->wind_ticks+r->kick_ticks) enter(r,RECOVER_FALLEN);
+        break;
+    }
+    return r->state;
+}
+
+float recovery_duty(const recovery_t* r){
+    if(r->state!=RECOVER_KICK) return 0;
+    return r->duty;
+}
+
+const char* recovery_state_name(recover_state_t state){
+    switch(state){
+    case RECOVER_UPRIGHT:
+        return "upright";
+    case RECOVER_FALLEN:
+        return "fallen";
+    case RECOVER_LYING:
+        return "lying";
+    case RECOVER_KICK:
+        return "self-righting";
+    }
+    return "unknown";
+}
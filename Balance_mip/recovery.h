@@ -0,0 +1,58 @@
+/*******************************************************************************
+* recovery.h
+*
+* Fall recovery for balance_mip. Past TIP_ANGLE the motors go off and the
+* MiP falls to the ground; once its body rate has stayed below
+* RECOVER_STILL_RATE for RECOVER_LYING_TIME it is lying. Without the kick it
+* waits there to be picked up. With it, both wheels are first wound up away
+* from the side it lies on for RECOVER_WIND_TIME and then driven toward it
+* at RECOVER_KICK_DUTY for at most RECOVER_KICK_TIME. Reversing the spinning
+* wheels pitches the body up hard, and the moderate kick duty lets them
+* arrive near upright slow, with the authority left to catch it. Whichever
+* way it comes up, balancing restarts once |theta| is inside
+* RECOVER_CAPTURE_ANGLE. A kick that ends outside the window leaves it
+* falling again, and after RECOVER_MAX_KICKS without balancing
+* RECOVER_UPRIGHT_TIME in between it waits to be picked up. Constant work
+* per tick, no hardware dependencies.
+*******************************************************************************/
+
+#ifndef RECOVERY
+#define RECOVERY
+
+#include <stdint.h>
+
+typedef enum recover_state_t{
+    RECOVER_UPRIGHT,    // balancing
+    RECOVER_FALLEN,     // past TIP_ANGLE or not yet captured, motors off
+    RECOVER_LYING,      // still on the ground, motors off
+    RECOVER_KICK        // self-righting kick
+} recover_state_t;
+
+typedef struct recovery_t{
+    int kick;                   // 1 to self-right, 0 to wait for a hand
+    uint32_t lying_ticks;
+    uint32_t wind_ticks;
+    uint32_t kick_ticks;
+    uint32_t upright_ticks;
+    recover_state_t state;
+    uint32_t ticks;             // in the state
+    float sign;                 // toward the side lying on
+    float duty;                 // of the kick
+    int kicks;                  // since balancing RECOVER_UPRIGHT_TIME
+    // totals over the run
+    uint32_t falls;
+    uint32_t kicked;            // kicks made
+    uint32_t captured;          // kicks that ended balancing
+    uint64_t down_ticks;        // ticks not balancing after a fall
+} recovery_t;
+
+void recovery_init(recovery_t* r,float hz,int kick);
+// upright with no kicks made, e.g. after another mode held the motors
+void recovery_reset(recovery_t* r);
+// one inner loop tick with the body angle and rate, returns the new state
+recover_state_t recovery_step(recovery_t* r,float theta,float theta_dot);
+// duty for both motors while kicking, 0 otherwise
+float recovery_duty(const recovery_t* r);
+const char* recovery_state_name(recover_state_t state);
+
+#endif	//RECOVERY
@@ -0,0 +1,179 @@
+/*******************************************************************************
+* telemetry.c
+*
+* Layout of the balance_mip shared memory segment and both ends of it.
+*******************************************************************************/
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "telemetry.h"
+
+// message for the status line, set from any thread of the control process
+static const char* telem_msg=NULL;
+
+static const char* reader_names[TELEM_READERS]={"mip_logger","mip_telemetry"};
+
+static size_t line_up(size_t n){
+    return (n+SHM_LINE-1)/SHM_LINE*SHM_LINE;
+}
+
+// balance_mip's part: header, status snapshot, sample ring
+static size_t control_size(uint32_t slots){
+    return shm_channel_pages(line_up(sizeof(telem_shm_t))+ \
+                             shm_snapshot_size(sizeof(telem_status_t))+ \
+                             shm_ring_size(slots,sizeof(telem_sample_t)));
+}
+
+// the readers' part: telem_readers_t, sample ring tail
+static size_t readers_size(){
+    return shm_channel_pages(line_up(sizeof(telem_readers_t))+ \
+                             sizeof(shm_ring_tail_t));
+}
+
+// slots is the caller's own, never read back from the segment here
+static void locate(telemetry_t* t,uint32_t slots){
+    char* base=(char*)t->shm;
+    char* readers=base+control_size(slots);
+    char* status=base+line_up(sizeof(telem_shm_t));
+
+    t->readers=(telem_readers_t*)readers;
+    shm_snapshot_map(&t->status,status,sizeof(telem_status_t));
+    shm_ring_map(&t->samples,status+shm_snapshot_size(sizeof(telem_status_t)), \
+                 readers+line_up(sizeof(telem_readers_t)),slots, \
+                 sizeof(telem_sample_t));
+    return;
+}
+
+// a process we may not signal still counts as running
+static int process_alive(int32_t pid){
+    return pid>0 && (kill(pid,0)==0 || errno==EPERM);
+}
+
+/*******************************************************************************
+* int telemetry_create()
+*
+* The magic is stored last, so a reader polling for the segment never
+* attaches to a half-initialized one.
+*******************************************************************************/
+int telemetry_create(telemetry_t* t,const char* name,uint32_t slots){
+    size_t size=control_size(slots)+readers_size();
+
+    memset(t,0,sizeof(*t));
+    if(slots==0 || (slots&(slots-1))){
+        fprintf(stderr,"ERROR: telemetry ring slots must be a power of 2\n");
+        return -1;
+    }
+    t->shm=shm_channel_create(name,size);
+    if(t->shm==NULL) return -1;
+    t->size=size;
+    locate(t,slots);
+    t->shm->slots=slots;
+    t->shm->control_pid=getpid();
+    t->shm->running=1;
+    shm_snapshot_init(&t->status);
+    shm_ring_init(&t->samples);
+    __atomic_store_n(&t->shm->magic,TELEM_MAGIC,__ATOMIC_RELEASE);
+    return 0;
+}
+
+/*******************************************************************************
+* void telemetry_publish()
+*
+* Numbers the sample, so the logger can tell ticks the full ring dropped,
+* pushes it and writes the status snapshot. The message is copied only when
+* it changes.
+*******************************************************************************/
+void telemetry_publish(telemetry_t* t,telem_sample_t* s,const float* values){
+    const char* msg=__atomic_load_n(&telem_msg,__ATOMIC_ACQUIRE);
+    int i;
+
+    if(t->shm==NULL) return;
+    s->tick=++t->tick;
+    shm_ring_push(&t->samples,s);
+    if(msg!=t->msg){
+        for(i=0;i<TELEM_MSG-1 && msg!=NULL && msg[i]!='\0';i++){
+            t->line.msg[i]=msg[i];
+        }
+        t->line.msg[i]='\0';
+        t->msg=msg;
+    }
+    t->line.tick=s->tick;
+    for(i=0;i<TELEM_VALUES;i++) t->line.values[i]=values[i];
+    shm_snapshot_write(&t->status,&t->line);
+    return;
+}
+
+void telemetry_message(const char* msg){
+    __atomic_store_n(&telem_msg,msg,__ATOMIC_RELEASE);
+    return;
+}
+
+void telemetry_close(telemetry_t* t,const char* name){
+    if(t->shm==NULL) return;
+    __atomic_store_n(&t->shm->running,0,__ATOMIC_RELEASE);
+    shm_channel_detach(t->shm,t->size);
+    shm_channel_remove(name);
+    t->shm=NULL;
+    return;
+}
+
+/*******************************************************************************
+* int telemetry_attach()
+*
+* A reader takes its slot in the readers' part unless a live process holds
+* it, so a restarted reader takes over from one that died, and two of the
+* same never consume the same ring. The ring size is read from the header
+* once and the segment checked to be exactly that big, after which only the
+* local copy is used.
+*******************************************************************************/
+int telemetry_attach(telemetry_t* t,const char* name,telem_reader_t reader){
+    size_t size;
+    uint32_t slots;
+    int32_t pid;
+
+    memset(t,0,sizeof(*t));
+    t->shm=shm_channel_attach(name,&size,readers_size());
+    if(t->shm==NULL) return (errno==ENOENT)?-1:-3;
+    t->size=size;
+    slots=t->shm->slots;
+    if(size<sizeof(telem_shm_t) || \
+       __atomic_load_n(&t->shm->magic,__ATOMIC_ACQUIRE)!=TELEM_MAGIC || \
+       slots==0 || (slots&(slots-1)) || \
+       size!=control_size(slots)+readers_size()){
+        shm_channel_detach(t->shm,size);
+        t->shm=NULL;
+        return -1;
+    }
+    locate(t,slots);
+    pid=__atomic_load_n(&t->readers->reader_pid[reader],__ATOMIC_ACQUIRE);
+    if((pid!=0 && process_alive(pid)) || \
+       !__atomic_compare_exchange_n(&t->readers->reader_pid[reader],&pid, \
+                                    getpid(),0,__ATOMIC_ACQ_REL, \
+                                    __ATOMIC_ACQUIRE)){
+        fprintf(stderr,"ERROR: %s pid %d is already attached to %s\n", \
+                reader_names[reader],pid,name);
+        shm_channel_detach(t->shm,size);
+        t->shm=NULL;
+        return -2;
+    }
+    t->reader=reader;
+    return 0;
+}
+
+int telemetry_alive(const telemetry_t* t){
+    return __atomic_load_n(&t->shm->running,__ATOMIC_ACQUIRE) && \
+           process_alive(t->shm->control_pid);
+}
+
+void telemetry_detach(telemetry_t* t){
+    int32_t pid=getpid();
+
+    if(t->shm==NULL) return;
+    __atomic_compare_exchange_n(&t->readers->reader_pid[t->reader],&pid,0,0, \
+                                __ATOMIC_ACQ_REL,__ATOMIC_RELAXED);
+    shm_channel_detach(t->shm,t->size);
+    t->shm=NULL;
+    return;
+}
@@ -0,0 +1,106 @@
+/*******************************************************************************
+* telemetry.h
+*
+* Shared memory between balance_mip, the control process, and the
+* mip_logger and mip_telemetry processes that do its file and console
+* output. balance_mip creates the segment at startup. Every inner loop tick
+* pushes a sample into a ring that mip_logger appends to a CSV file, and
+* writes the status line values into a snapshot that mip_telemetry prints.
+* Either reader can be started before or after balance_mip, killed and
+* restarted, or hang, and the control process does not notice: a ring
+* nobody drains fills up and drops samples, which the logger writes down
+* as a gap. Publishing is two record copies per tick, with no lock and no
+* system call. The readers map what balance_mip writes read-only; what they
+* write themselves (ring tail, reader pids, last tick logged) is on a page
+* of its own at the end.
+*******************************************************************************/
+
+#ifndef TELEMETRY
+#define TELEMETRY
+
+#include <stddef.h>
+#include <stdint.h>
+#include "shm_channel.h"
+
+#define TELEM_MAGIC             0x314d4c54 // "TLM1"
+#define TELEM_VALUES            6
+#define TELEM_LABELS            {"theta","theta_r","duty","misses","bias", \
+                                 "volts"}
+#define TELEM_MSG               32
+
+// processes reading the segment, one of each at a time
+typedef enum telem_reader_t{
+    TELEM_LOGGER,
+    TELEM_CONSOLE,
+    TELEM_READERS
+} telem_reader_t;
+
+// one inner loop tick, to the logger
+typedef struct telem_sample_t{
+    uint64_t start_ns;          // rt_now_ns() at loop start
+    uint32_t tick;              // 1-based, one per inner loop tick
+    uint8_t state;              // rc_state_t seen by the loop
+    uint8_t mode;               // wd_mode_t
+    uint8_t arg;                // as in REC_INNER events
+    uint8_t recover;            // recover_state_t
+    float theta;
+    float reference;            // theta_r, or phi_reference in lqr and mpc
+    float duty;                 // before the shaping and the battery scale
+    float steer;
+    float wheel_rate;           // rad/s, mean of both wheels
+    float heading;
+    float heading_reference;
+    float volts;
+} telem_sample_t;
+
+// status line, to the console
+typedef struct telem_status_t{
+    uint32_t tick;              // of the sample published with it
+    float values[TELEM_VALUES];
+    char msg[TELEM_MSG];        // NUL terminated, empty for none
+} telem_status_t;
+
+// segment header, followed by the status snapshot and the sample ring
+typedef struct telem_shm_t{
+    uint32_t magic;             // stored last when the segment is ready
+    uint32_t slots;             // of the sample ring
+    int32_t control_pid;
+    uint32_t running;           // cleared as balance_mip exits
+} telem_shm_t;
+
+// written by the readers, on the last page, followed by the ring tail
+typedef struct telem_readers_t{
+    int32_t reader_pid[TELEM_READERS]; // attached readers, 0 for none
+    uint32_t logged;            // last tick the logger has written out
+} telem_readers_t;
+
+// one process's view of the segment
+typedef struct telemetry_t{
+    telem_shm_t* shm;           // NULL when not created or attached
+    telem_readers_t* readers;
+    size_t size;
+    shm_snapshot_t status;
+    shm_ring_t samples;
+    uint32_t tick;              // control side: ticks published
+    telem_status_t line;        // control side: status being published
+    const char* msg;            // control side: message copied into line
+    int reader;                 // reader side: telem_reader_t held
+} telemetry_t;
+
+// control side: map a fresh segment, ring slots a power of 2
+int telemetry_create(telemetry_t* t,const char* name,uint32_t slots);
+// control side: one inner loop tick, does nothing without a segment
+void telemetry_publish(telemetry_t* t,telem_sample_t* s,const float* values);
+// message shown after the values, any thread; a static string or NULL
+void telemetry_message(const char* msg);
+// control side: tell the readers and unlink the segment
+void telemetry_close(telemetry_t* t,const char* name);
+
+// reader side: 0 attached, -1 no segment yet, -2 that reader is running,
+// -3 the segment cannot be mapped (printed)
+int telemetry_attach(telemetry_t* t,const char* name,telem_reader_t reader);
+// reader side: 1 while balance_mip is running
+int telemetry_alive(const telemetry_t* t);
+void telemetry_detach(telemetry_t* t);
+
+#endif	//TELEMETRY
@@ -0,0 +1,165 @@
+/*******************************************************************************
+* trajectory.c
+*
+* Command parsing, the command mailbox and jerk-limited reference axes.
+*******************************************************************************/
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "mip_config.h"
+#include "trajectory.h"
+
+int traj_parse(const char* line,traj_cmd_t* cmd){
+    char word[8];
+    float forward,heading;
+    int n;
+
+    n=sscanf(line,"%7s %f %f",word,&forward,&heading);
+    if(n==1 && strcmp(word,"stop")==0){
+        cmd->type=TRAJ_VELOCITY;
+        cmd->forward=0;
+        cmd->heading=0;
+        return 0;
+    }
+    if(n!=3 || !isfinite(forward) || !isfinite(heading)) return -1;
+    if(strcmp(word,"vel")==0) cmd->type=TRAJ_VELOCITY;
+    else if(strcmp(word,"pos")==0) cmd->type=TRAJ_POSITION;
+    else return -1;
+    cmd->forward=forward;
+    cmd->heading=heading;
+    return 0;
+}
+
+/*******************************************************************************
+* void traj_post()
+* int traj_take()
+*
+* Sequence lock with a single writer: seq is odd while the command is
+* written, so a reader that sees the same even seq before and after its copy
+* has a whole command. A command the loop has not taken yet is replaced, the
+* latest one wins. Neither side blocks; a torn read is retried next period.
+*******************************************************************************/
+void traj_post(traj_mailbox_t* m,const traj_cmd_t* cmd){
+    uint32_t seq=__atomic_load_n(&m->seq,__ATOMIC_RELAXED);
+    __atomic_store_n(&m->seq,seq+1,__ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&m->cmd.type,cmd->type,__ATOMIC_RELAXED);
+    __atomic_store(&m->cmd.forward,&cmd->forward,__ATOMIC_RELAXED);
+    __atomic_store(&m->cmd.heading,&cmd->heading,__ATOMIC_RELAXED);
+    __atomic_store_n(&m->seq,seq+2,__ATOMIC_RELEASE);
+    return;
+}
+
+int traj_take(traj_mailbox_t* m,traj_cmd_t* cmd){
+    uint32_t seq=__atomic_load_n(&m->seq,__ATOMIC_ACQUIRE);
+    traj_cmd_t c;
+
+    if(seq==m->taken || (seq&1)) return 0;
+    c.type=__atomic_load_n(&m->cmd.type,__ATOMIC_RELAXED);
+    __atomic_load(&m->cmd.forward,&c.forward,__ATOMIC_RELAXED);
+    __atomic_load(&m->cmd.heading,&c.heading,__ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if(__atomic_load_n(&m->seq,__ATOMIC_RELAXED)!=seq) return 0;
+    m->taken=seq;
+    *cmd=c;
+    return 1;
+}
+
+static void axis_init(traj_axis_t* a,float max_vel,float max_acc, \
+                      float max_jerk,float hz){
+    memset(a,0,sizeof(*a));
+    a->max_vel=max_vel;
+    a->max_acc=max_acc;
+    a->max_jerk=max_jerk;
+    a->dt=1/hz;
+    return;
+}
+
+static void axis_reset(traj_axis_t* a){
+    a->pos=0;
+    a->vel=0;
+    a->acc=0;
+    a->target=0;
+    a->hold=0;
+    return;
+}
+
+static float limit(float x,float lim){
+    if(x>lim) return lim;
+    if(x<-lim) return -lim;
+    return x;
+}
+
+/*******************************************************************************
+* static void axis_step()
+*
+* Speed goal first: the target rate, or when holding a position the speed
+* from which braking at max_acc, with the jerk-limited ramps into and out of
+* it, stops at the target. The acceleration goal is the one that can still
+* ramp to zero by jerk alone as the speed goal is reached, and never more
+* than closes the gap in one period; the acceleration moves toward it by at
+* most max_jerk per second. Once holding and within a period of the target
+* at rest, the axis snaps to it.
+*******************************************************************************/
+static void axis_step(traj_axis_t* a){
+    float A=a->max_acc,J=a->max_jerk,dt=a->dt;
+    float v_goal,a_goal,dx,dv,d;
+
+    if(a->hold){
+        dx=a->target-a->pos;
+        d=fabsf(dx);
+        // v^2/2A + v A/2J = d
+        v_goal=0.5f*(-A*A/J+sqrtf(A*A*A*A/(J*J)+8*A*d));
+        v_goal=fminf(v_goal,d/dt);
+        v_goal=copysignf(fminf(v_goal,a->max_vel),dx);
+        if(d<=a->max_jerk*dt*dt*dt && fabsf(a->vel)<=A*dt && \
+           fabsf(a->acc)<=J*dt){
+            a->pos=a->target;
+            a->vel=0;
+            a->acc=0;
+            return;
+        }
+    }
+    else{
+        v_goal=limit(a->target,a->max_vel);
+    }
+    dv=v_goal-a->vel;
+    a_goal=fminf(fminf(A,sqrtf(2*J*fabsf(dv))),fabsf(dv)/dt);
+    a_goal=copysignf(a_goal,dv);
+    a->acc+=limit(a_goal-a->acc,J*dt);
+    a->vel+=a->acc*dt;
+    a->pos+=a->vel*dt;
+    return;
+}
+
+void traj_init(traj_t* t,float hz){
+    axis_init(&t->phi,REF_MAX_SPEED/WHEEL_RADIUS_M,REF_MAX_ACCEL/WHEEL_RADIUS_M, \
+              REF_MAX_JERK/WHEEL_RADIUS_M,hz);
+    axis_init(&t->heading,REF_MAX_YAW_RATE,REF_MAX_YAW_ACCEL, \
+              REF_MAX_YAW_JERK,hz);
+    t->theta_ff=REF_THETA_FF;
+    return;
+}
+
+void traj_reset(traj_t* t){
+    axis_reset(&t->phi);
+    axis_reset(&t->heading);
+    return;
+}
+
+void traj_command(traj_t* t,const traj_cmd_t* cmd){
+    t->phi.hold=t->heading.hold=(cmd->type==TRAJ_POSITION);
+    t->phi.target=cmd->forward/WHEEL_RADIUS_M;
+    t->heading.target=cmd->heading;
+    return;
+}
+
+void traj_step(traj_t* t){
+    axis_step(&t->phi);
+    axis_step(&t->heading);
+    return;
+}
+
+float traj_lean(const traj_t* t){
+    return t->theta_ff*t->phi.acc;
+}
@@ -0,0 +1,80 @@
+/*******************************************************************************
+* trajectory.h
+*
+* Reference generator for balance_mip. Motion commands, as text lines from
+* a local command source, are parsed here, handed from the thread that reads
+* them to the control loop that owns the references through a single-slot
+* mailbox, and turned into jerk-limited trajectories for the wheel angle phi
+* and the heading, stepped once per outer loop period. The wheel
+* acceleration of the phi trajectory gives the feed-forward lean. Constant
+* work per step, no hardware dependencies.
+*
+* Commands, forward in metres of travel and heading in radians, positive
+* turning left, both from where balancing started:
+*
+*   vel <m/s> <rad/s>   drive and turn at these rates until the next command
+*   pos <m> <rad>       go to this position and heading and stop there
+*   stop                vel 0 0
+*******************************************************************************/
+
+#ifndef TRAJECTORY
+#define TRAJECTORY
+
+#include <stdint.h>
+
+typedef enum traj_cmd_type_t{
+    TRAJ_VELOCITY,
+    TRAJ_POSITION
+} traj_cmd_type_t;
+
+typedef struct traj_cmd_t{
+    uint32_t type;              // traj_cmd_type_t
+    float forward;              // m/s or m
+    float heading;              // rad/s or rad
+} traj_cmd_t;
+
+// latest command, written by one thread and taken by one loop
+typedef struct traj_mailbox_t{
+    uint32_t seq;               // odd while a command is being written
+    uint32_t taken;             // seq of the last command taken
+    traj_cmd_t cmd;
+} traj_mailbox_t;
+
+// one jerk-limited axis
+typedef struct traj_axis_t{
+    float pos;
+    float vel;
+    float acc;
+    float target;               // position or velocity, per hold
+    int hold;                   // 1 going to target position, 0 at target rate
+    float max_vel;
+    float max_acc;
+    float max_jerk;
+    float dt;
+} traj_axis_t;
+
+typedef struct traj_t{
+    traj_axis_t phi;            // wheel angle, rad
+    traj_axis_t heading;        // rad
+    float theta_ff;             // lean in rad per rad/s^2 of phi acceleration
+} traj_t;
+
+// parse one command line, returns 0 on success
+int traj_parse(const char* line,traj_cmd_t* cmd);
+// from the reading thread: replace the command waiting in the mailbox
+void traj_post(traj_mailbox_t* m,const traj_cmd_t* cmd);
+// from the loop: returns 1 and fills cmd if a new command is complete
+int traj_take(traj_mailbox_t* m,traj_cmd_t* cmd);
+
+// limits from the REF_* values of mip_config.h, stepped at hz
+void traj_init(traj_t* t,float hz);
+// at rest at zero, as when balancing starts
+void traj_reset(traj_t* t);
+// start following cmd from the current state
+void traj_command(traj_t* t,const traj_cmd_t* cmd);
+// advance both axes by one period
+void traj_step(traj_t* t);
+// lean that the planned acceleration needs, rad
+float traj_lean(const traj_t* t);
+
+#endif	//TRAJECTORY
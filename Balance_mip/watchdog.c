@@ -0,0 +1,193 @@
+/*******************************************************************************
+* watchdog.c
+*
+* Deadline tracking and degraded-mode selection for balance_mip. The inner
+* loop owns the mode; the outer loop and the supervisor only publish start
+* times or force SAFE_STOP through atomics.
+*******************************************************************************/
+#include <stddef.h>
+#include "mip_config.h"
+#include "watchdog.h"
+
+static void loop_init(wd_loop_t* l,float hz,float budget);
+static int loop_missed(wd_loop_t* l,uint64_t now_ns);
+static wd_mode_t set_mode(watchdog_t* wd,wd_mode_t from,wd_mode_t to);
+
+/*******************************************************************************
+* void watchdog_init()
+*
+* Sets loop periods and budgets and zeroes all counters.
+*******************************************************************************/
+void watchdog_init(watchdog_t* wd,float inner_hz,float outer_hz){
+    loop_init(&wd->inner,inner_hz,WD_INNER_BUDGET);
+    loop_init(&wd->outer,outer_hz,WD_OUTER_BUDGET);
+    wd->mode=WD_NORMAL;
+    wd->miss_score=0;
+    wd->ramp_events=0;
+    wd->inner_only_events=0;
+    wd->safe_stops=0;
+    return;
+}
+
+/*******************************************************************************
+* wd_mode_t watchdog_inner_begin()
+*
+* Checks the previous inner iteration and the freshness of the outer loop.
+* Each inner miss adds WD_MISS_WEIGHT to a score that leaks by one per good
+* tick, so isolated misses only ramp while clustered misses degrade or stop.
+*******************************************************************************/
+wd_mode_t watchdog_inner_begin(watchdog_t* wd,uint64_t now_ns){
+    wd_mode_t mode=__atomic_load_n(&wd->mode,__ATOMIC_ACQUIRE);
+    uint64_t outer_start;
+    int missed=loop_missed(&wd->inner,now_ns);
+
+    __atomic_store_n(&wd->inner.last_start_ns,now_ns,__ATOMIC_RELEASE);
+    wd->inner.iterations++;
+    if(mode==WD_SAFE_STOP) return mode;
+
+    if(missed){
+        wd->inner.misses++;
+        wd->miss_score+=WD_MISS_WEIGHT;
+    }
+    else if(wd->miss_score>0){
+        wd->miss_score--;
+    }
+
+    // a stale outer loop means theta_r can no longer be trusted
+    outer_start=__atomic_load_n(&wd->outer.last_start_ns,__ATOMIC_ACQUIRE);
+    int outer_stale=(outer_start!=0 && \
+                     now_ns-outer_start>WD_OUTER_STALE*wd->outer.period_ns);
+
+    if(wd->miss_score>=WD_STOP_SCORE){
+        return set_mode(wd,mode,WD_SAFE_STOP);
+    }
+    else if(wd->miss_score>=WD_DEGRADE_SCORE || outer_stale){
+        return set_mode(wd,mode,WD_INNER_ONLY);
+    }
+    else if(missed){
+        return set_mode(wd,mode,WD_RAMP);
+    }
+    // recover once the misses have leaked away
+    return set_mode(wd,mode,WD_NORMAL);
+}
+
+/*******************************************************************************
+* void watchdog_loop_done()
+*
+* Records the execution time of the iteration that just finished, plus any
+* injected fault delay.
+*******************************************************************************/
+void watchdog_loop_done(watchdog_t* wd,wd_loop_id_t id,uint64_t exec_ns){
+    wd_loop_t* l=(id==WD_LOOP_INNER)?&wd->inner:&wd->outer;
+    if(l->inject_every && (l->iterations%l->inject_every)==0){
+        exec_ns+=l->inject_ns;
+    }
+    l->last_exec_ns=exec_ns;
+    return;
+}
+
+/*******************************************************************************
+* void watchdog_outer_begin()
+*
+* Publishes the outer loop start time read by the inner loop.
+*******************************************************************************/
+void watchdog_outer_begin(watchdog_t* wd,uint64_t now_ns){
+    if(loop_missed(&wd->outer,now_ns)) wd->outer.misses++;
+    wd->outer.iterations++;
+    __atomic_store_n(&wd->outer.last_start_ns,now_ns,__ATOMIC_RELEASE);
+    return;
+}
+
+/*******************************************************************************
+* wd_mode_t watchdog_poll()
+*
+* Called outside the control loops. If the inner loop has not started for
+* WD_INNER_TIMEOUT periods, nothing else will stop the motors, so force
+* SAFE_STOP and let the caller disable them.
+*******************************************************************************/
+wd_mode_t watchdog_poll(watchdog_t* wd,uint64_t now_ns){
+    uint64_t start=__atomic_load_n(&wd->inner.last_start_ns,__ATOMIC_ACQUIRE);
+    if(start!=0 && now_ns>start && \
+       now_ns-start>WD_INNER_TIMEOUT*wd->inner.period_ns){
+        if(__atomic_exchange_n(&wd->mode,WD_SAFE_STOP,__ATOMIC_ACQ_REL) \
+           !=WD_SAFE_STOP){
+            __atomic_add_fetch(&wd->safe_stops,1,__ATOMIC_RELAXED);
+        }
+    }
+    return __atomic_load_n(&wd->mode,__ATOMIC_ACQUIRE);
+}
+
+/*******************************************************************************
+* void watchdog_reset()
+*
+* Returns to NORMAL with an empty miss history.
+*******************************************************************************/
+void watchdog_reset(watchdog_t* wd){
+    wd->miss_score=0;
+    __atomic_store_n(&wd->mode,WD_NORMAL,__ATOMIC_RELEASE);
+    return;
+}
+
+/*******************************************************************************
+* void watchdog_inject_fault()
+*
+* Adds extra_ns to the measured execution time of every n-th iteration of a
+* loop, so overrun handling can be exercised without actually stalling it.
+*******************************************************************************/
+void watchdog_inject_fault(watchdog_t* wd,wd_loop_id_t id,uint64_t extra_ns, \
+                           uint64_t every){
+    wd_loop_t* l=(id==WD_LOOP_INNER)?&wd->inner:&wd->outer;
+    l->inject_ns=extra_ns;
+    l->inject_every=every;
+    return;
+}
+
+const char* watchdog_mode_name(wd_mode_t mode){
+    switch(mode){
+    case WD_NORMAL:     return "normal";
+    case WD_RAMP:       return "watchdog: duty ramp";
+    case WD_INNER_ONLY: return "watchdog: inner loop only";
+    case WD_SAFE_STOP:  return "watchdog: motors stopped";
+    }
+    return "";
+}
+
+/*******************************************************************************
+* static helpers
+*******************************************************************************/
+static void loop_init(wd_loop_t* l,float hz,float budget){
+    l->period_ns=(uint64_t)(1e9/hz);
+    l->budget_ns=(uint64_t)(budget*l->period_ns);
+    l->last_start_ns=0;
+    l->last_exec_ns=0;
+    l->iterations=0;
+    l->misses=0;
+    l->inject_ns=0;
+    l->inject_every=0;
+    return;
+}
+
+// previous iteration ran over budget or this one started more than half a
+// period late
+static int loop_missed(wd_loop_t* l,uint64_t now_ns){
+    uint64_t last=l->last_start_ns;
+    if(last==0) return 0;
+    if(l->last_exec_ns>l->budget_ns) return 1;
+    return (now_ns-last)>(l->period_ns+l->period_ns/2);
+}
+
+// change mode unless watchdog_poll() forced SAFE_STOP meanwhile, counting
+// each entry into a degraded mode
+static wd_mode_t set_mode(watchdog_t* wd,wd_mode_t from,wd_mode_t to){
+    if(from==to) return to;
+    if(!__atomic_compare_exchange_n(&wd->mode,&from,to,0, \
+                                    __ATOMIC_ACQ_REL,__ATOMIC_ACQUIRE)){
+        return from;
+    }
+    if(to==WD_RAMP) wd->ramp_events++;
+    else if(to==WD_INNER_ONLY) wd->inner_only_events++;
+    else if(to==WD_SAFE_STOP){
+        __atomic_add_fetch(&wd->safe_stops,1,__ATOMIC_RELAXED);
+    }
+    return to;
+}
@@ -0,0 +1,68 @@
+/*******************************************************************************
+* watchdog.h
+*
+* Deadline watchdog for the inner and outer loops of balance_mip.
+* Tracks overruns of each loop and picks a degraded operating mode:
+* a single inner overrun ramps the duty, repeated misses or a stale outer
+* loop fall back to inner-loop-only balancing, and sustained misses or a
+* silent inner loop stop the motors. Has no hardware dependencies, so it
+* can be driven from a simulation.
+*******************************************************************************/
+
+#ifndef WATCHDOG
+#define WATCHDOG
+
+#include <stdint.h>
+
+// operating modes, ordered by severity
+typedef enum wd_mode_t{
+    WD_NORMAL,          // full cascade
+    WD_RAMP,            // inner loop overran last tick, rate-limit the duty
+    WD_INNER_ONLY,      // ignore D2, balance body only as in balance_body
+    WD_SAFE_STOP        // motors disabled until watchdog_reset()
+} wd_mode_t;
+
+typedef enum wd_loop_id_t{
+    WD_LOOP_INNER,
+    WD_LOOP_OUTER
+} wd_loop_id_t;
+
+// per-loop deadline tracking
+typedef struct wd_loop_t{
+    uint64_t period_ns;
+    uint64_t budget_ns;         // allowed execution time per iteration
+    uint64_t last_start_ns;     // shared with other threads, use atomics
+    uint64_t last_exec_ns;
+    uint64_t iterations;
+    uint64_t misses;            // total overruns, for monitoring
+    uint64_t inject_ns;         // fault injection: extra execution time
+    uint64_t inject_every;      // ...added every n-th iteration, 0 disables
+} wd_loop_t;
+
+typedef struct watchdog_t{
+    wd_loop_t inner;
+    wd_loop_t outer;
+    wd_mode_t mode;
+    int miss_score;             // leaky count of recent inner misses
+    uint64_t ramp_events;       // counters for monitoring
+    uint64_t inner_only_events;
+    uint64_t safe_stops;
+} watchdog_t;
+
+void watchdog_init(watchdog_t* wd,float inner_hz,float outer_hz);
+// inner loop: call at the start of a tick, returns the mode for this tick
+wd_mode_t watchdog_inner_begin(watchdog_t* wd,uint64_t now_ns);
+// record execution time of the loop that just finished
+void watchdog_loop_done(watchdog_t* wd,wd_loop_id_t id,uint64_t exec_ns);
+// outer loop: call at the start of each iteration
+void watchdog_outer_begin(watchdog_t* wd,uint64_t now_ns);
+// from any thread: stop if the inner loop has gone silent, returns mode
+wd_mode_t watchdog_poll(watchdog_t* wd,uint64_t now_ns);
+// leave SAFE_STOP and clear the miss history, keeps the totals
+void watchdog_reset(watchdog_t* wd);
+// fault injection hook: pretend every n-th iteration took extra_ns longer
+void watchdog_inject_fault(watchdog_t* wd,wd_loop_id_t id,uint64_t extra_ns, \
+                           uint64_t every);
+const char* watchdog_mode_name(wd_mode_t mode);
+
+#endif	//WATCHDOG
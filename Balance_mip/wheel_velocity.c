@@ -0,0 +1,113 @@
+/*******************************************************************************
+* wheel_velocity.c
+*
+* Mixed differencing and 1/T wheel rate estimation with a tracking observer.
+*******************************************************************************/
+#include <math.h>
+#include <string.h>
+#include "mip_config.h"
+#include "wheel_velocity.h"
+
+void wheel_vel_init(wheel_vel_t* w,float rad_per_count,float hz){
+    const float wn=2*M_PI*VEL_OBSERVER_HZ;
+
+    memset(w,0,sizeof(*w));
+    w->rad_per_count=rad_per_count;
+    w->gain_pos=2*VEL_DAMPING*wn;
+    w->gain_vel=wn*wn;
+    w->timeout_ns=(uint64_t)(VEL_TIMEOUT*1e9);
+    w->sparse_ns=(uint64_t)((VEL_SPARSE_TICKS-0.5)*1e9/hz);
+    w->slow_alpha=1-expf(-2*M_PI*VEL_SLOW_HZ/hz);
+    return;
+}
+
+/*******************************************************************************
+* float wheel_vel_update()
+*
+* The edge time is taken as the time of the update that first saw the new
+* count, so every interval is a whole number of ticks and the quantization
+* error averages out. When more than one count arrived since the last tick
+* the wheel is fast enough for plain differencing over that tick, which also
+* keeps a sudden start from being averaged over the slow stretch before it.
+* Starting from standstill, the interval is at most VEL_TIMEOUT, which
+* underestimates the first count rather than reporting a whole count in one
+* tick. A count that goes back to the last edge, or one behind it, is taken
+* as the reading chattering on that edge and not as an edge, so noise on a
+* slow wheel does not restart the interval or flip the direction; a real
+* reversal shows once the count is two behind. The raw rate is low-passed
+* at VEL_SLOW_HZ every update and that is what sparse edges report.
+*
+* The observer keeps its position as an offset from the last count, so it
+* stays exact however far the wheel has turned. Its error is the distance
+* to the nearest edge of the count that was read, zero while it is inside.
+* At speed this behaves like a second order filter on the differenced
+* rate. Near a reversal it keeps predicting the old direction only until it
+* runs out of the count, while differencing and 1/T hold the old rate until
+* the next edge in the new direction.
+*******************************************************************************/
+float wheel_vel_update(wheel_vel_t* w,int32_t count,uint64_t now_ns){
+    int32_t d,moved;
+    int dir;
+    float bound,dt,e;
+
+    if(!w->primed){
+        w->last_count=w->edge_count=count;
+        w->last_ns=w->edge_ns=now_ns;
+        w->offset=0.5f;
+        w->primed=1;
+        return w->rate;
+    }
+    d=count-w->last_count;
+    moved=count-w->edge_count;
+    dt=(now_ns-w->last_ns)*1e-9f;
+    w->offset+=w->vel*dt-d;
+    if(w->offset<0) e=-w->offset;
+    else if(w->offset>=1) e=1-w->offset;
+    else e=0;
+    w->offset+=w->gain_pos*dt*e;
+    w->vel+=w->gain_vel*dt*e;
+    if(d!=0 && moved!=0 && moved!=-w->dir){
+        dir=(moved>0)?1:-1;
+        w->steady=(dir==w->dir);
+        w->interval_ns=now_ns-w->edge_ns;
+        if((d>1 || d<-1) && (moved>1 || moved<-1)){
+            w->interval_ns=0;
+            w->edge_count=w->last_count;
+            w->edge_ns=w->last_ns;
+        }
+        else if(w->dir==0 && now_ns-w->edge_ns>w->timeout_ns){
+            w->edge_ns=now_ns-w->timeout_ns;
+        }
+        if(now_ns>w->edge_ns){
+            w->raw=(count-w->edge_count)*w->rad_per_count/ \
+                   ((now_ns-w->edge_ns)*1e-9f);
+        }
+        w->dir=dir;
+        w->edge_count=count;
+        w->edge_ns=now_ns;
+    }
+    else if(now_ns-w->edge_ns>=w->timeout_ns){
+        w->raw=0;
+        w->dir=0;
+    }
+    else if(now_ns>w->edge_ns){
+        // no count yet, so the wheel is slower than one count since the last
+        bound=fabsf(w->rad_per_count)/((now_ns-w->edge_ns)*1e-9f);
+        if(w->raw>bound) w->raw=bound;
+        else if(w->raw<-bound) w->raw=-bound;
+    }
+    w->last_count=count;
+    w->last_ns=now_ns;
+    w->slow+=w->slow_alpha*(w->raw-w->slow);
+    if(w->dir==0 || (w->steady && w->interval_ns>=w->sparse_ns)){
+        w->rate=w->slow;
+    }
+    else w->rate=w->vel*w->rad_per_count;
+    return w->rate;
+}
+
+void wheel_vel_rebase(wheel_vel_t* w,int32_t count){
+    w->edge_count+=count-w->last_count;
+    w->last_count=count;
+    return;
+}
@@ -0,0 +1,55 @@
+/*******************************************************************************
+* wheel_velocity.h
+*
+* Wheel rate from encoder counts sampled every inner loop tick. The raw
+* rate is counts moved divided by the time between the ticks that saw the
+* count change, so at speed (more than one count per tick) it is plain
+* differencing over one tick and at low speed, when a count arrives only
+* every few ticks, it becomes the time-between-edges (1/T) estimate. While
+* no count arrives, it is capped at one count over the time since the last
+* one and drops to zero after VEL_TIMEOUT.
+*
+* The filtered rate comes from a second order tracking observer on the
+* count (VEL_OBSERVER_HZ, VEL_DAMPING) that only corrects when its position
+* leaves the count the encoder reads, so it coasts through the ticks
+* between edges instead of seeing the rate drop to zero and jump back. Once
+* edges are VEL_SPARSE_TICKS or more apart in the same direction, or the
+* wheel has stopped, the 1/T rate through a VEL_SLOW_HZ low-pass is used
+* instead. A count chattering back and forth over one edge is not an edge.
+* Constant work per update, no hardware dependencies.
+*******************************************************************************/
+
+#ifndef WHEEL_VELOCITY
+#define WHEEL_VELOCITY
+
+#include <stdint.h>
+
+typedef struct wheel_vel_t{
+    float rad_per_count;        // signed, includes the encoder polarity
+    float gain_pos;             // observer gains, 1/s and 1/s^2
+    float gain_vel;
+    uint64_t timeout_ns;
+    uint64_t sparse_ns;         // edge interval from which 1/T is used
+    int primed;
+    int32_t last_count;         // count at the previous update
+    uint64_t last_ns;
+    int32_t edge_count;         // count when it last changed
+    uint64_t edge_ns;
+    int dir;                    // sign of the last movement, 0 when stopped
+    int steady;                 // the last edge kept the direction
+    uint64_t interval_ns;       // between the last two single count edges
+    float offset;               // observer position past last_count, counts
+    float vel;                  // observer rate, counts/s
+    float raw;                  // rad/s, differencing or 1/T
+    float slow_alpha;           // low-pass on raw, per update
+    float slow;                 // rad/s, raw low-passed
+    float rate;                 // rad/s
+} wheel_vel_t;
+
+void wheel_vel_init(wheel_vel_t* w,float rad_per_count,float hz);
+// new count sampled at now_ns, returns the filtered rate in rad/s
+float wheel_vel_update(wheel_vel_t* w,int32_t count,uint64_t now_ns);
+// the encoder was reset so that the last count now reads count
+void wheel_vel_rebase(wheel_vel_t* w,int32_t count);
+
+#endif	//WHEEL_VELOCITY
@@ -0,0 +1,146 @@
+/*******************************************************************************
+* calibration.c
+*
+* Measures, loads and saves the per-robot theta offset and gyro bias.
+*******************************************************************************/
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "calibration.h"
+
+#define CAL_LINE                128
+
+calibration_t calibration_default(float theta_offset){
+    calibration_t c;
+    memset(&c,0,sizeof(c));
+    c.theta_offset=theta_offset;
+    return c;
+}
+
+/*******************************************************************************
+* int calibration_load()
+*
+* Reads "key=value" lines, ignoring comments and unknown keys. A file written
+* in the future of the current clock counts as stale, since the clock cannot
+* be trusted to measure its age.
+*******************************************************************************/
+int calibration_load(const char* path,calibration_t* c,int64_t max_age_s){
+    FILE* f=fopen(path,"r");
+    char line[CAL_LINE];
+    calibration_t read=calibration_default(0);
+    int found=0;
+    long long ll;
+    unsigned long ul;
+    int64_t age;
+
+    if(f==NULL) return -1;
+    while(fgets(line,sizeof(line),f)!=NULL){
+        if(line[0]=='#') continue;
+        if(sscanf(line,"theta_offset=%f",&read.theta_offset)==1) found|=1;
+        else if(sscanf(line,"gyro_bias=%f",&read.gyro_bias)==1) found|=2;
+        else if(sscanf(line,"time=%lld",&ll)==1) read.time=ll;
+        else if(sscanf(line,"samples=%lu",&ul)==1) read.samples=ul;
+    }
+    fclose(f);
+    if(found!=3 || !isfinite(read.theta_offset) || !isfinite(read.gyro_bias)){
+        fprintf(stderr,"ERROR: %s is not a calibration file\n",path);
+        return -1;
+    }
+    *c=read;
+    age=(int64_t)time(NULL)-read.time;
+    return (age>=0 && age<=max_age_s)?0:1;
+}
+
+/*******************************************************************************
+* int calibration_save()
+*
+* Creates the parent directory if needed. The file is renamed into place so
+* a power cut while writing leaves the previous calibration intact.
+*******************************************************************************/
+int calibration_save(const char* path,calibration_t* c){
+    char tmp[CAL_LINE*2];
+    char* slash;
+    FILE* f;
+
+    if(c->time==0) c->time=time(NULL);
+    snprintf(tmp,sizeof(tmp),"%s",path);
+    slash=strrchr(tmp,'/');
+    if(slash!=NULL && slash!=tmp){
+        *slash='\0';
+        if(mkdir(tmp,0755) && errno!=EEXIST){
+            perror(tmp);
+            return -1;
+        }
+    }
+    snprintf(tmp,sizeof(tmp),"%s.tmp",path);
+    f=fopen(tmp,"w");
+    if(f==NULL){
+        perror(tmp);
+        return -1;
+    }
+    fprintf(f,"# eduMiP calibration, measured held upright\n");
+    fprintf(f,"theta_offset=%.6f\n",c->theta_offset);
+    fprintf(f,"gyro_bias=%.6f\n",c->gyro_bias);
+    fprintf(f,"time=%lld\n",(long long)c->time);
+    fprintf(f,"samples=%lu\n",(unsigned long)c->samples);
+    if(fflush(f) || fsync(fileno(f)) || fclose(f)){
+        perror(tmp);
+        return -1;
+    }
+    if(rename(tmp,path)){
+        perror(path);
+        return -1;
+    }
+    return 0;
+}
+
+void calibration_start(calibration_run_t* r,uint32_t samples, \
+                       float max_gyro_std,float nominal_offset, \
+                       float max_change){
+    memset(r,0,sizeof(*r));
+    r->target=samples?samples:1;
+    r->max_gyro_std=max_gyro_std;
+    r->nominal_offset=nominal_offset;
+    r->max_change=max_change;
+    return;
+}
+
+/*******************************************************************************
+* int calibration_add()
+*
+* The offset is minus the mean accelerometer angle, so the filter reads zero
+* where the robot was held, and the bias is the mean gyro rate. Constant work
+* per sample; a rejected window starts over from the next sample.
+*******************************************************************************/
+int calibration_add(calibration_run_t* r,const float accel[3], \
+                    const float gyro[3],calibration_t* c){
+    double n,gyro_mean,gyro_var;
+    float offset;
+
+    r->tilt_sum+=atan2(-accel[2],accel[1]);
+    r->gyro_sum+=gyro[0];
+    r->gyro_sq+=(double)gyro[0]*gyro[0];
+    r->n++;
+    if(r->n<r->target) return 0;
+
+    n=r->n;
+    gyro_mean=r->gyro_sum/n;
+    gyro_var=r->gyro_sq/n-gyro_mean*gyro_mean;
+    offset=-r->tilt_sum/n;
+    r->n=0;
+    r->tilt_sum=r->gyro_sum=r->gyro_sq=0;
+    if(gyro_var>(double)r->max_gyro_std*r->max_gyro_std || \
+       fabsf(offset-r->nominal_offset)>r->max_change){
+        r->restarts++;
+        return -1;
+    }
+    c->theta_offset=offset;
+    c->gyro_bias=gyro_mean;
+    c->samples=r->target;
+    c->time=0;
+    return 1;
+}
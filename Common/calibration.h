@@ -0,0 +1,62 @@
+/*******************************************************************************
+* calibration.h
+*
+* Per-robot calibration shared by the balance programs: the THETA_OFFSET that
+* makes the filter read zero at the balance point, and the gyro x bias. Both
+* are averaged over a window of IMU samples while the robot is held upright
+* and still, then kept in a small text file that is loaded at startup, so a
+* fresh file lets the program balance without measuring again. Averaging is
+* allocation and system call free, so it can run in the IMU interrupt. Has
+* no hardware dependencies.
+*******************************************************************************/
+
+#ifndef CALIBRATION
+#define CALIBRATION
+
+#include <stdint.h>
+
+typedef struct calibration_t{
+    float theta_offset;         // rad, added to the filter angle
+    float gyro_bias;            // deg/s, subtracted from gyro x
+    int64_t time;               // wall clock when measured, s since epoch
+    uint32_t samples;           // length of the averaging window
+} calibration_t;
+
+// handoff between the loop measuring and the thread that saves the result
+typedef enum cal_state_t{
+    CAL_IDLE,           // using the loaded or compiled calibration
+    CAL_MEASURING,      // averaging in the IMU interrupt, motors off
+    CAL_MEASURED        // applied by the loop, waiting to be saved
+} cal_state_t;
+
+// averaging state of one calibration window
+typedef struct calibration_run_t{
+    uint32_t target;            // samples per window
+    uint32_t n;
+    double tilt_sum;
+    double gyro_sum;
+    double gyro_sq;
+    float max_gyro_std;         // deg/s, held still below this
+    float nominal_offset;       // rad, compiled THETA_OFFSET
+    float max_change;           // rad, upright within this of nominal
+    uint32_t restarts;          // windows rejected because the robot moved
+} calibration_run_t;
+
+// calibration with the compiled offset and no gyro bias
+calibration_t calibration_default(float theta_offset);
+// 0 if path was read and is at most max_age_s old, 1 if read but stale,
+// -1 if missing or unreadable, in which case c is unchanged
+int calibration_load(const char* path,calibration_t* c,int64_t max_age_s);
+// write c to path through a temporary file, stamping the time if unset
+int calibration_save(const char* path,calibration_t* c);
+// begin a window of samples, rejected if gyro x varies more than max_gyro_std
+// or the offset is further than max_change from nominal_offset
+void calibration_start(calibration_run_t* r,uint32_t samples, \
+                       float max_gyro_std,float nominal_offset, \
+                       float max_change);
+// add one IMU sample, returns 1 and fills c when a window is accepted,
+// -1 when a window was rejected and restarted, 0 otherwise
+int calibration_add(calibration_run_t* r,const float accel[3], \
+                    const float gyro[3],calibration_t* c);
+
+#endif	//CALIBRATION
@@ -0,0 +1,43 @@
+/*******************************************************************************
+* comp_filter.c
+*
+* Complementary filter recursion for the body angle.
+*******************************************************************************/
+#include <roboticscape.h>
+#include "comp_filter.h"
+
+/*******************************************************************************
+* float comp_filter_step()
+*
+* Takes the accelerometer angle of the BeagleBone relative to the x-axis and
+* the gyroscope x-axis rate. The rate is integrated with Euler's method,
+* then the accelerometer angle is low-passed and the gyro angle high-passed
+* and the two are summed to a theta angle estimate of the MiP body relative
+* to the x-axis. The caller adds its offsets.
+*******************************************************************************/
+float comp_filter_step(comp_filter_t* f,float accel_angle,float gyro_rate, \
+                       double omega_c,double dt){
+    float* theta_a=f->theta_a;
+    float* theta_a_raw=f->theta_a_raw;
+    float* theta_g=f->theta_g;
+    float* theta_g_raw=f->theta_g_raw;
+    float theta;
+
+    theta_a_raw[0]=accel_angle;
+    // use Euler's integration on gyroscope x-axis data
+    theta_g_raw[0]=theta_g_raw[1]+(gyro_rate*DEG_TO_RAD*dt);
+
+    // apply a low-pass filter to theta_a_raw
+    theta_a[0]=(1-omega_c*dt)*theta_a[1]+(omega_c*dt)*theta_a_raw[1];
+    // apply a high-pass filter to theta_g_raw
+    theta_g[0]=(1-omega_c*dt)*theta_g[1]+theta_g_raw[0]-theta_g_raw[1];
+    theta=theta_a[0]+theta_g[0];
+
+    // update theta values for next iteration
+    theta_a_raw[1]=theta_a_raw[0];
+    theta_g_raw[1]=theta_g_raw[0];
+    theta_a[1]=theta_a[0];
+    theta_g[1]=theta_g[0];
+
+    return theta;
+}
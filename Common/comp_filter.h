@@ -0,0 +1,24 @@
+/*******************************************************************************
+* comp_filter.h
+*
+* Complementary filter for the MiP body angle shared by the MiP programs:
+* the accelerometer angle low-passed and the integrated gyro rate
+* high-passed at the same omega_c, summed. Has no hardware dependencies.
+*******************************************************************************/
+
+#ifndef COMP_FILTER
+#define COMP_FILTER
+
+// filter values of this tick [0] and the last [1], zero to start
+typedef struct comp_filter_t{
+    float theta_a[2];
+    float theta_a_raw[2];
+    float theta_g[2];
+    float theta_g_raw[2];
+} comp_filter_t;
+
+// accel_angle in rad, gyro_rate in deg/s, returns the angle before offsets
+float comp_filter_step(comp_filter_t* f,float accel_angle,float gyro_rate, \
+                       double omega_c,double dt);
+
+#endif	//COMP_FILTER
@@ -0,0 +1,172 @@
+/*******************************************************************************
+* controller.c
+*
+* Difference equation controllers with conditioning anti-windup and
+* bumpless presetting.
+*******************************************************************************/
+#include <math.h>
+#include "controller.h"
+
+/*******************************************************************************
+* initialize_controller()
+*
+* Allocates controller values to be used for difference equation
+* computations. Default inputs and outputs are set to zero.
+*
+* aw sets the anti-windup of an integrating controller, one whose
+* denominator has a root at z=1: the conditioned denominator is the same
+* with that root moved to 1-aw, so aw=0 leaves the controller as it is and
+* aw=1 stops the integration completely while the output is clipped.
+* Controllers without an integrator cannot wind up and are left as they are.
+*******************************************************************************/
+controller_d_t initialize_controller(float gain,int n, int m,float* num, \
+                                     float* den,float sat,float aw){
+    // create controller object
+    controller_d_t d;
+    // initialize for loop counts
+    int i=0;
+    int j=0;
+    // allocate controller numerator values and zero inputs
+    for(i=0;i<(n+1);i++){
+        d.numerator[i]=num[i];
+        d.inputs[i]=0;
+    }
+    // allocate controller denominator values and zero outputs
+    float sum=0;
+    for(j=0;j<(m+1);j++){
+        d.denominator[j]=den[j];
+        d.conditioned[j]=den[j];
+        d.outputs[j]=0;
+        d.applied[j]=0;
+        sum+=den[j];
+    }
+    // divide out the integrator (z-1) and multiply back (z-(1-aw))
+    if(m>0 && aw>0 && fabsf(sum)<1e-4f*fabsf(den[0])){
+        float q[3];
+        q[0]=den[0];
+        for(j=1;j<m;j++) q[j]=den[j]+q[j-1];
+        for(j=1;j<m;j++) d.conditioned[j]=q[j]-(1-aw)*q[j-1];
+        d.conditioned[m]=-(1-aw)*q[m-1];
+    }
+    // allocate gain and saturation values
+    d.gain=gain;
+    d.saturation=sat;
+    // save # of poles and zeros of controller
+    d.n=n;
+    d.m=m;
+    return d;
+}
+
+/*******************************************************************************
+* float control_step()
+*
+* Performs difference equation calculation using controller values from
+* controller d and an input error.
+*
+* Anti-windup by conditioning: with den the denominator, c the conditioned
+* one, u the unclipped and v the applied outputs, the recursion is
+*   den[0] u[k] = gain num e - sum c[j] u[k-j] - sum (den[j]-c[j]) v[k-j]
+* which is the plain difference equation while v=u, and while clipped runs
+* on c, whose poles are all inside the unit circle. An integrating
+* controller then comes off the limit as soon as the error turns instead of
+* first unwinding what it accumulated, and the lead and lag of the other
+* poles are kept.
+*******************************************************************************/
+float control_step(controller_d_t* d,float loop_error){
+    // retrieve # of poles and zeros for calculations
+    int n=d->n;
+    int m=d->m;
+    // initialize for loop counts
+    int i=0; int j=0; int k=0; int l=0;
+    // set input error as initial input
+    d->inputs[0]=loop_error;
+    // initialize output
+    float update_error=0;
+    // perform difference equation calculation
+    for(i=0;i<(n+1);i++){
+        d->outputs[0]+=d->gain*d->numerator[i]*d->inputs[i];
+    }
+    for(j=1;j<(m+1);j++){
+        d->outputs[0]-=d->conditioned[j]*d->outputs[j]+ \
+                       (d->denominator[j]-d->conditioned[j])*d->applied[j];
+    }
+    d->outputs[0]/=d->denominator[0];
+
+    update_error=d->outputs[0];
+    // check for saturation
+    if(update_error>d->saturation){
+        update_error=d->saturation;
+    }
+    else if(update_error<-d->saturation){
+        update_error=-d->saturation;
+    }
+    d->applied[0]=update_error;
+    // update inputs and outputs for next iteration
+    for(k=n;k>0;k--){
+        d->inputs[k]=d->inputs[k-1];
+    }
+    for(l=m;l>0;l--){
+        d->outputs[l]=d->outputs[l-1];
+        d->applied[l]=d->applied[l-1];
+    }
+    // zero out output of difference equation
+    d->outputs[0]=0;
+
+    return update_error;
+}
+
+/*******************************************************************************
+* void clear_controls()
+*
+* Clears input and output values of controllers to prevent lock-up.
+*******************************************************************************/
+void clear_controls(controller_d_t* d){
+    int n=d->n;
+    int m=d->m;
+    int i=0; int j=0;
+    // set input and output values to zero
+    for(i=n;i>=0;i--){
+        d->inputs[i]=0;
+    }
+    for(j=m;j>=0;j--){
+        d->outputs[j]=0;
+        d->applied[j]=0;
+    }
+    return;
+}
+
+/*******************************************************************************
+* void preset_controls()
+*
+* Fills the input history with input and the output history with the one
+* constant value h for which the next control_step() with that input
+* returns exactly output, instead of the proportional kick of a cleared
+* history. With the history constant the difference equation gives
+*   den[0] output = gain sum(num) input - h sum(den[1..m])
+* which is solved for h. h is not output itself unless the numerator sums
+* to zero: the balance programs' D1 sums to 0.0151, so presetting its
+* outputs to output would start it off by gain*0.0151*input. A controller without poles has no
+* history to preset and starts from its static response. Used for bumpless
+* enabling.
+*******************************************************************************/
+void preset_controls(controller_d_t* d,float input,float output){
+    int i=0; int j=0;
+    float num=0,den=0,h=output;
+    for(i=d->n;i>=0;i--){
+        d->inputs[i]=input;
+        num+=d->numerator[i];
+    }
+    for(j=d->m;j>0;j--){
+        den+=d->denominator[j];
+    }
+    if(fabsf(den)>1e-6f){
+        h=(d->gain*num*input-d->denominator[0]*output)/den;
+    }
+    // outputs[0] accumulates the next output and starts at zero
+    d->outputs[0]=0;
+    for(j=d->m;j>0;j--){
+        d->outputs[j]=h;
+        d->applied[j]=h;
+    }
+    return;
+}
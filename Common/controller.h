@@ -0,0 +1,40 @@
+/*******************************************************************************
+* controller.h
+*
+* Discrete transfer function controllers shared by the MiP programs, run as
+* difference equations of up to CONTROLLER_ORDER poles and zeros with the
+* output clipped to a saturation. Has no hardware dependencies, so it can
+* be driven from a simulation.
+*******************************************************************************/
+
+#ifndef CONTROLLER
+#define CONTROLLER
+
+#define CONTROLLER_ORDER        2 // most poles or zeros of a controller
+
+// controller structure
+typedef struct controller_d_t{
+    float gain;
+    int n;
+    int m;
+    float numerator[CONTROLLER_ORDER+1];
+    float denominator[CONTROLLER_ORDER+1];
+    float inputs[CONTROLLER_ORDER+1];
+    float outputs[CONTROLLER_ORDER+1];
+    float conditioned[CONTROLLER_ORDER+1]; // denominator while clipped
+    float applied[CONTROLLER_ORDER+1];     // outputs after clipping
+    float saturation;
+} controller_d_t;
+
+// n zeros and m poles, aw the anti-windup of an integrator, 0 for none
+controller_d_t initialize_controller(float gain,int n, int m,float* num, \
+                                     float* den,float sat,float aw);
+// one step on the error, returns the clipped output
+float control_step(controller_d_t* d,float loop_error);
+// zero the input and output history
+void clear_controls(controller_d_t* d);
+// history for which the next step with input returns output, for bumpless
+// enabling
+void preset_controls(controller_d_t* d,float input,float output);
+
+#endif	//CONTROLLER
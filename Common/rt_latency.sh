@@ -0,0 +1,55 @@
+#!/bin/sh
+# rt_latency.sh program [seconds]
+#
+# Before/after figures for the real-time setup. Run on the board as root
+# from the program's directory ("make latency"). Builds the program with the
+# setup skipped (make rtoff) and as usual, runs each build for the given
+# time (default 60 s) on an idle board and under stress-ng, and prints the
+# worst loop jitter and execution time each run reports on exit. Lay the
+# MiP on its side first, the loops run but the motors stay off.
+
+target=$1
+secs=${2:-60}
+load="stress-ng --cpu 1 --io 1 --vm 1 --vm-bytes 32M"
+
+if [ -z "$target" ]; then
+	echo "usage: rt_latency.sh program [seconds]"
+	exit 1
+fi
+if ! command -v stress-ng >/dev/null; then
+	echo "ERROR: stress-ng is not installed"
+	exit 1
+fi
+dir=$(mktemp -d) || exit 1
+
+make -s clean && make -s rtoff >/dev/null && mv $target $dir/rt_off || exit 1
+make -s clean && make -s >/dev/null && cp $target $dir/rt_on || exit 1
+
+# run build load: one run, stopped with SIGINT like ctrl-c
+run(){
+	spid=
+	if [ $2 = stress ]; then
+		$load --timeout $((secs+10))s >/dev/null 2>&1 &
+		spid=$!
+		sleep 2
+	fi
+	timeout -s INT $secs $dir/$1 >$dir/out 2>&1
+	if [ -n "$spid" ]; then
+		kill $spid 2>/dev/null
+		wait $spid 2>/dev/null
+	fi
+	if grep -q "iterations, max jitter" $dir/out; then
+		grep "iterations, max jitter" $dir/out | sed "s/^/$1 $2 /"
+	else
+		echo "$1 $2 no loop statistics:"
+		cat $dir/out
+	fi
+}
+
+echo "$target, $secs s per run, load: $load"
+for build in rt_off rt_on; do
+	for cond in idle stress; do
+		run $build $cond
+	done
+done
+rm -rf $dir
@@ -0,0 +1,288 @@
+/*******************************************************************************
+* rt_setup.c
+*
+* Memory locking, thread scheduling and latency statistics for the control
+* loops. With RT_DEBUG, also interposes the allocator, sleep, stdio, file
+* and device I/O and mutex calls so any use inside an RT section stops the
+* program under a debugger. With RT_OFF, the setup does nothing, to measure
+* the loops without it (rt_latency.sh).
+*******************************************************************************/
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <rc_usefulincludes.h>
+#include <dlfcn.h>
+#include <malloc.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "rt_setup.h"
+
+/*******************************************************************************
+* int rt_setup_process()
+*
+* Locks all current and future pages so the control loops never take a page
+* fault, and keeps freed heap memory mapped instead of trimming it.
+*******************************************************************************/
+int rt_setup_process(){
+#ifdef RT_OFF
+    return 0;
+#endif
+    if(mlockall(MCL_CURRENT|MCL_FUTURE)){
+        perror("mlockall");
+        return -1;
+    }
+    mallopt(M_TRIM_THRESHOLD,-1);
+    mallopt(M_MMAP_MAX,0);
+    return 0;
+}
+
+/*******************************************************************************
+* int rt_setup_thread()
+*
+* Called once from the thread being set up. Touches RT_STACK_PREFAULT bytes
+* of stack so it is resident, switches to SCHED_FIFO at priority and, when
+* cpu is not negative, pins the thread to that CPU.
+*******************************************************************************/
+int rt_setup_thread(int priority,int cpu){
+    volatile unsigned char stack[RT_STACK_PREFAULT];
+    struct sched_param param;
+    int i=0;
+    int ret;
+
+#ifdef RT_OFF
+    return 0;
+#endif
+    // write one byte per page to fault the stack in
+    for(i=0;i<RT_STACK_PREFAULT;i+=4096){
+        stack[i]=0;
+    }
+    (void)stack[0];
+
+    memset(&param,0,sizeof(param));
+    param.sched_priority=priority;
+    ret=pthread_setschedparam(pthread_self(),SCHED_FIFO,&param);
+    if(ret){
+        fprintf(stderr,"WARNING: failed to set SCHED_FIFO %d: %s\n", \
+                priority,strerror(ret));
+        return -1;
+    }
+    if(cpu>=0){
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu,&set);
+        ret=pthread_setaffinity_np(pthread_self(),sizeof(set),&set);
+        if(ret){
+            fprintf(stderr,"WARNING: failed to pin to CPU %d: %s\n", \
+                    cpu,strerror(ret));
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/*******************************************************************************
+* uint64_t rt_now_ns()
+*
+* Returns CLOCK_MONOTONIC time in nanoseconds. Host simulations build with
+* RT_SIM_CLOCK so the control code sees simulated time and runs
+* deterministically, faster than real time.
+*******************************************************************************/
+#ifdef RT_SIM_CLOCK
+uint64_t rt_sim_time_ns=0;
+
+uint64_t rt_now_ns(){
+    return rt_sim_time_ns;
+}
+#else
+uint64_t rt_now_ns(){
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC,&t);
+    return (uint64_t)t.tv_sec*1000000000ULL+t.tv_nsec;
+}
+#endif
+
+/*******************************************************************************
+* loop statistics
+*
+* rt_stats_begin() and rt_stats_end() bracket one iteration of a loop and
+* track the worst start jitter and execution time. rt_latency.sh compares
+* them with and without the setup above, idle and under a stress load.
+*******************************************************************************/
+void rt_stats_init(rt_loop_stats_t* s,const char* name,float hz){
+    memset(s,0,sizeof(*s));
+    s->name=name;
+    s->period_ns=(uint64_t)(1e9/hz);
+    return;
+}
+
+uint64_t rt_stats_begin(rt_loop_stats_t* s){
+    uint64_t now=rt_now_ns();
+    if(s->count>0){
+        uint64_t period=now-s->last_start_ns;
+        uint64_t jitter=(period>s->period_ns)?period-s->period_ns: \
+                                              s->period_ns-period;
+        if(jitter>s->max_jitter_ns) s->max_jitter_ns=jitter;
+    }
+    s->last_start_ns=now;
+    s->count++;
+    return now;
+}
+
+void rt_stats_end(rt_loop_stats_t* s,uint64_t start_ns){
+    uint64_t exec=rt_now_ns()-start_ns;
+    if(exec>s->max_exec_ns) s->max_exec_ns=exec;
+    return;
+}
+
+void rt_stats_print(const rt_loop_stats_t* s){
+    printf("%s: %llu iterations, max jitter %.1f us, max exec %.1f us\n", \
+           s->name,(unsigned long long)s->count, \
+           s->max_jitter_ns/1e3,s->max_exec_ns/1e3);
+    return;
+}
+
+#ifdef RT_DEBUG
+/*******************************************************************************
+* RT_DEBUG interposers
+*
+* These replace the libc symbols for the whole program, including calls made
+* from libroboticscape, so a cape call that reaches a sysfs file or a device
+* through open/read/write/ioctl, or takes a mutex, is caught as well. Inside
+* an RT section they report the call and raise SIGTRAP, outside they forward
+* to libc or straight to the system call.
+*******************************************************************************/
+__thread int rt_section=0;
+
+extern void* __libc_malloc(size_t size);
+extern void* __libc_calloc(size_t n,size_t size);
+extern void* __libc_realloc(void* p,size_t size);
+extern void __libc_free(void* p);
+
+// libpthread's lock, looked up before main() since it is not exported under
+// another name in every glibc
+static int (*next_mutex_lock)(pthread_mutex_t* m)=NULL;
+
+__attribute__((constructor)) static void rt_debug_init(){
+    next_mutex_lock=dlsym(RTLD_NEXT,"pthread_mutex_lock");
+    return;
+}
+
+static void rt_violation(const char* call){
+    char msg[96];
+    int len=snprintf(msg,sizeof(msg),"RT_DEBUG: %s called in RT section\n",call);
+    // leave the section so the report itself does not recurse
+    rt_section=0;
+    if(syscall(SYS_write,STDERR_FILENO,msg,len)<0){}
+    raise(SIGTRAP);
+    return;
+}
+
+void* malloc(size_t size){
+    if(rt_section) rt_violation("malloc");
+    return __libc_malloc(size);
+}
+
+void* calloc(size_t n,size_t size){
+    if(rt_section) rt_violation("calloc");
+    return __libc_calloc(n,size);
+}
+
+void* realloc(void* p,size_t size){
+    if(rt_section) rt_violation("realloc");
+    return __libc_realloc(p,size);
+}
+
+void free(void* p){
+    if(rt_section) rt_violation("free");
+    __libc_free(p);
+    return;
+}
+
+int nanosleep(const struct timespec* req,struct timespec* rem){
+    if(rt_section) rt_violation("nanosleep");
+    return syscall(SYS_nanosleep,req,rem);
+}
+
+int usleep(useconds_t us){
+    struct timespec t;
+    if(rt_section) rt_violation("usleep");
+    t.tv_sec=us/1000000;
+    t.tv_nsec=(us%1000000)*1000;
+    return syscall(SYS_nanosleep,&t,NULL);
+}
+
+int clock_nanosleep(clockid_t clk,int flags,const struct timespec* req, \
+                    struct timespec* rem){
+    if(rt_section) rt_violation("clock_nanosleep");
+    // libc returns the error number rather than setting errno
+    if(syscall(SYS_clock_nanosleep,clk,flags,req,rem)) return errno;
+    return 0;
+}
+
+int printf(const char* fmt,...){
+    va_list args;
+    int ret;
+    if(rt_section) rt_violation("printf");
+    va_start(args,fmt);
+    ret=vfprintf(stdout,fmt,args);
+    va_end(args);
+    return ret;
+}
+
+int fprintf(FILE* f,const char* fmt,...){
+    va_list args;
+    int ret;
+    if(rt_section) rt_violation("fprintf");
+    va_start(args,fmt);
+    ret=vfprintf(f,fmt,args);
+    va_end(args);
+    return ret;
+}
+
+int puts(const char* s){
+    if(rt_section) rt_violation("puts");
+    if(fputs(s,stdout)==EOF) return EOF;
+    return fputc('\n',stdout);
+}
+
+int open(const char* path,int flags,...){
+    va_list args;
+    mode_t mode=0;
+    if(rt_section) rt_violation("open");
+    if(flags&O_CREAT){
+        va_start(args,flags);
+        mode=va_arg(args,mode_t);
+        va_end(args);
+    }
+    return syscall(SYS_openat,AT_FDCWD,path,flags,mode);
+}
+
+ssize_t read(int fd,void* buf,size_t n){
+    if(rt_section) rt_violation("read");
+    return syscall(SYS_read,fd,buf,n);
+}
+
+ssize_t write(int fd,const void* buf,size_t n){
+    if(rt_section) rt_violation("write");
+    return syscall(SYS_write,fd,buf,n);
+}
+
+int ioctl(int fd,unsigned long request,...){
+    va_list args;
+    void* arg;
+    if(rt_section) rt_violation("ioctl");
+    va_start(args,request);
+    arg=va_arg(args,void*);
+    va_end(args);
+    return syscall(SYS_ioctl,fd,request,arg);
+}
+
+int pthread_mutex_lock(pthread_mutex_t* m){
+    if(rt_section) rt_violation("pthread_mutex_lock");
+    return next_mutex_lock(m);
+}
+#endif	//RT_DEBUG
@@ -0,0 +1,54 @@
+/*******************************************************************************
+* rt_setup.h
+*
+* Real-time setup for the balance programs: locked memory, prefaulted stacks,
+* SCHED_FIFO priorities, optional CPU pinning and loop latency statistics.
+* Building with -D RT_DEBUG (make rtdebug) traps heap allocation, sleeping,
+* stdio, open/read/write/ioctl and mutex locking inside an RT section.
+* Building with -D RT_OFF (make rtoff) skips the setup, for comparison.
+*******************************************************************************/
+
+#ifndef RT_SETUP
+#define RT_SETUP
+
+#include <stdint.h>
+
+#define RT_STACK_PREFAULT       (64*1024) // bytes of stack touched per thread
+
+// timing statistics of one periodic loop, written only by that loop
+typedef struct rt_loop_stats_t{
+    const char* name;
+    uint64_t period_ns;         // nominal period
+    uint64_t last_start_ns;
+    uint64_t count;
+    uint64_t max_jitter_ns;     // worst deviation of start from period
+    uint64_t max_exec_ns;       // worst execution time
+} rt_loop_stats_t;
+
+// lock current and future memory and stop malloc from returning it to the OS
+int rt_setup_process();
+// from inside a control thread: prefault stack, set SCHED_FIFO, pin to cpu>=0
+int rt_setup_thread(int priority,int cpu);
+// CLOCK_MONOTONIC in nanoseconds, or the simulated clock with RT_SIM_CLOCK
+uint64_t rt_now_ns();
+#ifdef RT_SIM_CLOCK
+extern uint64_t rt_sim_time_ns;     // advanced by the host simulation
+#endif
+
+// loop statistics
+void rt_stats_init(rt_loop_stats_t* s,const char* name,float hz);
+uint64_t rt_stats_begin(rt_loop_stats_t* s);
+void rt_stats_end(rt_loop_stats_t* s,uint64_t start_ns);
+void rt_stats_print(const rt_loop_stats_t* s);
+
+// mark code that must not allocate or block, checked only with RT_DEBUG
+#ifdef RT_DEBUG
+extern __thread int rt_section;
+#define RT_ENTER()              (rt_section=1)
+#define RT_EXIT()               (rt_section=0)
+#else
+#define RT_ENTER()              ((void)0)
+#define RT_EXIT()               ((void)0)
+#endif
+
+#endif	//RT_SETUP
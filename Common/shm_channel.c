@@ -0,0 +1,246 @@
+/*******************************************************************************
+* shm_channel.c
+*
+* Shared memory segments, SPSC rings and seqlocked snapshots. Records are
+* copied a word at a time with relaxed atomics and ordered by the acquire
+* and release on the indices, as status_display.c does within a process.
+*******************************************************************************/
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "shm_channel.h"
+
+#define SNAPSHOT_TRIES          4
+
+/*******************************************************************************
+* void* shm_channel_create()
+*
+* Unlinks a segment left by a previous run so attached readers of that run
+* keep the old one, then maps a fresh one and clears it, which faults every
+* page in; under mlockall() they stay resident. The mode is set again after
+* the open, which the umask would otherwise have cut down.
+*******************************************************************************/
+void* shm_channel_create(const char* name,size_t size){
+    void* base;
+    int fd;
+
+    shm_unlink(name);
+    fd=shm_open(name,O_RDWR|O_CREAT|O_EXCL,SHM_MODE);
+    if(fd<0){
+        perror(name);
+        return NULL;
+    }
+    if(fchmod(fd,SHM_MODE) || ftruncate(fd,size)){
+        perror(name);
+        close(fd);
+        shm_unlink(name);
+        return NULL;
+    }
+    base=mmap(NULL,size,PROT_READ|PROT_WRITE,MAP_SHARED,fd,0);
+    close(fd);
+    if(base==MAP_FAILED){
+        perror(name);
+        shm_unlink(name);
+        return NULL;
+    }
+    memset(base,0,size);
+    return base;
+}
+
+/*******************************************************************************
+* void* shm_channel_attach()
+*
+* Quietly returns NULL with errno ENOENT while the segment does not exist
+* yet or is still too small, so readers can poll for the writer to start.
+* Anything else, such as a segment of another group, is printed. The whole
+* segment is mapped read-only first and the readers' part is then mapped
+* writable over its end, so the two stay contiguous and one munmap() undoes
+* both. What the segment holds is for the caller to check.
+*******************************************************************************/
+void* shm_channel_attach(const char* name,size_t* size,size_t writable){
+    struct stat st;
+    char* base;
+    int fd;
+
+    fd=shm_open(name,(writable>0)?O_RDWR:O_RDONLY,0);
+    if(fd<0){
+        if(errno!=ENOENT) perror(name);
+        return NULL;
+    }
+    if(fstat(fd,&st)){
+        perror(name);
+        close(fd);
+        return NULL;
+    }
+    if(st.st_size<=0 || (size_t)st.st_size<writable || \
+       st.st_size%sysconf(_SC_PAGESIZE)!=0){
+        close(fd);
+        errno=ENOENT;
+        return NULL;
+    }
+    base=mmap(NULL,st.st_size,PROT_READ,MAP_SHARED,fd,0);
+    if(base==MAP_FAILED){
+        perror(name);
+        close(fd);
+        return NULL;
+    }
+    if(writable>0 && mmap(base+st.st_size-writable,writable, \
+                          PROT_READ|PROT_WRITE,MAP_SHARED|MAP_FIXED,fd, \
+                          st.st_size-writable)==MAP_FAILED){
+        perror(name);
+        munmap(base,st.st_size);
+        close(fd);
+        return NULL;
+    }
+    close(fd);
+    *size=st.st_size;
+    return base;
+}
+
+void shm_channel_detach(void* base,size_t size){
+    if(base!=NULL) munmap(base,size);
+    return;
+}
+
+void shm_channel_remove(const char* name){
+    if(shm_unlink(name) && errno!=ENOENT) perror(name);
+    return;
+}
+
+size_t shm_channel_pages(size_t n){
+    size_t page=sysconf(_SC_PAGESIZE);
+    return (n+page-1)/page*page;
+}
+
+static size_t line_up(size_t n){
+    return (n+SHM_LINE-1)/SHM_LINE*SHM_LINE;
+}
+
+size_t shm_ring_size(uint32_t slots,uint32_t record){
+    return line_up(sizeof(shm_ring_head_t)+(size_t)slots*record);
+}
+
+size_t shm_snapshot_size(uint32_t record){
+    return line_up(SHM_LINE+record);
+}
+
+static void copy_in(uint32_t* dst,const void* src,uint32_t bytes){
+    const uint32_t* s=src;
+    uint32_t i;
+    for(i=0;i<bytes/4;i++) __atomic_store_n(&dst[i],s[i],__ATOMIC_RELAXED);
+    return;
+}
+
+static void copy_out(void* dst,const uint32_t* src,uint32_t bytes){
+    uint32_t* d=dst;
+    uint32_t i;
+    for(i=0;i<bytes/4;i++) d[i]=__atomic_load_n(&src[i],__ATOMIC_RELAXED);
+    return;
+}
+
+void shm_ring_map(shm_ring_t* r,void* base,void* tail,uint32_t slots, \
+                  uint32_t record){
+    r->slots=slots;
+    r->record=record;
+    r->head=base;
+    r->tail=tail;
+    r->data=(uint32_t*)((char*)base+sizeof(shm_ring_head_t));
+    return;
+}
+
+void shm_ring_init(shm_ring_t* r){
+    r->head->head=0;
+    r->head->dropped=0;
+    r->tail->tail=0;
+    return;
+}
+
+/*******************************************************************************
+* int shm_ring_push()
+*
+* A consumer that is gone or stopped simply leaves the ring full, so the
+* producer costs the same whether anyone is reading or not.
+*******************************************************************************/
+int shm_ring_push(shm_ring_t* r,const void* rec){
+    uint32_t head=__atomic_load_n(&r->head->head,__ATOMIC_RELAXED);
+    uint32_t tail=__atomic_load_n(&r->tail->tail,__ATOMIC_ACQUIRE);
+    uint32_t words=r->record/4;
+
+    // a tail beyond the head, which no consumer can set, counts as full
+    if(head-tail>=r->slots){
+        __atomic_add_fetch(&r->head->dropped,1,__ATOMIC_RELAXED);
+        return -1;
+    }
+    copy_in(&r->data[(head&(r->slots-1))*words],rec,r->record);
+    __atomic_store_n(&r->head->head,head+1,__ATOMIC_RELEASE);
+    return 0;
+}
+
+uint32_t shm_ring_pending(const shm_ring_t* r){
+    return __atomic_load_n(&r->head->head,__ATOMIC_ACQUIRE)- \
+           __atomic_load_n(&r->tail->tail,__ATOMIC_RELAXED);
+}
+
+void shm_ring_peek(const shm_ring_t* r,uint32_t i,void* rec){
+    uint32_t tail=__atomic_load_n(&r->tail->tail,__ATOMIC_RELAXED);
+    copy_out(rec,&r->data[((tail+i)&(r->slots-1))*(r->record/4)],r->record);
+    return;
+}
+
+/*******************************************************************************
+* void shm_ring_release()
+*
+* Separate from the peek so a consumer can release records only once it has
+* stored them, and a restarted one sees again whatever its predecessor had
+* not finished with.
+*******************************************************************************/
+void shm_ring_release(shm_ring_t* r,uint32_t n){
+    uint32_t tail=__atomic_load_n(&r->tail->tail,__ATOMIC_RELAXED);
+    __atomic_store_n(&r->tail->tail,tail+n,__ATOMIC_RELEASE);
+    return;
+}
+
+void shm_snapshot_map(shm_snapshot_t* s,void* base,uint32_t record){
+    s->record=record;
+    s->seq=base;
+    s->data=(uint32_t*)((char*)base+SHM_LINE);
+    return;
+}
+
+void shm_snapshot_init(shm_snapshot_t* s){
+    *s->seq=0;
+    return;
+}
+
+void shm_snapshot_write(shm_snapshot_t* s,const void* rec){
+    uint32_t seq=__atomic_load_n(s->seq,__ATOMIC_RELAXED);
+    __atomic_store_n(s->seq,seq+1,__ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    copy_in(s->data,rec,s->record);
+    __atomic_store_n(s->seq,seq+2,__ATOMIC_RELEASE);
+    return;
+}
+
+/*******************************************************************************
+* int shm_snapshot_read()
+*
+* The writer publishes at its own rate and never waits, so a copy it tore
+* is retried a few times rather than waited out.
+*******************************************************************************/
+int shm_snapshot_read(const shm_snapshot_t* s,void* rec){
+    uint32_t seq0,seq1;
+    int i;
+
+    for(i=0;i<SNAPSHOT_TRIES;i++){
+        seq0=__atomic_load_n(s->seq,__ATOMIC_ACQUIRE);
+        copy_out(rec,s->data,s->record);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        seq1=__atomic_load_n(s->seq,__ATOMIC_RELAXED);
+        if(seq0==seq1 && !(seq0&1)) return 0;
+    }
+    return -1;
+}
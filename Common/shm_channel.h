@@ -0,0 +1,101 @@
+/*******************************************************************************
+* shm_channel.h
+*
+* Lock-free channels between processes through a POSIX shared memory
+* segment. A ring carries fixed-size records from one producer to one
+* consumer, and a snapshot holds the latest copy of one record behind a
+* seqlock. The producer side never waits, allocates or makes a system call,
+* so it can run inside a control loop: a full ring drops and counts the
+* record, and a reader that catches the writer mid-update retries. All
+* indices live in the segment, so a consumer process can die and be
+* restarted and carry on where it stopped.
+*
+* A segment is laid out by its user in two parts, each a whole number of
+* pages: what the creator writes, which readers map read-only, and at the
+* end what readers write (ring tails and the like), which they map
+* writable. Sizes, such as the slots and record of a ring, are kept in each
+* process's own handle and never read back from the segment, so a reader
+* cannot make the creator write outside it. Readers open the segment
+* read-write for their part, so it is created with SHM_MODE, readable and
+* writable by the creator's group: run the readers as the same user or
+* group as the creator (balance_mip installed setuid root keeps the group
+* of whoever starts it), anyone else gets "Permission denied".
+*******************************************************************************/
+
+#ifndef SHM_CHANNEL
+#define SHM_CHANNEL
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHM_LINE                64 // bytes, keeps producer and consumer apart
+#define SHM_MODE                0660 // creator's user and group
+
+// ring indices in the segment, each on its own line
+typedef struct shm_ring_head_t{
+    uint32_t head;              // records pushed
+    uint32_t dropped;           // records refused because the ring was full
+    uint8_t pad[SHM_LINE-2*sizeof(uint32_t)];
+} shm_ring_head_t;
+
+typedef struct shm_ring_tail_t{
+    uint32_t tail;              // records released
+    uint8_t pad[SHM_LINE-sizeof(uint32_t)];
+} shm_ring_tail_t;
+
+// one process's handle on a single-producer single-consumer ring
+typedef struct shm_ring_t{
+    uint32_t slots;             // power of 2
+    uint32_t record;            // bytes per slot, multiple of 4
+    shm_ring_head_t* head;      // written by the producer, followed by data
+    shm_ring_tail_t* tail;      // written by the consumer, in its part
+    uint32_t* data;             // slots*record bytes
+} shm_ring_t;
+
+// one process's handle on the latest copy of one record, single writer
+typedef struct shm_snapshot_t{
+    uint32_t record;            // bytes, multiple of 4
+    uint32_t* seq;              // odd while being written
+    uint32_t* data;
+} shm_snapshot_t;
+
+// map a new zeroed segment of size bytes named "/name", replacing a stale one
+void* shm_channel_create(const char* name,size_t size);
+// map an existing segment and set *size to its length, the last writable
+// bytes writable and the rest read-only; NULL with errno ENOENT if there is
+// none yet, other errors are printed
+void* shm_channel_attach(const char* name,size_t* size,size_t writable);
+void shm_channel_detach(void* base,size_t size);
+// unlink the name, processes still attached keep their mapping
+void shm_channel_remove(const char* name);
+// n rounded up to whole pages, for the size of each part of a segment
+size_t shm_channel_pages(size_t n);
+
+// bytes a ring (head and data) or snapshot takes in the creator's part, a
+// multiple of SHM_LINE; the ring's shm_ring_tail_t goes in the readers' part
+size_t shm_ring_size(uint32_t slots,uint32_t record);
+size_t shm_snapshot_size(uint32_t record);
+
+// either side: point r at a ring laid out at base, with its tail at tail
+void shm_ring_map(shm_ring_t* r,void* base,void* tail,uint32_t slots, \
+                  uint32_t record);
+// producer: empty the ring
+void shm_ring_init(shm_ring_t* r);
+// producer: copy rec in, -1 if the ring is full
+int shm_ring_push(shm_ring_t* r,const void* rec);
+// consumer: records pushed and not yet released
+uint32_t shm_ring_pending(const shm_ring_t* r);
+// consumer: copy the i-th pending record without releasing it
+void shm_ring_peek(const shm_ring_t* r,uint32_t i,void* rec);
+// consumer: release the n oldest pending records to the producer
+void shm_ring_release(shm_ring_t* r,uint32_t n);
+
+// either side: point s at a snapshot laid out at base
+void shm_snapshot_map(shm_snapshot_t* s,void* base,uint32_t record);
+// writer: mark it as never written
+void shm_snapshot_init(shm_snapshot_t* s);
+void shm_snapshot_write(shm_snapshot_t* s,const void* rec);
+// 0 with a consistent copy in rec, -1 if the writer kept interfering
+int shm_snapshot_read(const shm_snapshot_t* s,void* rec);
+
+#endif	//SHM_CHANNEL
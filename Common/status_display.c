@@ -0,0 +1,123 @@
+/*******************************************************************************
+* status_display.c
+*
+* Snapshot slot and renderer thread for the console status line.
+* The slot is a seqlock: the producer never waits, and the renderer simply
+* skips a frame if it catches the producer mid-write.
+*******************************************************************************/
+#include <rc_usefulincludes.h>
+#include <roboticscape.h>
+#include "status_display.h"
+
+// snapshot slot
+static unsigned int status_seq=0;
+static float status_values[STATUS_MAX_VALUES];
+static const char* status_msg=NULL;
+
+// renderer configuration
+static const char* const* status_labels;
+static int status_n=0;
+static float status_hz=10;
+static int status_running=0;
+static pthread_t status_thread;
+
+static void* status_render();
+
+/*******************************************************************************
+* int status_display_start()
+*
+* Saves the labels and render rate and creates the renderer thread.
+*******************************************************************************/
+int status_display_start(const char* const* labels,int n,float hz){
+    if(n<0 || n>STATUS_MAX_VALUES || hz<=0){
+        fprintf(stderr,"ERROR: invalid status display configuration\n");
+        return -1;
+    }
+    status_labels=labels;
+    status_n=n;
+    status_hz=hz;
+    status_running=1;
+    if(pthread_create(&status_thread,NULL,status_render,(void*)NULL)){
+        fprintf(stderr,"ERROR: failed to start status display thread\n");
+        status_running=0;
+        return -1;
+    }
+    return 0;
+}
+
+/*******************************************************************************
+* void status_display_stop()
+*
+* Stops the renderer thread and moves the cursor past the status line.
+*******************************************************************************/
+void status_display_stop(){
+    if(!status_running) return;
+    __atomic_store_n(&status_running,0,__ATOMIC_RELEASE);
+    pthread_join(status_thread,NULL);
+    printf("\n");
+    return;
+}
+
+/*******************************************************************************
+* void status_publish()
+*
+* Copies status_n values into the snapshot slot. An odd sequence number
+* marks the slot as being written.
+*******************************************************************************/
+void status_publish(const float* values){
+    int i=0;
+    unsigned int seq=status_seq;
+    __atomic_store_n(&status_seq,seq+1,__ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    for(i=0;i<status_n;i++){
+        __atomic_store(&status_values[i],&values[i],__ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&status_seq,seq+2,__ATOMIC_RELEASE);
+    return;
+}
+
+/*******************************************************************************
+* void status_message()
+*
+* Publishes a message pointer, may be called from any thread.
+*******************************************************************************/
+void status_message(const char* msg){
+    __atomic_store_n(&status_msg,msg,__ATOMIC_RELEASE);
+    return;
+}
+
+/*******************************************************************************
+* void* status_render()
+*
+* Renders the latest consistent snapshot at status_hz. Frames where the
+* producer was writing are dropped rather than waited for.
+*******************************************************************************/
+static void* status_render(){
+    float values[STATUS_MAX_VALUES];
+    unsigned int seq0,seq1;
+    const char* msg;
+    int i=0;
+
+    while(__atomic_load_n(&status_running,__ATOMIC_ACQUIRE)){
+        // take a snapshot of the slot
+        seq0=__atomic_load_n(&status_seq,__ATOMIC_ACQUIRE);
+        for(i=0;i<status_n;i++){
+            __atomic_load(&status_values[i],&values[i],__ATOMIC_RELAXED);
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        seq1=__atomic_load_n(&status_seq,__ATOMIC_RELAXED);
+        msg=__atomic_load_n(&status_msg,__ATOMIC_ACQUIRE);
+
+        // render only complete snapshots
+        if(seq0==seq1 && !(seq0&1)){
+            printf("\r");
+            for(i=0;i<status_n;i++){
+                printf("%s= %f,",status_labels[i],values[i]);
+            }
+            printf(" %-32s",msg?msg:"");
+            fflush(stdout);
+        }
+        rc_usleep(1000000/status_hz);
+    }
+    return NULL;
+}
@@ -0,0 +1,23 @@
+/*******************************************************************************
+* status_display.h
+*
+* Console status line shared by the MiP programs. Hot paths publish values
+* into a snapshot slot and a separate thread renders the latest snapshot at
+* a fixed rate, so terminal I/O never runs inside a control loop.
+*******************************************************************************/
+
+#ifndef STATUS_DISPLAY
+#define STATUS_DISPLAY
+
+#define STATUS_MAX_VALUES       8
+
+// start renderer thread printing "label= value," for each of n labels at hz
+int status_display_start(const char* const* labels,int n,float hz);
+// stop and join renderer thread, ending the status line
+void status_display_stop();
+// publish n values, wait-free; values must come from a single thread
+void status_publish(const float* values);
+// set message shown after the values; msg must be a static string or NULL
+void status_message(const char* msg);
+
+#endif	//STATUS_DISPLAY
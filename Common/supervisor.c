@@ -0,0 +1,206 @@
+/*******************************************************************************
+* supervisor.c
+*
+* epoll based supervisor loop. An eventfd carries state changes, one timerfd
+* detects a long press of the pause button and an optional second timerfd
+* drives periodic work that used to live in the polling while loop.
+*******************************************************************************/
+#include <rc_usefulincludes.h>
+#include <roboticscape.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include "supervisor.h"
+
+static int epoll_fd=-1;
+static int state_fd=-1;
+static int press_fd=-1;
+static int periodic_fd=-1;
+static void (*periodic_func)()=NULL;
+
+static int watch_fd(int fd);
+static void arm_timer(int fd,long us,long interval_us);
+static void update_leds();
+static void on_signal(int signo);
+
+/*******************************************************************************
+* int supervisor_init()
+*
+* Creates the epoll instance and its event sources. Must be called after
+* rc_initialize() so our signal handler replaces the library's.
+*******************************************************************************/
+int supervisor_init(){
+    struct sigaction action;
+
+    epoll_fd=epoll_create1(EPOLL_CLOEXEC);
+    state_fd=eventfd(0,EFD_NONBLOCK|EFD_CLOEXEC);
+    press_fd=timerfd_create(CLOCK_MONOTONIC,TFD_NONBLOCK|TFD_CLOEXEC);
+    if(epoll_fd<0 || state_fd<0 || press_fd<0){
+        fprintf(stderr,"ERROR: failed to create supervisor events\n");
+        return -1;
+    }
+    if(watch_fd(state_fd) || watch_fd(press_fd)) return -1;
+
+    // signals set EXITING and wake the loop
+    memset(&action,0,sizeof(action));
+    action.sa_handler=on_signal;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT,&action,NULL);
+    sigaction(SIGTERM,&action,NULL);
+    return 0;
+}
+
+/*******************************************************************************
+* void supervisor_set_state()
+*
+* Sets the program state and signals the eventfd. Only an 8 byte write, so it
+* is safe to call from control loops, button callbacks and signal handlers.
+*******************************************************************************/
+void supervisor_set_state(rc_state_t state){
+    uint64_t one=1;
+    rc_set_state(state);
+    if(state_fd>=0){
+        if(write(state_fd,&one,sizeof(one))<0){
+            // counter already pending, the loop will still wake
+        }
+    }
+    return;
+}
+
+/*******************************************************************************
+* void supervisor_pause_pressed()
+*
+* Arms the long-press timer instead of polling the button for 2 seconds.
+*******************************************************************************/
+void supervisor_pause_pressed(){
+    arm_timer(press_fd,LONG_PRESS_US,0);
+    return;
+}
+
+/*******************************************************************************
+* void supervisor_pause_released()
+*
+* Disarms the long-press timer and toggles between paused and running.
+*******************************************************************************/
+void supervisor_pause_released(){
+    arm_timer(press_fd,0,0);
+    if(rc_get_state()==RUNNING)		supervisor_set_state(PAUSED);
+    else if(rc_get_state()==PAUSED)	supervisor_set_state(RUNNING);
+    return;
+}
+
+/*******************************************************************************
+* int supervisor_set_periodic()
+*
+* Registers func to be called from the supervisor loop at hz.
+*******************************************************************************/
+int supervisor_set_periodic(void (*func)(),float hz){
+    periodic_fd=timerfd_create(CLOCK_MONOTONIC,TFD_NONBLOCK|TFD_CLOEXEC);
+    if(periodic_fd<0 || watch_fd(periodic_fd)){
+        fprintf(stderr,"ERROR: failed to create periodic timer\n");
+        return -1;
+    }
+    periodic_func=func;
+    arm_timer(periodic_fd,1000000/hz,1000000/hz);
+    return 0;
+}
+
+/*******************************************************************************
+* int supervisor_run()
+*
+* Sleeps in epoll_wait() and dispatches events until the state is EXITING.
+*******************************************************************************/
+int supervisor_run(){
+    struct epoll_event events[4];
+    uint64_t count;
+    int i,n;
+
+    update_leds();
+    while(rc_get_state()!=EXITING){
+        n=epoll_wait(epoll_fd,events,4,-1);
+        if(n<0){
+            if(errno==EINTR) continue;
+            perror("epoll_wait");
+            return -1;
+        }
+        for(i=0;i<n;i++){
+            int fd=events[i].data.fd;
+            // clear the event counter or timer expiration count
+            if(read(fd,&count,sizeof(count))<0) continue;
+            if(fd==state_fd){
+                update_leds();
+            }
+            else if(fd==press_fd){
+                if(rc_get_pause_button()==PRESSED){
+                    printf("long press detected, shutting down\n");
+                    supervisor_set_state(EXITING);
+                }
+            }
+            else if(fd==periodic_fd && periodic_func!=NULL){
+                if(rc_get_state()==RUNNING) periodic_func();
+            }
+        }
+    }
+    return 0;
+}
+
+/*******************************************************************************
+* void supervisor_cleanup()
+*
+* Closes all supervisor file descriptors.
+*******************************************************************************/
+void supervisor_cleanup(){
+    if(periodic_fd>=0) close(periodic_fd);
+    if(press_fd>=0) close(press_fd);
+    if(state_fd>=0) close(state_fd);
+    if(epoll_fd>=0) close(epoll_fd);
+    periodic_fd=press_fd=state_fd=epoll_fd=-1;
+    return;
+}
+
+/*******************************************************************************
+* static helpers
+*******************************************************************************/
+static int watch_fd(int fd){
+    struct epoll_event ev;
+    memset(&ev,0,sizeof(ev));
+    ev.events=EPOLLIN;
+    ev.data.fd=fd;
+    if(epoll_ctl(epoll_fd,EPOLL_CTL_ADD,fd,&ev)){
+        perror("epoll_ctl");
+        return -1;
+    }
+    return 0;
+}
+
+// arm a timerfd for us microseconds, zero disarms it
+static void arm_timer(int fd,long us,long interval_us){
+    struct itimerspec spec;
+    if(fd<0) return;
+    spec.it_value.tv_sec=us/1000000;
+    spec.it_value.tv_nsec=(us%1000000)*1000;
+    spec.it_interval.tv_sec=interval_us/1000000;
+    spec.it_interval.tv_nsec=(interval_us%1000000)*1000;
+    timerfd_settime(fd,0,&spec,NULL);
+    return;
+}
+
+// green while running, red while paused
+static void update_leds(){
+    if(rc_get_state()==RUNNING){
+        rc_set_led(GREEN, ON);
+        rc_set_led(RED, OFF);
+    }
+    else if(rc_get_state()==PAUSED){
+        rc_set_led(GREEN, OFF);
+        rc_set_led(RED, ON);
+    }
+    return;
+}
+
+static void on_signal(int signo){
+    (void)signo;
+    supervisor_set_state(EXITING);
+    return;
+}
@@ -0,0 +1,30 @@
+/*******************************************************************************
+* supervisor.h
+*
+* Event-driven main loop shared by the MiP programs. State changes, pause
+* button edges, signals and timers all wake a single epoll loop, so main()
+* sleeps until something happens instead of polling every 100 ms.
+*******************************************************************************/
+
+#ifndef SUPERVISOR
+#define SUPERVISOR
+
+#include <roboticscape.h>
+
+#define LONG_PRESS_US           2000000 // hold pause for 2 s to exit
+
+// create epoll loop, state event and long-press timer, trap SIGINT/SIGTERM
+int supervisor_init();
+// set state and wake the supervisor loop, safe from any thread
+void supervisor_set_state(rc_state_t state);
+// pause button callbacks for rc_set_pause_pressed/released_func()
+void supervisor_pause_pressed();
+void supervisor_pause_released();
+// run func from the supervisor loop at hz while RUNNING, call before run
+int supervisor_set_periodic(void (*func)(),float hz);
+// handle events until state is EXITING
+int supervisor_run();
+// close supervisor file descriptors
+void supervisor_cleanup();
+
+#endif	//SUPERVISOR
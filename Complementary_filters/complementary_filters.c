@@ -7,6 +7,8 @@
 *******************************************************************************/
 #include <rc_usefulincludes.h>
 #include <roboticscape.h>
+#include "status_display.h"
+#include "supervisor.h"
 
 // variable declarations
 rc_imu_data_t imu_read;
@@ -21,9 +23,11 @@ float theta_f;
 float omega_c=2;
 float step_size=0.01;
 
+// console status line
+float display_freq=10;
+const char* status_labels[]={"theta_a","theta_g","theta_f"};
+
 // function declarations
-void on_pause_pressed();
-void on_pause_released();
 int imu_filtered();
 
 /*******************************************************************************
@@ -32,7 +36,8 @@ int imu_filtered();
 * This template main function contains these critical components
 * - call to rc_initialize() at the beginning
 * - sets imu configuration and interrupt function
-* - main while loop that checks for EXITING condition
+* - starts the console status display
+* - supervisor loop that sleeps until EXITING
 * - rc_cleanup() at the end
 *******************************************************************************/
 int main(){
@@ -44,8 +49,11 @@ int main(){
 
 	// do your own initialization here
 	printf("\nComplementary Filters\n");
-	rc_set_pause_pressed_func(&on_pause_pressed);
-	rc_set_pause_released_func(&on_pause_released);
+	if(supervisor_init()){
+		return -1;
+	}
+	rc_set_pause_pressed_func(&supervisor_pause_pressed);
+	rc_set_pause_released_func(&supervisor_pause_released);
 
 	// set default IMU configuration
 	rc_imu_config_t config = rc_default_imu_config();
@@ -63,75 +71,33 @@ int main(){
 	theta_g=theta_g_raw;
 	theta_g_prev=0.0;
 
-	// print filtered imu angle values
+	// print filtered imu angle values from a separate display thread
+	if(status_display_start(status_labels,3,display_freq)){
+		return -1;
+	}
 	rc_set_imu_interrupt_func(&imu_filtered);
 
 	// done initializing so set state to RUNNING
-	rc_set_state(RUNNING);
+	supervisor_set_state(RUNNING);
 
-	// Keep looping until state changes to EXITING
-	while(rc_get_state()!=EXITING){
-		// handle other states
-		if(rc_get_state()==RUNNING){
-			// do things
-			rc_set_led(GREEN, ON);
-			rc_set_led(RED, OFF);
-		}
-		else if(rc_get_state()==PAUSED){
-			// do other things
-			rc_set_led(GREEN, OFF);
-			rc_set_led(RED, ON);
-		}
-		// always sleep at some point
-		rc_usleep(100000);
-	}
+	// sleep until events arrive, returns once state is EXITING
+	supervisor_run();
 
 	// exit cleanly
 	rc_power_off_imu();
+	status_display_stop();
+	supervisor_cleanup();
 	rc_cleanup();
 	return 0;
 }
 
-/*******************************************************************************
-* void on_pause_released()
-*
-* Make the Pause button toggle between paused and running states.
-*******************************************************************************/
-void on_pause_released(){
-	// toggle between paused and running modes
-	if(rc_get_state()==RUNNING)		rc_set_state(PAUSED);
-	else if(rc_get_state()==PAUSED)	rc_set_state(RUNNING);
-	return;
-}
-
-/*******************************************************************************
-* void on_pause_pressed()
-*
-* If the user holds the pause button for 2 seconds, set state to exiting which
-* triggers the rest of the program to exit cleanly.
-*******************************************************************************/
-void on_pause_pressed(){
-	int i=0;
-	const int samples = 100;	// check for release 100 times in this period
-	const int us_wait = 2000000; // 2 seconds
-
-	// now keep checking to see if the button is still held down
-	for(i=0;i<samples;i++){
-		rc_usleep(us_wait/samples);
-		if(rc_get_pause_button() == RELEASED) return;
-	}
-	printf("long press detected, shutting down\n");
-	rc_set_state(EXITING);
-	return;
-}
-
 /*******************************************************************************
 * int imu_filtered()
 *
 * Converts accelerometer and gyroscope data into angle values (in radians) of
 * the BeagleBone relative to the x-axis. These values are then passed through
 * low-pass (accelerometer data) and high-pass (gyroscope data) filters and then
-* printed to the screen as theta values.
+* published to the console status display as theta values.
 *******************************************************************************/
 int imu_filtered(){
     // compute accelerometer angle of BeagleBone relative to x-axis
@@ -148,10 +114,8 @@ int imu_filtered(){
     // update theta_g_prev value
     theta_g_prev=theta_g_raw;
 
-    // print values to console at 100 Hz
-    printf("\r");
-    printf("theta_a= %f,theta_g= %f,theta_f= %f",theta_a,theta_g,theta_f);
-    fflush(stdout);
-    rc_usleep(10000);
+    // publish values for the display thread
+    float values[3]={theta_a,theta_g,theta_f};
+    status_publish(values);
     return 0;
 }
@@ -0,0 +1,564 @@
+/*******************************************************************************
+* log_spectrum.c
+*
+* Streaming spectral analysis of telemetry logs: theta_data.txt and
+* raw_data.txt from imu_data_export, sysid_data.txt from system_id, or any
+* CSV with a header line, or raw little-endian float32 records (-b).
+*
+* Computes Welch PSDs (Hann window, 50% overlap) of the chosen channels and
+* the cross-spectrum and coherence of channel pairs. The log is read one
+* line at a time into a ring of the last segment, and finished segments are
+* handed to worker threads in fixed-size batches, so memory use depends only
+* on the segment length, channel count and batch size, not on the log size.
+* Each worker accumulates its own partial spectra, which are summed at the
+* end. The summary goes to stderr, the spectra as CSV to stdout or -o.
+*
+* If the log has theta_a and theta_g, the effective complementary filter
+* crossover is reported: the frequency where the low-passed accelerometer
+* angle and the high-passed gyro angle carry equal power, next to the
+* crossover implied by omega_c (-w, default 2 rad/s as in OMEGA_C) at the
+* filter step (-d, default 0.01 s as in DT), which is the IMU period even
+* when the log was decimated.
+*
+* usage: log_spectrum [-c ch,ch,...] [-p a:b]... [-l seglen] [-r rate_hz]
+*                     [-j threads] [-w omega_c] [-d filter_dt] [-b channels]
+*                     [-o out.csv] log
+*******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <complex.h>
+#include <pthread.h>
+
+#define MAX_CHANNELS            16
+#define MAX_PAIRS               16
+#define MAX_LINE                1024
+#define BATCH_SEGMENTS          64 // segments per batch handed to the workers
+#define MAX_THREADS             64
+
+typedef struct pair_t{
+    int a;
+    int b;
+} pair_t;
+
+// partial spectra of one worker
+typedef struct accum_t{
+    double* psd[MAX_CHANNELS];
+    double complex* cross[MAX_PAIRS];
+    long segments;
+} accum_t;
+
+// segments copied out of the stream, channel-major per segment
+typedef struct batch_t{
+    int count;
+    double* data;
+} batch_t;
+
+typedef struct pool_t{
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t done;
+    batch_t* batch;             // batch being processed, NULL when idle
+    unsigned long generation;
+    int pending;                // workers still busy on the batch
+    int quit;
+    int threads;
+} pool_t;
+
+// analysis settings, fixed before the workers start
+static int seglen=1024;
+static int nch=0;
+static int channel[MAX_CHANNELS];       // column of each analyzed channel
+static char channel_name[MAX_CHANNELS][32];
+static int npairs=0;
+static pair_t pairs[MAX_PAIRS];
+static double* window;
+static double window_power;
+
+static pool_t pool;
+static accum_t accum[MAX_THREADS];
+
+/*******************************************************************************
+* void fft()
+*
+* In-place iterative radix-2 FFT, len must be a power of 2.
+*******************************************************************************/
+static void fft(double complex* x,int len){
+    int i,j,k,m;
+    for(i=1,j=0;i<len;i++){
+        int bit=len>>1;
+        for(;j&bit;bit>>=1) j^=bit;
+        j^=bit;
+        if(i<j){
+            double complex tmp=x[i];
+            x[i]=x[j];
+            x[j]=tmp;
+        }
+    }
+    for(m=2;m<=len;m<<=1){
+        double complex w=cexp(-2*M_PI*I/m);
+        for(k=0;k<len;k+=m){
+            double complex wk=1;
+            for(j=0;j<m/2;j++){
+                double complex a=x[k+j];
+                double complex b=wk*x[k+j+m/2];
+                x[k+j]=a+b;
+                x[k+j+m/2]=a-b;
+                wk*=w;
+            }
+        }
+    }
+    return;
+}
+
+/*******************************************************************************
+* void process_segment()
+*
+* Detrends, windows and transforms every channel of one segment and adds
+* the auto and cross spectra to the worker's accumulator.
+*******************************************************************************/
+static void process_segment(const double* seg,double complex* X,accum_t* acc){
+    int bins=seglen/2+1;
+    int c,i,k;
+    for(c=0;c<nch;c++){
+        const double* s=seg+c*seglen;
+        double complex* x=X+c*seglen;
+        double mean=0;
+        for(i=0;i<seglen;i++) mean+=s[i];
+        mean/=seglen;
+        for(i=0;i<seglen;i++) x[i]=(s[i]-mean)*window[i];
+        fft(x,seglen);
+        for(k=0;k<bins;k++) acc->psd[c][k]+=creal(x[k]*conj(x[k]));
+    }
+    for(i=0;i<npairs;i++){
+        double complex* xa=X+pairs[i].a*seglen;
+        double complex* xb=X+pairs[i].b*seglen;
+        for(k=0;k<bins;k++) acc->cross[i][k]+=conj(xa[k])*xb[k];
+    }
+    acc->segments++;
+    return;
+}
+
+/*******************************************************************************
+* void* worker()
+*
+* Waits for a batch and processes every threads-th segment of it, starting
+* at its own index.
+*******************************************************************************/
+static void* worker(void* arg){
+    int id=(int)(long)arg;
+    double complex* X=malloc(nch*seglen*sizeof(double complex));
+    unsigned long seen=0;
+    batch_t* b;
+    int i;
+
+    for(;;){
+        pthread_mutex_lock(&pool.lock);
+        while(!pool.quit && pool.generation==seen){
+            pthread_cond_wait(&pool.work,&pool.lock);
+        }
+        if(pool.quit){
+            pthread_mutex_unlock(&pool.lock);
+            break;
+        }
+        seen=pool.generation;
+        b=pool.batch;
+        pthread_mutex_unlock(&pool.lock);
+
+        for(i=id;i<b->count;i+=pool.threads){
+            process_segment(b->data+(size_t)i*nch*seglen,X,&accum[id]);
+        }
+
+        pthread_mutex_lock(&pool.lock);
+        if(--pool.pending==0) pthread_cond_signal(&pool.done);
+        pthread_mutex_unlock(&pool.lock);
+    }
+    free(X);
+    return NULL;
+}
+
+// blocks until the workers have finished the current batch
+static void pool_wait(){
+    pthread_mutex_lock(&pool.lock);
+    while(pool.pending>0) pthread_cond_wait(&pool.done,&pool.lock);
+    pool.batch=NULL;
+    pthread_mutex_unlock(&pool.lock);
+    return;
+}
+
+static void pool_submit(batch_t* b){
+    pool_wait();
+    pthread_mutex_lock(&pool.lock);
+    pool.batch=b;
+    pool.pending=pool.threads;
+    pool.generation++;
+    pthread_cond_broadcast(&pool.work);
+    pthread_mutex_unlock(&pool.lock);
+    return;
+}
+
+/*******************************************************************************
+* int split_csv()
+*
+* Splits a CSV line in place, returns the field count.
+*******************************************************************************/
+static int split_csv(char* line,char** fields,int max){
+    int n=0;
+    char* p=line;
+    while(n<max){
+        fields[n++]=p;
+        p=strchr(p,',');
+        if(p==NULL) break;
+        *p++='\0';
+    }
+    return n;
+}
+
+static int find_column(char** names,int n,const char* name){
+    int i;
+    for(i=0;i<n;i++) if(strcmp(names[i],name)==0) return i;
+    return -1;
+}
+
+/*******************************************************************************
+* stream reader
+*
+* Keeps the last seglen samples of every channel in a ring. Every hop of
+* seglen/2 new samples completes a segment, which is copied into the batch
+* being filled; full batches go to the workers while the next one fills.
+*******************************************************************************/
+typedef struct stream_t{
+    double* ring;               // nch x seglen
+    long samples;
+    batch_t batch[2];
+    int filling;
+    long segments;
+} stream_t;
+
+static void stream_push(stream_t* s,const double* values){
+    int pos=s->samples%seglen;
+    int c,i,hop=seglen/2;
+    batch_t* b;
+    for(c=0;c<nch;c++) s->ring[c*seglen+pos]=values[c];
+    s->samples++;
+    if(s->samples<seglen || (s->samples-seglen)%hop) return;
+
+    // oldest sample of the segment is the next one to be overwritten
+    b=&s->batch[s->filling];
+    for(c=0;c<nch;c++){
+        double* dst=b->data+((size_t)b->count*nch+c)*seglen;
+        for(i=0;i<seglen;i++){
+            dst[i]=s->ring[c*seglen+(s->samples+i)%seglen];
+        }
+    }
+    b->count++;
+    s->segments++;
+    if(b->count==BATCH_SEGMENTS){
+        // pool_submit() waits for the other buffer, so it is free to refill
+        pool_submit(b);
+        s->filling^=1;
+        s->batch[s->filling].count=0;
+    }
+    return;
+}
+
+static void stream_flush(stream_t* s){
+    batch_t* b=&s->batch[s->filling];
+    if(b->count>0) pool_submit(b);
+    pool_wait();
+    return;
+}
+
+/*******************************************************************************
+* int parse_pair()
+*
+* Reads "a:b" into a pair of channel names, resolved once the header is read.
+*******************************************************************************/
+static char pair_names[MAX_PAIRS][2][32];
+
+static int parse_pair(const char* arg){
+    if(npairs==MAX_PAIRS) return -1;
+    if(sscanf(arg,"%31[^:]:%31s",pair_names[npairs][0],pair_names[npairs][1])!=2){
+        return -1;
+    }
+    npairs++;
+    return 0;
+}
+
+static int channel_index(const char* name){
+    int c;
+    for(c=0;c<nch;c++) if(strcmp(channel_name[c],name)==0) return c;
+    return -1;
+}
+
+/*******************************************************************************
+* double crossover()
+*
+* Lowest frequency above DC where the theta_g PSD reaches the theta_a PSD,
+* interpolated in log power. Returns -1 if they never cross.
+*******************************************************************************/
+static double crossover(const double* pa,const double* pg,int bins,double df){
+    int k;
+    for(k=2;k<bins;k++){
+        if(pg[k]>=pa[k] && pg[k-1]<pa[k-1] && pa[k]>0 && pg[k]>0 && \
+           pa[k-1]>0 && pg[k-1]>0){
+            double d0=log(pa[k-1]/pg[k-1]);
+            double d1=log(pa[k]/pg[k]);
+            return df*(k-1+d0/(d0-d1));
+        }
+    }
+    return -1;
+}
+
+static const char* usage="usage: log_spectrum [-c ch,ch,...] [-p a:b]... " \
+    "[-l seglen] [-r rate_hz] [-j threads] [-w omega_c] [-d filter_dt] " \
+    "[-b channels] [-o out.csv] log\n";
+
+int main(int argc,char* argv[]){
+    const char* select=NULL;
+    const char* out_name=NULL;
+    FILE* in;
+    FILE* out=stdout;
+    char line[MAX_LINE];
+    char* fields[MAX_CHANNELS*4];
+    char header[MAX_LINE];
+    double values[MAX_CHANNELS];
+    double rate=0,omega_c=2,filter_dt=0.01,t0=0,t1=0,df,scale;
+    int binary=0,threads=0,time_col=-1,nfields=0;
+    int c,i,k,bins;
+    pthread_t tid[MAX_THREADS];
+    stream_t s;
+    accum_t total;
+
+    threads=(int)sysconf(_SC_NPROCESSORS_ONLN);
+    while((c=getopt(argc,argv,"c:p:l:r:j:w:d:b:o:"))!=-1){
+        switch(c){
+        case 'c': select=optarg; break;
+        case 'p':
+            if(parse_pair(optarg)){
+                fprintf(stderr,"ERROR: bad pair '%s', use a:b\n",optarg);
+                return -1;
+            }
+            break;
+        case 'l': seglen=atoi(optarg); break;
+        case 'r': rate=atof(optarg); break;
+        case 'j': threads=atoi(optarg); break;
+        case 'w': omega_c=atof(optarg); break;
+        case 'd': filter_dt=atof(optarg); break;
+        case 'b': binary=atoi(optarg); break;
+        case 'o': out_name=optarg; break;
+        default:
+            fprintf(stderr,"%s",usage);
+            return -1;
+        }
+    }
+    if(optind!=argc-1 || seglen<8 || (seglen&(seglen-1)) || \
+       binary<0 || binary>MAX_CHANNELS){
+        fprintf(stderr,"%s",usage);
+        return -1;
+    }
+    if(threads<1) threads=1;
+    if(threads>MAX_THREADS) threads=MAX_THREADS;
+
+    in=fopen(argv[optind],binary?"rb":"r");
+    if(in==NULL){
+        perror(argv[optind]);
+        return -1;
+    }
+
+    // channel names come from the CSV header or are ch0..chN-1
+    if(binary){
+        if(rate<=0){
+            fprintf(stderr,"ERROR: binary logs need -r rate_hz\n");
+            return -1;
+        }
+        nfields=binary;
+        for(i=0;i<nfields;i++){
+            snprintf(header+i*8,8,"ch%d",i);
+            fields[i]=header+i*8;
+        }
+    }
+    else{
+        do{
+            if(fgets(header,sizeof(header),in)==NULL){
+                fprintf(stderr,"ERROR: %s has no header\n",argv[optind]);
+                return -1;
+            }
+        }while(header[0]=='#');
+        header[strcspn(header,"\r\n")]='\0';
+        nfields=split_csv(header,fields,MAX_CHANNELS*4);
+        time_col=find_column(fields,nfields,"time(s)");
+    }
+    if(select!=NULL){
+        char list[MAX_LINE];
+        char* name;
+        strncpy(list,select,sizeof(list)-1);
+        list[sizeof(list)-1]='\0';
+        for(name=strtok(list,",");name!=NULL;name=strtok(NULL,",")){
+            i=find_column(fields,nfields,name);
+            if(i<0 || nch==MAX_CHANNELS){
+                fprintf(stderr,"ERROR: no channel '%s'\n",name);
+                return -1;
+            }
+            channel[nch]=i;
+            snprintf(channel_name[nch++],32,"%s",name);
+        }
+    }
+    else{
+        for(i=0;i<nfields && nch<MAX_CHANNELS;i++){
+            if(i==time_col || strcmp(fields[i],"sample")==0) continue;
+            channel[nch]=i;
+            snprintf(channel_name[nch++],32,"%s",fields[i]);
+        }
+    }
+    for(i=0;i<npairs;i++){
+        pairs[i].a=channel_index(pair_names[i][0]);
+        pairs[i].b=channel_index(pair_names[i][1]);
+        if(pairs[i].a<0 || pairs[i].b<0){
+            fprintf(stderr,"ERROR: pair %s:%s needs both channels selected\n", \
+                    pair_names[i][0],pair_names[i][1]);
+            return -1;
+        }
+    }
+    if(nch==0){
+        fprintf(stderr,"ERROR: no channels to analyze\n");
+        return -1;
+    }
+
+    // fixed-size buffers for the whole run
+    bins=seglen/2+1;
+    window=malloc(seglen*sizeof(double));
+    window_power=0;
+    for(i=0;i<seglen;i++){
+        window[i]=0.5-0.5*cos(2*M_PI*i/seglen);
+        window_power+=window[i]*window[i];
+    }
+    memset(&s,0,sizeof(s));
+    s.ring=calloc((size_t)nch*seglen,sizeof(double));
+    for(i=0;i<2;i++){
+        s.batch[i].data=malloc((size_t)BATCH_SEGMENTS*nch*seglen*sizeof(double));
+        if(s.batch[i].data==NULL) return -1;
+    }
+    for(i=0;i<threads;i++){
+        for(c=0;c<nch;c++) accum[i].psd[c]=calloc(bins,sizeof(double));
+        for(c=0;c<npairs;c++) accum[i].cross[c]=calloc(bins,sizeof(double complex));
+    }
+    pthread_mutex_init(&pool.lock,NULL);
+    pthread_cond_init(&pool.work,NULL);
+    pthread_cond_init(&pool.done,NULL);
+    pool.threads=threads;
+    for(i=0;i<threads;i++){
+        pthread_create(&tid[i],NULL,worker,(void*)(long)i);
+    }
+
+    // stream the log
+    if(binary){
+        float rec[MAX_CHANNELS];
+        while(fread(rec,sizeof(float),binary,in)==(size_t)binary){
+            for(c=0;c<nch;c++) values[c]=rec[channel[c]];
+            stream_push(&s,values);
+        }
+    }
+    else{
+        while(fgets(line,sizeof(line),in)!=NULL){
+            int n=split_csv(line,fields,MAX_CHANNELS*4);
+            if(line[0]=='#' || n<nfields) continue;
+            if(time_col>=0){
+                double t=atof(fields[time_col]);
+                if(s.samples==0) t0=t;
+                t1=t;
+            }
+            for(c=0;c<nch;c++) values[c]=atof(fields[channel[c]]);
+            stream_push(&s,values);
+        }
+    }
+    fclose(in);
+    stream_flush(&s);
+    pthread_mutex_lock(&pool.lock);
+    pool.quit=1;
+    pthread_cond_broadcast(&pool.work);
+    pthread_mutex_unlock(&pool.lock);
+    for(i=0;i<threads;i++) pthread_join(tid[i],NULL);
+
+    if(rate<=0){
+        if(time_col<0 || s.samples<2 || t1<=t0){
+            fprintf(stderr,"ERROR: no time column, give the rate with -r\n");
+            return -1;
+        }
+        rate=(s.samples-1)/(t1-t0);
+    }
+    if(s.segments<1){
+        fprintf(stderr,"ERROR: %ld samples, need at least %d\n",s.samples,seglen);
+        return -1;
+    }
+
+    // sum the partial spectra, one-sided density scaling
+    memset(&total,0,sizeof(total));
+    for(c=0;c<nch;c++) total.psd[c]=calloc(bins,sizeof(double));
+    for(c=0;c<npairs;c++) total.cross[c]=calloc(bins,sizeof(double complex));
+    for(i=0;i<threads;i++){
+        for(k=0;k<bins;k++){
+            for(c=0;c<nch;c++) total.psd[c][k]+=accum[i].psd[c][k];
+            for(c=0;c<npairs;c++) total.cross[c][k]+=accum[i].cross[c][k];
+        }
+        total.segments+=accum[i].segments;
+    }
+    df=rate/seglen;
+    for(k=0;k<bins;k++){
+        scale=((k==0 || k==bins-1)?1.0:2.0)/(rate*window_power*total.segments);
+        for(c=0;c<nch;c++) total.psd[c][k]*=scale;
+        for(c=0;c<npairs;c++) total.cross[c][k]*=scale;
+    }
+
+    fprintf(stderr,"%ld samples at %.3f Hz, %ld segments of %d, %.4f Hz resolution, " \
+           "%d threads\n",s.samples,rate,total.segments,seglen,df,threads);
+    i=channel_index("theta_a");
+    c=channel_index("theta_g");
+    if(i>=0 && c>=0){
+        double fx=crossover(total.psd[i],total.psd[c],bins,df);
+        // the filters use 1-omega_c*dt, whose continuous pole is -ln(.)/dt
+        double expected=-log(1-omega_c*filter_dt)/filter_dt/(2*M_PI);
+        if(fx>0){
+            fprintf(stderr,"complementary filter crossover %.4f Hz (%.3f rad/s), " \
+                   "omega_c=%g rad/s implies %.4f Hz\n",fx,2*M_PI*fx, \
+                   omega_c,expected);
+        }
+        else{
+            fprintf(stderr,"theta_a and theta_g PSDs do not cross, omega_c=%g rad/s " \
+                   "implies %.4f Hz\n",omega_c,expected);
+        }
+    }
+
+    if(out_name!=NULL){
+        out=fopen(out_name,"w");
+        if(out==NULL){
+            perror(out_name);
+            return -1;
+        }
+    }
+    fprintf(out,"freq_hz");
+    for(c=0;c<nch;c++) fprintf(out,",psd_%s",channel_name[c]);
+    for(c=0;c<npairs;c++){
+        fprintf(out,",csd_mag_%s_%s,csd_phase_deg_%s_%s,coherence_%s_%s", \
+                channel_name[pairs[c].a],channel_name[pairs[c].b], \
+                channel_name[pairs[c].a],channel_name[pairs[c].b], \
+                channel_name[pairs[c].a],channel_name[pairs[c].b]);
+    }
+    fprintf(out,"\n");
+    for(k=0;k<bins;k++){
+        fprintf(out,"%.6f",k*df);
+        for(c=0;c<nch;c++) fprintf(out,",%.6e",total.psd[c][k]);
+        for(c=0;c<npairs;c++){
+            double pa=total.psd[pairs[c].a][k];
+            double pb=total.psd[pairs[c].b][k];
+            double complex x=total.cross[c][k];
+            fprintf(out,",%.6e,%.2f,%.4f",cabs(x),carg(x)*180/M_PI, \
+                    (pa>0 && pb>0)?creal(x*conj(x))/(pa*pb):0);
+        }
+        fprintf(out,"\n");
+    }
+    if(out!=stdout) fclose(out);
+    return 0;
+}
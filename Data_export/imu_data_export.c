@@ -3,10 +3,37 @@
 *
 * Prints filtered accelerometer and gyroscope data and
 * exports the theta values to a text file for external
-* use and plotting.
+* use and plotting. Every exported record carries the
+* CLOCK_MONOTONIC timestamp and IMU sample index of the
+* data it was decimated from. With -w the raw IMU and
+* encoder stream is written at full rate instead, in the
+* format replayed by Balance_mip/host/replay_mip.
 *******************************************************************************/
 #include <rc_usefulincludes.h>
 #include <roboticscape.h>
+#include "status_display.h"
+#include "supervisor.h"
+
+// export buffer length (power of 2), ~25 s of records at 10 Hz
+#define EXPORT_BUFFER_LEN       256
+
+// encoder channels of the wheels, as wired in Balance_mip/mip_config.h
+#define RAW_ENCODER_L           3
+#define RAW_ENCODER_R           2
+
+// exported record structure
+typedef struct export_record_t{
+    uint64_t sample;            // index of last IMU sample in the record
+    uint64_t time_ns;           // CLOCK_MONOTONIC time of that sample
+    float theta_a;
+    float theta_g;
+    float theta_f;
+    float accel_y;              // raw inputs of the last sample, for -w
+    float accel_z;
+    float gyro_x;
+    int encoder_l;
+    int encoder_r;
+} export_record_t;
 
 // variable declarations
 rc_imu_data_t imu_read;
@@ -23,25 +50,47 @@ float step_size=0.01;
 float micro=1000000;
 float sample_freq=100;
 float print_freq=10;
+float export_freq=10;
+float display_freq=10;
+int export_average=1; // 1 averages each block, 0 keeps every Nth sample
+int export_raw=0; // 1 writes raw inputs at full rate to raw_data.txt
+
+// decimation state, owned by imu_filters()
+int export_decimation;
+int block_count=0;
+uint64_t sample_count=0;
+float block_sum[3];
+
+// single-producer single-consumer record buffer
+export_record_t export_buffer[EXPORT_BUFFER_LEN];
+unsigned int export_head=0; // written by imu_filters()
+unsigned int export_tail=0; // written by data_export()
+unsigned int export_dropped=0;
+
+// console status line
+const char* status_labels[]={"theta_a","theta_g","theta_f"};
 
 // function declarations
-void on_pause_pressed();
-void on_pause_released();
-void* theta_display();
 void* data_export();
 int imu_filters();
+void push_record(uint64_t time_ns,float a,float g,float f);
+int parse_args(int argc,char* argv[]);
 
 /*******************************************************************************
 * int main()
 *
 * This template main function contains these critical components
 * - call to rc_initialize() at the beginning
+* - parses the export rate, decimation and raw mode from the command line
 * - sets imu configuration and interrupt function
-* - creates threads for printing and exporting theta data
-* - main while loop that checks for EXITING condition
+* - starts the status display and a thread for exporting theta data
+* - supervisor loop that sleeps until EXITING
 * - rc_cleanup() at the end
 *******************************************************************************/
-int main(){
+int main(int argc,char* argv[]){
+	// export rate must be known before the IMU starts
+	if(parse_args(argc,argv)) return -1;
+
 	// always initialize cape library first
 	if(rc_initialize()){
 		fprintf(stderr,"ERROR: failed to initialize rc_initialize(), are you root?\n");
@@ -50,8 +99,11 @@ int main(){
 
 	// do your own initialization here
 	printf("\nExport IMU Data\n");
-	rc_set_pause_pressed_func(&on_pause_pressed);
-	rc_set_pause_released_func(&on_pause_released);
+	if(supervisor_init()){
+		return -1;
+	}
+	rc_set_pause_pressed_func(&supervisor_pause_pressed);
+	rc_set_pause_released_func(&supervisor_pause_released);
 
 	// set default IMU configuration
 	rc_imu_config_t config = rc_default_imu_config();
@@ -73,70 +125,71 @@ int main(){
 	rc_set_imu_interrupt_func(&imu_filters);
 
 	// print filtered theta values
-	pthread_t theta_thread;
-	pthread_create(&theta_thread,NULL,theta_display,(void*)NULL);
+	if(status_display_start(status_labels,3,display_freq)){
+		return -1;
+	}
 
 	// export filtered data
 	pthread_t data_thread;
 	pthread_create(&data_thread,NULL,data_export,(void*)NULL);
 
 	// done initializing so set state to RUNNING
-	rc_set_state(RUNNING);
-
-	// Keep looping until state changes to EXITING
-	while(rc_get_state()!=EXITING){
-		// handle other states
-		if(rc_get_state()==RUNNING){
-			// do things
-			rc_set_led(GREEN, ON);
-			rc_set_led(RED, OFF);
-		}
-		else if(rc_get_state()==PAUSED){
-			// do other things
-			rc_set_led(GREEN, OFF);
-			rc_set_led(RED, ON);
-		}
-		// always sleep at some point
-		rc_usleep(100000);
-	}
+	supervisor_set_state(RUNNING);
+
+	// sleep until events arrive, returns once state is EXITING
+	supervisor_run();
 
-	// exit cleanly
+	// exit cleanly, once the last records are drained and the file closed
+	pthread_join(data_thread,NULL);
 	rc_power_off_imu();
+	status_display_stop();
+	supervisor_cleanup();
 	rc_cleanup();
 	return 0;
 }
 
 /*******************************************************************************
-* void on_pause_released()
-*
-* Make the Pause button toggle between paused and running states.
-*******************************************************************************/
-void on_pause_released(){
-	// toggle between paused and running modes
-	if(rc_get_state()==RUNNING)		rc_set_state(PAUSED);
-	else if(rc_get_state()==PAUSED)	rc_set_state(RUNNING);
-	return;
-}
-
-/*******************************************************************************
-* void on_pause_pressed()
+* int parse_args()
 *
-* If the user holds the pause button for 2 seconds, set state to exiting which
-* triggers the rest of the program to exit cleanly.
+* Reads the optional export rate (-r <hz>), decimation mode (-n keeps every
+* Nth sample instead of averaging) and raw mode (-w exports every sample with
+* its raw inputs) from the command line. The export rate must divide the IMU
+* sample rate so every record covers a whole block of samples.
 *******************************************************************************/
-void on_pause_pressed(){
-	int i=0;
-	const int samples = 100;	// check for release 100 times in this period
-	const int us_wait = 2000000; // 2 seconds
-
-	// now keep checking to see if the button is still held down
-	for(i=0;i<samples;i++){
-		rc_usleep(us_wait/samples);
-		if(rc_get_pause_button() == RELEASED) return;
-	}
-	printf("long press detected, shutting down\n");
-	rc_set_state(EXITING);
-	return;
+int parse_args(int argc,char* argv[]){
+    int c;
+    while((c=getopt(argc,argv,"r:nw"))!=-1){
+        switch(c){
+        case 'r':
+            export_freq=atof(optarg);
+            break;
+        case 'n':
+            export_average=0;
+            break;
+        case 'w':
+            export_raw=1;
+            break;
+        default:
+            fprintf(stderr,"usage: imu_data_export [-r export_hz] [-n] [-w]\n");
+            return -1;
+        }
+    }
+    // raw records are never decimated
+    if(export_raw){
+        export_freq=sample_freq;
+        export_average=0;
+    }
+    // check export rate against IMU sample rate
+    if(export_freq<=0 || export_freq>sample_freq){
+        fprintf(stderr,"ERROR: export rate must be in (0,%g] Hz\n",sample_freq);
+        return -1;
+    }
+    export_decimation=(int)(sample_freq/export_freq+0.5);
+    if(fabs(export_decimation*export_freq-sample_freq)>1e-3){
+        fprintf(stderr,"ERROR: export rate must divide %g Hz\n",sample_freq);
+        return -1;
+    }
+    return 0;
 }
 
 /*******************************************************************************
@@ -145,8 +198,14 @@ void on_pause_pressed(){
 * Converts accelerometer and gyroscope data into angle values (in radians) of
 * the BeagleBone relative to the x-axis. These values are then passed through
 * low-pass (accelerometer data) and high-pass (gyroscope data) filters.
+* Every export_decimation samples a record is handed to the export buffer,
+* either the block average or the last sample of the block.
 *******************************************************************************/
 int imu_filters(){
+    // timestamp the sample as soon as it arrives
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC,&now);
+
     // compute accelerometer angle of BeagleBone relative to x-axis
     theta_a_raw=atan2(-imu_read.accel[2],imu_read.accel[1]);
     // use Euler's integration on gyroscope x-axis data
@@ -160,48 +219,123 @@ int imu_filters(){
 
     // update theta_g_prev value
     theta_g_prev=theta_g_raw;
-    // set 100 Hz timing
-    rc_usleep(micro/sample_freq);
+    // publish values for the display thread
+    float values[3]={theta_a,theta_g,theta_f};
+    status_publish(values);
+
+    // accumulate the decimation block
+    block_sum[0]+=theta_a;
+    block_sum[1]+=theta_g;
+    block_sum[2]+=theta_f;
+    block_count++;
+    sample_count++;
+    if(block_count==export_decimation){
+        uint64_t time_ns=(uint64_t)now.tv_sec*1000000000ULL+now.tv_nsec;
+        if(export_average){
+            push_record(time_ns,block_sum[0]/block_count, \
+                        block_sum[1]/block_count,block_sum[2]/block_count);
+        }
+        else{
+            push_record(time_ns,theta_a,theta_g,theta_f);
+        }
+        block_sum[0]=block_sum[1]=block_sum[2]=0;
+        block_count=0;
+    }
+    // timing comes from the IMU interrupt, so no sleep here
     return 0;
 }
 
 /*******************************************************************************
-* void* theta_display()
+* void push_record()
 *
-* Displays filtered theta values calculated and retrieved from imu_filters.
+* Appends a record to the export buffer, with the raw inputs of the current
+* sample. Never blocks the IMU thread: if the exporter has fallen a full
+* buffer behind, the record is dropped and counted.
 *******************************************************************************/
-void* theta_display(){
-    // print filtered theta values to screen
-    while(rc_get_state()!=EXITING){
-        printf("\r");
-        printf("theta_a= %f,theta_g= %f,theta_f= %f",theta_a,theta_g,theta_f);
-        fflush(stdout);
-        // set 100 Hz timing
-        rc_usleep(micro/sample_freq);
+void push_record(uint64_t time_ns,float a,float g,float f){
+    unsigned int head=export_head;
+    unsigned int tail=__atomic_load_n(&export_tail,__ATOMIC_ACQUIRE);
+    if(head-tail>=EXPORT_BUFFER_LEN){
+        export_dropped++;
+        return;
     }
-    return NULL;
+    export_record_t* r=&export_buffer[head&(EXPORT_BUFFER_LEN-1)];
+    r->sample=sample_count-1;
+    r->time_ns=time_ns;
+    r->theta_a=a;
+    r->theta_g=g;
+    r->theta_f=f;
+    r->accel_y=imu_read.accel[1];
+    r->accel_z=imu_read.accel[2];
+    r->gyro_x=imu_read.gyro[0];
+    r->encoder_l=rc_get_encoder_pos(RAW_ENCODER_L);
+    r->encoder_r=rc_get_encoder_pos(RAW_ENCODER_R);
+    // publish the record only after it is fully written
+    __atomic_store_n(&export_head,head+1,__ATOMIC_RELEASE);
+    return;
 }
 
 /*******************************************************************************
 * void* data_export()
 *
-* Creates a text file to store filtered data for external use. Samples data
-* at 10 Hz.
+* Creates a text file to store filtered data for external use. Drains the
+* records produced by imu_filters() at export_freq. Time is measured from the
+* first exported sample; with averaging, each record covers the block ending
+* at its sample index. In raw mode every sample is written to raw_data.txt
+* with floats printed to full precision so a replay sees the same bits.
 *******************************************************************************/
 void* data_export(){
     // create text file to store filtered values for
     // MATLAB plotting
     FILE *theta_data;
-    theta_data=fopen("theta_data.txt","w");
-    fprintf(theta_data,"time(s),theta_a,theta_g,theta_f\n");
-    float time_count=0.0;
-
-    while(rc_get_state()!=EXITING){
-        fprintf(theta_data,"%f,%f,%f,%f\n",time_count/print_freq, \
-                theta_a,theta_g,theta_f);
-        time_count++;
-        // set 10 Hz timing
-        rc_usleep(micro/print_freq);
+    const char* name=export_raw?"raw_data.txt":"theta_data.txt";
+    theta_data=fopen(name,"w");
+    if(theta_data==NULL){
+        fprintf(stderr,"ERROR: failed to open %s\n",name);
+        return NULL;
+    }
+    if(export_raw){
+        fprintf(theta_data,"time(s),sample,accel_y,accel_z,gyro_x," \
+                "encoder_l,encoder_r\n");
+    }
+    else{
+        fprintf(theta_data,"time(s),sample,theta_a,theta_g,theta_f\n");
+    }
+    uint64_t time_start=0;
+    int started=0;
+    int exiting=0;
+
+    // drain once more after EXITING so no buffered record is lost
+    while(!exiting){
+        exiting=(rc_get_state()==EXITING);
+        unsigned int tail=export_tail;
+        unsigned int head=__atomic_load_n(&export_head,__ATOMIC_ACQUIRE);
+        while(tail!=head){
+            export_record_t* r=&export_buffer[tail&(EXPORT_BUFFER_LEN-1)];
+            if(!started){
+                time_start=r->time_ns;
+                started=1;
+            }
+            if(export_raw){
+                fprintf(theta_data,"%.6f,%llu,%.9g,%.9g,%.9g,%d,%d\n", \
+                        (r->time_ns-time_start)/1e9, \
+                        (unsigned long long)r->sample, \
+                        r->accel_y,r->accel_z,r->gyro_x, \
+                        r->encoder_l,r->encoder_r);
+            }
+            else{
+                fprintf(theta_data,"%.6f,%llu,%f,%f,%f\n", \
+                        (r->time_ns-time_start)/1e9, \
+                        (unsigned long long)r->sample, \
+                        r->theta_a,r->theta_g,r->theta_f);
+            }
+            tail++;
+            __atomic_store_n(&export_tail,tail,__ATOMIC_RELEASE);
+        }
+        if(!exiting) rc_usleep(micro/print_freq);
+    }
+    if(export_dropped){
+        fprintf(stderr,"\nWARNING: %u export records dropped\n",export_dropped);
     }
     fclose(theta_data);
     return NULL;
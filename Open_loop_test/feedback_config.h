@@ -14,6 +14,10 @@
 #define WHEEL_RADIUS_M			0.034
 #define TRACK_WIDTH_M			0.035
 
+// Timing constants
+#define TEST_HZ					10 // wheel test update rate
+#define STATUS_HZ				10 // console status line refresh
+
 // Electrical hookups
 #define MOTOR_CHANNEL_L			3
 #define MOTOR_CHANNEL_R			2
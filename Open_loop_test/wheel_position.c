@@ -11,18 +11,22 @@
 #include <rc_usefulincludes.h>
 #include <roboticscape.h>
 #include "./feedback_config.h"
+#include "status_display.h"
+#include "supervisor.h"
+
+// console status line
+const char* status_labels[]={"Radians Turned(Left)","Radians Turned(Right)"};
 
 // function declarations
-void on_pause_pressed();
-void on_pause_released();
+void wheel_position_step();
 
 /*******************************************************************************
 * int main()
 *
 * This template main function contains these critical components
 * - call to rc_initialize() at the beginning
-* - main while loop that checks for EXITING condition
-* - open-loop test conducted in while loop
+* - open-loop test scheduled at TEST_HZ on the supervisor loop
+* - supervisor loop that sleeps until EXITING
 * - rc_cleanup() at the end
 *******************************************************************************/
 int main(){
@@ -34,87 +38,58 @@ int main(){
 
 	// do your own initialization here
 	printf("\nWheel Position Check\n");
-	rc_set_pause_pressed_func(&on_pause_pressed);
-	rc_set_pause_released_func(&on_pause_released);
+	if(supervisor_init()){
+		return -1;
+	}
+	rc_set_pause_pressed_func(&supervisor_pause_pressed);
+	rc_set_pause_released_func(&supervisor_pause_released);
 	rc_enable_motors();
 
-	// create local variables
-    float l_wheel;
-    float r_wheel;
-
-	// done initializing so set state to RUNNING
-	rc_set_state(RUNNING);
+	// print wheel positions from a separate display thread
+	if(status_display_start(status_labels,2,STATUS_HZ)){
+		return -1;
+	}
 
-	// Keep looping until state changes to EXITING
-	while(rc_get_state()!=EXITING){
-		// handle other states
-		if(rc_get_state()==RUNNING){
-            // find radians right wheel turns
-            r_wheel=(rc_get_encoder_pos(ENCODER_CHANNEL_R) \
-            *ENCODER_POLARITY_R*TWO_PI/(GEARBOX*ENCODER_RES));
-            // find radians left wheel turns
-            l_wheel=(rc_get_encoder_pos(ENCODER_CHANNEL_L) \
-            *ENCODER_POLARITY_L*TWO_PI/(GEARBOX*ENCODER_RES));
-            // power left wheel in direction opposite right wheel
-            rc_set_motor(MOTOR_CHANNEL_L,-r_wheel*MOTOR_POLARITY_L);
+	// run the test from the supervisor loop
+	if(supervisor_set_periodic(&wheel_position_step,TEST_HZ)){
+		return -1;
+	}
 
-            // print angular position of wheels (rad)
-            printf("Radians Turned(Left): %6f, ",l_wheel);
-            printf("Radians Turned(Right): %6f \n",r_wheel);
+	// done initializing so set state to RUNNING
+	supervisor_set_state(RUNNING);
 
-			rc_set_led(GREEN, ON);
-			rc_set_led(RED, OFF);
-		}
-		else if(rc_get_state()==PAUSED){
-			// do other things
-			rc_set_led(GREEN, OFF);
-			rc_set_led(RED, ON);
-		}
-		// always sleep at some point
-		usleep(100000);
-	}
+	// sleep until events arrive, returns once state is EXITING
+	supervisor_run();
 
 	// exit cleanly
 	rc_disable_motors();
+	status_display_stop();
 	printf("Motors Disabled");
+	supervisor_cleanup();
 	rc_cleanup();
 	return 0;
 }
 
-
 /*******************************************************************************
-* void on_pause_released()
+* void wheel_position_step()
 *
-* Make the Pause button toggle between paused and running states.
+* Powers the left wheel opposite the radians turned by the right wheel and
+* publishes both wheel positions. Called by the supervisor while RUNNING.
 *******************************************************************************/
-void on_pause_released(){
-	// toggle between paused and running modes
-	if(rc_get_state()==RUNNING){
-        rc_set_state(PAUSED);
-	}
-	else if(rc_get_state()==PAUSED){
-        rc_set_state(RUNNING);
-	}
-	return;
-}
-
-/*******************************************************************************
-* void on_pause_pressed()
-*
-* If the user holds the pause button for 2 seconds, set state to exiting which
-* triggers the rest of the program to exit cleanly.
-*******************************************************************************/
-void on_pause_pressed(){
-	int i=0;
-	const int samples = 100;	// check for release 100 times in this period
-	const int us_wait = 2000000; // 2 seconds
+void wheel_position_step(){
+    float l_wheel;
+    float r_wheel;
+    // find radians right wheel turns
+    r_wheel=(rc_get_encoder_pos(ENCODER_CHANNEL_R) \
+    *ENCODER_POLARITY_R*TWO_PI/(GEARBOX*ENCODER_RES));
+    // find radians left wheel turns
+    l_wheel=(rc_get_encoder_pos(ENCODER_CHANNEL_L) \
+    *ENCODER_POLARITY_L*TWO_PI/(GEARBOX*ENCODER_RES));
+    // power left wheel in direction opposite right wheel
+    rc_set_motor(MOTOR_CHANNEL_L,-r_wheel*MOTOR_POLARITY_L);
 
-	// now keep checking to see if the button is still held down
-	for(i=0;i<samples;i++){
-		rc_usleep(us_wait/samples);
-		if(rc_get_pause_button() == RELEASED) return;
-	}
-	printf("long press detected, shutting down\n");
-	rc_set_state(EXITING);
-	return;
+    // publish angular position of wheels (rad)
+    float values[2]={l_wheel,r_wheel};
+    status_publish(values);
+    return;
 }
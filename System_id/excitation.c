@@ -0,0 +1,175 @@
+/*******************************************************************************
+* excitation.c
+*
+* Chirp, PRBS and multisine generators for system_id. All set-up work, such
+* as picking the LFSR length or normalizing the multisine peak, is done in
+* excitation_init() so excitation_next() is cheap and bounded.
+*******************************************************************************/
+#include <math.h>
+#include <string.h>
+#include "excitation.h"
+
+#define PRBS_MIN_ORDER          5
+#define PRBS_MAX_ORDER          15
+
+// Galois feedback masks of maximal-length LFSRs, indexed by order
+static const uint32_t prbs_taps[PRBS_MAX_ORDER+1]={
+    0,0,0,0,0,0x14,0x30,0x60,0xB8,0x110,0x240,0x500,0x829,0x100D,0x2015,0x6000
+};
+
+static uint64_t whole_periods(uint64_t samples,uint64_t period);
+static float multisine_value(const excitation_t* e,uint64_t k);
+
+/*******************************************************************************
+* int excitation_init()
+*
+* Chirp: sweeps f0 to f1 logarithmically over duration.
+* PRBS: holds each bit long enough to keep power up to f1 and uses the
+* shortest LFSR whose period is longer than 1/f0.
+* Multisine: up to EXC_MAX_TONES log-spaced harmonics of f0 up to f1 with
+* Schroeder phases, so one period is 1/f0 and the crest factor stays low.
+*******************************************************************************/
+int excitation_init(excitation_t* e,exc_type_t type,float amplitude, \
+                    float f0,float f1,float duration,float rate){
+    uint64_t samples=(uint64_t)(duration*rate+0.5);
+    uint64_t period;
+    int i,h,last;
+    float peak;
+
+    if(amplitude<=0 || f0<=0 || f1<=f0 || f1>rate/2 || samples==0) return -1;
+    memset(e,0,sizeof(*e));
+    e->type=type;
+    e->amplitude=amplitude;
+    e->rate=rate;
+    e->f0=f0;
+    e->f1=f1;
+
+    switch(type){
+    case EXC_CHIRP:
+        e->n=samples;
+        break;
+    case EXC_PRBS:
+        // a PRBS clocked at fc keeps its power flat to about fc/3
+        e->hold=(int)(rate/(3*f1));
+        if(e->hold<1) e->hold=1;
+        for(e->order=PRBS_MIN_ORDER;e->order<PRBS_MAX_ORDER;e->order++){
+            if((((uint64_t)1<<e->order)-1)*e->hold>=rate/f0) break;
+        }
+        e->taps=prbs_taps[e->order];
+        e->lfsr=1;
+        e->n=whole_periods(samples,excitation_period(e));
+        break;
+    case EXC_MULTISINE:
+        period=(uint64_t)(rate/f0+0.5);
+        e->f0=rate/period;
+        last=0;
+        for(i=0;i<EXC_MAX_TONES;i++){
+            h=(int)(pow(f1/e->f0,(double)i/(EXC_MAX_TONES-1))+0.5);
+            if(h<=last || h*e->f0>rate/2) continue;
+            e->freq[e->tones]=h*e->f0;
+            last=h;
+            e->tones++;
+        }
+        for(i=0;i<e->tones;i++){
+            e->phase[i]=-M_PI*i*(i+1)/e->tones;
+        }
+        // normalize the peak over one period to the requested amplitude
+        e->scale=1;
+        peak=0;
+        for(i=0;i<(int)period;i++){
+            float v=fabsf(multisine_value(e,i));
+            if(v>peak) peak=v;
+        }
+        e->scale=amplitude/peak;
+        e->n=whole_periods(samples,period);
+        break;
+    default:
+        return -1;
+    }
+    return 0;
+}
+
+/*******************************************************************************
+* float excitation_next()
+*
+* Returns the next sample of the signal.
+*******************************************************************************/
+float excitation_next(excitation_t* e){
+    float v=0;
+    double t,T,r;
+    uint32_t bit;
+
+    if(e->k>=e->n) return 0;
+    switch(e->type){
+    case EXC_CHIRP:
+        // instantaneous frequency f0*(f1/f0)^(t/T)
+        t=e->k/e->rate;
+        T=e->n/e->rate;
+        r=e->f1/e->f0;
+        v=e->amplitude*sin(2*M_PI*e->f0*T/log(r)*(pow(r,t/T)-1));
+        break;
+    case EXC_PRBS:
+        if(e->k%e->hold==0){
+            bit=e->lfsr&1;
+            e->lfsr>>=1;
+            if(bit) e->lfsr^=e->taps;
+            e->level=bit?e->amplitude:-e->amplitude;
+        }
+        v=e->level;
+        break;
+    case EXC_MULTISINE:
+        v=multisine_value(e,e->k);
+        break;
+    }
+    e->k++;
+    return v;
+}
+
+int excitation_done(const excitation_t* e){
+    return e->k>=e->n;
+}
+
+uint64_t excitation_period(const excitation_t* e){
+    switch(e->type){
+    case EXC_PRBS:
+        return (((uint64_t)1<<e->order)-1)*e->hold;
+    case EXC_MULTISINE:
+        return (uint64_t)(e->rate/e->f0+0.5);
+    default:
+        return 0;
+    }
+}
+
+int excitation_parse(const char* name,exc_type_t* type){
+    if(strcmp(name,"chirp")==0) *type=EXC_CHIRP;
+    else if(strcmp(name,"prbs")==0) *type=EXC_PRBS;
+    else if(strcmp(name,"multisine")==0) *type=EXC_MULTISINE;
+    else return -1;
+    return 0;
+}
+
+const char* excitation_name(exc_type_t type){
+    switch(type){
+    case EXC_CHIRP:     return "chirp";
+    case EXC_PRBS:      return "prbs";
+    case EXC_MULTISINE: return "multisine";
+    }
+    return "";
+}
+
+/*******************************************************************************
+* static helpers
+*******************************************************************************/
+static uint64_t whole_periods(uint64_t samples,uint64_t period){
+    return ((samples+period-1)/period)*period;
+}
+
+static float multisine_value(const excitation_t* e,uint64_t k){
+    double t=(k%excitation_period(e))/e->rate;
+    double v=0;
+    int i;
+    for(i=0;i<e->tones;i++){
+        v+=sin(2*M_PI*e->freq[i]*t+e->phase[i]);
+    }
+    return e->scale*v;
+}
@@ -0,0 +1,56 @@
+/*******************************************************************************
+* excitation.h
+*
+* Excitation signals for system identification: logarithmic chirp, PRBS
+* from a maximal-length LFSR and Schroeder-phased multisine. Signals are
+* generated one sample at a time without allocation, so they can be stepped
+* from the IMU interrupt. Has no hardware dependencies.
+*******************************************************************************/
+
+#ifndef EXCITATION
+#define EXCITATION
+
+#include <stdint.h>
+#include "sysid_config.h"
+
+typedef enum exc_type_t{
+    EXC_CHIRP,
+    EXC_PRBS,
+    EXC_MULTISINE
+} exc_type_t;
+
+typedef struct excitation_t{
+    exc_type_t type;
+    float amplitude;
+    float rate;                 // samples per second
+    uint64_t k;                 // next sample index
+    uint64_t n;                 // total samples
+    // chirp
+    float f0;
+    float f1;
+    // PRBS
+    uint32_t lfsr;
+    uint32_t taps;
+    int order;
+    int hold;                   // samples per bit
+    float level;
+    // multisine
+    int tones;
+    float freq[EXC_MAX_TONES];
+    float phase[EXC_MAX_TONES];
+    float scale;                // normalizes the peak to amplitude
+} excitation_t;
+
+// band [f0,f1] in Hz at rate samples/s, runs for at least duration seconds;
+// PRBS and multisine are rounded up to whole periods
+int excitation_init(excitation_t* e,exc_type_t type,float amplitude, \
+                    float f0,float f1,float duration,float rate);
+// next sample, 0 once finished
+float excitation_next(excitation_t* e);
+int excitation_done(const excitation_t* e);
+// period of the signal in samples, 0 for the chirp
+uint64_t excitation_period(const excitation_t* e);
+int excitation_parse(const char* name,exc_type_t* type);
+const char* excitation_name(exc_type_t type);
+
+#endif	//EXCITATION
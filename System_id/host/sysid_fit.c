@@ -0,0 +1,428 @@
+/*******************************************************************************
+* sysid_fit.c
+*
+* Host tool for system_id captures. Estimates the frequency response from
+* the applied duty to the body angle (or gyro rate, or wheel angle) and fits
+* a continuous-time transfer function B(s)/A(s) of the requested order.
+*
+* The response is H = S_ry/S_ru with r the injected excitation, from Welch
+* averaged cross spectra (Hann window, 50% overlap). Using the excitation as
+* the reference keeps the estimate unbiased in closed loop, where the duty
+* is correlated with the measurement noise; in open loop it is the usual
+* S_yu/S_uu. The fit is a Sanathanan-Koerner iteration of Levy's linear
+* least squares, weighted by coherence, over the bins inside the excited
+* band with enough coherence.
+*
+* usage: sysid_fit [-y theta|gyro|wheel] [-l seglen] [-n poles] [-m zeros]
+*                  [-f f0] [-F f1] [-c min_coherence] [-o response.csv] log
+*******************************************************************************/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <math.h>
+#include <complex.h>
+#include "sysid_config.h"
+
+#define MAX_LINE                512
+#define MAX_ORDER               6
+#define SK_ITERATIONS           20
+
+typedef enum output_t{
+    OUT_THETA,
+    OUT_GYRO,
+    OUT_WHEEL
+} output_t;
+
+typedef struct capture_t{
+    int n;
+    double rate;
+    double f0;                  // excited band from the log header
+    double f1;
+    double* r;                  // excitation
+    double* u;                  // duty
+    double* y;                  // chosen output
+} capture_t;
+
+typedef struct response_t{
+    int bins;
+    double* freq;               // Hz
+    double complex* h;
+    double* coherence;          // between excitation and output
+} response_t;
+
+/*******************************************************************************
+* int load_capture()
+*
+* Reads a system_id log. Lines starting with # carry the excitation settings.
+*******************************************************************************/
+static int load_capture(const char* path,output_t out,capture_t* c){
+    FILE* f=fopen(path,"r");
+    char line[MAX_LINE];
+    char type[32],loop[16];
+    double t,e,duty,ay,az,gx,theta,amp;
+    unsigned long long sample;
+    int el,er,cap=0;
+
+    if(f==NULL){
+        perror(path);
+        return -1;
+    }
+    memset(c,0,sizeof(*c));
+    c->rate=D1_HZ;
+    while(fgets(line,sizeof(line),f)!=NULL){
+        if(line[0]=='#'){
+            sscanf(line,"# excitation=%31s amplitude=%lf f0=%lf f1=%lf " \
+                   "rate=%lf loop=%15s",type,&amp,&c->f0,&c->f1,&c->rate,loop);
+            continue;
+        }
+        if(sscanf(line,"%lf,%llu,%lf,%lf,%lf,%lf,%lf,%d,%d,%lf",&t,&sample, \
+                  &e,&duty,&ay,&az,&gx,&el,&er,&theta)!=10){
+            continue;   // column header
+        }
+        if(c->n==cap){
+            cap=cap?2*cap:4096;
+            c->r=realloc(c->r,cap*sizeof(double));
+            c->u=realloc(c->u,cap*sizeof(double));
+            c->y=realloc(c->y,cap*sizeof(double));
+            if(c->r==NULL || c->u==NULL || c->y==NULL){
+                fclose(f);
+                return -1;
+            }
+        }
+        c->r[c->n]=e;
+        c->u[c->n]=duty;
+        switch(out){
+        case OUT_THETA:
+            c->y[c->n]=theta;
+            break;
+        case OUT_GYRO:
+            c->y[c->n]=gx*M_PI/180;
+            break;
+        case OUT_WHEEL:
+            c->y[c->n]=0.5*(el*ENCODER_POLARITY_L+er*ENCODER_POLARITY_R)* \
+                       2*M_PI/(GEARBOX*ENCODER_RES);
+            break;
+        }
+        c->n++;
+    }
+    fclose(f);
+    return c->n;
+}
+
+/*******************************************************************************
+* void fft()
+*
+* In-place iterative radix-2 FFT, len must be a power of 2.
+*******************************************************************************/
+static void fft(double complex* x,int len){
+    int i,j,k,m;
+    for(i=1,j=0;i<len;i++){
+        int bit=len>>1;
+        for(;j&bit;bit>>=1) j^=bit;
+        j^=bit;
+        if(i<j){
+            double complex tmp=x[i];
+            x[i]=x[j];
+            x[j]=tmp;
+        }
+    }
+    for(m=2;m<=len;m<<=1){
+        double complex w=cexp(-2*M_PI*I/m);
+        for(k=0;k<len;k+=m){
+            double complex wk=1;
+            for(j=0;j<m/2;j++){
+                double complex a=x[k+j];
+                double complex b=wk*x[k+j+m/2];
+                x[k+j]=a+b;
+                x[k+j+m/2]=a-b;
+                wk*=w;
+            }
+        }
+    }
+    return;
+}
+
+// mean-removed, Hann windowed segment
+static void load_segment(double complex* x,const double* s,const double* win, \
+                         int len){
+    double mean=0;
+    int i;
+    for(i=0;i<len;i++) mean+=s[i];
+    mean/=len;
+    for(i=0;i<len;i++) x[i]=(s[i]-mean)*win[i];
+    fft(x,len);
+    return;
+}
+
+/*******************************************************************************
+* int estimate_response()
+*
+* Welch averaged H = S_ry/S_ru and the coherence of r and y, for bins 1 up
+* to Nyquist.
+*******************************************************************************/
+static int estimate_response(const capture_t* c,int len,response_t* resp){
+    int bins=len/2;
+    double* win=malloc(len*sizeof(double));
+    double complex* R=malloc(len*sizeof(double complex));
+    double complex* U=malloc(len*sizeof(double complex));
+    double complex* Y=malloc(len*sizeof(double complex));
+    double complex* Sry=calloc(bins,sizeof(double complex));
+    double complex* Sru=calloc(bins,sizeof(double complex));
+    double* Srr=calloc(bins,sizeof(double));
+    double* Syy=calloc(bins,sizeof(double));
+    int i,k,start,segments=0;
+
+    if(win==NULL || R==NULL || U==NULL || Y==NULL || Sry==NULL || \
+       Sru==NULL || Srr==NULL || Syy==NULL){
+        return -1;
+    }
+    for(i=0;i<len;i++) win[i]=0.5-0.5*cos(2*M_PI*i/len);
+    for(start=0;start+len<=c->n;start+=len/2){
+        load_segment(R,c->r+start,win,len);
+        load_segment(U,c->u+start,win,len);
+        load_segment(Y,c->y+start,win,len);
+        for(k=1;k<bins;k++){
+            Sry[k]+=conj(R[k])*Y[k];
+            Sru[k]+=conj(R[k])*U[k];
+            Srr[k]+=creal(conj(R[k])*R[k]);
+            Syy[k]+=creal(conj(Y[k])*Y[k]);
+        }
+        segments++;
+    }
+    if(segments<2){
+        fprintf(stderr,"ERROR: need at least %d samples for seglen %d\n", \
+                3*len/2,len);
+        return -1;
+    }
+
+    resp->bins=bins-1;
+    resp->freq=malloc(bins*sizeof(double));
+    resp->h=malloc(bins*sizeof(double complex));
+    resp->coherence=malloc(bins*sizeof(double));
+    for(k=1;k<bins;k++){
+        resp->freq[k-1]=k*c->rate/len;
+        resp->h[k-1]=(cabs(Sru[k])>0)?Sry[k]/Sru[k]:0;
+        resp->coherence[k-1]=(Srr[k]>0 && Syy[k]>0)? \
+            creal(Sry[k]*conj(Sry[k]))/(Srr[k]*Syy[k]):0;
+    }
+    printf("%d segments of %d samples, %.3f Hz resolution\n",segments,len, \
+           c->rate/len);
+    free(win); free(R); free(U); free(Y);
+    free(Sry); free(Sru); free(Srr); free(Syy);
+    return 0;
+}
+
+/*******************************************************************************
+* int solve()
+*
+* Gaussian elimination with partial pivoting on an n x n system, in place.
+*******************************************************************************/
+static int solve(double* a,double* b,int n){
+    int i,j,k,p;
+    for(k=0;k<n;k++){
+        p=k;
+        for(i=k+1;i<n;i++) if(fabs(a[i*n+k])>fabs(a[p*n+k])) p=i;
+        if(fabs(a[p*n+k])<1e-300) return -1;
+        if(p!=k){
+            for(j=0;j<n;j++){
+                double t=a[k*n+j]; a[k*n+j]=a[p*n+j]; a[p*n+j]=t;
+            }
+            double t=b[k]; b[k]=b[p]; b[p]=t;
+        }
+        for(i=k+1;i<n;i++){
+            double f=a[i*n+k]/a[k*n+k];
+            for(j=k;j<n;j++) a[i*n+j]-=f*a[k*n+j];
+            b[i]-=f*b[k];
+        }
+    }
+    for(k=n-1;k>=0;k--){
+        for(j=k+1;j<n;j++) b[k]-=a[k*n+j]*b[j];
+        b[k]/=a[k*n+k];
+    }
+    return 0;
+}
+
+static double complex polyval(const double* p,int order,double complex s){
+    double complex v=0;
+    int i;
+    for(i=order;i>=0;i--) v=v*s+p[i];
+    return v;
+}
+
+/*******************************************************************************
+* double fit_tf()
+*
+* Fits H(s) ~ B(s)/A(s), A monic of order np, B of order nz, over the bins
+* flagged in use[]. Frequencies are scaled by the top of the band while
+* fitting to keep the normal equations well conditioned. Coefficients are
+* returned lowest power first; the return value is the relative RMS error.
+*******************************************************************************/
+static double fit_tf(const response_t* r,const int* use,int np,int nz, \
+                     double* num,double* den){
+    int unknowns=np+nz+1;
+    double a[(2*MAX_ORDER+1)*(2*MAX_ORDER+1)];
+    double b[2*MAX_ORDER+1];
+    double row_re[2*MAX_ORDER+1],row_im[2*MAX_ORDER+1];
+    double wn=0,err=0,ref=0,scale;
+    int i,j,k,it;
+
+    for(k=0;k<r->bins;k++) if(use[k]) wn=2*M_PI*r->freq[k];
+    memset(den,0,(np+1)*sizeof(double));
+    den[np]=1;
+    for(it=0;it<SK_ITERATIONS;it++){
+        memset(a,0,sizeof(a));
+        memset(b,0,sizeof(b));
+        for(k=0;k<r->bins;k++){
+            double complex s,sp,h,rhs;
+            double w;
+            if(!use[k]) continue;
+            s=I*2*M_PI*r->freq[k]/wn;
+            h=r->h[k];
+            // SK weight 1/|A_prev|; none on the first pass, plain Levy,
+            // since any seed A may vanish on a bin
+            w=r->coherence[k];
+            if(it>0) w/=cabs(polyval(den,np,s));
+            // unknowns: a_0..a_{np-1}, then b_0..b_nz
+            // B(s) - H(s)*(a_0 + ... + a_{np-1} s^{np-1}) = H(s) s^np
+            sp=1;
+            for(i=0;i<np;i++){
+                row_re[i]=-creal(h*sp)*w;
+                row_im[i]=-cimag(h*sp)*w;
+                sp*=s;
+            }
+            rhs=h*sp*w;
+            sp=1;
+            for(i=0;i<=nz;i++){
+                row_re[np+i]=creal(sp)*w;
+                row_im[np+i]=cimag(sp)*w;
+                sp*=s;
+            }
+            for(i=0;i<unknowns;i++){
+                for(j=0;j<unknowns;j++){
+                    a[i*unknowns+j]+=row_re[i]*row_re[j]+row_im[i]*row_im[j];
+                }
+                b[i]+=row_re[i]*creal(rhs)+row_im[i]*cimag(rhs);
+            }
+        }
+        if(solve(a,b,unknowns)) return -1;
+        for(i=0;i<np;i++) den[i]=b[i];
+        den[np]=1;
+        for(i=0;i<=nz;i++) num[i]=b[np+i];
+    }
+
+    // fit error on the scaled frequencies, then undo the scaling
+    for(k=0;k<r->bins;k++){
+        double complex s=I*2*M_PI*r->freq[k]/wn;
+        if(!use[k]) continue;
+        err+=pow(cabs(polyval(num,nz,s)/polyval(den,np,s)-r->h[k]),2);
+        ref+=pow(cabs(r->h[k]),2);
+    }
+    for(i=0;i<np;i++) den[i]*=pow(wn,np-i);
+    for(i=0;i<=nz;i++) num[i]*=pow(wn,np-i);
+    scale=sqrt(err/ref);
+    return scale;
+}
+
+static void print_poly(const char* name,const double* p,int order){
+    int i;
+    printf("%s = [",name);
+    for(i=order;i>=0;i--) printf("%s%.6g",i==order?"":", ",p[i]);
+    printf("]\n");
+    return;
+}
+
+int main(int argc,char* argv[]){
+    output_t out=OUT_THETA;
+    const char* out_names[]={"theta","gyro","wheel"};
+    const char* response_file=NULL;
+    int len=512,np=3,nz=1,c,k,used=0;
+    double f0=-1,f1=-1,min_coherence=0.5,rel;
+    double num[MAX_ORDER+1],den[MAX_ORDER+1];
+    capture_t cap;
+    response_t resp;
+    int* use;
+
+    while((c=getopt(argc,argv,"y:l:n:m:f:F:c:o:"))!=-1){
+        switch(c){
+        case 'y':
+            for(k=0;k<3 && strcmp(optarg,out_names[k]);k++);
+            if(k==3){
+                fprintf(stderr,"ERROR: unknown output '%s'\n",optarg);
+                return -1;
+            }
+            out=k;
+            break;
+        case 'l': len=atoi(optarg); break;
+        case 'n': np=atoi(optarg); break;
+        case 'm': nz=atoi(optarg); break;
+        case 'f': f0=atof(optarg); break;
+        case 'F': f1=atof(optarg); break;
+        case 'c': min_coherence=atof(optarg); break;
+        case 'o': response_file=optarg; break;
+        default:
+            fprintf(stderr,"usage: sysid_fit [-y theta|gyro|wheel] [-l seglen] " \
+                    "[-n poles] [-m zeros] [-f f0] [-F f1] [-c min_coherence] " \
+                    "[-o response.csv] log\n");
+            return -1;
+        }
+    }
+    if(optind!=argc-1 || len<8 || (len&(len-1)) || np<1 || np>MAX_ORDER || \
+       nz<0 || nz>np){
+        fprintf(stderr,"usage: sysid_fit [-y theta|gyro|wheel] [-l seglen] " \
+                "[-n poles] [-m zeros] [-f f0] [-F f1] [-c min_coherence] " \
+                "[-o response.csv] log\n" \
+                "seglen must be a power of 2, 1<=poles<=%d, zeros<=poles\n", \
+                MAX_ORDER);
+        return -1;
+    }
+
+    if(load_capture(argv[optind],out,&cap)<=0){
+        fprintf(stderr,"ERROR: no samples in %s\n",argv[optind]);
+        return -1;
+    }
+    if(f0<0) f0=cap.f0;
+    if(f1<0) f1=cap.f1?cap.f1:cap.rate/2;
+    printf("%s: %d samples at %g Hz, duty -> %s\n",argv[optind],cap.n, \
+           cap.rate,out_names[out]);
+    if(estimate_response(&cap,len,&resp)) return -1;
+
+    use=calloc(resp.bins,sizeof(int));
+    for(k=0;k<resp.bins;k++){
+        use[k]=(resp.freq[k]>=f0 && resp.freq[k]<=f1 && \
+                resp.coherence[k]>=min_coherence);
+        used+=use[k];
+    }
+    if(response_file!=NULL){
+        FILE* f=fopen(response_file,"w");
+        if(f==NULL){
+            perror(response_file);
+            return -1;
+        }
+        fprintf(f,"freq_hz,mag_db,phase_deg,coherence,used\n");
+        for(k=0;k<resp.bins;k++){
+            fprintf(f,"%.4f,%.3f,%.2f,%.4f,%d\n",resp.freq[k], \
+                    20*log10(cabs(resp.h[k])+1e-300), \
+                    carg(resp.h[k])*180/M_PI,resp.coherence[k],use[k]);
+        }
+        fclose(f);
+    }
+    printf("fit band %.3f-%.3f Hz, %d of %d bins with coherence >= %.2f\n", \
+           f0,f1,used,resp.bins,min_coherence);
+    if(used<np+nz+1){
+        fprintf(stderr,"ERROR: too few usable bins for %d poles and %d zeros\n", \
+                np,nz);
+        return -1;
+    }
+
+    rel=fit_tf(&resp,use,np,nz,num,den);
+    if(rel<0){
+        fprintf(stderr,"ERROR: fit is singular, try a lower order\n");
+        return -1;
+    }
+    printf("G(s) = num(s)/den(s), highest power first\n");
+    print_poly("num",num,nz);
+    print_poly("den",den,np);
+    printf("relative fit error %.2f %%\n",100*rel);
+    return 0;
+}
@@ -0,0 +1,63 @@
+/*******************************************************************************
+* sysid_config.h
+*
+* Contains defines for system_id.c
+* Defines the excitation defaults, the capture buffer, controller D1 for
+* closed-loop identification, the complementary filter, the eduMiP, the
+* motors, and the encoders.
+*******************************************************************************/
+
+#ifndef SYSID_CONFIG
+#define SYSID_CONFIG
+
+// timing constants
+#define D1_HZ                   100
+#define STATUS_HZ               10 // console status line refresh
+#define LOG_HZ                  10 // capture file flush rate
+
+// real-time setup
+#define IMU_PRIORITY            80 // SCHED_FIFO priority of inner loop
+#define RT_CPU                  -1 // CPU to pin control threads, -1 for none
+
+// excitation defaults, all overridable from the command line
+#define EXC_AMPLITUDE           0.2 // duty
+#define EXC_F0                  0.2 // Hz, lowest frequency of interest
+#define EXC_F1                  20 // Hz, highest frequency of interest
+#define EXC_DURATION            60 // s
+#define EXC_MAX_TONES           32 // multisine components
+
+// capture buffer length (power of 2), ~10 s of samples at 100 Hz
+#define LOG_BUFFER_LEN          1024
+
+// structural properties of eduMiP
+#define GEARBOX 				35.577
+#define ENCODER_RES				60
+
+// MiP balance constants
+#define TIP_ANGLE               0.8 // radians from y-axis (~45 degrees)
+#define THETA_REFERENCE         0
+
+// complementary filter constants
+#define OMEGA_C                 2 // 1/time constant
+#define DT                      0.01 // step in seconds
+#define THETA_OFFSET            0.23
+
+// inner loop controller, used with -c
+#define D1_GAIN					-4.24
+#define D1_N				    2 // # of zeros in numerator
+#define D1_M                    2 // # of poles in denominator
+#define D1_NUM					{1, -1.678, 0.6931}
+#define D1_DEN					{1, -1.566, 0.566}
+#define D1_SATURATION        	1
+
+// electrical hookups
+#define MOTOR_CHANNEL_L			3
+#define MOTOR_CHANNEL_R			2
+#define MOTOR_POLARITY_L		1
+#define MOTOR_POLARITY_R		-1
+#define ENCODER_CHANNEL_L		3
+#define ENCODER_CHANNEL_R		2
+#define ENCODER_POLARITY_L		1
+#define ENCODER_POLARITY_R		-1
+
+#endif	//SYSID_CONFIG
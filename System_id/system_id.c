@@ -0,0 +1,374 @@
+/*******************************************************************************
+* system_id.c
+*
+* Injects a chirp, PRBS or multisine into the motor duty and captures the
+* excitation, the applied duty, the raw IMU data, both encoders and the
+* filtered body angle of every IMU sample, for the host/sysid_fit tool.
+* In open loop the excitation is the whole duty, for a MiP lying down or
+* held with its wheels free. With -c it is added to the duty of controller
+* D1 while the MiP balances, for closed-loop identification.
+*******************************************************************************/
+#include <rc_usefulincludes.h>
+#include <roboticscape.h>
+#include "sysid_config.h"
+#include "excitation.h"
+#include "controller.h"
+#include "comp_filter.h"
+#include "status_display.h"
+#include "supervisor.h"
+#include "rt_setup.h"
+
+// captured sample structure
+typedef struct log_record_t{
+    uint64_t sample;            // IMU sample index
+    uint64_t time_ns;           // CLOCK_MONOTONIC time of the sample
+    float excitation;
+    float duty;                 // duty sent to the motors
+    float accel_y;
+    float accel_z;
+    float gyro_x;
+    float theta;
+    int encoder_l;
+    int encoder_r;
+} log_record_t;
+
+// function declarations
+float complementary_filter();
+void inner_loop();
+void push_record(const log_record_t* r);
+void* log_writer();
+void check_done();
+int parse_args(int argc,char* argv[]);
+
+// variable declarations
+rc_imu_data_t imu_reader;
+controller_d_t D1;
+excitation_t ex;
+int closed_loop=0;
+int finished=0; // set by inner_loop(), read by check_done()
+uint64_t sample_count=0;
+const char* log_name="sysid_data.txt";
+
+// single-producer single-consumer capture buffer
+log_record_t log_buffer[LOG_BUFFER_LEN];
+unsigned int log_head=0; // written by inner_loop()
+unsigned int log_tail=0; // written by log_writer()
+unsigned int log_dropped=0;
+
+// console status line
+const char* status_labels[]={"theta","excitation","duty"};
+
+// loop timing statistics
+rt_loop_stats_t inner_stats;
+
+/*******************************************************************************
+* int main()
+*
+* This template main function contains these critical components
+* - parses the excitation from the command line
+* - call to rc_initialize() at the beginning
+* - memory locked for real-time operation
+* - configuration and initialization of IMU
+* - initialization of controller D1
+* - console status display and capture thread started
+* - IMU interrupt function set to inner loop
+* - supervisor loop that sleeps until the excitation ends or EXITING
+* - rc_cleanup() at the end
+*******************************************************************************/
+int main(int argc,char* argv[]){
+	// excitation must be known before the IMU starts
+	if(parse_args(argc,argv)) return -1;
+
+	// always initialize cape library first
+	if(rc_initialize()){
+		fprintf(stderr,"ERROR: failed to initialize rc_initialize(), are you root?\n");
+		return -1;
+	}
+
+	// lock memory before any control thread exists
+	if(rt_setup_process()){
+		fprintf(stderr,"ERROR: failed to lock memory\n");
+		return -1;
+	}
+
+	// do your own initialization here
+	printf("\nSystem Identification: %s, %.1f s, %s loop\n", \
+	       excitation_name(ex.type),ex.n/ex.rate,closed_loop?"closed":"open");
+	if(supervisor_init()){
+		return -1;
+	}
+	rc_set_pause_pressed_func(&supervisor_pause_pressed);
+	rc_set_pause_released_func(&supervisor_pause_released);
+
+	// set default IMU configuration
+	rc_imu_config_t config = rc_default_imu_config();
+
+	// initialize IMU for DMP mode
+	if(rc_initialize_imu_dmp(&imu_reader,config)){
+            printf("Error initializing IMU\n");
+            return -1;
+	}
+
+	// create controller
+	float D1_num[]=D1_NUM;
+	float D1_den[]=D1_DEN;
+	D1=initialize_controller(D1_GAIN,D1_N,D1_M,D1_num, \
+                          D1_den,D1_SATURATION,0);
+
+	// print status from a separate display thread
+	if(status_display_start(status_labels,3,STATUS_HZ)){
+		return -1;
+	}
+
+	// write captured samples from a separate thread
+	pthread_t log_thread;
+	pthread_create(&log_thread,NULL,log_writer,(void*)NULL);
+
+	// stop once the excitation has been played
+	if(supervisor_set_periodic(&check_done,STATUS_HZ)){
+		return -1;
+	}
+
+	// set inner loop as IMU interrupt function
+	rt_stats_init(&inner_stats,"inner loop",D1_HZ);
+	rc_set_imu_interrupt_func(&inner_loop);
+	rc_enable_motors();
+
+	// done initializing so set state to RUNNING
+	supervisor_set_state(RUNNING);
+
+	// sleep until events arrive, returns once state is EXITING
+	supervisor_run();
+
+	// exit cleanly
+	rc_disable_motors();
+	pthread_join(log_thread,NULL);
+	rc_power_off_imu();
+	status_display_stop();
+	rt_stats_print(&inner_stats);
+	supervisor_cleanup();
+	rc_cleanup();
+	return 0;
+}
+
+/*******************************************************************************
+* int parse_args()
+*
+* usage: system_id [-s chirp|prbs|multisine] [-a amplitude] [-f f0_hz]
+*                  [-F f1_hz] [-t seconds] [-c] [-o file]
+* Defaults are in sysid_config.h.
+*******************************************************************************/
+int parse_args(int argc,char* argv[]){
+    exc_type_t type=EXC_CHIRP;
+    float amplitude=EXC_AMPLITUDE;
+    float f0=EXC_F0;
+    float f1=EXC_F1;
+    float duration=EXC_DURATION;
+    int c;
+    while((c=getopt(argc,argv,"s:a:f:F:t:co:"))!=-1){
+        switch(c){
+        case 's':
+            if(excitation_parse(optarg,&type)){
+                fprintf(stderr,"ERROR: unknown excitation '%s'\n",optarg);
+                return -1;
+            }
+            break;
+        case 'a':
+            amplitude=atof(optarg);
+            break;
+        case 'f':
+            f0=atof(optarg);
+            break;
+        case 'F':
+            f1=atof(optarg);
+            break;
+        case 't':
+            duration=atof(optarg);
+            break;
+        case 'c':
+            closed_loop=1;
+            break;
+        case 'o':
+            log_name=optarg;
+            break;
+        default:
+            fprintf(stderr,"usage: system_id [-s chirp|prbs|multisine] " \
+                    "[-a amplitude] [-f f0_hz] [-F f1_hz] [-t seconds] " \
+                    "[-c] [-o file]\n");
+            return -1;
+        }
+    }
+    if(amplitude>D1_SATURATION || \
+       excitation_init(&ex,type,amplitude,f0,f1,duration,D1_HZ)){
+        fprintf(stderr,"ERROR: need 0<amplitude<=%g and 0<f0<f1<=%g Hz\n", \
+                (double)D1_SATURATION,D1_HZ/2.0);
+        return -1;
+    }
+    return 0;
+}
+
+/*******************************************************************************
+* void inner_loop()
+*
+* Steps the excitation once per IMU sample and sends it to the motors, on
+* its own or on top of the D1 duty. Every sample is captured with its
+* timestamp. While paused the motors are off and the excitation waits.
+*******************************************************************************/
+void inner_loop(){
+    static int rt_ready=0;
+    struct timespec now;
+    log_record_t r;
+    float theta,control_duty,duty,e;
+    uint64_t start;
+    // timestamp the sample as soon as it arrives
+    clock_gettime(CLOCK_MONOTONIC,&now);
+    // first call runs in the IMU thread, so set it up for real-time here
+    if(!rt_ready){
+        rt_setup_thread(IMU_PRIORITY,RT_CPU);
+        rt_ready=1;
+    }
+    start=rt_stats_begin(&inner_stats);
+    RT_ENTER();
+    sample_count++;
+    // find current angle of MiP, the filter runs in every mode
+    theta=complementary_filter();
+    if(rc_get_state()!=RUNNING || finished){
+        rc_set_motor(MOTOR_CHANNEL_L,0);
+        rc_set_motor(MOTOR_CHANNEL_R,0);
+        RT_EXIT();
+        rt_stats_end(&inner_stats,start);
+        return;
+    }
+    // a closed-loop run ends if the MiP falls
+    if(closed_loop && fabs(theta)>TIP_ANGLE){
+        rc_disable_motors();
+        status_message("Oops,unexpected trustfall!");
+        finished=1;
+        RT_EXIT();
+        rt_stats_end(&inner_stats,start);
+        return;
+    }
+    e=excitation_next(&ex);
+    control_duty=closed_loop?control_step(&D1,THETA_REFERENCE-theta):0;
+    duty=control_duty+e;
+    if(duty>D1_SATURATION) duty=D1_SATURATION;
+    else if(duty<-D1_SATURATION) duty=-D1_SATURATION;
+    rc_set_motor(MOTOR_CHANNEL_L,MOTOR_POLARITY_L*duty);
+    rc_set_motor(MOTOR_CHANNEL_R,MOTOR_POLARITY_R*duty);
+    // capture everything this sample used and produced
+    r.sample=sample_count-1;
+    r.time_ns=(uint64_t)now.tv_sec*1000000000ULL+now.tv_nsec;
+    r.excitation=e;
+    r.duty=duty;
+    r.accel_y=imu_reader.accel[1];
+    r.accel_z=imu_reader.accel[2];
+    r.gyro_x=imu_reader.gyro[0];
+    r.theta=theta;
+    r.encoder_l=rc_get_encoder_pos(ENCODER_CHANNEL_L);
+    r.encoder_r=rc_get_encoder_pos(ENCODER_CHANNEL_R);
+    push_record(&r);
+    if(excitation_done(&ex)) __atomic_store_n(&finished,1,__ATOMIC_RELEASE);
+    // publish values for the display thread
+    float values[3]={theta,e,duty};
+    status_publish(values);
+    // 100 Hz timing comes from the IMU interrupt
+    RT_EXIT();
+    rt_stats_end(&inner_stats,start);
+    return;
+}
+
+/*******************************************************************************
+* void check_done()
+*
+* Runs on the supervisor loop and exits once the excitation has finished.
+*******************************************************************************/
+void check_done(){
+    if(__atomic_load_n(&finished,__ATOMIC_ACQUIRE)){
+        supervisor_set_state(EXITING);
+    }
+    return;
+}
+
+/*******************************************************************************
+* void push_record()
+*
+* Appends a sample to the capture buffer. Never blocks the IMU thread: if the
+* writer has fallen a full buffer behind, the sample is dropped and counted.
+*******************************************************************************/
+void push_record(const log_record_t* r){
+    unsigned int head=log_head;
+    unsigned int tail=__atomic_load_n(&log_tail,__ATOMIC_ACQUIRE);
+    if(head-tail>=LOG_BUFFER_LEN){
+        log_dropped++;
+        return;
+    }
+    log_buffer[head&(LOG_BUFFER_LEN-1)]=*r;
+    // publish the record only after it is fully written
+    __atomic_store_n(&log_head,head+1,__ATOMIC_RELEASE);
+    return;
+}
+
+/*******************************************************************************
+* void* log_writer()
+*
+* Drains the capture buffer into the log file at LOG_HZ. Time is measured
+* from the first captured sample; floats are printed to full precision so the
+* fit sees the values the loop used.
+*******************************************************************************/
+void* log_writer(){
+    FILE* f=fopen(log_name,"w");
+    uint64_t time_start=0;
+    int started=0;
+    int exiting=0;
+    if(f==NULL){
+        fprintf(stderr,"ERROR: failed to open %s\n",log_name);
+        return NULL;
+    }
+    fprintf(f,"# excitation=%s amplitude=%g f0=%g f1=%g rate=%g loop=%s\n", \
+            excitation_name(ex.type),ex.amplitude,ex.f0,ex.f1,ex.rate, \
+            closed_loop?"closed":"open");
+    fprintf(f,"time(s),sample,excitation,duty,accel_y,accel_z,gyro_x," \
+            "encoder_l,encoder_r,theta\n");
+
+    // drain once more after EXITING so no buffered sample is lost
+    while(!exiting){
+        exiting=(rc_get_state()==EXITING);
+        unsigned int tail=log_tail;
+        unsigned int head=__atomic_load_n(&log_head,__ATOMIC_ACQUIRE);
+        while(tail!=head){
+            log_record_t* r=&log_buffer[tail&(LOG_BUFFER_LEN-1)];
+            if(!started){
+                time_start=r->time_ns;
+                started=1;
+            }
+            fprintf(f,"%.6f,%llu,%.9g,%.9g,%.9g,%.9g,%.9g,%d,%d,%.9g\n", \
+                    (r->time_ns-time_start)/1e9,(unsigned long long)r->sample, \
+                    r->excitation,r->duty,r->accel_y,r->accel_z,r->gyro_x, \
+                    r->encoder_l,r->encoder_r,r->theta);
+            tail++;
+            __atomic_store_n(&log_tail,tail,__ATOMIC_RELEASE);
+        }
+        if(!exiting) rc_usleep(1000000/LOG_HZ);
+    }
+    if(log_dropped){
+        fprintf(stderr,"\nWARNING: %u samples dropped\n",log_dropped);
+    }
+    fclose(f);
+    printf("\ncaptured to %s\n",log_name);
+    return NULL;
+}
+
+/*******************************************************************************
+* float complementary_filter()
+*
+* Body angle of the MiP in radians from the IMU through the complementary
+* filter in ../Common/comp_filter.c, with the compiled THETA_OFFSET.
+*******************************************************************************/
+float complementary_filter(){
+    static comp_filter_t filter;
+    // accelerometer angle of BeagleBone relative to x-axis
+    float theta_a_raw=atan2(-imu_reader.accel[2],imu_reader.accel[1]);
+    // calculate theta angle of MIP
+    return comp_filter_step(&filter,theta_a_raw,imu_reader.gyro[0], \
+                            OMEGA_C,DT)+THETA_OFFSET;
+}